@@ -0,0 +1,211 @@
+#include "AccessTrace.h"
+
+#include "DiskCache.h"
+#include "H5Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+// =============================================================================
+// AccessTraceRecorder
+// =============================================================================
+
+AccessTraceRecorder::AccessTraceRecorder(const std::string& path, const std::int64_t numRows, const std::int64_t numCols) :
+    _path(path),
+    _start(Clock::now())
+{
+    if (_path.empty())
+        return;
+
+    _file.open(_path, std::ios::binary | std::ios::trunc);
+
+    AccessTraceHeader header;
+    header._numRows = numRows;
+    header._numCols = numCols;
+    _file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (!_file.good()) {
+        std::cerr << "AccessTraceRecorder: cannot write " << _path << std::endl;
+    }
+
+    _records.reserve(flushSize);
+}
+
+AccessTraceRecorder::~AccessTraceRecorder()
+{
+    flush();
+}
+
+void AccessTraceRecorder::record(const bool row, const std::int64_t index, const bool hit, const Clock::time_point start, const Clock::time_point end)
+{
+    AccessRecord record;
+    record._timeNs      = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start - _start).count());
+    record._index       = index;
+    record._latencyUs   = static_cast<std::uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+    record._row         = row ? 1 : 0;
+    record._hit         = hit ? 1 : 0;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _records.push_back(record);
+
+    if (!_path.empty() && _records.size() >= flushSize) {
+        writeRecords();
+    }
+}
+
+void AccessTraceRecorder::flush()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (!_path.empty()) {
+        writeRecords();
+        _file.flush();
+    }
+}
+
+std::int64_t AccessTraceRecorder::getNumRecords()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _numWritten + static_cast<std::int64_t>(_records.size());
+}
+
+std::vector<AccessRecord> AccessTraceRecorder::getRecords()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _records;
+}
+
+void AccessTraceRecorder::writeRecords()
+{
+    if (_records.empty() || !_file.good())
+        return;
+
+    _file.write(reinterpret_cast<const char*>(_records.data()), _records.size() * sizeof(AccessRecord));
+    _numWritten += static_cast<std::int64_t>(_records.size());
+    _records.clear();
+}
+
+bool readAccessTrace(const std::string& path, AccessTraceHeader& header, std::vector<AccessRecord>& records)
+{
+    records.clear();
+
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        std::cerr << "readAccessTrace: cannot open " << path << std::endl;
+        return false;
+    }
+
+    const std::streamoff size = file.tellg();
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    const AccessTraceHeader expected;
+    if (!file.good() || std::memcmp(header._magic, expected._magic, sizeof(expected._magic)) != 0 || header._version != expected._version) {
+        std::cerr << "readAccessTrace: " << path << " is not an access trace" << std::endl;
+        return false;
+    }
+
+    // A trace of a process that did not exit cleanly may end with a partial record
+    records.resize(static_cast<size_t>(size - static_cast<std::streamoff>(sizeof(header))) / sizeof(AccessRecord));
+    file.read(reinterpret_cast<char*>(records.data()), records.size() * sizeof(AccessRecord));
+
+    return file.good();
+}
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+ReplayResult summarizeAccessTrace(const std::vector<AccessRecord>& records)
+{
+    ReplayResult result;
+    result._numAccesses = static_cast<std::int64_t>(records.size());
+
+    if (records.empty())
+        return result;
+
+    std::vector<std::uint32_t> latencies;
+    latencies.reserve(records.size());
+
+    for (const AccessRecord& record : records) {
+        result._numHits += record._hit;
+        latencies.push_back(record._latencyUs);
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+
+    // Nearest rank
+    auto percentileMs = [&latencies](const double percentile) {
+        const size_t rank = static_cast<size_t>(std::ceil(percentile / 100.0 * latencies.size()));
+        return latencies[std::clamp<size_t>(rank, 1, latencies.size()) - 1] / 1000.0;
+        };
+
+    double totalUs = 0.0;
+    for (const std::uint32_t latency : latencies) {
+        totalUs += latency;
+    }
+
+    result._totalSeconds    = totalUs / 1e6;
+    result._latencyP50Ms    = percentileMs(50.0);
+    result._latencyP90Ms    = percentileMs(90.0);
+    result._latencyP99Ms    = percentileMs(99.0);
+    result._latencyMaxMs    = latencies.back() / 1000.0;
+
+    return result;
+}
+
+bool replayAccessTrace(SparseMatrixReader& reader, const std::vector<AccessRecord>& records, const ReplaySettings& settings, ReplayResult& result)
+{
+    result = {};
+
+    if (reader.getNumRows() == 0) {
+        std::cerr << "replayAccessTrace: no matrix is open" << std::endl;
+        return false;
+    }
+
+    reader.setMaxCacheSize(settings._cacheSize);
+    reader.setUseBlockIndex(settings._useBlockIndex);
+    reader.setDiskCache(settings._diskCacheDirectory.empty() ? nullptr : DiskCache::open(settings._diskCacheDirectory, settings._diskCacheSize));
+
+    // The replayed accesses are recorded like the original ones
+    auto trace = std::make_shared<AccessTraceRecorder>("", reader.getNumRows(), reader.getNumCols());
+    reader.setAccessTrace(trace);
+
+    const std::uint64_t bytesBefore = reader.getBytesRead();
+    std::int64_t numSkipped = 0;
+
+    std::vector<std::int64_t> batch;
+
+    for (size_t i = 0; i < records.size(); ++i) {
+        const AccessRecord& record = records[i];
+        const std::int64_t size = record._row ? reader.getNumRows() : reader.getNumCols();
+
+        if (record._index < 0 || record._index >= size)
+            numSkipped++;
+        else
+            batch.push_back(record._index);
+
+        const bool batchEnds = i + 1 == records.size() || records[i + 1]._timeNs != record._timeNs || records[i + 1]._row != record._row;
+        if (!batchEnds || batch.empty())
+            continue;
+
+        if (batch.size() > 1)
+            record._row ? reader.getRows(batch) : reader.getColumns(batch);
+        else if (record._row)
+            reader.getRow(batch.front());
+        else
+            reader.getColumn(batch.front());
+
+        batch.clear();
+    }
+
+    reader.setAccessTrace(nullptr);
+
+    result              = summarizeAccessTrace(trace->getRecords());
+    result._numSkipped  = numSkipped;
+    result._bytesRead   = reader.getBytesRead() - bytesBefore;
+
+    return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class SparseMatrixReader;
+
+// =============================================================================
+// Access traces
+// =============================================================================
+
+/*
+Records every getRow/getColumn call of a reader, such that cache sizes, prefetching and
+block sizes can be tuned with real access patterns. Batched reads record one entry per
+requested array, all with the start time of the batch. A trace file is a header followed
+by fixed-size records:
+```
+AccessTraceHeader       # magic "SH5T", version, shape of the matrix
+AccessRecord * n        # in the order of the calls
+```
+Traces are replayed offline against any file and cache configuration with replayAccessTrace,
+e.g. with the SparseH5Replay tool.
+*/
+
+struct AccessTraceHeader {
+    char            _magic[4]   = { 'S', 'H', '5', 'T' };
+    std::uint32_t   _version    = 1;
+    std::int64_t    _numRows    = 0;
+    std::int64_t    _numCols    = 0;
+};
+
+struct AccessRecord {
+    std::uint64_t   _timeNs     = 0;    // Start of the call since the start of the trace
+    std::int64_t    _index      = 0;
+    std::uint32_t   _latencyUs  = 0;
+    std::uint8_t    _row        = 0;    // 1 for rows, 0 for columns
+    std::uint8_t    _hit        = 0;    // 1 if served by the in-memory cache
+    std::uint8_t    _padding[2] = {};
+};
+
+static_assert(sizeof(AccessRecord) == 24, "AccessRecord is written as is");
+
+class AccessTraceRecorder
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Writes to the given file, or keeps all records in memory if the path is empty
+    AccessTraceRecorder(const std::string& path, const std::int64_t numRows, const std::int64_t numCols);
+    ~AccessTraceRecorder();
+
+    // Thread safe, records are written in blocks
+    void record(const bool row, const std::int64_t index, const bool hit, const Clock::time_point start, const Clock::time_point end);
+    void flush();
+
+    bool isGood() const { return _path.empty() || _file.good(); }
+    const std::string& getPath() const { return _path; }
+    std::int64_t getNumRecords();
+
+    // All records of an in-memory trace, the records that are not flushed yet otherwise
+    std::vector<AccessRecord> getRecords();
+
+private:
+    void writeRecords();
+
+private:
+    static constexpr size_t flushSize = 4096;   // Records per write
+
+    std::mutex                  _mutex      = {};
+    std::string                 _path       = "";
+    std::ofstream               _file       = {};
+    Clock::time_point           _start      = {};
+    std::vector<AccessRecord>   _records    = {};
+    std::int64_t                _numWritten = 0;
+};
+
+// Returns false if the file is not a readable trace
+bool readAccessTrace(const std::string& path, AccessTraceHeader& header, std::vector<AccessRecord>& records);
+
+// =============================================================================
+// Replay
+// =============================================================================
+
+struct ReplaySettings {
+    size_t          _cacheSize          = 10;       // Arrays per direction in the in-memory cache
+    bool            _useBlockIndex      = true;
+    std::string     _diskCacheDirectory = "";       // Disabled if empty
+    std::uint64_t   _diskCacheSize      = std::uint64_t{ 8 } << 30;
+};
+
+struct ReplayResult {
+    std::int64_t    _numAccesses    = 0;
+    std::int64_t    _numHits        = 0;
+    std::int64_t    _numSkipped     = 0;    // Indices outside of the replayed matrix
+    std::uint64_t   _bytesRead      = 0;    // Decoded indices and values, see SparseMatrixReader::getBytesRead
+    double          _totalSeconds   = 0.0;  // Sum of all latencies
+    double          _latencyP50Ms   = 0.0;
+    double          _latencyP90Ms   = 0.0;
+    double          _latencyP99Ms   = 0.0;
+    double          _latencyMaxMs   = 0.0;
+
+    double getHitRate() const { return _numAccesses > 0 ? static_cast<double>(_numHits) / _numAccesses : 0.0; }
+};
+
+// Hit rate and latencies of recorded accesses
+ReplayResult summarizeAccessTrace(const std::vector<AccessRecord>& records);
+
+// Replays the accesses in order and without their pauses on a reader that was just opened,
+// replaces the cache configuration of the reader. Records with the same start are read as a batch.
+bool replayAccessTrace(SparseMatrixReader& reader, const std::vector<AccessRecord>& records, const ReplaySettings& settings, ReplayResult& result);
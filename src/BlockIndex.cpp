@@ -0,0 +1,285 @@
+#include "BlockIndex.h"
+
+#include "ReaderRegistry.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// Index format
+// =============================================================================
+
+namespace {
+
+    constexpr char          indexMagic[4]   = { 'S', 'H', '5', 'I' };
+    constexpr std::uint32_t indexVersion    = 1;
+
+    // Followed by numBlocks + 1 std::int64_t boundaries and the std::uint64_t words of all blocks
+    struct IndexHeader {
+        char            _magic[4]           = { 'S', 'H', '5', 'I' };
+        std::uint32_t   _version            = indexVersion;
+        std::uint32_t   _kind               = 0;
+        std::uint32_t   _numHashes          = 0;
+        std::int64_t    _sizeSecondary      = 0;
+        std::uint64_t   _bitsPerBlock       = 0;
+        std::uint64_t   _numBlocks          = 0;
+        std::uint64_t   _fileSize           = 0;    // Of the matrix file when the index was built
+        std::int64_t    _fileModified       = 0;
+        std::uint32_t   _indptrChecksum     = 0;    // CRC-32 of indptr, tells matrices in one file apart
+        std::uint32_t   _checksum           = 0;    // CRC-32 of boundaries and words
+    };
+
+    template<typename T>
+    std::uint32_t checksum(const std::vector<T>& values, uLong crc = crc32(0L, Z_NULL, 0)) {
+        return static_cast<std::uint32_t>(crc32_z(crc, reinterpret_cast<const Bytef*>(values.data()), values.size() * sizeof(T)));
+    }
+
+    // Same checksum as over the plain values, decoded in chunks if the indptr is encoded
+    std::uint32_t checksum(const IndptrArray& indptr) {
+        constexpr size_t chunkSize = size_t{ 1 } << 16;
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+        std::vector<std::int64_t> chunk;
+
+        for (size_t first = 0; first < indptr.size(); first += chunkSize) {
+            chunk.resize(std::min(chunkSize, indptr.size() - first));
+            indptr.decode(first, first + chunk.size(), chunk.data());
+            crc = checksum(chunk, crc);
+        }
+
+        return static_cast<std::uint32_t>(crc);
+    }
+
+    std::uint64_t wordsPerBlock(const std::uint64_t bitsPerBlock) {
+        return (bitsPerBlock + 63) / 64;
+    }
+
+    // Finalizer of splitmix64, spreads neighboring indices over the whole filter
+    std::uint64_t mix(std::uint64_t x) {
+        x += 0x9e3779b97f4a7c15ull;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+        return x ^ (x >> 31);
+    }
+
+} // namespace
+
+// =============================================================================
+// BlockIndex
+// =============================================================================
+
+BlockIndex::BlockIndex(const std::vector<BlockRange>& blocks, const std::int64_t sizeSecondary) :
+    _sizeSecondary(sizeSecondary)
+{
+    _boundaries.reserve(blocks.size() + 1);
+    for (const auto& [begin, end] : blocks) {
+        _boundaries.push_back(begin);
+    }
+    if (!blocks.empty()) {
+        _boundaries.push_back(blocks.back().second);
+    }
+
+    // A bitmap is exact, use it as long as it is not larger than a Bloom filter
+    const std::uint64_t bloomBits = std::bit_ceil(static_cast<std::uint64_t>(bloomBitsPerEntry * blockNnz));
+
+    if (static_cast<std::uint64_t>(sizeSecondary) <= bloomBits) {
+        _kind           = Kind::BITMAP;
+        _bitsPerBlock   = static_cast<std::uint64_t>(sizeSecondary);
+    }
+    else {
+        _kind           = Kind::BLOOM;
+        _bitsPerBlock   = bloomBits;
+    }
+
+    _words.assign(getNumBlocks() * wordsPerBlock(_bitsPerBlock), 0);
+}
+
+void BlockIndex::addBlock(const size_t block, const std::int64_t* indices, const std::int64_t count) {
+    std::uint64_t* words = _words.data() + block * wordsPerBlock(_bitsPerBlock);
+
+    auto setBit = [words](const std::uint64_t bit) {
+        words[bit / 64] |= std::uint64_t{ 1 } << (bit % 64);
+        };
+
+    if (_kind == Kind::BITMAP) {
+        for (std::int64_t i = 0; i < count; ++i) {
+            setBit(static_cast<std::uint64_t>(indices[i]));
+        }
+        return;
+    }
+
+    // Double hashing, the filter size is a power of two
+    const std::uint64_t mask = _bitsPerBlock - 1;
+    for (std::int64_t i = 0; i < count; ++i) {
+        const std::uint64_t hash  = mix(static_cast<std::uint64_t>(indices[i]));
+        const std::uint64_t step  = (hash >> 32) | 1;
+        for (std::uint32_t k = 0; k < bloomNumHashes; ++k) {
+            setBit((hash + k * step) & mask);
+        }
+    }
+}
+
+bool BlockIndex::mayContain(const size_t block, const std::int64_t secondary) const {
+    if (secondary < 0 || secondary >= _sizeSecondary)
+        return false;
+
+    const std::uint64_t* words = _words.data() + block * wordsPerBlock(_bitsPerBlock);
+
+    auto testBit = [words](const std::uint64_t bit) {
+        return (words[bit / 64] >> (bit % 64)) & 1;
+        };
+
+    if (_kind == Kind::BITMAP)
+        return testBit(static_cast<std::uint64_t>(secondary));
+
+    const std::uint64_t mask = _bitsPerBlock - 1;
+    const std::uint64_t hash = mix(static_cast<std::uint64_t>(secondary));
+    const std::uint64_t step = (hash >> 32) | 1;
+    for (std::uint32_t k = 0; k < bloomNumHashes; ++k) {
+        if (!testBit((hash + k * step) & mask))
+            return false;
+    }
+
+    return true;
+}
+
+size_t BlockIndex::findBlock(const std::int64_t primary) const {
+    return static_cast<size_t>(std::upper_bound(_boundaries.begin(), _boundaries.end(), primary) - _boundaries.begin()) - 1;
+}
+
+std::vector<BlockRange> BlockIndex::candidateRanges(const std::vector<std::int64_t>& secondary, const IndptrArray& indptr, const std::int64_t maxNnz) const {
+    const std::int64_t numBlocks = static_cast<std::int64_t>(getNumBlocks());
+    std::vector<std::uint8_t> selected(numBlocks, 0);
+
+#pragma omp parallel for
+    for (std::int64_t block = 0; block < numBlocks; ++block) {
+        selected[block] = std::any_of(secondary.begin(), secondary.end(), [this, block](const std::int64_t idx) { return mayContain(block, idx); });
+    }
+
+    return mergeBlocks(selected, indptr, maxNnz);
+}
+
+std::vector<BlockRange> BlockIndex::mergedRanges(const IndptrArray& indptr, const std::int64_t maxNnz) const {
+    return mergeBlocks(std::vector<std::uint8_t>(getNumBlocks(), 1), indptr, maxNnz);
+}
+
+std::vector<BlockRange> BlockIndex::mergeBlocks(const std::vector<std::uint8_t>& selected, const IndptrArray& indptr, const std::int64_t maxNnz) const {
+    std::vector<BlockRange> ranges;
+
+    for (size_t block = 0; block < selected.size(); ++block) {
+        if (!selected[block])
+            continue;
+
+        const auto [begin, end] = getBlock(block);
+
+        // Extend the previous range if this block directly follows it and both fit the nnz budget
+        if (!ranges.empty() && ranges.back().second == begin && indptr[end] - indptr[ranges.back().first] <= maxNnz)
+            ranges.back().second = end;
+        else
+            ranges.emplace_back(begin, end);
+    }
+
+    return ranges;
+}
+
+std::unique_ptr<BlockIndex> BlockIndex::load(const std::string& filename, const IndptrArray& indptr, const std::int64_t sizeSecondary) {
+    FileIdentity identity;
+    if (!readFileIdentity(filename, identity))
+        return nullptr;
+
+    const std::string path = indexPath(filename);
+
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return nullptr;
+
+    IndexHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    // Built for another version of the file or another matrix in it
+    if (!file.good() || std::memcmp(header._magic, indexMagic, sizeof(indexMagic)) != 0 || header._version != indexVersion ||
+        header._fileSize != identity._size || header._fileModified != identity._modified || header._indptrChecksum != checksum(indptr) || header._sizeSecondary != sizeSecondary ||
+        header._kind > static_cast<std::uint32_t>(Kind::BLOOM) || header._numHashes != bloomNumHashes)
+        return nullptr;
+
+    // Guards the allocations below against a damaged header
+    const std::uint64_t bloomBits = std::bit_ceil(static_cast<std::uint64_t>(bloomBitsPerEntry * blockNnz));
+    if (header._numBlocks >= indptr.size() || header._bitsPerBlock > std::max(static_cast<std::uint64_t>(sizeSecondary), bloomBits))
+        return nullptr;
+
+    auto index = std::unique_ptr<BlockIndex>(new BlockIndex());
+    index->_kind            = static_cast<Kind>(header._kind);
+    index->_sizeSecondary   = header._sizeSecondary;
+    index->_bitsPerBlock    = header._bitsPerBlock;
+    index->_boundaries.resize(header._numBlocks + 1);
+    index->_words.resize(header._numBlocks * wordsPerBlock(header._bitsPerBlock));
+
+    file.read(reinterpret_cast<char*>(index->_boundaries.data()), index->_boundaries.size() * sizeof(std::int64_t));
+    file.read(reinterpret_cast<char*>(index->_words.data()), index->_words.size() * sizeof(std::uint64_t));
+
+    if (!file.good() || checksum(index->_words, checksum(index->_boundaries)) != header._checksum) {
+        std::cerr << "BlockIndex::load: ignoring corrupt index " << path << std::endl;
+        return nullptr;
+    }
+
+    if (index->_boundaries.back() != static_cast<std::int64_t>(indptr.size()) - 1)
+        return nullptr;
+
+    return index;
+}
+
+bool BlockIndex::save(const std::string& filename, const IndptrArray& indptr) const {
+    FileIdentity identity;
+    if (!readFileIdentity(filename, identity))
+        return false;
+
+    IndexHeader header;
+    header._kind            = static_cast<std::uint32_t>(_kind);
+    header._numHashes       = bloomNumHashes;
+    header._sizeSecondary   = _sizeSecondary;
+    header._bitsPerBlock    = _bitsPerBlock;
+    header._numBlocks       = getNumBlocks();
+    header._fileSize        = identity._size;
+    header._fileModified    = identity._modified;
+    header._indptrChecksum  = checksum(indptr);
+    header._checksum        = checksum(_words, checksum(_boundaries));
+
+    const std::string path      = indexPath(filename);
+    const std::string tmpPath   = path + ".tmp";
+
+    // Written aside and renamed, such that other instances never load a partial index
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(_boundaries.data()), _boundaries.size() * sizeof(std::int64_t));
+        file.write(reinterpret_cast<const char*>(_words.data()), _words.size() * sizeof(std::uint64_t));
+
+        if (!file.good()) {
+            std::cerr << "BlockIndex::save: cannot write " << tmpPath << std::endl;
+            file.close();
+            std::error_code error;
+            fs::remove(tmpPath, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(tmpPath, path, error);
+
+    if (error) {
+        std::cerr << "BlockIndex::save: cannot write " << path << ": " << error.message() << std::endl;
+        fs::remove(tmpPath, error);
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "IndptrArray.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+// =============================================================================
+// BlockIndex
+// =============================================================================
+
+using BlockRange = std::pair<std::int64_t, std::int64_t>;   // [first, last) primary index
+
+/*
+Records which secondary indices occur in each block of primary arrays, e.g. which
+columns occur in a block of rows of a CSR matrix. Scans for a secondary array only
+read the blocks that may contain it, such that rare variables touch a small part of
+the indices.
+
+Narrow matrices store an exact bitmap per block. Wide matrices, where a bitmap would
+be larger than the indices of a block, store a Bloom filter with 8 bits per entry and
+5 hashes instead, i.e. about 2% of the blocks are read without a hit.
+
+The index is saved next to the matrix file as <file>.sh5idx together with the size and
+modification time of the file and a checksum of indptr, and rebuilt if they differ.
+*/
+class BlockIndex
+{
+public:
+    enum class Kind : std::uint32_t {
+        BITMAP,
+        BLOOM,
+    };
+
+    static constexpr std::int64_t blockNnz         = std::int64_t{ 1 } << 16;  // Target entries per block
+    static constexpr std::int64_t bloomBitsPerEntry = 8;
+    static constexpr std::uint32_t bloomNumHashes   = 5;
+
+    // Blocks should hold about blockNnz entries each, sizeSecondary is the length of the primary arrays
+    BlockIndex(const std::vector<BlockRange>& blocks, const std::int64_t sizeSecondary);
+
+    static std::string indexPath(const std::string& filename) { return filename + ".sh5idx"; }
+
+    // Returns nullptr if there is no index for this version of the file and matrix
+    static std::unique_ptr<BlockIndex> load(const std::string& filename, const IndptrArray& indptr, const std::int64_t sizeSecondary);
+    bool save(const std::string& filename, const IndptrArray& indptr) const;
+
+public:
+    // Blocks may be added from several threads at once, as long as each block is added once
+    void addBlock(const size_t block, const std::int64_t* indices, const std::int64_t count);
+
+    bool mayContain(const size_t block, const std::int64_t secondary) const;
+
+    // Block that holds the given primary index
+    size_t findBlock(const std::int64_t primary) const;
+
+    // Ranges of blocks that may contain any of the secondary indices, neighboring blocks are
+    // merged while the merged range holds at most maxNnz entries
+    std::vector<BlockRange> candidateRanges(const std::vector<std::int64_t>& secondary, const IndptrArray& indptr, const std::int64_t maxNnz) const;
+
+    // Neighboring blocks merged up to maxNnz entries, e.g. to read several blocks at once while building
+    std::vector<BlockRange> mergedRanges(const IndptrArray& indptr, const std::int64_t maxNnz) const;
+
+    Kind getKind() const { return _kind; }
+    size_t getNumBlocks() const { return _boundaries.empty() ? 0 : _boundaries.size() - 1; }
+    BlockRange getBlock(const size_t block) const { return { _boundaries[block], _boundaries[block + 1] }; }
+    size_t getSizeBytes() const { return _words.size() * sizeof(std::uint64_t); }
+
+private:
+    BlockIndex() = default;
+
+    std::vector<BlockRange> mergeBlocks(const std::vector<std::uint8_t>& selected, const IndptrArray& indptr, const std::int64_t maxNnz) const;
+
+private:
+    Kind                        _kind           = Kind::BITMAP;
+    std::int64_t                _sizeSecondary  = 0;
+    std::uint64_t               _bitsPerBlock   = 0;    // Power of two for Bloom filters
+    std::vector<std::int64_t>   _boundaries     = {};   // First primary index of every block and the end
+    std::vector<std::uint64_t>  _words          = {};   // Bits of all blocks, block after block
+};
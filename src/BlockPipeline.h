@@ -0,0 +1,140 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// =============================================================================
+// Block pipeline
+// =============================================================================
+
+/*
+Overlaps reading with processing: a dedicated I/O thread fills block N+1 while the
+calling thread (and its OpenMP workers) processes block N.
+A fixed set of buffers is handed back and forth between the stages, such that
+at most numBuffers blocks are in flight and their allocations are reused.
+Exceptions from either stage stop the pipeline and are rethrown in the calling thread.
+*/
+template<typename Buffer>
+class BlockPipeline {
+public:
+    using Produce = std::function<void(std::int64_t item, Buffer& buffer)>;
+    using Consume = std::function<void(std::int64_t item, Buffer& buffer)>;
+
+    BlockPipeline(const size_t numBuffers = 3) : _buffers(numBuffers < 2 ? 2 : numBuffers) {}
+
+    // Calls produce for all items in order on the I/O thread and consume for all items in order on the calling thread
+    void run(const std::int64_t numItems, const Produce& produce, const Consume& consume) {
+        if (numItems <= 0) {
+            return;
+        }
+
+        _free.clear();
+        _filled.clear();
+        _stop = false;
+        _producerError = nullptr;
+
+        for (Buffer& buffer : _buffers) {
+            _free.push_back(&buffer);
+        }
+
+        std::thread io([this, numItems, &produce]() {
+            for (std::int64_t item = 0; item < numItems; ++item) {
+                Buffer* buffer = nullptr;
+
+                {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _freeCondition.wait(lock, [this]() { return _stop || !_free.empty(); });
+
+                    if (_stop) {
+                        return;
+                    }
+
+                    buffer = _free.front();
+                    _free.pop_front();
+                }
+
+                try {
+                    produce(item, *buffer);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _producerError = std::current_exception();
+                    _stop = true;
+                    _filledCondition.notify_all();
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+                    _filled.emplace_back(item, buffer);
+                }
+                _filledCondition.notify_one();
+            }
+            });
+
+        std::exception_ptr consumerError = nullptr;
+
+        for (std::int64_t item = 0; item < numItems; ++item) {
+            Buffer* buffer = nullptr;
+
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _filledCondition.wait(lock, [this]() { return _stop || !_filled.empty(); });
+
+                if (_filled.empty()) {
+                    break;  // producer failed
+                }
+
+                buffer = _filled.front().second;
+                _filled.pop_front();
+            }
+
+            try {
+                consume(item, *buffer);
+            }
+            catch (...) {
+                consumerError = std::current_exception();
+                break;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _free.push_back(buffer);
+            }
+            _freeCondition.notify_one();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _freeCondition.notify_all();
+
+        io.join();
+
+        if (_producerError) {
+            std::rethrow_exception(_producerError);
+        }
+
+        if (consumerError) {
+            std::rethrow_exception(consumerError);
+        }
+    }
+
+private:
+    std::vector<Buffer>                             _buffers        = {};
+    std::deque<Buffer*>                             _free           = {};
+    std::deque<std::pair<std::int64_t, Buffer*>>    _filled         = {};
+    std::mutex                                      _mutex          = {};
+    std::condition_variable                         _freeCondition  = {};
+    std::condition_variable                         _filledCondition = {};
+    bool                                            _stop           = false;
+    std::exception_ptr                              _producerError  = nullptr;
+};
@@ -0,0 +1,421 @@
+#include "DenseMatrixReader.h"
+
+#include "BlockPipeline.h"
+
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+
+// =============================================================================
+// Dense block utilities
+// =============================================================================
+
+// Values of a rectangular block of the matrix, in the order they are stored in the file
+struct DenseBlock {
+    std::int64_t        _rowBegin   = 0;
+    std::int64_t        _rowEnd     = 0;
+    std::int64_t        _colBegin   = 0;
+    std::int64_t        _colEnd     = 0;
+    bool                _transposed = false;
+    std::vector<float>  _values     = {};
+
+    float at(const std::int64_t row, const std::int64_t col) const {
+        if (_transposed)
+            return _values[(col - _colBegin) * (_rowEnd - _rowBegin) + (row - _rowBegin)];
+
+        return _values[(row - _rowBegin) * (_colEnd - _colBegin) + (col - _colBegin)];
+    }
+};
+
+// Extent of datasets without chunked layout, reads are aligned to these pseudo-chunks (in file order)
+static constexpr hsize_t contiguousChunkRows = 1024;
+static constexpr hsize_t contiguousChunkCols = 16;
+
+static constexpr size_t minChunkCacheSize = size_t{ 1 } << 20;
+static constexpr size_t maxChunkCacheSize = size_t{ 256 } << 20;
+
+static size_t nextPrime(size_t n) {
+    auto isPrime = [](const size_t v) -> bool {
+        if (v < 2)
+            return false;
+        for (size_t d = 2; d * d <= v; ++d)
+            if (v % d == 0)
+                return false;
+        return true;
+        };
+
+    while (!isPrime(n))
+        ++n;
+
+    return n;
+}
+
+// Length of blocks along an axis: a multiple of the chunk extent, such that a block holds roughly maxElements values
+static std::int64_t alignedBlockLength(const std::int64_t chunk, const std::int64_t width, const std::int64_t maxElements, const std::int64_t size) {
+    const std::int64_t length = std::max<std::int64_t>(maxElements / std::max<std::int64_t>(width, 1), 1);
+    return std::clamp((length / chunk) * chunk, chunk, std::max<std::int64_t>(size, 1));
+}
+
+static void readDenseBlock(const SparseMatrixData& data, DenseBlock& block) {
+    const hsize_t rows = static_cast<hsize_t>(block._rowEnd - block._rowBegin);
+    const hsize_t cols = static_cast<hsize_t>(block._colEnd - block._colBegin);
+
+    const std::array<hsize_t, 2> offset = block._transposed ?
+        std::array<hsize_t, 2>{ static_cast<hsize_t>(block._colBegin), static_cast<hsize_t>(block._rowBegin) } :
+        std::array<hsize_t, 2>{ static_cast<hsize_t>(block._rowBegin), static_cast<hsize_t>(block._colBegin) };
+    const std::array<hsize_t, 2> count = block._transposed ? std::array<hsize_t, 2>{ cols, rows } : std::array<hsize_t, 2>{ rows, cols };
+
+    block._values.resize(rows * cols);
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    const H5::DataSet& dataset = *data._data_ds;
+    H5::DataSpace file_space = dataset.getSpace();
+    file_space.selectHyperslab(H5S_SELECT_SET, count.data(), offset.data());
+    H5::DataSpace mem_space(2, count.data());
+
+    dataset.read(block._values.data(), H5::PredType::NATIVE_FLOAT, mem_space, file_space);
+
+    data._bytesRead += block._values.size() * sizeof(float);
+}
+
+// Reads the blocks on the pipeline's I/O thread while the previous block is consumed
+static void readDenseBlocks(const SparseMatrixData& data, const std::vector<DenseBlock>& ranges, const std::function<void(const DenseBlock&)>& consume) {
+    BlockPipeline<DenseBlock> pipeline;
+
+    pipeline.run(static_cast<std::int64_t>(ranges.size()),
+        [&data, &ranges](std::int64_t item, DenseBlock& block) {
+            block._rowBegin     = ranges[item]._rowBegin;
+            block._rowEnd       = ranges[item]._rowEnd;
+            block._colBegin     = ranges[item]._colBegin;
+            block._colEnd       = ranges[item]._colEnd;
+            block._transposed   = ranges[item]._transposed;
+            readDenseBlock(data, block);
+        },
+        [&consume](std::int64_t, DenseBlock& block) {
+            consume(block);
+        });
+}
+
+// =============================================================================
+// DenseMatrixReader
+// =============================================================================
+
+DenseMatrixReader::DenseMatrixReader() :
+    SparseMatrixReader(SparseMatrixType::DENSE)
+{
+}
+
+DenseMatrixReader::DenseMatrixReader(const std::string& filename) :
+    DenseMatrixReader()
+{
+    readFile(filename);
+}
+
+DenseMatrixReader::~DenseMatrixReader() = default;
+
+bool DenseMatrixReader::readFile(const std::string& filename)
+{
+    if (_data._file || !_data._filename.empty()) {
+        reset();
+    }
+
+    if (!std::filesystem::exists(filename)) {
+        std::cerr << "DenseMatrixReader::readFile: file does not exist " << filename << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    try {
+        _data._filename = filename;
+        _data._file = openH5File(_data._filename, _h5Access, _data._access);
+
+        std::string datasetName = "";
+
+        if (groupExists(*_data._file, "X") && _data._file->childObjType("X") == H5O_TYPE_DATASET) {
+            datasetName = "X";
+            _transposed = false;
+        }
+        else if (groupExists(*_data._file, "matrix") && _data._file->childObjType("matrix") == H5O_TYPE_DATASET) {
+            datasetName = "matrix";
+            _transposed = true;
+        }
+        else {
+            std::cerr << "DenseMatrixReader::readFile: file has neither a dense X nor a loom matrix" << std::endl;
+            return false;
+        }
+
+        const H5::DataSet dataset = _data._file->openDataSet(datasetName);
+        const H5::DataSpace space = dataset.getSpace();
+
+        if (space.getSimpleExtentNdims() != 2) {
+            std::cerr << "DenseMatrixReader::readFile: " << datasetName << " must be two-dimensional" << std::endl;
+            return false;
+        }
+
+        std::array<hsize_t, 2> dims{};
+        space.getSimpleExtentDims(dims.data());
+
+        _data._num_rows = static_cast<std::int64_t>(_transposed ? dims[1] : dims[0]);
+        _data._num_cols = static_cast<std::int64_t>(_transposed ? dims[0] : dims[1]);
+
+        std::array<hsize_t, 2> chunk_dims = { std::min<hsize_t>(std::max<hsize_t>(dims[0], 1), contiguousChunkRows), std::min<hsize_t>(std::max<hsize_t>(dims[1], 1), contiguousChunkCols) };
+
+        const H5::DSetCreatPropList create_plist = dataset.getCreatePlist();
+        if (create_plist.getLayout() == H5D_CHUNKED) {
+            create_plist.getChunk(2, chunk_dims.data());
+        }
+
+        _chunkShape = _transposed ?
+            std::array<std::int64_t, 2>{ static_cast<std::int64_t>(chunk_dims[1]), static_cast<std::int64_t>(chunk_dims[0]) } :
+            std::array<std::int64_t, 2>{ static_cast<std::int64_t>(chunk_dims[0]), static_cast<std::int64_t>(chunk_dims[1]) };
+
+        // Hold all chunks that one column touches, i.e. one column stride of the chunk grid
+        const size_t chunkBytes         = static_cast<size_t>(chunk_dims[0] * chunk_dims[1]) * dataset.getDataType().getSize();
+        const size_t chunksPerColumn    = static_cast<size_t>((_data._num_rows + _chunkShape[0] - 1) / _chunkShape[0]);
+        _chunkCacheSize                 = std::clamp(chunkBytes * chunksPerColumn, minChunkCacheSize, maxChunkCacheSize);
+
+        // HDF5 recommends a prime number of hash slots, about 100 times the number of chunks in the cache
+        const size_t numSlots = nextPrime(std::max<size_t>(521, 100 * (_chunkCacheSize / std::max<size_t>(chunkBytes, 1) + 1)));
+
+        H5::DSetAccPropList access_plist;
+        access_plist.setChunkCache(numSlots, _chunkCacheSize, 0.75);
+
+        _data._data_ds = std::make_unique<H5::DataSet>(_data._file->openDataSet(datasetName, access_plist));
+
+        if (_transposed) {
+            readStringArray(*_data._file, "row_attrs", "Gene", _data._var_names);
+            readStringArray(*_data._file, "col_attrs", "CellID", _data._obs_names);
+        }
+        else {
+            readStringArray(*_data._file, "obs", "_index", _data._obs_names);
+            readStringArray(*_data._file, "var", "_index", _data._var_names);
+        }
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "DenseMatrixReader::readFile: " << e.getDetailMsg() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DenseMatrixReader::readStripes(const bool columns, const std::vector<std::int64_t>& indices, const BlockConsumer& consume) const
+{
+    const std::int64_t size         = columns ? _data._num_cols : _data._num_rows;
+    const std::int64_t otherSize    = columns ? _data._num_rows : _data._num_cols;
+    const std::int64_t stripeWidth  = columns ? _chunkShape[1] : _chunkShape[0];
+    const std::int64_t otherChunk   = columns ? _chunkShape[0] : _chunkShape[1];
+
+    // Requested span per chunk stripe, sorted by stripe
+    std::map<std::int64_t, std::pair<std::int64_t, std::int64_t>> stripes;
+    for (const std::int64_t index : indices) {
+        if (index < 0 || index >= size)
+            continue;
+
+        auto [it, inserted] = stripes.try_emplace(index / stripeWidth, index, index + 1);
+        if (!inserted) {
+            it->second.first  = std::min(it->second.first, index);
+            it->second.second = std::max(it->second.second, index + 1);
+        }
+    }
+
+    const std::int64_t blockLength = alignedBlockLength(otherChunk, stripeWidth, defaultBlockNnz, otherSize);
+
+    std::vector<DenseBlock> ranges;
+    for (const auto& [stripe, span] : stripes) {
+        for (std::int64_t begin = 0; begin < otherSize; begin += blockLength) {
+            const std::int64_t end = std::min(begin + blockLength, otherSize);
+
+            DenseBlock range;
+            range._transposed = _transposed;
+            if (columns) {
+                range._rowBegin = begin;        range._rowEnd = end;
+                range._colBegin = span.first;   range._colEnd = span.second;
+            }
+            else {
+                range._rowBegin = span.first;   range._rowEnd = span.second;
+                range._colBegin = begin;        range._colEnd = end;
+            }
+            ranges.push_back(std::move(range));
+        }
+    }
+
+    try {
+        readDenseBlocks(_data, ranges, consume);
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "DenseMatrixReader::readStripes: " << e.getDetailMsg() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DenseMatrixReader::readRowBlocks(const std::int64_t blockElements, const BlockConsumer& consume) const
+{
+    const std::int64_t blockLength = alignedBlockLength(_chunkShape[0], _data._num_cols, blockElements, _data._num_rows);
+
+    std::vector<DenseBlock> ranges;
+    for (std::int64_t begin = 0; begin < _data._num_rows; begin += blockLength) {
+        DenseBlock range;
+        range._transposed   = _transposed;
+        range._rowBegin     = begin;
+        range._rowEnd       = std::min(begin + blockLength, _data._num_rows);
+        range._colBegin     = 0;
+        range._colEnd       = _data._num_cols;
+        ranges.push_back(std::move(range));
+    }
+
+    try {
+        readDenseBlocks(_data, ranges, consume);
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "DenseMatrixReader::readRowBlocks: " << e.getDetailMsg() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::vector<float> DenseMatrixReader::getRowImpl(std::int64_t row_idx) const
+{
+    return std::move(getRowsImpl({ row_idx }).front());
+}
+
+std::vector<float> DenseMatrixReader::getColumnImpl(std::int64_t col_idx) const
+{
+    return std::move(getColumnsImpl({ col_idx }).front());
+}
+
+std::vector<std::vector<float>> DenseMatrixReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    std::vector<std::vector<float>> rows(row_indices.size(), std::vector<float>(_data._num_cols, 0.0f));
+
+    for (const std::int64_t row_idx : row_indices) {
+        if (row_idx < 0 || row_idx >= _data._num_rows)
+            std::cerr << "DenseMatrixReader::getRowsImpl: could not read from index " << row_idx << std::endl;
+    }
+
+    const ValueTransformer transform = getValueTransformer();
+
+    readStripes(false, row_indices, [&rows, &row_indices, &transform](const DenseBlock& block) {
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(row_indices.size()); ++i) {
+            const std::int64_t row = row_indices[i];
+            if (row < block._rowBegin || row >= block._rowEnd)
+                continue;
+
+            for (std::int64_t col = block._colBegin; col < block._colEnd; ++col) {
+                const float value = block.at(row, col);
+                rows[i][col] = value != 0.0f ? transform(value, row, col) : 0.0f;
+            }
+        }
+        });
+
+    return rows;
+}
+
+std::vector<std::vector<float>> DenseMatrixReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    std::vector<std::vector<float>> columns(col_indices.size(), std::vector<float>(_data._num_rows, 0.0f));
+
+    for (const std::int64_t col_idx : col_indices) {
+        if (col_idx < 0 || col_idx >= _data._num_cols)
+            std::cerr << "DenseMatrixReader::getColumnsImpl: could not read from index " << col_idx << std::endl;
+    }
+
+    const ValueTransformer transform = getValueTransformer();
+
+    readStripes(true, col_indices, [&columns, &col_indices, &transform](const DenseBlock& block) {
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < static_cast<std::int64_t>(col_indices.size()); ++i) {
+            const std::int64_t col = col_indices[i];
+            if (col < block._colBegin || col >= block._colEnd)
+                continue;
+
+            for (std::int64_t row = block._rowBegin; row < block._rowEnd; ++row) {
+                const float value = block.at(row, col);
+                columns[i][row] = value != 0.0f ? transform(value, row, col) : 0.0f;
+            }
+        }
+        });
+
+    return columns;
+}
+
+std::vector<float> DenseMatrixReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    std::vector<float> sums(_data._num_rows, 0.0f);
+
+    readStripes(true, col_indices, [&sums, &col_indices](const DenseBlock& block) {
+#pragma omp parallel for
+        for (std::int64_t row = block._rowBegin; row < block._rowEnd; ++row) {
+            for (const std::int64_t col : col_indices) {
+                if (col >= block._colBegin && col < block._colEnd)
+                    sums[row] += block.at(row, col);
+            }
+        }
+        });
+
+    return sums;
+}
+
+std::vector<float> DenseMatrixReader::getRowTotalsImpl() const
+{
+    std::vector<float> totals(_data._num_rows, 0.0f);
+
+    readRowBlocks(defaultBlockNnz, [&totals](const DenseBlock& block) {
+#pragma omp parallel for
+        for (std::int64_t row = block._rowBegin; row < block._rowEnd; ++row) {
+            float total = 0.0f;
+            for (std::int64_t col = block._colBegin; col < block._colEnd; ++col)
+                total += block.at(row, col);
+            totals[row] = total;
+        }
+        });
+
+    return totals;
+}
+
+bool DenseMatrixReader::streamBlocks(const BlockCallback& process, const bool readValues, const std::int64_t blockNnz) const
+{
+    if (!_data._data_ds || _data._num_rows == 0) {
+        std::cerr << "DenseMatrixReader::streamBlocks: no data to stream" << std::endl;
+        return false;
+    }
+
+    PrimaryBlock sparseBlock;
+    std::int64_t offset = 0;
+
+    return readRowBlocks(std::max<std::int64_t>(blockNnz, 1), [&](const DenseBlock& block) {
+        sparseBlock._begin  = block._rowBegin;
+        sparseBlock._end    = block._rowEnd;
+        sparseBlock._offset = offset;
+        sparseBlock._indptr.assign(1, 0);
+        sparseBlock._indices.clear();
+        sparseBlock._values.clear();
+
+        for (std::int64_t row = block._rowBegin; row < block._rowEnd; ++row) {
+            for (std::int64_t col = block._colBegin; col < block._colEnd; ++col) {
+                const float value = block.at(row, col);
+                if (value == 0.0f)
+                    continue;
+
+                sparseBlock._indices.push_back(col);
+                if (readValues)
+                    sparseBlock._values.push_back(value);
+            }
+            sparseBlock._indptr.push_back(static_cast<std::int64_t>(sparseBlock._indices.size()));
+        }
+
+        offset += sparseBlock._indptr.back();
+
+        process(sparseBlock);
+        });
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "H5Utils.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// DenseMatrixReader
+// =============================================================================
+
+struct DenseBlock;
+
+/*
+Reads dense, optionally chunked matrices from .h5 files behind the SparseMatrixReader interface:
+ - anndata with a dense X: dataset X (obs x var), names in obs/_index and var/_index
+ - loom: dataset matrix (var x obs), names in row_attrs/Gene and col_attrs/CellID
+
+All reads are chunk-aligned hyperslabs. Requested rows or columns are grouped by the chunk
+stripe they fall into, every chunk of a stripe is read once and serves all requested arrays in it.
+The chunk cache of the dataset is sized to hold all chunks along one column, such that
+consecutive single-column reads from the same stripe do not hit the disk again.
+*/
+class DenseMatrixReader : public SparseMatrixReader
+{
+
+public:
+    DenseMatrixReader();
+    DenseMatrixReader(const std::string& filename);
+
+    ~DenseMatrixReader();
+
+public: // Setup
+
+    bool readFile(const std::string& filename) override;
+
+public: // Getter
+
+    std::vector<float> getRowImpl(std::int64_t row_idx) const override;
+    std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    // Streams row blocks as sparse blocks that only contain the non-zero entries
+    bool streamBlocks(const BlockCallback& process, const bool readValues = true, const std::int64_t blockNnz = defaultBlockNnz) const override;
+
+    bool isTransposed() const { return _transposed; }
+    const std::array<std::int64_t, 2>& getChunkShape() const { return _chunkShape; }
+    size_t getChunkCacheSize() const { return _chunkCacheSize; }
+
+private:
+    using BlockConsumer = std::function<void(const DenseBlock&)>;
+
+    // Reads the requested arrays along one axis stripe by stripe, blocks span at most blockElements values
+    bool readStripes(const bool columns, const std::vector<std::int64_t>& indices, const BlockConsumer& consume) const;
+
+    // Reads all rows in chunk-aligned blocks of full rows
+    bool readRowBlocks(const std::int64_t blockElements, const BlockConsumer& consume) const;
+
+private:
+    bool                        _transposed     = false;        /** Matrix is stored as var x obs (loom) */
+    std::array<std::int64_t, 2> _chunkShape     = { 1, 1 };     /** Chunk extent along rows and columns */
+    size_t                      _chunkCacheSize = 0;            /** Bytes of the HDF5 chunk cache of the dataset */
+};
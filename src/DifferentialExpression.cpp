@@ -0,0 +1,249 @@
+#include "DifferentialExpression.h"
+
+#include "H5Utils.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// =============================================================================
+// Accumulators
+// =============================================================================
+
+namespace {
+
+    struct GroupSums {
+        double          _sum        = 0.0;
+        double          _sumSquares = 0.0;
+        std::int64_t    _nnz        = 0;
+
+        void add(const double value) {
+            _sum        += value;
+            _sumSquares += value * value;
+            ++_nnz;
+        }
+
+        void merge(const GroupSums& other) {
+            _sum        += other._sum;
+            _sumSquares += other._sumSquares;
+            _nnz        += other._nnz;
+        }
+    };
+
+    // Group g of column c at numGroups * c + g, e.g. selected rows at 2 * c and all other rows at 2 * c + 1
+    using Accumulators = std::vector<GroupSums>;
+
+    // Sample variance of a group of n values, of which only the non-zero ones were accumulated
+    double variance(const GroupSums& sums, const double mean, const std::int64_t n) {
+        if (n < 2)
+            return 0.0;
+
+        return std::max(0.0, (sums._sumSquares - n * mean * mean) / (n - 1));
+    }
+
+    // Accumulates the values of every column as read, optionally log1p transformed, per group of rows in a single pass,
+    // groupOfRow holds the group of every row in [0, numGroups), negative is set if any value is below zero
+    bool accumulateGroups(const SparseMatrixReader& reader, const std::vector<std::uint8_t>& groupOfRow, const std::int64_t numGroups, const bool logTransform, const std::int64_t blockNnz, Accumulators& accumulators, bool& negative, const std::function<void(float)>& progress) {
+        const std::int64_t num_cols     = reader.getNumCols();
+        const bool rowsArePrimary       = reader.getType() != SparseMatrixType::CSC;
+        const ValueTransformer valueTransform = reader.getValueTransformer();
+        std::vector<float> transformed;
+
+        // Counts are never negative, log1p is undefined from -1 on
+        std::atomic<bool> anyNegative = false;
+        auto transform = [logTransform, &anyNegative](const float value) -> double {
+            if (value < 0.0f) {
+                anyNegative.store(true, std::memory_order_relaxed);
+                return static_cast<double>(value);
+            }
+
+            return logTransform ? std::log1p(static_cast<double>(value)) : static_cast<double>(value);
+            };
+
+        accumulators.assign(numGroups * num_cols, GroupSums{});
+
+        // Sharded readers have no indptr of their own and report no progress
+        const IndptrArray& indptr = reader.getRawData()._indptr;
+        const double total_nnz = indptr.empty() ? 0.0 : static_cast<double>(indptr.back());
+        double processed_nnz = 0.0;
+
+        const bool streamed = reader.streamBlocks([&](const PrimaryBlock& block) {
+            const std::int64_t num_arrs = block._end - block._begin;
+            const std::vector<float>& values = transformBlockValues(block, valueTransform, transformed);
+
+            if (rowsArePrimary) {
+                // Rows scatter into all columns, every thread accumulates on its own and merges after the block
+#pragma omp parallel
+                {
+                    Accumulators local(numGroups * num_cols);
+
+#pragma omp for schedule(dynamic, 64)
+                    for (std::int64_t a = 0; a < num_arrs; ++a) {
+                        const std::int64_t group = groupOfRow[block._begin + a];
+                        for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                            local[numGroups * block._indices[i] + group].add(transform(values[i]));
+                        }
+                    }
+
+#pragma omp critical
+                    for (std::int64_t k = 0; k < numGroups * num_cols; ++k) {
+                        if (local[k]._nnz > 0) {
+                            accumulators[k].merge(local[k]);
+                        }
+                    }
+                }
+            }
+            else {
+                // Every array is a column, threads do not conflict
+#pragma omp parallel for schedule(dynamic, 64)
+                for (std::int64_t a = 0; a < num_arrs; ++a) {
+                    const std::int64_t column = block._begin + a;
+                    for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                        const std::int64_t group = groupOfRow[block._indices[i]];
+                        accumulators[numGroups * column + group].add(transform(values[i]));
+                    }
+                }
+            }
+
+            processed_nnz += static_cast<double>(block._indptr.back());
+            if (progress && total_nnz > 0.0) {
+                progress(static_cast<float>(std::min(1.0, processed_nnz / total_nnz)));
+            }
+
+            }, /* readValues = */ true, blockNnz);
+
+        negative = anyNegative;
+        return streamed;
+    }
+
+    // Accumulates with log1p as requested, or again without for matrices that are not counts
+    bool accumulateValues(const SparseMatrixReader& reader, const std::vector<std::uint8_t>& groupOfRow, const std::int64_t numGroups, const DifferentialExpressionSettings& settings, Accumulators& accumulators, bool& logTransformed, bool& negative, const std::function<void(float)>& progress) {
+        // Values the reader already returns log1p transformed are not transformed twice
+        const bool readLog1p    = reader.getValueTransform()._log1p || reader.getStoredValueTransform()._log1p;
+        const bool log1p        = settings._logTransform && !readLog1p;
+        logTransformed          = log1p || readLog1p;
+
+        if (!accumulateGroups(reader, groupOfRow, numGroups, log1p, settings._blockNnz, accumulators, negative, progress))
+            return false;
+
+        if (!log1p || !negative)
+            return true;
+
+        std::cerr << "accumulateValues: the matrix has negative values, statistics are of the values as read instead of log1p" << std::endl;
+        logTransformed = false;
+
+        return accumulateGroups(reader, groupOfRow, numGroups, logTransformed, settings._blockNnz, accumulators, negative, progress);
+    }
+
+} // namespace
+
+// =============================================================================
+// Differential expression
+// =============================================================================
+
+bool computeDifferentialExpression(const SparseMatrixReader& reader, const std::vector<std::int64_t>& selectedRows, const DifferentialExpressionSettings& settings, DifferentialExpressionResult& result, const std::function<void(float)>& progress)
+{
+    const std::int64_t num_rows = reader.getNumRows();
+    const std::int64_t num_cols = reader.getNumCols();
+
+    result = {};
+
+    // Selected rows are group 0, all other rows group 1
+    std::vector<std::uint8_t> selected(num_rows, 1);
+    for (const std::int64_t row : selectedRows) {
+        if (row >= 0 && row < num_rows) {
+            selected[row] = 0;
+        }
+    }
+
+    const std::int64_t num_selected = std::count(selected.begin(), selected.end(), std::uint8_t{ 0 });
+    const std::int64_t num_rest     = num_rows - num_selected;
+
+    if (num_cols < 1 || num_selected == 0 || num_rest == 0) {
+        std::cerr << "computeDifferentialExpression: needs selected and unselected rows" << std::endl;
+        return false;
+    }
+
+    Accumulators accumulators;
+    bool logTransform = false, negative = false;
+    if (!accumulateValues(reader, selected, 2, settings, accumulators, logTransform, negative, progress)) {
+        std::cerr << "computeDifferentialExpression: could not stream the matrix" << std::endl;
+        return false;
+    }
+
+    result._numSelected     = num_selected;
+    result._numRest         = num_rest;
+    result._logTransformed  = logTransform;
+    result._ranking.resize(num_cols);
+
+#pragma omp parallel for
+    for (std::int64_t column = 0; column < num_cols; ++column) {
+        const GroupSums& inside  = accumulators[2 * column];
+        const GroupSums& outside = accumulators[2 * column + 1];
+
+        const double mean_selected  = inside._sum / num_selected;
+        const double mean_rest      = outside._sum / num_rest;
+        const double standard_error = std::sqrt(variance(inside, mean_selected, num_selected) / num_selected + variance(outside, mean_rest, num_rest) / num_rest);
+
+        // Fold changes of the means on the original scale
+        const double raw_selected   = logTransform ? std::expm1(mean_selected) : mean_selected;
+        const double raw_rest       = logTransform ? std::expm1(mean_rest) : mean_rest;
+
+        DifferentialExpressionStatistics& statistics = result._ranking[column];
+        statistics._column              = column;
+        statistics._meanSelected        = static_cast<float>(mean_selected);
+        statistics._meanRest            = static_cast<float>(mean_rest);
+        statistics._fractionSelected    = static_cast<float>(inside._nnz) / num_selected;
+        statistics._fractionRest        = static_cast<float>(outside._nnz) / num_rest;
+        statistics._logFoldChange       = negative ? 0.0f : static_cast<float>(std::log2((raw_selected + 1e-9) / (raw_rest + 1e-9)));
+        statistics._tStatistic          = standard_error > 0.0 ? static_cast<float>((mean_selected - mean_rest) / standard_error) : 0.0f;
+    }
+
+    // NaN last, e.g. of non-finite stored values, such that the order stays a strict weak ordering
+    std::stable_sort(result._ranking.begin(), result._ranking.end(), [](const DifferentialExpressionStatistics& a, const DifferentialExpressionStatistics& b) {
+        if (std::isnan(a._tStatistic))
+            return false;
+        if (std::isnan(b._tStatistic))
+            return true;
+        return a._tStatistic > b._tStatistic;
+        });
+
+    return true;
+}
+
+bool computeColumnStatistics(const SparseMatrixReader& reader, const DifferentialExpressionSettings& settings, std::vector<ColumnStatistics>& statistics, const std::function<void(float)>& progress)
+{
+    const std::int64_t num_rows = reader.getNumRows();
+    const std::int64_t num_cols = reader.getNumCols();
+
+    statistics.clear();
+
+    if (num_rows < 1 || num_cols < 1) {
+        std::cerr << "computeColumnStatistics: the matrix is empty" << std::endl;
+        return false;
+    }
+
+    Accumulators accumulators;
+    bool logTransform = false, negative = false;
+    if (!accumulateValues(reader, std::vector<std::uint8_t>(num_rows, 0), 1, settings, accumulators, logTransform, negative, progress)) {
+        std::cerr << "computeColumnStatistics: could not stream the matrix" << std::endl;
+        return false;
+    }
+
+    statistics.resize(num_cols);
+
+#pragma omp parallel for
+    for (std::int64_t column = 0; column < num_cols; ++column) {
+        const GroupSums& sums = accumulators[column];
+        const double mean = sums._sum / num_rows;
+
+        statistics[column]._column      = column;
+        statistics[column]._mean        = static_cast<float>(mean);
+        statistics[column]._variance    = static_cast<float>(variance(sums, mean, num_rows));
+        statistics[column]._fraction    = static_cast<float>(sums._nnz) / num_rows;
+    }
+
+    return true;
+}
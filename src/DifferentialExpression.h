@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class SparseMatrixReader;
+
+// =============================================================================
+// Streaming differential expression
+// =============================================================================
+
+/*
+Compares every column of the matrix between a set of selected rows and all other rows
+in a single pass over the matrix on disk. Per column and group, the sum, sum of squares
+and number of non-zero entries are accumulated; zeros are implicit and never visited.
+For CSR blocks the threads accumulate into their own arrays that are merged after each
+block, for CSC blocks every thread owns the columns of its arrays.
+
+Values are read with the value transform of the reader, like rows and columns. Columns are
+ranked by Welch's t-statistic of the selected rows against the rest, with values log1p
+transformed by default such as for counts, unless the reader already applies log1p.
+Matrices with negative values, e.g. scaled or centered ones, are not counts: their
+statistics are of the values as read.
+*/
+
+struct DifferentialExpressionSettings {
+    bool            _logTransform   = true;                     // Statistics of log1p(value), not applied again if the reader transforms with log1p
+    std::int64_t    _blockNnz       = std::int64_t{ 1 } << 22;
+};
+
+struct DifferentialExpressionStatistics {
+    std::int64_t    _column             = 0;
+    float           _meanSelected       = 0.0f;     // Of the (transformed) values
+    float           _meanRest           = 0.0f;
+    float           _fractionSelected   = 0.0f;     // Rows with a non-zero value
+    float           _fractionRest       = 0.0f;
+    float           _logFoldChange      = 0.0f;     // log2 ratio of the untransformed means, 0 for matrices with negative values
+    float           _tStatistic         = 0.0f;     // Welch's t, 0 if both groups have no variance, NaN columns are ranked last
+};
+
+// Of all rows, e.g. to pick the most variable or most frequent variables
+struct ColumnStatistics {
+    std::int64_t    _column     = 0;
+    float           _mean       = 0.0f;     // Of the (transformed) values
+    float           _variance   = 0.0f;     // Sample variance of the (transformed) values
+    float           _fraction   = 0.0f;     // Rows with a non-zero value
+};
+
+struct DifferentialExpressionResult {
+    std::vector<DifferentialExpressionStatistics>   _ranking        = {};   // All columns, highest t first
+    std::int64_t                                    _numSelected    = 0;
+    std::int64_t                                    _numRest        = 0;
+    bool                                            _logTransformed = false;    // Statistics of log1p(value) by the reader or these statistics, false for matrices with negative values
+};
+
+// progress is called with values in [0, 1]
+bool computeDifferentialExpression(const SparseMatrixReader& reader, const std::vector<std::int64_t>& selectedRows, const DifferentialExpressionSettings& settings, DifferentialExpressionResult& result, const std::function<void(float)>& progress = {});
+
+// Statistics of every column over all rows in column order, streamed like computeDifferentialExpression
+bool computeColumnStatistics(const SparseMatrixReader& reader, const DifferentialExpressionSettings& settings, std::vector<ColumnStatistics>& statistics, const std::function<void(float)>& progress = {});
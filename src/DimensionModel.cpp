@@ -0,0 +1,30 @@
+#include "DimensionModel.h"
+
+DimensionModel::DimensionModel(QObject* parent) :
+    QAbstractListModel(parent),
+    _names()
+{
+}
+
+void DimensionModel::setNames(const QStringList& names)
+{
+    beginResetModel();
+    _names = names;
+    endResetModel();
+}
+
+int DimensionModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : static_cast<int>(_names.size());
+}
+
+QVariant DimensionModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= _names.size())
+        return {};
+
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
+        return _names[index.row()];
+
+    return {};
+}
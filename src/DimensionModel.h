@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QVariant>
+
+/*
+List of variable names shared by all dimension pickers, such that adding a picker
+does not copy the names. The names are implicitly shared with the plugin.
+*/
+class DimensionModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+
+    /**
+     * Constructor
+     * @param parent Pointer to parent object
+     */
+    DimensionModel(QObject* parent = nullptr);
+
+    void setNames(const QStringList& names);
+    const QStringList& getNames() const { return _names; }
+
+public: // QAbstractListModel
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+
+private:
+    QStringList     _names;     /** Variable names in column order */
+};
@@ -0,0 +1,95 @@
+#include "DimensionSearch.h"
+
+#include <algorithm>
+#include <cctype>
+#include <numeric>
+
+static std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](const unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+}
+
+// =============================================================================
+// DimensionSearchIndex
+// =============================================================================
+
+DimensionSearchIndex::DimensionSearchIndex(const std::vector<std::string>& names) :
+    _lowerNames(names.size()),
+    _sorted(names.size())
+{
+    const std::int64_t numNames = static_cast<std::int64_t>(names.size());
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < numNames; ++i) {
+        _lowerNames[i] = toLower(names[i]);
+    }
+
+    std::iota(_sorted.begin(), _sorted.end(), std::int64_t{ 0 });
+    std::stable_sort(_sorted.begin(), _sorted.end(), [this](const std::int64_t a, const std::int64_t b) {
+        return _lowerNames[a] < _lowerNames[b];
+        });
+}
+
+std::vector<std::int64_t> DimensionSearchIndex::prefixMatches(const std::string& lowerQuery, const size_t maxResults) const {
+    const auto first = std::lower_bound(_sorted.begin(), _sorted.end(), lowerQuery, [this](const std::int64_t index, const std::string& query) {
+        return _lowerNames[index] < query;
+        });
+
+    std::vector<std::int64_t> matches;
+    for (auto it = first; it != _sorted.end() && matches.size() < maxResults && _lowerNames[*it].starts_with(lowerQuery); ++it) {
+        matches.push_back(*it);
+    }
+
+    return matches;
+}
+
+std::vector<std::int64_t> DimensionSearchIndex::search(const std::string& query, const size_t maxResults) {
+    const std::string lowerQuery = toLower(query);
+
+    if (lowerQuery.empty()) {
+        std::vector<std::int64_t> all(std::min(maxResults, _lowerNames.size()));
+        std::iota(all.begin(), all.end(), std::int64_t{ 0 });
+        return all;
+    }
+
+    std::vector<std::int64_t> matches = prefixMatches(lowerQuery, maxResults);
+
+    if (matches.size() >= maxResults)
+        return matches;
+
+    // Names that contain the query, refined from the previous query while typing
+    const bool refine = !_lastQuery.empty() && lowerQuery.find(_lastQuery) != std::string::npos;
+
+    if (refine) {
+        std::erase_if(_lastMatches, [this, &lowerQuery](const std::int64_t index) {
+            return _lowerNames[index].find(lowerQuery) == std::string::npos;
+            });
+    }
+    else {
+        const std::int64_t numNames = static_cast<std::int64_t>(_lowerNames.size());
+        std::vector<char> contains(_lowerNames.size(), 0);
+
+#pragma omp parallel for schedule(static, 4096)
+        for (std::int64_t i = 0; i < numNames; ++i) {
+            contains[i] = _lowerNames[i].find(lowerQuery) != std::string::npos;
+        }
+
+        _lastMatches.clear();
+        for (std::int64_t i = 0; i < numNames; ++i) {
+            if (contains[i])
+                _lastMatches.push_back(i);
+        }
+    }
+
+    _lastQuery = lowerQuery;
+
+    for (const std::int64_t index : _lastMatches) {
+        if (matches.size() >= maxResults)
+            break;
+
+        if (!_lowerNames[index].starts_with(lowerQuery))
+            matches.push_back(index);
+    }
+
+    return matches;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// DimensionSearchIndex
+// =============================================================================
+
+/*
+Case-insensitive search over the variable names of a matrix, for dimension pickers
+over 100k+ variables. Names that start with the query are found by a binary search in
+the sorted names, names that only contain it by a parallel scan. A query that extends
+the previous one, as while typing, only checks the matches of the previous query.
+*/
+class DimensionSearchIndex
+{
+public:
+    DimensionSearchIndex() = default;
+    explicit DimensionSearchIndex(const std::vector<std::string>& names);
+
+    // Names that start with the query in alphabetical order, followed by the names that contain it
+    // in index order, at most maxResults. An empty query matches all names in index order.
+    std::vector<std::int64_t> search(const std::string& query, const size_t maxResults = std::numeric_limits<size_t>::max());
+
+    size_t size() const { return _lowerNames.size(); }
+
+private:
+    std::vector<std::int64_t> prefixMatches(const std::string& lowerQuery, const size_t maxResults) const;
+
+private:
+    std::vector<std::string>    _lowerNames     = {};
+    std::vector<std::int64_t>   _sorted         = {};   // Indices sorted by lower-case name
+    std::string                 _lastQuery      = "";   // Lower-case
+    std::vector<std::int64_t>   _lastMatches    = {};   // All names that contain _lastQuery, in index order
+};
@@ -0,0 +1,322 @@
+#include "DiskCache.h"
+
+#include "ReaderRegistry.h"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// Entry format
+// =============================================================================
+
+namespace {
+
+    constexpr char          entryExtension[]    = ".sh5c";
+    constexpr char          entryMagic[4]       = { 'S', 'H', '5', 'C' };
+    constexpr std::uint32_t entryVersion        = 1;
+
+    // Followed by nnz std::uint32_t indices and nnz float values
+    struct EntryHeader {
+        char            _magic[4]   = { 'S', 'H', '5', 'C' };
+        std::uint32_t   _version    = entryVersion;
+        std::int64_t    _length     = 0;    // Length of the dense array
+        std::int64_t    _nnz        = 0;
+        std::uint32_t   _checksum   = 0;    // CRC-32 of indices and values
+        std::uint32_t   _reserved   = 0;
+    };
+
+    std::uint32_t checksum(const std::vector<std::uint32_t>& indices, const std::vector<float>& values) {
+        uLong crc = crc32(0L, Z_NULL, 0);
+        crc = crc32_z(crc, reinterpret_cast<const Bytef*>(indices.data()), indices.size() * sizeof(std::uint32_t));
+        crc = crc32_z(crc, reinterpret_cast<const Bytef*>(values.data()), values.size() * sizeof(float));
+        return static_cast<std::uint32_t>(crc);
+    }
+
+    // 64-bit FNV-1a, stable across platforms and sessions unlike std::hash
+    std::uint64_t fnv1a(const std::string& text) {
+        std::uint64_t hash = 14695981039346656037ull;
+        for (const unsigned char c : text) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::int64_t now() {
+        return fs::file_time_type::clock::now().time_since_epoch().count();
+    }
+
+} // namespace
+
+// =============================================================================
+// DiskCache
+// =============================================================================
+
+DiskCache::DiskCache(const std::string& directory, const std::uint64_t maxSize) :
+    _directory(directory),
+    _maxSize(maxSize)
+{
+    std::error_code error;
+    fs::create_directories(_directory, error);
+
+    if (error) {
+        std::cerr << "DiskCache: cannot create " << _directory << ": " << error.message() << std::endl;
+        return;
+    }
+
+    for (const fs::directory_entry& file : fs::directory_iterator(_directory, error)) {
+        if (!file.is_regular_file(error))
+            continue;
+
+        const fs::path& path = file.path();
+
+        // Left over from an interrupted store
+        if (path.extension() == ".tmp") {
+            fs::remove(path, error);
+            continue;
+        }
+
+        if (path.extension() != entryExtension)
+            continue;
+
+        Entry entry;
+        entry._size     = file.file_size(error);
+        entry._lastUse  = file.last_write_time(error).time_since_epoch().count();
+
+        _size += entry._size;
+        _entries[path.filename().string()] = entry;
+    }
+
+    evict();
+}
+
+std::shared_ptr<DiskCache> DiskCache::open(const std::string& directory, const std::uint64_t maxSize) {
+    static std::mutex mutex;
+    static std::map<std::string, std::weak_ptr<DiskCache>> caches;
+
+    std::error_code error;
+    const std::string key = fs::weakly_canonical(directory, error).string();
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (std::shared_ptr<DiskCache> cache = caches[key].lock()) {
+        cache->setMaxSize(maxSize);
+        return cache;
+    }
+
+    auto cache = std::make_shared<DiskCache>(key, maxSize);
+    caches[key] = cache;
+
+    return cache;
+}
+
+std::string DiskCache::fileKey(const std::string& filename) {
+    FileIdentity identity;
+    if (!readFileIdentity(filename, identity)) {
+        return "";
+    }
+
+    const std::string text = identity._canonicalPath + "\n" + std::to_string(identity._size) + "\n" + std::to_string(identity._modified);
+
+    char key[17] = {};
+    std::snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(fnv1a(text)));
+
+    return key;
+}
+
+std::string DiskCache::entryName(const std::string& fileKey, const bool row, const std::int64_t index) const {
+    return fileKey + (row ? "_r" : "_c") + std::to_string(index) + entryExtension;
+}
+
+bool DiskCache::load(const std::string& fileKey, const bool row, const std::int64_t index, const std::int64_t length, std::vector<float>& dest) {
+    if (fileKey.empty())
+        return false;
+
+    const std::string name = entryName(fileKey, row, index);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    auto it = _entries.find(name);
+    if (it == _entries.end())
+        return false;
+
+    const fs::path path = fs::path(_directory) / name;
+    std::ifstream file(path, std::ios::binary);
+
+    EntryHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+    std::vector<std::uint32_t> indices;
+    std::vector<float> values;
+
+    bool valid = file.good() && std::memcmp(header._magic, entryMagic, sizeof(entryMagic)) == 0 && header._version == entryVersion &&
+                 header._nnz >= 0 && header._nnz <= header._length;
+
+    if (valid && header._length != length) {
+        return false;
+    }
+
+    if (valid) {
+        indices.resize(header._nnz);
+        values.resize(header._nnz);
+        file.read(reinterpret_cast<char*>(indices.data()), indices.size() * sizeof(std::uint32_t));
+        file.read(reinterpret_cast<char*>(values.data()), values.size() * sizeof(float));
+
+        valid = file.good() && checksum(indices, values) == header._checksum &&
+                std::all_of(indices.begin(), indices.end(), [length](const std::uint32_t i) { return static_cast<std::int64_t>(i) < length; });
+    }
+
+    file.close();
+
+    if (!valid) {
+        std::cerr << "DiskCache::load: removing corrupt entry " << path.string() << std::endl;
+        remove(name);
+        return false;
+    }
+
+    dest.assign(length, 0.f);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        dest[indices[i]] = values[i];
+    }
+
+    // Persist the recency for the next session
+    std::error_code error;
+    it->second._lastUse = now();
+    fs::last_write_time(path, fs::file_time_type(fs::file_time_type::duration(it->second._lastUse)), error);
+
+    return true;
+}
+
+void DiskCache::store(const std::string& fileKey, const bool row, const std::int64_t index, const std::vector<float>& values) {
+    if (fileKey.empty() || _maxSize == 0)
+        return;
+
+    // Indices are stored with 32 bits
+    if (values.size() > std::numeric_limits<std::uint32_t>::max())
+        return;
+
+    EntryHeader header;
+    header._length = static_cast<std::int64_t>(values.size());
+
+    std::vector<std::uint32_t> nonZeroIndices;
+    std::vector<float> nonZeroValues;
+    for (size_t i = 0; i < values.size(); ++i) {
+        if (values[i] != 0.f) {
+            nonZeroIndices.push_back(static_cast<std::uint32_t>(i));
+            nonZeroValues.push_back(values[i]);
+        }
+    }
+
+    header._nnz      = static_cast<std::int64_t>(nonZeroIndices.size());
+    header._checksum = checksum(nonZeroIndices, nonZeroValues);
+
+    const std::uint64_t size = sizeof(header) + nonZeroIndices.size() * sizeof(std::uint32_t) + nonZeroValues.size() * sizeof(float);
+    if (size > _maxSize)
+        return;
+
+    const std::string name = entryName(fileKey, row, index);
+    const fs::path path = fs::path(_directory) / name;
+    const fs::path tmpPath = fs::path(_directory) / (name + ".tmp");
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_entries.contains(name))
+        return;
+
+    // Written aside and renamed, such that readers never see partial entries
+    {
+        std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(nonZeroIndices.data()), nonZeroIndices.size() * sizeof(std::uint32_t));
+        file.write(reinterpret_cast<const char*>(nonZeroValues.data()), nonZeroValues.size() * sizeof(float));
+
+        if (!file.good()) {
+            std::cerr << "DiskCache::store: cannot write " << tmpPath.string() << std::endl;
+            file.close();
+            std::error_code error;
+            fs::remove(tmpPath, error);
+            return;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(tmpPath, path, error);
+
+    if (error) {
+        std::cerr << "DiskCache::store: cannot write " << path.string() << ": " << error.message() << std::endl;
+        fs::remove(tmpPath, error);
+        return;
+    }
+
+    _entries[name] = { size, now() };
+    _size += size;
+
+    evict();
+}
+
+void DiskCache::setMaxSize(const std::uint64_t maxSize) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _maxSize = maxSize;
+    evict();
+}
+
+void DiskCache::clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    while (!_entries.empty()) {
+        remove(_entries.begin()->first);
+    }
+}
+
+std::uint64_t DiskCache::getSize() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _size;
+}
+
+size_t DiskCache::getNumEntries() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}
+
+void DiskCache::remove(const std::string& name) {
+    auto it = _entries.find(name);
+    if (it == _entries.end())
+        return;
+
+    std::error_code error;
+    fs::remove(fs::path(_directory) / name, error);
+
+    _size -= it->second._size;
+    _entries.erase(it);
+}
+
+void DiskCache::evict() {
+    if (_size <= _maxSize)
+        return;
+
+    // Evict down to 90% of the cap, such that not every store sorts all entries
+    const std::uint64_t targetSize = _maxSize - _maxSize / 10;
+
+    std::vector<std::pair<std::int64_t, std::string>> byLastUse;
+    byLastUse.reserve(_entries.size());
+    for (const auto& [name, entry] : _entries) {
+        byLastUse.emplace_back(entry._lastUse, name);
+    }
+    std::sort(byLastUse.begin(), byLastUse.end());
+
+    for (const auto& [lastUse, name] : byLastUse) {
+        if (_size <= targetSize)
+            break;
+        remove(name);
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// DiskCache
+// =============================================================================
+
+/*
+Second-level cache of decoded rows and columns that persists across sessions.
+Every array is stored sparsely in its own file in the cache folder:
+```
+<folder>/<file key>_c<index>.sh5c     # column <index> of one file version
+<folder>/<file key>_r<index>.sh5c     # row <index>
+```
+The file key hashes the canonical path, size and modification time of the matrix
+file, such that arrays of a file that changed on disk are not found anymore and
+age out. Each entry carries a CRC-32 of its contents, corrupt entries are removed
+when they are read. Once the folder exceeds the size cap, the least recently used
+entries are evicted, the recency is kept in the modification time of the entries.
+*/
+class DiskCache
+{
+public:
+    DiskCache(const std::string& directory, const std::uint64_t maxSize);
+
+    // One instance per folder and process, such that the size is tracked in one place
+    static std::shared_ptr<DiskCache> open(const std::string& directory, const std::uint64_t maxSize);
+
+    // Identifies a version of a matrix file, empty if the file does not exist
+    static std::string fileKey(const std::string& filename);
+
+public:
+    // Fills dest with the dense array of the given length, returns false if it is not cached
+    bool load(const std::string& fileKey, const bool row, const std::int64_t index, const std::int64_t length, std::vector<float>& dest);
+    void store(const std::string& fileKey, const bool row, const std::int64_t index, const std::vector<float>& values);
+
+    void setMaxSize(const std::uint64_t maxSize);
+    void clear();
+
+    const std::string& getDirectory() const { return _directory; }
+    std::uint64_t getMaxSize() const { return _maxSize; }
+    std::uint64_t getSize();
+    size_t getNumEntries();
+
+private:
+    struct Entry {
+        std::uint64_t   _size       = 0;
+        std::int64_t    _lastUse    = 0;    // Ticks of the file clock
+    };
+
+    std::string entryName(const std::string& fileKey, const bool row, const std::int64_t index) const;
+    void remove(const std::string& name);
+    void evict();
+
+private:
+    std::mutex                      _mutex      = {};
+    std::string                     _directory  = "";
+    std::uint64_t                   _maxSize    = 0;    // Bytes
+    std::uint64_t                   _size       = 0;    // Bytes of all entries
+    std::map<std::string, Entry>    _entries    = {};   // Keyed by file name in _directory
+};
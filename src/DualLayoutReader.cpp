@@ -0,0 +1,221 @@
+#include "DualLayoutReader.h"
+
+#include "ZarrUtils.h"
+
+#include <H5Cpp.h>
+
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <optional>
+
+// =============================================================================
+// Layout detection
+// =============================================================================
+
+struct SparseGroupInfo {
+    SparseMatrixType            _type   = SparseMatrixType::UNKNOWN;
+    std::array<std::int64_t, 2> _shape  = { 0, 0 };
+    std::int64_t                _nnz    = 0;
+    std::string                 _copyOf = "";
+};
+
+// Encoding, shape and number of non-zeros of an anndata sparse group
+static std::optional<SparseGroupInfo> readSparseGroupInfo(const H5::H5File& file, const std::string& path) {
+    if (!groupExists(file, path) || file.childObjType(path) != H5O_TYPE_GROUP) {
+        return std::nullopt;
+    }
+
+    H5::Group group = file.openGroup(path);
+
+    if (!group.attrExists("encoding-type") || !group.attrExists("shape") || !group.nameExists("indptr") || !group.nameExists("indices") || !group.nameExists("data")) {
+        return std::nullopt;
+    }
+
+    SparseGroupInfo info;
+    info._type = sparseMatrixStringToType(readAttributeString(group, "encoding-type"));
+
+    if (info._type != SparseMatrixType::CSR && info._type != SparseMatrixType::CSC) {
+        return std::nullopt;
+    }
+
+    group.openAttribute("shape").read(H5::PredType::NATIVE_INT64, info._shape.data());
+
+    if (group.attrExists("copy-of")) {
+        info._copyOf = readAttributeString(group, "copy-of");
+    }
+
+    // The last index pointer is the number of non-zeros
+    H5::DataSet indptr = group.openDataSet("indptr");
+    H5::DataSpace fileSpace = indptr.getSpace();
+    hsize_t size = 0;
+    fileSpace.getSimpleExtentDims(&size);
+
+    if (size > 0) {
+        const hsize_t offset = size - 1, count = 1;
+        H5::DataSpace memSpace(1, &count);
+        fileSpace.selectHyperslab(H5S_SELECT_SET, &count, &offset);
+        indptr.read(&info._nnz, H5::PredType::NATIVE_INT64, memSpace, fileSpace);
+    }
+
+    return info;
+}
+
+std::vector<MatrixLayout> findMatrixLayouts(const std::string& filename) {
+    std::vector<MatrixLayout> layouts;
+
+    if (isZarrStore(filename) || !std::filesystem::exists(filename)) {
+        return layouts;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    try {
+        const H5::H5File file(filename, H5F_ACC_RDONLY);
+
+        const std::optional<SparseGroupInfo> main = readSparseGroupInfo(file, "X");
+        if (!main) {
+            return layouts;
+        }
+
+        layouts.push_back({ "X", main->_type });
+
+        std::vector<std::string> candidates = { "X_csr", "X_csc" };
+        if (groupExists(file, "layers") && file.childObjType("layers") == H5O_TYPE_GROUP) {
+            const H5::Group layers = file.openGroup("layers");
+            for (hsize_t i = 0; i < layers.getNumObjs(); ++i) {
+                candidates.push_back("layers/" + layers.getObjnameByIdx(i));
+            }
+        }
+
+        // Only declared copies, a layer with a matching name and size may still hold other values
+        for (const std::string& candidate : candidates) {
+            const std::optional<SparseGroupInfo> copy = readSparseGroupInfo(file, candidate);
+            if (!copy) {
+                continue;
+            }
+
+            const bool declared = copy->_copyOf == "/X" || copy->_copyOf == "X";
+
+            if (declared && copy->_shape == main->_shape && copy->_nnz == main->_nnz) {
+                layouts.push_back({ candidate, copy->_type });
+            }
+        }
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "findMatrixLayouts: " << e.getDetailMsg() << std::endl;
+    }
+
+    return layouts;
+}
+
+// =============================================================================
+// DualLayoutReader
+// =============================================================================
+
+DualLayoutReader::DualLayoutReader() :
+    SparseMatrixReader(SparseMatrixType::CSR)
+{
+}
+
+DualLayoutReader::DualLayoutReader(const std::string& filename) :
+    DualLayoutReader()
+{
+    readFile(filename);
+}
+
+DualLayoutReader::~DualLayoutReader() = default;
+
+bool DualLayoutReader::readFile(const std::string& filename)
+{
+    reset();
+    _csr.reset();
+    _csc.reset();
+    _csrGroup = "";
+    _cscGroup = "";
+
+    for (const MatrixLayout& layout : findMatrixLayouts(filename)) {
+        if (layout._type == SparseMatrixType::CSR && _csrGroup.empty())
+            _csrGroup = layout._group;
+        else if (layout._type == SparseMatrixType::CSC && _cscGroup.empty())
+            _cscGroup = layout._group;
+    }
+
+    if (_csrGroup.empty() || _cscGroup.empty()) {
+        _csrGroup = "";
+        _cscGroup = "";
+        return false;
+    }
+
+    // Both copies are opened from the same file and share the budget for reading it into memory
+    H5AccessSettings access = _h5Access;
+    access._coreBudgetBytes /= 2;
+    _csr.setH5Access(access);
+    _csc.setH5Access(access);
+
+    if (!_csr.readFileGroup(filename, _csrGroup) || !_csc.readFileGroup(filename, _cscGroup)) {
+        std::cerr << "DualLayoutReader::readFile: cannot read " << _csrGroup << " and " << _cscGroup << " in " << filename << std::endl;
+        return false;
+    }
+
+    // Arrays are cached once by this reader
+    _csr.setUseCache(false);
+    _csc.setUseCache(false);
+
+    _data._filename  = filename;
+    _data._num_rows  = _csr.getNumRows();
+    _data._num_cols  = _csr.getNumCols();
+    _data._obs_names = _csr.getObsNames();
+    _data._var_names = _csr.getVarNames();
+    _data._access    = _csr.getRawData()._access;
+
+    return true;
+}
+
+void DualLayoutReader::setValueTransform(const ValueTransform& transform)
+{
+    _csr.setValueTransform(transform);
+    _csc.setValueTransform(transform);
+    SparseMatrixReader::setValueTransform(transform);
+}
+
+std::vector<float> DualLayoutReader::getRowImpl(std::int64_t row_idx) const
+{
+    return _csr.getRowImpl(row_idx);
+}
+
+std::vector<float> DualLayoutReader::getColumnImpl(std::int64_t col_idx) const
+{
+    return _csc.getColumnImpl(col_idx);
+}
+
+std::vector<std::vector<float>> DualLayoutReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    return _csr.getRowsImpl(row_indices);
+}
+
+std::vector<std::vector<float>> DualLayoutReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return _csc.getColumnsImpl(col_indices);
+}
+
+std::vector<float> DualLayoutReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return _csc.getColumnSumImpl(col_indices);
+}
+
+std::vector<float> DualLayoutReader::getRowTotalsImpl() const
+{
+    return _csr.getRowTotalsImpl();
+}
+
+std::vector<SparseArray> DualLayoutReader::getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return _csc.getSparseColumnsImpl(col_indices);
+}
+
+bool DualLayoutReader::streamBlocks(const BlockCallback& process, const bool readValues, const std::int64_t blockNnz) const
+{
+    return _csr.streamBlocks(process, readValues, blockNnz);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "H5Utils.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// DualLayoutReader
+// =============================================================================
+
+struct MatrixLayout {
+    std::string         _group  = "";
+    SparseMatrixType    _type   = SparseMatrixType::UNKNOWN;
+};
+
+// Sparse groups that hold the matrix X: X itself, followed by copies in layers/ or at the root.
+// Copies must carry the attribute copy-of="/X", as written by SparseH5Repack,
+// and have the same shape and number of non-zeros as X.
+std::vector<MatrixLayout> findMatrixLayouts(const std::string& filename);
+
+/*
+Reads files that store the same matrix in both orientations, e.g. as written by SparseH5Repack:
+```
+X                   # csr_matrix
+layers/X_csc        # csc_matrix, attribute copy-of = "/X"
+```
+Rows are always read from the CSR copy and columns from the CSC copy,
+such that both directions are contiguous primary-axis reads.
+*/
+class DualLayoutReader : public SparseMatrixReader
+{
+
+public:
+    DualLayoutReader();
+    DualLayoutReader(const std::string& filename);
+
+    ~DualLayoutReader();
+
+public: // Setup
+
+    // Fails if the file does not hold both a CSR and a CSC copy
+    bool readFile(const std::string& filename) override;
+
+    // Both copies transform their values
+    void setValueTransform(const ValueTransform& transform) override;
+
+public: // Getter
+
+    std::vector<float> getRowImpl(std::int64_t row_idx) const override;
+    std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    std::vector<SparseArray> getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    // Streams the rows of the CSR copy
+    bool streamBlocks(const BlockCallback& process, const bool readValues = true, const std::int64_t blockNnz = defaultBlockNnz) const override;
+
+    std::uint64_t getBytesRead() const override { return _csr.getBytesRead() + _csc.getBytesRead(); }
+
+    const std::string& getCsrGroup() const { return _csrGroup; }
+    const std::string& getCscGroup() const { return _cscGroup; }
+
+private:
+    CSRReader       _csr        = {};
+    CSCReader       _csc        = {};
+    std::string     _csrGroup   = "";
+    std::string     _cscGroup   = "";
+};
@@ -0,0 +1,206 @@
+#include "H5FileAccess.h"
+
+#include "H5Utils.h"
+
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+namespace {
+    constexpr std::uint64_t MiB = std::uint64_t{ 1 } << 20;
+
+    constexpr std::uint64_t pageBufferMaxBytes  = 512 * MiB;
+    constexpr std::uint64_t pageBufferMinPages  = 16;
+
+    std::string formatMiB(const std::uint64_t bytes) {
+        return bytes >= MiB ? std::to_string(bytes / MiB) + " MiB" : std::to_string(bytes >> 10) + " KiB";
+    }
+
+    // Sets the fapl property, reports and skips it if HDF5 does not accept it
+    void applyProperty(const herr_t status, const char* property) {
+        if (status < 0)
+            std::cerr << "openH5File: cannot set " << property << ", using the default" << std::endl;
+    }
+}
+
+// =============================================================================
+// H5Driver
+// =============================================================================
+
+std::string h5DriverToString(const H5Driver& driver)
+{
+    switch (driver)
+    {
+    case H5Driver::CORE:    return "core";
+    case H5Driver::DIRECT:  return "direct";
+    case H5Driver::SEC2:    break;
+    }
+
+    return "sec2";
+}
+
+H5Driver h5DriverStringToType(const std::string& driver)
+{
+    if (driver == "core")
+        return H5Driver::CORE;
+
+    if (driver == "direct")
+        return H5Driver::DIRECT;
+
+    return H5Driver::SEC2;
+}
+
+// =============================================================================
+// H5AccessSettings
+// =============================================================================
+
+std::string h5AccessKey(const H5AccessSettings& settings) {
+    // Auto-tuned files are opened the same way whatever the other settings are
+    if (settings._autoTune)
+        return "";
+
+    return "_a" + h5DriverToString(settings._driver) + "," + std::to_string(settings._pageBufferBytes) + "," +
+        std::to_string(settings._metadataCacheBytes) + "," + std::to_string(settings._metaBlockBytes);
+}
+
+std::string h5AccessToString(const H5AccessSettings& settings) {
+    std::string text = h5DriverToString(settings._driver);
+
+    if (settings._pageBufferBytes > 0)
+        text += ", " + formatMiB(settings._pageBufferBytes) + " page buffer";
+
+    if (settings._metadataCacheBytes > 0)
+        text += ", " + formatMiB(settings._metadataCacheBytes) + " metadata cache";
+
+    if (settings._metaBlockBytes > 0)
+        text += ", " + formatMiB(settings._metaBlockBytes) + " metadata blocks";
+
+    return text;
+}
+
+bool readH5FileLayout(const std::string& filename, H5FileLayout& layout) {
+    layout = {};
+
+    std::error_code error;
+    layout._fileSize = std::filesystem::file_size(filename, error);
+    if (error)
+        return false;
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    try {
+        const H5::H5File file(filename, H5F_ACC_RDONLY);
+        const H5::FileCreatPropList fcpl = file.getCreatePlist();
+
+        H5F_fspace_strategy_t strategy = H5F_FSPACE_STRATEGY_FSM_AGGR;
+        hbool_t persist = false;
+        hsize_t threshold = 0;
+        hsize_t pageSize = 0;
+
+        if (H5Pget_file_space_strategy(fcpl.getId(), &strategy, &persist, &threshold) >= 0 && strategy == H5F_FSPACE_STRATEGY_PAGE &&
+            H5Pget_file_space_page_size(fcpl.getId(), &pageSize) >= 0 && pageSize > 0) {
+            layout._paged = true;
+            layout._pageSize = pageSize;
+        }
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "readH5FileLayout: " << e.getDetailMsg() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+H5AccessSettings tuneH5Access(const H5FileLayout& layout, const H5AccessSettings& requested) {
+    H5AccessSettings settings = requested;
+
+    if (requested._autoTune) {
+        settings._driver = layout._fileSize <= requested._coreBudgetBytes ? H5Driver::CORE : H5Driver::SEC2;
+
+        settings._pageBufferBytes = 0;
+        if (layout._paged && settings._driver != H5Driver::CORE)
+            settings._pageBufferBytes = std::clamp(layout._fileSize / 32, pageBufferMinPages * layout._pageSize, std::max(pageBufferMaxBytes, pageBufferMinPages * layout._pageSize));
+
+        if (layout._fileSize >= (std::uint64_t{ 4 } << 30))
+            settings._metadataCacheBytes = 64 * MiB;
+        else if (settings._driver != H5Driver::CORE)
+            settings._metadataCacheBytes = 16 * MiB;
+        else
+            settings._metadataCacheBytes = 0;
+
+        // Metadata blocks only matter for writes
+        settings._metaBlockBytes = 0;
+    }
+
+    // Whole pages of paged files only
+    if (!layout._paged || layout._pageSize == 0)
+        settings._pageBufferBytes = 0;
+    else if (settings._pageBufferBytes > 0)
+        settings._pageBufferBytes = std::max(settings._pageBufferBytes / layout._pageSize, std::uint64_t{ 1 }) * layout._pageSize;
+
+    return settings;
+}
+
+std::unique_ptr<H5::H5File> openH5File(const std::string& filename, const H5AccessSettings& requested, H5AccessSettings& applied) {
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    applied = {};
+    applied._autoTune = requested._autoTune;
+
+    if (requested == H5AccessSettings{ ._autoTune = false }) {
+        return std::make_unique<H5::H5File>(filename, H5F_ACC_RDONLY);
+    }
+
+    H5FileLayout layout;
+    if (!readH5FileLayout(filename, layout)) {
+        return std::make_unique<H5::H5File>(filename, H5F_ACC_RDONLY);
+    }
+
+    applied = tuneH5Access(layout, requested);
+
+    H5::FileAccPropList fapl;
+    const hid_t faplId = fapl.getId();
+
+    switch (applied._driver)
+    {
+    case H5Driver::CORE:
+        // Read-only, nothing is written back
+        applyProperty(H5Pset_fapl_core(faplId, 64 * MiB, false), "the core driver");
+        break;
+    case H5Driver::DIRECT:
+#ifdef H5_HAVE_DIRECT
+        applyProperty(H5Pset_fapl_direct(faplId, 4096, 4096, 16 * MiB), "the direct driver");
+#else
+        std::cerr << "openH5File: HDF5 is built without the direct driver, using sec2" << std::endl;
+        applied._driver = H5Driver::SEC2;
+#endif
+        break;
+    case H5Driver::SEC2:
+        applyProperty(H5Pset_fapl_sec2(faplId), "the sec2 driver");
+        break;
+    }
+
+    if (applied._pageBufferBytes > 0)
+        applyProperty(H5Pset_page_buffer_size(faplId, static_cast<size_t>(applied._pageBufferBytes), 0, 0), "the page buffer size");
+
+    if (applied._metadataCacheBytes > 0) {
+        H5AC_cache_config_t config = {};
+        config.version = H5AC__CURR_CACHE_CONFIG_VERSION;
+
+        if (H5Pget_mdc_config(faplId, &config) >= 0) {
+            config.set_initial_size = true;
+            config.initial_size     = static_cast<size_t>(applied._metadataCacheBytes);
+            config.max_size         = std::max(config.max_size, config.initial_size);
+            config.min_size         = std::min(config.min_size, config.initial_size);
+            applyProperty(H5Pset_mdc_config(faplId, &config), "the metadata cache size");
+        }
+    }
+
+    if (applied._metaBlockBytes > 0)
+        applyProperty(H5Pset_meta_block_size(faplId, applied._metaBlockBytes), "the metadata block size");
+
+    return std::make_unique<H5::H5File>(filename, H5F_ACC_RDONLY, H5::FileCreatPropList::DEFAULT, fapl);
+}
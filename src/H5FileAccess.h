@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+// =============================================================================
+// H5 file access
+// =============================================================================
+
+namespace H5 {
+    class H5File;
+}
+
+// Virtual file driver of HDF5 files opened for reading
+enum class H5Driver : std::int32_t {
+    SEC2,       // Default, one pread per request
+    CORE,       // Reads the whole file into memory when it is opened
+    DIRECT,     // Bypasses the OS page cache, only if HDF5 is built with it, sec2 otherwise
+};
+
+std::string h5DriverToString(const H5Driver& driver);
+H5Driver h5DriverStringToType(const std::string& driver);
+
+// Sizes of 0 keep the defaults of the library
+struct H5AccessSettings {
+    bool            _autoTune           = true;     // Pick the settings below from the file, see tuneH5Access
+    H5Driver        _driver             = H5Driver::SEC2;
+    std::uint64_t   _pageBufferBytes    = 0;        // Only for files written with paged aggregation, rounded down to whole pages
+    std::uint64_t   _metadataCacheBytes = 0;        // Initial size of the metadata cache, e.g. chunk B-trees
+    std::uint64_t   _metaBlockBytes     = 0;        // Minimum size of metadata block allocations
+    std::uint64_t   _coreBudgetBytes    = std::uint64_t{ 256 } << 20;   // Auto-tuning reads files up to this size into memory, shared by files opened together
+
+    bool operator==(const H5AccessSettings& other) const = default;
+};
+
+// Appended to reader keys, empty for the defaults
+std::string h5AccessKey(const H5AccessSettings& settings);
+
+// e.g. "core, 16 MiB metadata cache"
+std::string h5AccessToString(const H5AccessSettings& settings);
+
+struct H5FileLayout {
+    std::uint64_t   _fileSize   = 0;
+    bool            _paged      = false;    // Written with the paged aggregation strategy
+    std::uint64_t   _pageSize   = 0;        // File space page size of paged files
+};
+
+// False if the file cannot be opened
+bool readH5FileLayout(const std::string& filename, H5FileLayout& layout);
+
+/*
+Settings for a file with the given layout. Without auto-tuning these are the requested ones,
+only page buffering is dropped for files that are not paged and rounded down to whole pages.
+
+The auto-tuner reads files within the core budget into memory with the core driver, such that
+the many small hyperslab reads of secondary scans do not each become a pread. Larger files use
+sec2 with a page buffer of 1/32 of the file for paged files, at most 512 MiB, and a metadata
+cache that grows with the file, since large files hold more chunk B-tree nodes.
+*/
+H5AccessSettings tuneH5Access(const H5FileLayout& layout, const H5AccessSettings& requested);
+
+// Opens a file read-only, tuned for its layout, applied holds the settings that are used
+std::unique_ptr<H5::H5File> openH5File(const std::string& filename, const H5AccessSettings& requested, H5AccessSettings& applied);
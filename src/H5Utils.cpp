@@ -1,14 +1,28 @@
 #include "H5Utils.h"
 
+#include "AccessTrace.h"
+#include "BlockIndex.h"
+#include "BlockPipeline.h"
+#include "DenseMatrixReader.h"
+#include "DiskCache.h"
+#include "DualLayoutReader.h"
+#include "ZarrUtils.h"
+
 #include <H5Cpp.h>
 
 #include <algorithm>
 #include <array>
 #include <cassert>
 #include <cctype>
+#include <chrono>
+#include <cstdio>
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <numeric>
+#include <regex>
 #include <string>
 #include <stdlib.h> // free
 
@@ -16,6 +30,11 @@
 // H5 utilities
 // =============================================================================
 
+std::recursive_mutex& h5Mutex() {
+    static std::recursive_mutex mutex;
+    return mutex;
+}
+
 std::string readAttributeString(H5::H5Object& file, const std::string& attr_name) {
     std::string value = "";
 
@@ -37,9 +56,64 @@ bool attributeExists(const H5::H5Object& loc, const std::string& attr_name) {
 }
 
 bool groupExists(const H5::H5File& file, const std::string& path) {
+    // H5Lexists fails instead of returning false if an intermediate group of a nested path is missing
+    for (size_t end = path.find('/'); end != std::string::npos; end = path.find('/', end + 1)) {
+        if (end > 0 && H5Lexists(file.getLocId(), path.substr(0, end).c_str(), H5P_DEFAULT) <= 0)
+            return false;
+    }
+
     return H5Lexists(file.getLocId(), path.c_str(), H5P_DEFAULT) > 0;
 }
 
+void readStringArray(const H5::H5File& file, const std::string& groupName, const std::string& datasetName, std::vector<std::string>& dest) {
+    dest.clear();
+
+    if (!groupExists(file, groupName)) {
+        return;
+    }
+
+    H5::Group grp = file.openGroup(groupName);
+
+    if (!grp.nameExists(datasetName)) {
+        return;
+    }
+
+    H5::DataSet str_ds = grp.openDataSet(datasetName);
+    H5::DataSpace str_space = str_ds.getSpace();
+    hsize_t n = {};
+    str_space.getSimpleExtentDims(&n);
+
+    const H5::StrType file_type = str_ds.getStrType();
+
+    dest.reserve(n);
+
+    if (file_type.isVariableStr()) {
+        // Variable-length UTF-8 string type
+        H5::StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);
+        str_type.setCset(H5T_CSET_UTF8);        // UTF-8 character set
+        str_type.setStrpad(H5T_STR_NULLTERM);   // Null-terminated
+
+        std::vector<char*> str_raw(n);
+        str_ds.read(str_raw.data(), str_type);
+
+        for (size_t i = 0; i < n; ++i) {
+            dest.emplace_back(str_raw[i]);
+            free(str_raw[i]); // Free HDF5-allocated memory
+        }
+    }
+    else {
+        // Fixed-length strings, e.g. numpy bytes as written by loompy
+        const size_t str_size = file_type.getSize();
+        std::vector<char> str_raw(n * str_size);
+        str_ds.read(str_raw.data(), file_type);
+
+        for (size_t i = 0; i < n; ++i) {
+            const char* begin = str_raw.data() + i * str_size;
+            dest.emplace_back(begin, std::find(begin, begin + str_size, '\0'));
+        }
+    }
+}
+
 
 // =============================================================================
 // Sparse matrix common utilities
@@ -57,6 +131,9 @@ std::string sparseMatrixTypeToString(const SparseMatrixType& type)
     case SparseMatrixType::CSC:
         typeStr = "CSC";
         break;
+    case SparseMatrixType::DENSE:
+        typeStr = "DENSE";
+        break;
     case SparseMatrixType::UNKNOWN:
         typeStr = "UNKNOWN";
         break;
@@ -82,27 +159,184 @@ SparseMatrixType sparseMatrixStringToType(const std::string& typeStr)
     if (typeStrUpperCase == "CSC" || typeStrUpperCase == "CSC_MATRIX")
         type = SparseMatrixType::CSC;
 
+    if (typeStrUpperCase == "DENSE" || typeStrUpperCase == "ARRAY")
+        type = SparseMatrixType::DENSE;
+
     return type;
 }
 
-bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data)
+std::string aggregateReductionToString(const AggregateReduction& reduction)
+{
+    std::string reductionStr = "";
+
+    switch (reduction)
+    {
+    case AggregateReduction::SUM:
+        reductionStr = "Sum";
+        break;
+    case AggregateReduction::MEAN:
+        reductionStr = "Mean";
+        break;
+    case AggregateReduction::NORMALIZED_MEAN:
+        reductionStr = "Normalized mean";
+        break;
+    }
+
+    return reductionStr;
+}
+
+AggregateReduction aggregateReductionStringToType(const std::string& reductionStr)
+{
+    AggregateReduction reduction = AggregateReduction::SUM;
+
+    auto str_tolower = [](std::string str) -> std::string {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+        return str;
+        };
+
+    const std::string reductionStrLowerCase = str_tolower(reductionStr);
+
+    if (reductionStrLowerCase == "mean")
+        reduction = AggregateReduction::MEAN;
+
+    if (reductionStrLowerCase == "normalized mean" || reductionStrLowerCase == "normalized_mean")
+        reduction = AggregateReduction::NORMALIZED_MEAN;
+
+    return reduction;
+}
+
+bool RowPredicate::matches(const float value) const
+{
+    switch (_op)
+    {
+    case PredicateOp::LESS:             return value < _value;
+    case PredicateOp::LESS_EQUAL:       return value <= _value;
+    case PredicateOp::EQUAL:            return value == _value;
+    case PredicateOp::NOT_EQUAL:        return value != _value;
+    case PredicateOp::GREATER_EQUAL:    return value >= _value;
+    case PredicateOp::GREATER:          return value > _value;
+    }
+
+    return false;
+}
+
+bool parseRowQuery(const std::string& query, const std::vector<std::string>& var_names, std::vector<RowPredicate>& predicates, std::string& error)
+{
+    predicates.clear();
+    error = "";
+
+    auto trim = [](const std::string& str) -> std::string {
+        const size_t first = str.find_first_not_of(" \t\r\n");
+        if (first == std::string::npos)
+            return "";
+        return str.substr(first, str.find_last_not_of(" \t\r\n") - first + 1);
+        };
+
+    if (trim(query).empty()) {
+        error = "empty query";
+        return false;
+    }
+
+    const std::unordered_map<std::string, PredicateOp> operators = {
+        { "<",  PredicateOp::LESS },            { "<=", PredicateOp::LESS_EQUAL },
+        { "==", PredicateOp::EQUAL },           { "=",  PredicateOp::EQUAL },
+        { "!=", PredicateOp::NOT_EQUAL },       { ">=", PredicateOp::GREATER_EQUAL },
+        { ">",  PredicateOp::GREATER },
+    };
+
+    std::unordered_map<std::string, std::int64_t> var_indices;
+    var_indices.reserve(var_names.size());
+    for (size_t var = 0; var < var_names.size(); ++var) {
+        var_indices.emplace(var_names[var], static_cast<std::int64_t>(var));
+    }
+
+    // Clauses are separated by AND or &&
+    static const std::regex conjunction(R"(\s+and\s+|&&)", std::regex::icase);
+
+    for (auto it = std::sregex_token_iterator(query.begin(), query.end(), conjunction, -1); it != std::sregex_token_iterator(); ++it) {
+        const std::string clause = trim(*it);
+
+        const size_t op_begin = clause.find_first_of("<>=!");
+        if (op_begin == std::string::npos) {
+            error = "missing comparison in '" + clause + "'";
+            return false;
+        }
+
+        const size_t op_end         = std::min(clause.find_first_not_of("<>=!", op_begin), clause.size());
+        const std::string name      = trim(clause.substr(0, op_begin));
+        const std::string op        = clause.substr(op_begin, op_end - op_begin);
+        const std::string value     = trim(clause.substr(op_end));
+
+        const auto op_it = operators.find(op);
+        if (op_it == operators.end()) {
+            error = "unknown comparison '" + op + "' in '" + clause + "'";
+            return false;
+        }
+
+        const auto var_it = var_indices.find(name);
+        if (var_it == var_indices.end()) {
+            error = "unknown variable '" + name + "'";
+            return false;
+        }
+
+        char* value_end = nullptr;
+        const float threshold = std::strtof(value.c_str(), &value_end);
+        if (value.empty() || value_end != value.c_str() + value.size()) {
+            error = "invalid number '" + value + "' in '" + clause + "'";
+            return false;
+        }
+
+        predicates.push_back({ var_it->second, op_it->second, threshold });
+    }
+
+    return true;
+}
+
+// Written by extractColumns to uns/value_transform, one scalar per field
+static void readStoredTransform(const H5::H5File& file, ValueTransform& dest) {
+    dest = {};
+
+    if (!groupExists(file, "uns/value_transform"))
+        return;
+
+    const H5::Group group = file.openGroup("uns/value_transform");
+
+    auto readScalar = [&group](const std::string& name, const double fallback) -> double {
+        if (!H5Lexists(group.getLocId(), name.c_str(), H5P_DEFAULT))
+            return fallback;
+
+        double value = fallback;
+        group.openDataSet(name).read(&value, H5::PredType::NATIVE_DOUBLE);
+        return value;
+        };
+
+    dest._normalizeTotals   = readScalar("normalize_totals", 0.0) != 0.0;
+    dest._targetSum         = static_cast<float>(readScalar("target_sum", dest._targetSum));
+    dest._log1p             = readScalar("log1p", 0.0) != 0.0;
+    dest._scale             = static_cast<float>(readScalar("scale", dest._scale));
+    dest._clipMax           = static_cast<float>(readScalar("clip_max", dest._clipMax));
+}
+
+bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data, const std::string& groupName, const H5AccessSettings& access)
 {
     if (!std::filesystem::exists(filename)) {
         std::cerr << "readMatrixFromFile: file does not exist" << filename << std::endl;
         return false;
     }
 
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
     // TODO: add some checks if the type on disk is actually int64
     try {
         data._filename = filename;
-        data._file = std::make_unique<H5::H5File>(data._filename, H5F_ACC_RDONLY);
+        data._file = openH5File(data._filename, access, data._access);
 
-        if (!groupExists(*(data._file.get()), "X")) {
-            std::cerr << "readMatrixFromFile: group X does not exist" << std::endl;
+        if (!groupExists(*(data._file.get()), groupName)) {
+            std::cerr << "readMatrixFromFile: group " << groupName << " does not exist" << std::endl;
             return false;
         }
 
-        H5::Group Xgrp = data._file->openGroup("X");
+        H5::Group Xgrp = data._file->openGroup(groupName);
 
         // Read shape
         H5::Attribute shape_attr = Xgrp.openAttribute("shape");
@@ -116,7 +350,7 @@ bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data)
             return !Xgrp.nameExists(datasets_name);
             }))
         {
-            std::cerr << "readMatrixFromFile: group X must have datasets data, indices, indptr" << std::endl;
+            std::cerr << "readMatrixFromFile: group " << groupName << " must have datasets data, indices, indptr" << std::endl;
             return false;
         }
 
@@ -129,48 +363,15 @@ bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data)
         H5::DataSpace indptr_space = data._indptr_ds->getSpace();
         hsize_t indptr_size = {};
         indptr_space.getSimpleExtentDims(&indptr_size);
-        data._indptr.resize(indptr_size);
-        data._indptr_ds->read(data._indptr.data(), H5::PredType::NATIVE_INT64);
+        std::vector<std::int64_t> indptr(indptr_size);
+        data._indptr_ds->read(indptr.data(), H5::PredType::NATIVE_INT64);
+        data._indptr = std::move(indptr);
 
         // Read variable and observation names (if available)
-        auto readStringArray = [&data](const std::string& groupName, const std::string& datasetName, std::vector<std::string>& dest) -> void {
-
-            if (!groupExists(*(data._file.get()), groupName)) {
-                dest.clear();
-                return;
-            }
-
-            H5::Group grp = data._file->openGroup(groupName);
-
-            if (!grp.nameExists(datasetName)) {
-                dest.clear();
-                return;
-            }
-
-            H5::DataSet obs_ds = grp.openDataSet(datasetName);
-            H5::DataSpace obs_space = obs_ds.getSpace();
-            hsize_t n = {};
-            obs_space.getSimpleExtentDims(&n);
-
-            // Variable-length UTF-8 string type
-            H5::StrType str_type(H5::PredType::C_S1, H5T_VARIABLE);
-            str_type.setCset(H5T_CSET_UTF8);        // UTF-8 character set
-            str_type.setStrpad(H5T_STR_NULLTERM);   // Null-terminated
-
-            std::vector<char*> obs_raw(n);
-            obs_ds.read(obs_raw.data(), str_type);
-
-            dest.clear();
-            dest.reserve(n);
-            for (size_t i = 0; i < n; ++i) {
-                dest.emplace_back(obs_raw[i]);
-                free(obs_raw[i]); // Free HDF5-allocated memory
-            }
-
-            };
+        readStringArray(*data._file, "obs", "_index", data._obs_names);
+        readStringArray(*data._file, "var", "_index", data._var_names);
 
-        readStringArray("obs", "_index", data._obs_names);
-        readStringArray("var", "_index", data._var_names);
+        readStoredTransform(*data._file, data._stored_transform);
     }
     catch (H5::FileIException& e) {
         std::cerr << "HDF5 file error: " << e.getDetailMsg() << std::endl;
@@ -196,6 +397,99 @@ bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data)
     return true;
 }
 
+// Cell Ranger stores features x barcodes in CSC layout in the group matrix, with the names in datasets next to it
+static bool isCellRangerLayout(const H5::H5File& file) {
+    if (!groupExists(file, "matrix") || file.childObjType("matrix") != H5O_TYPE_GROUP)
+        return false;
+
+    const H5::Group grp = file.openGroup("matrix");
+
+    return grp.nameExists("barcodes") && grp.nameExists("shape") && grp.nameExists("indptr");
+}
+
+bool isCellRangerFile(const std::string& filename)
+{
+    if (!std::filesystem::is_regular_file(filename))
+        return false;
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    try {
+        if (!H5::H5File::isHdf5(filename))
+            return false;
+
+        const H5::H5File file(filename, H5F_ACC_RDONLY);
+        return isCellRangerLayout(file);
+    }
+    catch (const H5::Exception&) {
+        return false;
+    }
+}
+
+bool readMatrixFromCellRanger(const std::string& filename, SparseMatrixData& data, const H5AccessSettings& access)
+{
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    try {
+        data._filename = filename;
+        data._file = openH5File(data._filename, access, data._access);
+
+        if (!isCellRangerLayout(*data._file)) {
+            std::cerr << "readMatrixFromCellRanger: no group matrix with barcodes, shape and indptr in " << filename << std::endl;
+            return false;
+        }
+
+        H5::Group matrixGrp = data._file->openGroup("matrix");
+
+        if (!matrixGrp.nameExists("data") || !matrixGrp.nameExists("indices")) {
+            std::cerr << "readMatrixFromCellRanger: group matrix must have datasets data, indices, indptr" << std::endl;
+            return false;
+        }
+
+        data._data_ds = std::make_unique<H5::DataSet>(matrixGrp.openDataSet("data"));
+        data._indices_ds = std::make_unique<H5::DataSet>(matrixGrp.openDataSet("indices"));
+        data._indptr_ds = std::make_unique<H5::DataSet>(matrixGrp.openDataSet("indptr"));
+
+        // Counts are int32 or uint32 and indices int32 or int64, HDF5 converts them while reading
+        const H5T_class_t valueClass = data._data_ds->getTypeClass();
+        if ((valueClass != H5T_INTEGER && valueClass != H5T_FLOAT) || data._indices_ds->getTypeClass() != H5T_INTEGER || data._indptr_ds->getTypeClass() != H5T_INTEGER) {
+            std::cerr << "readMatrixFromCellRanger: data must be numbers, indices and indptr integers" << std::endl;
+            return false;
+        }
+
+        // The shape is a dataset of features x barcodes, barcodes are the rows here
+        const H5::DataSet shape_ds = matrixGrp.openDataSet("shape");
+        std::array<std::int64_t, 2> shape{};
+        shape_ds.read(shape.data(), H5::PredType::NATIVE_INT64);
+        data._num_rows = shape[1];
+        data._num_cols = shape[0];
+
+        hsize_t indptr_size = {};
+        data._indptr_ds->getSpace().getSimpleExtentDims(&indptr_size);
+
+        if (static_cast<std::int64_t>(indptr_size) != data._num_rows + 1) {
+            std::cerr << "readMatrixFromCellRanger: indptr does not match " << data._num_rows << " barcodes" << std::endl;
+            return false;
+        }
+
+        std::vector<std::int64_t> indptr(indptr_size);
+        data._indptr_ds->read(indptr.data(), H5::PredType::NATIVE_INT64);
+        data._indptr = std::move(indptr);
+
+        // Gene symbols, or the feature IDs of files without them
+        readStringArray(*data._file, "matrix", "barcodes", data._obs_names);
+        readStringArray(*data._file, "matrix/features", "name", data._var_names);
+        if (data._var_names.empty())
+            readStringArray(*data._file, "matrix/features", "id", data._var_names);
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "readMatrixFromCellRanger: " << e.getDetailMsg() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
 SparseMatrixData::SparseMatrixData() :
     _file(std::make_unique<H5::H5File>()),
     _indptr_ds(std::make_unique<H5::DataSet>()),
@@ -204,42 +498,74 @@ SparseMatrixData::SparseMatrixData() :
 {
 }
 
-SparseMatrixData::~SparseMatrixData() = default;
+SparseMatrixData::~SparseMatrixData()
+{
+    reset();
+}
 
 void SparseMatrixData::reset()
 {
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
     _filename   = "";
     _file       = {};
     _data_ds    = {};
     _indices_ds = {};
     _indptr_ds  = {};
+    _source     = {};
     _num_rows   = 0;
     _num_cols   = 0;
     _indptr     = {};
     _obs_names  = {};
     _var_names  = {};
+    _stored_transform = {};
+    _bytesRead  = 0;
 }
 
 SparseMatrixType SparseMatrixReader::readMatrixType(const std::string& filename) {
+    if (isZarrStore(filename)) {
+        return readZarrMatrixType(filename);
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
     H5::H5File file = H5::H5File(filename, H5F_ACC_RDONLY);
 
-    std::string format = "";
+    SparseMatrixType type = SparseMatrixType::UNKNOWN;
 
+    // anndata files carry encoding-type "anndata" at the root, so fall through to X if the root does not name a matrix type
     if (file.attrExists("format")) {
-        format = readAttributeString(file, "format");
+        type = sparseMatrixStringToType(readAttributeString(file, "format"));
     }
-    else if (file.attrExists("encoding-type")) {
-        format = readAttributeString(file, "encoding-type");
+    
+    if (type == SparseMatrixType::UNKNOWN && file.attrExists("encoding-type")) {
+        type = sparseMatrixStringToType(readAttributeString(file, "encoding-type"));
     }
-    else if (groupExists(file, "X")) {
-        H5::Group grp_X = file.openGroup("X");
+    
+    if (type == SparseMatrixType::UNKNOWN && groupExists(file, "X")) {
+        if (file.childObjType("X") == H5O_TYPE_DATASET) {
+            type = SparseMatrixType::DENSE;
+        }
+        else {
+            H5::Group grp_X = file.openGroup("X");
 
-        if (grp_X.attrExists("encoding-type")) {
-            format = readAttributeString(grp_X, "encoding-type");
+            if (grp_X.attrExists("encoding-type")) {
+                type = sparseMatrixStringToType(readAttributeString(grp_X, "encoding-type"));
+            }
         }
     }
 
-    return sparseMatrixStringToType(format);
+    // Cell Ranger files store the barcodes as the primary arrays, i.e. CSR with cells as rows
+    if (type == SparseMatrixType::UNKNOWN && isCellRangerLayout(file)) {
+        type = SparseMatrixType::CSR;
+    }
+
+    // loom files store the matrix as a dense dataset at the root
+    if (type == SparseMatrixType::UNKNOWN && groupExists(file, "matrix") && file.childObjType("matrix") == H5O_TYPE_DATASET) {
+        type = SparseMatrixType::DENSE;
+    }
+
+    return type;
 }
 
 bool SparseMatrixReader::readFile(const std::string& filename)
@@ -248,17 +574,65 @@ bool SparseMatrixReader::readFile(const std::string& filename)
         reset();
     }
 
-    return readMatrixFromFile(filename, _data);
+    bool success = false;
+    if (isZarrStore(filename))
+        success = readMatrixFromZarr(filename, _data);
+    else if (isCellRangerFile(filename))
+        success = readMatrixFromCellRanger(filename, _data, _h5Access);
+    else
+        success = readMatrixFromFile(filename, _data, "X", _h5Access);
+
+    if (success && _compactIndptr && _data._indptr.size() >= IndptrArray::compactMinSize) {
+        _data._indptr.compact();
+    }
+
+    return success;
+}
+
+bool SparseMatrixReader::readFileGroup(const std::string& filename, const std::string& groupName)
+{
+    if (_data._file || !_data._filename.empty()) {
+        reset();
+    }
+
+    const bool success = readMatrixFromFile(filename, _data, groupName, _h5Access);
+
+    if (success && _compactIndptr && _data._indptr.size() >= IndptrArray::compactMinSize) {
+        _data._indptr.compact();
+    }
+
+    return success;
+}
+
+void SparseMatrixReader::setCompactIndptr(const bool compactIndptr)
+{
+    _compactIndptr = compactIndptr;
+
+    if (!_compactIndptr)
+        _data._indptr.expand();
+    else if (_data._indptr.size() >= IndptrArray::compactMinSize)
+        _data._indptr.compact();
 }
 
 void SparseMatrixReader::reset(const bool keepType) {
+    std::scoped_lock lock(_cacheMutex, _rowTotalsMutex, _blockIndexMutex);
     _data.reset(); 
     _lookupOrderRows.clear();
     _cacheRows.clear();
     _lookupOrderColumns.clear();
     _cacheColumns.clear();
+    _inFlightRows.clear();
+    _inFlightColumns.clear();
+    ++_cacheGeneration;
+    _rowTotals.clear();
     _maxCacheSize = 10;
     _useCache = true;
+    _diskCache.reset();
+    _diskCacheKey = "";
+    _blockIndex.reset();
+    _useBlockIndex = true;
+    _valueTransform = {};
+    _valueTransformKey = "";
 
     if (!keepType) {
         _type = SparseMatrixType::UNKNOWN;
@@ -266,6 +640,8 @@ void SparseMatrixReader::reset(const bool keepType) {
 };
 
 void SparseMatrixReader::setMaxCacheSize(const size_t newSize) {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+
     if (newSize == _maxCacheSize)
         return;
 
@@ -277,6 +653,121 @@ void SparseMatrixReader::setMaxCacheSize(const size_t newSize) {
     assert(_cacheColumns.size() <= _maxCacheSize);
 }
 
+void SparseMatrixReader::setDiskCache(std::shared_ptr<DiskCache> diskCache) {
+    const std::string diskCacheKey = diskCache ? DiskCache::fileKey(_data._filename) : "";
+
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    _diskCache      = diskCacheKey.empty() ? nullptr : std::move(diskCache);
+    _diskCacheKey   = diskCacheKey;
+}
+
+void SparseMatrixReader::releaseDiskCache(const std::shared_ptr<DiskCache>& diskCache) {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+
+    if (_diskCache != diskCache)
+        return;
+
+    _diskCache.reset();
+    _diskCacheKey = "";
+}
+
+void SparseMatrixReader::setAccessTrace(std::shared_ptr<AccessTraceRecorder> trace) {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    _accessTrace = std::move(trace);
+}
+
+void SparseMatrixReader::releaseAccessTrace(const std::shared_ptr<AccessTraceRecorder>& trace) {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+
+    if (_accessTrace == trace)
+        _accessTrace.reset();
+}
+
+// Expects _cacheMutex to be held
+void SparseMatrixReader::recordAccess(const bool row, const std::int64_t index, const bool hit, const std::chrono::steady_clock::time_point start) const {
+    if (_accessTrace)
+        _accessTrace->record(row, index, hit, start, std::chrono::steady_clock::now());
+}
+
+std::string valueTransformKey(const ValueTransform& transform) {
+    if (transform.isIdentity())
+        return "";
+
+    const std::string fields = std::to_string(transform._normalizeTotals) + "," + std::to_string(transform._targetSum) + "," +
+        std::to_string(transform._log1p) + "," + std::to_string(transform._scale) + "," + std::to_string(transform._clipMax);
+
+    // FNV-1a
+    std::uint32_t hash = 2166136261u;
+    for (const char c : fields) {
+        hash = (hash ^ static_cast<std::uint8_t>(c)) * 16777619u;
+    }
+
+    char key[16];
+    std::snprintf(key, sizeof(key), "_t%08x", hash);
+    return key;
+}
+
+const std::vector<float>& transformBlockValues(const PrimaryBlock& block, const ValueTransformer& transform, std::vector<float>& buffer) {
+    if (transform.isIdentity())
+        return block._values;
+
+    buffer.resize(block._values.size());
+
+    const std::int64_t num_arrs = block._end - block._begin;
+
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::int64_t a = 0; a < num_arrs; ++a) {
+        for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+            buffer[i] = transform(block._values[i], block._begin + a, block._indices[i]);
+        }
+    }
+
+    return buffer;
+}
+
+void SparseMatrixReader::setValueTransform(const ValueTransform& transform) {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+
+    if (transform == _valueTransform)
+        return;
+
+    if (!_data._stored_transform.isIdentity() && transform != _data._stored_transform)
+        std::cerr << "SparseMatrixReader::setValueTransform: values of " << _data._filename << " are stored with another transform, the new one is applied on top of it" << std::endl;
+
+    _valueTransform     = transform;
+    _valueTransformKey  = valueTransformKey(transform);
+
+    // Fetches that started with the previous transform do not cache their results
+    _lookupOrderRows.clear();
+    _cacheRows.clear();
+    _lookupOrderColumns.clear();
+    _cacheColumns.clear();
+    _inFlightRows.clear();
+    _inFlightColumns.clear();
+    ++_cacheGeneration;
+}
+
+ValueTransformer SparseMatrixReader::getValueTransformer() const {
+    ValueTransform transform;
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        transform = _valueTransform;
+    }
+
+    // The stored values already have the transform
+    if (transform.isIdentity() || transform == _data._stored_transform)
+        return {};
+
+    // Rows are the primary arrays of all but CSC matrices
+    const std::vector<float>* rowTotals = transform._normalizeTotals ? &getRowTotals() : nullptr;
+    return { transform, rowTotals, _type != SparseMatrixType::CSC };
+}
+
+std::vector<std::int64_t> SparseMatrixReader::getCachedColumns() const {
+    std::lock_guard<std::mutex> lock(_cacheMutex);
+    return { _lookupOrderColumns.begin(), _lookupOrderColumns.end() };
+}
+
 void SparseMatrixReader::removeLeastRecentlyUsed(Cache& cache, std::list<std::int64_t>& order) const {
     assert(order.size() == cache.size());
 
@@ -306,10 +797,18 @@ std::optional<std::vector<float>*> SparseMatrixReader::lookupCache(Cache& cache,
     return std::nullopt;
 }
 
-void SparseMatrixReader::saveToCache(Cache& cache, std::list<std::int64_t>& order, std::int64_t id, const std::vector<float>& data) const {
-    if (!_useCache)
+void SparseMatrixReader::saveToCache(Cache& cache, std::list<std::int64_t>& order, std::int64_t id, const std::vector<float>& data, const std::uint64_t generation) const {
+    if (!_useCache || generation != _cacheGeneration)
         return;
 
+    // Another fetch of the same array may have finished first
+    auto it = cache.find(id);
+    if (it != cache.end()) {
+        it->second.first = data;
+        order.splice(order.begin(), order, it->second.second);
+        return;
+    }
+
     if (cache.size() >= _maxCacheSize) {
         removeLeastRecentlyUsed(cache, order);
     }
@@ -320,145 +819,1001 @@ void SparseMatrixReader::saveToCache(Cache& cache, std::list<std::int64_t>& orde
 }
 
 std::vector<float> SparseMatrixReader::getRow(std::int64_t row_idx) {
-    // Check cache
-    const auto cacheResult = lookupCache(_cacheRows, _lookupOrderRows, row_idx);
-
-    if (cacheResult.has_value() && cacheResult.value() != nullptr) {
-        return *(cacheResult.value());
-    }
-
-    // Otherwise, fetch data
-    std::vector<float> data = getRowImpl(row_idx);
-
-    // Add to cache
-    saveToCache(_cacheRows, _lookupOrderRows, row_idx, data);
-
-    return data;
+    return std::move(getArrays(_cacheRows, _lookupOrderRows, _inFlightRows, { row_idx }, /* rows = */ true).front());
 }
 
 std::vector<float> SparseMatrixReader::getColumn(std::int64_t col_idx) {
-    // Check cache
-    const auto cacheResult = lookupCache(_cacheColumns, _lookupOrderColumns, col_idx);
+    return std::move(getArrays(_cacheColumns, _lookupOrderColumns, _inFlightColumns, { col_idx }, /* rows = */ false).front());
+}
 
-    if (cacheResult.has_value() && cacheResult.value() != nullptr) {
-        return *(cacheResult.value());
-    }
+// Partial results of a subset of the requested arrays, completed with the arrays that are already loaded
+// Array j of the subset is copied to all of subsetPositions[j]
+static ProgressiveRead partialSubset(const ProgressiveRead* progressive, std::vector<std::vector<float>>& arrays, const std::vector<std::vector<size_t>>& subsetPositions) {
+    ProgressiveRead subset = *progressive;
 
-    // Otherwise, fetch data
-    std::vector<float> data = getColumnImpl(col_idx);
+    subset._onPartial = [progressive, &arrays, &subsetPositions](const std::vector<std::vector<float>>& partial, const float fraction) {
+        for (size_t j = 0; j < subsetPositions.size(); ++j) {
+            for (const size_t position : subsetPositions[j]) {
+                arrays[position] = partial[j];
+            }
+        }
 
-    // Add to cache
-    saveToCache(_cacheColumns, _lookupOrderColumns, col_idx, data);
+        progressive->_onPartial(arrays, fraction);
+        };
 
-    return data;
+    return subset;
 }
 
-static std::vector<float> getArrayPrimary(const SparseMatrixData& data, const std::int64_t size_primary, const std::int64_t size_second, const std::int64_t idx) {
-    std::vector<float> dense_array(size_second, 0.0f);
+std::vector<std::vector<float>> SparseMatrixReader::getArrays(Cache& cache, std::list<std::int64_t>& order, InFlight& inFlight, const std::vector<std::int64_t>& indices, const bool rows, const ProgressiveRead* progressive) {
+    std::vector<std::vector<float>> arrays(indices.size());
+    const auto start = std::chrono::steady_clock::now();
 
-    if (!data._data_ds || !data._indices_ds || idx < 0 || idx >= size_primary) {
-        std::cerr << "getArrayPrimary: could not read from index" << std::endl;
-        return dense_array;  // invalid data sets
-    }
+    // Collect unique indices that are not cached, those that other threads are fetching are waited for
+    // Progressive reads fetch them as well, such that their partial results are complete
+    std::vector<std::int64_t> missing;
+    std::vector<std::int64_t> waiting;
+    std::vector<std::shared_future<void>> otherFetches;
+    std::unordered_map<std::int64_t, std::vector<size_t>> missingPositions;
 
-    const std::int64_t start = data._indptr[idx];
-    const std::int64_t end = data._indptr[idx + 1];
-    const std::int64_t arr_nnz = end - start;
+    std::unique_lock<std::mutex> lock(_cacheMutex);
+    const std::uint64_t generation = _cacheGeneration;
 
-    if (arr_nnz == 0) {
-        return dense_array;  // Empty array
-    }
+    for (size_t i = 0; i < indices.size(); ++i) {
+        const auto cacheResult = lookupCache(cache, order, indices[i]);
 
-    try {
-        // Define hyperslab parameters
-        hsize_t offset = start;
-        hsize_t count = arr_nnz;
+        if (cacheResult.has_value() && cacheResult.value() != nullptr) {
+            arrays[i] = *(cacheResult.value());
+            recordAccess(rows, indices[i], /* hit = */ true, start);
+            continue;
+        }
+
+        auto& positions = missingPositions[indices[i]];
+        if (positions.empty()) {
+            const auto fetch = inFlight.find(indices[i]);
+
+            if (fetch != inFlight.end() && _useCache && progressive == nullptr) {
+                waiting.push_back(indices[i]);
+                otherFetches.push_back(fetch->second);
+            }
+            else {
+                missing.push_back(indices[i]);
+            }
+        }
+        positions.push_back(i);
+    }
+
+    if (missing.empty() && waiting.empty()) {
+        return arrays;
+    }
+
+    // Caches the fetched arrays and hands them out, expects _cacheMutex to be held
+    const auto storeFetched = [&](const std::vector<std::int64_t>& fetchedIndices, std::vector<std::vector<float>>& fetched) {
+        assert(fetched.size() == fetchedIndices.size());
+
+        for (size_t j = 0; j < fetchedIndices.size(); ++j) {
+            saveToCache(cache, order, fetchedIndices[j], fetched[j], generation);
+
+            // Records of a batch share its start, such that replays can batch them again
+            const auto& positions = missingPositions[fetchedIndices[j]];
+            for (size_t p = 0; p < positions.size(); ++p) {
+                recordAccess(rows, fetchedIndices[j], /* hit = */ false, start);
+            }
+
+            for (size_t p = 1; p < positions.size(); ++p) {
+                arrays[positions[p]] = fetched[j];
+            }
+            arrays[positions.front()] = std::move(fetched[j]);
+        }
+        };
+
+    if (!missing.empty()) {
+        // Announce the fetch, threads that miss on the same arrays meanwhile wait for it
+        std::promise<void> fetchDone;
+        const std::shared_future<void> fetchFuture = fetchDone.get_future().share();
+
+        std::vector<std::int64_t> announced;
+        for (const std::int64_t idx : missing) {
+            if (inFlight.emplace(idx, fetchFuture).second)
+                announced.push_back(idx);
+        }
+
+        // Cleared entries belong to fetches of a later generation
+        const auto withdraw = [&]() {
+            if (generation == _cacheGeneration) {
+                for (const std::int64_t idx : announced) {
+                    inFlight.erase(idx);
+                }
+            }
+
+            fetchDone.set_value();
+            };
+
+        // Fetch all missing arrays at once, other threads may use the cache meanwhile
+        lock.unlock();
+
+        std::vector<std::vector<float>> fetched;
+        try {
+            if (progressive && progressive->_onPartial) {
+                // Partial results include the cached arrays
+                std::vector<std::vector<size_t>> subsetPositions;
+                for (const std::int64_t idx : missing) {
+                    subsetPositions.push_back(missingPositions[idx]);
+                }
+
+                const ProgressiveRead subset = partialSubset(progressive, arrays, subsetPositions);
+                fetched = fetchArrays(missing, rows, &subset);
+            }
+            else {
+                fetched = fetchArrays(missing, rows);
+            }
+        }
+        catch (...) {
+            // Waiting threads find nothing in the cache and read the arrays themselves
+            lock.lock();
+            withdraw();
+            throw;
+        }
+
+        lock.lock();
+        storeFetched(missing, fetched);
+        withdraw();
+    }
+
+    if (waiting.empty()) {
+        return arrays;
+    }
+
+    lock.unlock();
+
+    for (const std::shared_future<void>& fetch : otherFetches) {
+        fetch.wait();
+    }
+
+    lock.lock();
+
+    // Fetched arrays may have been evicted already or not cached at all, those are read here
+    std::vector<std::int64_t> stillMissing;
+    for (const std::int64_t idx : waiting) {
+        const auto cacheResult = lookupCache(cache, order, idx);
+
+        if (!cacheResult.has_value() || cacheResult.value() == nullptr) {
+            stillMissing.push_back(idx);
+            continue;
+        }
+
+        for (const size_t position : missingPositions[idx]) {
+            arrays[position] = *(cacheResult.value());
+            recordAccess(rows, idx, /* hit = */ true, start);
+        }
+    }
+
+    if (stillMissing.empty()) {
+        return arrays;
+    }
+
+    lock.unlock();
+    std::vector<std::vector<float>> fetched = fetchArrays(stillMissing, rows);
+
+    lock.lock();
+    storeFetched(stillMissing, fetched);
+
+    return arrays;
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::fetchArrays(const std::vector<std::int64_t>& indices, const bool rows, const ProgressiveRead* progressive) const {
+    std::shared_ptr<DiskCache> diskCache;
+    std::string diskCacheKey;
+    {
+        std::lock_guard<std::mutex> lock(_cacheMutex);
+        diskCache       = _diskCache;
+        diskCacheKey    = _diskCacheKey + _valueTransformKey;
+    }
+
+    if (!diskCache) {
+        if (!rows && progressive)
+            return getColumnsProgressiveImpl(indices, *progressive);
+
+        return rows ? getRowsImpl(indices) : getColumnsImpl(indices);
+    }
+
+    const std::int64_t length = rows ? _data._num_cols : _data._num_rows;
+
+    std::vector<std::vector<float>> arrays(indices.size());
+    std::vector<std::int64_t> missing;
+    std::vector<size_t> missingPositions;
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (!diskCache->load(diskCacheKey, rows, indices[i], length, arrays[i])) {
+            missing.push_back(indices[i]);
+            missingPositions.push_back(i);
+        }
+    }
+
+    if (missing.empty()) {
+        return arrays;
+    }
+
+    std::vector<std::vector<float>> fetched;
+    if (!rows && progressive && progressive->_onPartial) {
+        std::vector<std::vector<size_t>> subsetPositions;
+        for (const size_t position : missingPositions) {
+            subsetPositions.push_back({ position });
+        }
+
+        fetched = getColumnsProgressiveImpl(missing, partialSubset(progressive, arrays, subsetPositions));
+    }
+    else {
+        fetched = rows ? getRowsImpl(missing) : getColumnsImpl(missing);
+    }
+
+    for (size_t j = 0; j < missing.size(); ++j) {
+        diskCache->store(diskCacheKey, rows, missing[j], fetched[j]);
+        arrays[missingPositions[j]] = std::move(fetched[j]);
+    }
+
+    return arrays;
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getRows(const std::vector<std::int64_t>& row_indices) {
+    return getArrays(_cacheRows, _lookupOrderRows, _inFlightRows, row_indices, /* rows = */ true);
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getColumns(const std::vector<std::int64_t>& col_indices) {
+    return getArrays(_cacheColumns, _lookupOrderColumns, _inFlightColumns, col_indices, /* rows = */ false);
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getColumnsProgressive(const std::vector<std::int64_t>& col_indices, const ProgressiveRead& progressive) {
+    return getArrays(_cacheColumns, _lookupOrderColumns, _inFlightColumns, col_indices, /* rows = */ false, &progressive);
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const {
+    std::vector<std::vector<float>> rows(row_indices.size());
+
+    for (size_t i = 0; i < row_indices.size(); ++i) {
+        rows[i] = getRowImpl(row_indices[i]);
+    }
+
+    return rows;
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const {
+    std::vector<std::vector<float>> columns(col_indices.size());
+
+    for (size_t i = 0; i < col_indices.size(); ++i) {
+        columns[i] = getColumnImpl(col_indices[i]);
+    }
+
+    return columns;
+}
+
+std::vector<std::vector<float>> SparseMatrixReader::getColumnsProgressiveImpl(const std::vector<std::int64_t>& col_indices, const ProgressiveRead&) const {
+    return getColumnsImpl(col_indices);
+}
+
+const std::vector<float>& SparseMatrixReader::getRowTotals() const {
+    std::lock_guard<std::mutex> lock(_rowTotalsMutex);
+
+    if (_rowTotals.empty() && _data._num_rows > 0) {
+        _rowTotals = getRowTotalsImpl();
+    }
+
+    return _rowTotals;
+}
+
+std::vector<float> SparseMatrixReader::getColumnAggregate(const std::vector<std::int64_t>& col_indices, const AggregateReduction reduction) {
+    // Each variable contributes once
+    std::vector<std::int64_t> unique_indices;
+    unique_indices.reserve(col_indices.size());
+    std::copy_if(col_indices.begin(), col_indices.end(), std::back_inserter(unique_indices), [this](const std::int64_t col_idx) {
+        return col_idx >= 0 && col_idx < _data._num_cols;
+        });
+    std::sort(unique_indices.begin(), unique_indices.end());
+    unique_indices.erase(std::unique(unique_indices.begin(), unique_indices.end()), unique_indices.end());
+
+    if (unique_indices.empty()) {
+        std::cerr << "getColumnAggregate: no valid column indices" << std::endl;
+        return std::vector<float>(_data._num_rows, 0.0f);
+    }
+
+    std::vector<float> aggregate = getColumnSumImpl(unique_indices);
+
+    if (reduction == AggregateReduction::SUM) {
+        return aggregate;
+    }
+
+    const std::int64_t num_rows = static_cast<std::int64_t>(aggregate.size());
+    const float inv_num_cols    = 1.0f / static_cast<float>(unique_indices.size());
+
+    if (reduction == AggregateReduction::MEAN) {
+#pragma omp parallel for
+        for (std::int64_t row = 0; row < num_rows; ++row) {
+            aggregate[row] *= inv_num_cols;
+        }
+
+        return aggregate;
+    }
+
+    // Normalized mean, scale each row to a total of 10k
+    constexpr float target_sum          = 1e4f;
+    const std::vector<float>& totals    = getRowTotals();
+    assert(totals.size() == aggregate.size());
+
+#pragma omp parallel for
+    for (std::int64_t row = 0; row < num_rows; ++row) {
+        aggregate[row] = totals[row] > 0.0f ? aggregate[row] / totals[row] * target_sum * inv_num_cols : 0.0f;
+    }
+
+    return aggregate;
+}
 
-        H5::DataSpace mem_space(1, &count);
+std::vector<std::int64_t> SparseMatrixReader::queryRows(const std::vector<RowPredicate>& predicates) const {
+    if (predicates.empty()) {
+        return {};
+    }
+
+    std::vector<std::int64_t> columns;
+    for (const RowPredicate& predicate : predicates) {
+        if (predicate._column < 0 || predicate._column >= getNumCols()) {
+            std::cerr << "queryRows: column index out of range " << predicate._column << std::endl;
+            return {};
+        }
+        columns.push_back(predicate._column);
+    }
 
-        // Read data
-        H5::DataSpace data_space = data._data_ds->getSpace();
-        data_space.selectHyperslab(H5S_SELECT_SET, &count, &offset);
-        std::vector<float> arr_data(arr_nnz);
-        data._data_ds->read(arr_data.data(), H5::PredType::NATIVE_FLOAT, mem_space, data_space);
+    // Each column is read once, also if several predicates refer to it
+    std::sort(columns.begin(), columns.end());
+    columns.erase(std::unique(columns.begin(), columns.end()), columns.end());
 
-        // Read indices
-        H5::DataSpace indices_space = data._indices_ds->getSpace();
-        indices_space.selectHyperslab(H5S_SELECT_SET, &count, &offset);
-        std::vector<std::int64_t> arr_indices(arr_nnz);
-        data._indices_ds->read(arr_indices.data(), H5::PredType::NATIVE_INT64, mem_space, indices_space);
+    const std::vector<SparseArray> sparse_columns = getSparseColumnsImpl(columns);
+
+    std::optional<std::vector<std::int64_t>> candidates;    // Rows that pass every predicate that fails for zero
+    std::vector<std::int64_t> excluded;                     // Rows that fail a predicate that holds for zero
+
+    for (const RowPredicate& predicate : predicates) {
+        const SparseArray& column = sparse_columns[std::lower_bound(columns.begin(), columns.end(), predicate._column) - columns.begin()];
+        const bool zero_matches = predicate.matches(0.0f);
+
+        // Rows whose outcome differs from that of an implicit zero
+        std::vector<std::int64_t> rows;
+        for (size_t i = 0; i < column._indices.size(); ++i) {
+            if (predicate.matches(column._values[i]) != zero_matches) {
+                rows.push_back(column._indices[i]);
+            }
+        }
+        std::sort(rows.begin(), rows.end());
+
+        if (zero_matches) {
+            excluded.insert(excluded.end(), rows.begin(), rows.end());
+        }
+        else if (!candidates) {
+            candidates = std::move(rows);
+        }
+        else {
+            std::vector<std::int64_t> intersection;
+            std::set_intersection(candidates->begin(), candidates->end(), rows.begin(), rows.end(), std::back_inserter(intersection));
+            candidates = std::move(intersection);
+        }
+    }
+
+    std::sort(excluded.begin(), excluded.end());
+    excluded.erase(std::unique(excluded.begin(), excluded.end()), excluded.end());
+
+    std::vector<std::int64_t> result;
+
+    if (candidates) {
+        std::set_difference(candidates->begin(), candidates->end(), excluded.begin(), excluded.end(), std::back_inserter(result));
+        return result;
+    }
+
+    // Every predicate holds for zero, so all rows match but the excluded ones
+    const std::int64_t num_rows = getNumRows();
+    result.reserve(num_rows - static_cast<std::int64_t>(excluded.size()));
+
+    auto excluded_it = excluded.begin();
+    for (std::int64_t row = 0; row < num_rows; ++row) {
+        if (excluded_it != excluded.end() && *excluded_it == row) {
+            ++excluded_it;
+            continue;
+        }
+        result.push_back(row);
+    }
+
+    return result;
+}
+
+std::vector<SparseArray> SparseMatrixReader::getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const {
+    const std::vector<std::vector<float>> dense_columns = getColumnsImpl(col_indices);
+    std::vector<SparseArray> sparse_columns(dense_columns.size());
+
+    for (size_t col = 0; col < dense_columns.size(); ++col) {
+        for (size_t row = 0; row < dense_columns[col].size(); ++row) {
+            if (dense_columns[col][row] != 0.0f) {
+                sparse_columns[col]._indices.push_back(static_cast<std::int64_t>(row));
+                sparse_columns[col]._values.push_back(dense_columns[col][row]);
+            }
+        }
+    }
+
+    return sparse_columns;
+}
+
+template<typename T>
+static void readSlice(const H5::DataSet& dataset, const H5::PredType& mem_type, const std::int64_t offset, const std::int64_t count, std::vector<T>& dest) {
+    dest.resize(count);
+
+    if (count <= 0) {
+        return;
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    hsize_t h5_offset = offset;
+    hsize_t h5_count  = count;
+
+    H5::DataSpace mem_space(1, &h5_count);
+    H5::DataSpace file_space = dataset.getSpace();
+    file_space.selectHyperslab(H5S_SELECT_SET, &h5_count, &h5_offset);
+    dataset.read(dest.data(), mem_type, mem_space, file_space);
+}
+
+static bool hasSparseArrays(const SparseMatrixData& data) {
+    return data._source || (data._data_ds && data._indices_ds);
+}
+
+static void readIndicesSlice(const SparseMatrixData& data, const std::int64_t offset, const std::int64_t count, std::vector<std::int64_t>& dest) {
+    if (data._source)
+        data._source->readIndices(offset, count, dest);
+    else
+        readSlice(*data._indices_ds, H5::PredType::NATIVE_INT64, offset, count, dest);
+
+    data._bytesRead += static_cast<std::uint64_t>(count) * sizeof(std::int64_t);
+}
+
+static void readValuesSlice(const SparseMatrixData& data, const std::int64_t offset, const std::int64_t count, std::vector<float>& dest) {
+    if (data._source)
+        data._source->readValues(offset, count, dest);
+    else
+        readSlice(*data._data_ds, H5::PredType::NATIVE_FLOAT, offset, count, dest);
+
+    data._bytesRead += static_cast<std::uint64_t>(count) * sizeof(float);
+}
+
+// Prints the exception that is currently handled, HDF5 exceptions do not derive from std::exception
+static void reportException(const std::string& context) {
+    try {
+        throw;
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << context << ": " << e.getDetailMsg() << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << context << ": " << e.what() << std::endl;
+    }
+}
+
+static std::vector<BlockRange> primaryBlockRanges(const SparseMatrixData& data, const std::int64_t size_primary, const std::int64_t block_nnz) {
+    std::vector<BlockRange> ranges;
+
+    const auto indptr_begin = data._indptr.begin();
+    const auto indptr_end   = data._indptr.begin() + size_primary + 1;
+
+    std::int64_t begin = 0;
+    while (begin < size_primary) {
+        // Last primary index such that the block stays within the nnz target
+        const std::int64_t target = data._indptr[begin] + block_nnz;
+        std::int64_t end = static_cast<std::int64_t>(std::upper_bound(indptr_begin + begin + 1, indptr_end, target) - indptr_begin) - 1;
+        end = std::clamp(end, begin + 1, size_primary);
+
+        ranges.emplace_back(begin, end);
+        begin = end;
+    }
+
+    return ranges;
+}
+
+// Reads the given primary blocks on a dedicated I/O thread and hands them to process in order,
+// such that reading the next block overlaps with processing the current one
+static void streamPrimaryBlocks(const SparseMatrixData& data, const std::vector<BlockRange>& ranges, const bool readValues, const BlockCallback& process) {
+    BlockPipeline<PrimaryBlock> pipeline;
+
+    auto readBlock = [&data, &ranges, readValues](const std::int64_t item, PrimaryBlock& block) {
+        const auto& [begin, end] = ranges[item];
+
+        block._begin  = begin;
+        block._end    = end;
+        block._offset = data._indptr[begin];
+
+        block._indptr.resize(end - begin + 1);
+        data._indptr.decode(begin, end + 1, block._indptr.data());
+        for (std::int64_t& ptr : block._indptr) {
+            ptr -= block._offset;
+        }
+
+        const std::int64_t block_nnz = block._indptr.back();
+
+        readIndicesSlice(data, block._offset, block_nnz, block._indices);
+
+        if (readValues) {
+            readValuesSlice(data, block._offset, block_nnz, block._values);
+        }
+        else {
+            block._values.clear();
+        }
+        };
+
+    auto processBlock = [&process](const std::int64_t, PrimaryBlock& block) {
+        if (block._indices.empty()) {
+            return;
+        }
+
+        process(block);
+        };
+
+    pipeline.run(static_cast<std::int64_t>(ranges.size()), readBlock, processBlock);
+}
+
+// Reads a single primary array without densifying it
+static void readPrimarySparse(const SparseMatrixData& data, const std::int64_t idx, std::vector<std::int64_t>& indices, std::vector<float>& values) {
+    const std::int64_t start    = data._indptr[idx];
+    const std::int64_t arr_nnz  = data._indptr[idx + 1] - start;
+
+    readValuesSlice(data, start, arr_nnz, values);
+    readIndicesSlice(data, start, arr_nnz, indices);
+}
+
+bool SparseMatrixReader::streamBlocks(const BlockCallback& process, const bool readValues, const std::int64_t blockNnz) const {
+    if (!hasSparseArrays(_data) || _data._indptr.empty()) {
+        std::cerr << "streamBlocks: no data to stream" << std::endl;
+        return false;
+    }
+
+    try {
+        streamPrimaryBlocks(_data, primaryBlockRanges(_data, getPrimarySize(), std::max<std::int64_t>(blockNnz, 1)), readValues, process);
+    }
+    catch (...) {
+        reportException("Error streaming blocks");
+        return false;
+    }
+
+    return true;
+}
+
+// Reads several index blocks at once and fills them in parallel
+static std::unique_ptr<BlockIndex> buildBlockIndex(const SparseMatrixData& data, const std::int64_t size_primary, const std::int64_t size_second) {
+    auto index = std::make_unique<BlockIndex>(primaryBlockRanges(data, size_primary, BlockIndex::blockNnz), size_second);
+
+    streamPrimaryBlocks(data, index->mergedRanges(data._indptr, SparseMatrixReader::defaultBlockNnz), /* readValues = */ false, [&](const PrimaryBlock& block) {
+        const std::int64_t first_block = static_cast<std::int64_t>(index->findBlock(block._begin));
+        const std::int64_t last_block  = static_cast<std::int64_t>(index->findBlock(block._end - 1)) + 1;
+
+#pragma omp parallel for
+        for (std::int64_t b = first_block; b < last_block; ++b) {
+            const auto [begin, end]  = index->getBlock(b);
+            const std::int64_t start = block._indptr[begin - block._begin];
+            index->addBlock(b, block._indices.data() + start, block._indptr[end - block._begin] - start);
+        }
+        });
+
+    return index;
+}
+
+std::shared_ptr<const BlockIndex> SparseMatrixReader::getBlockIndex() const {
+    if (!_useBlockIndex || !hasSparseArrays(_data) || _data._indptr.empty()) {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(_blockIndexMutex);
+
+    if (_blockIndex) {
+        return _blockIndex;
+    }
+
+    std::unique_ptr<BlockIndex> index = BlockIndex::load(_data._filename, _data._indptr, getSecondarySize());
+
+    if (!index) {
+        try {
+            index = buildBlockIndex(_data, getPrimarySize(), getSecondarySize());
+        }
+        catch (...) {
+            reportException("Error building block index");
+            return nullptr;
+        }
+
+        // Still used for this session if the folder is read-only
+        index->save(_data._filename, _data._indptr);
+    }
+
+    _blockIndex = std::move(index);
+    return _blockIndex;
+}
+
+// Blocks of the secondary scan, only those that may contain one of idxs if there is an index
+static std::vector<BlockRange> secondaryScanRanges(const SparseMatrixData& data, const BlockIndex* index, const std::int64_t size_primary, const std::vector<std::int64_t>& idxs) {
+    if (index) {
+        return index->candidateRanges(idxs, data._indptr, SparseMatrixReader::defaultBlockNnz);
+    }
+
+    return primaryBlockRanges(data, size_primary, SparseMatrixReader::defaultBlockNnz);
+}
+
+static std::vector<float> getArrayPrimary(const SparseMatrixData& data, const ValueTransformer& transform, const std::int64_t size_primary, const std::int64_t size_second, const std::int64_t idx) {
+    std::vector<float> dense_array(size_second, 0.0f);
+
+    if (!hasSparseArrays(data) || idx < 0 || idx >= size_primary) {
+        std::cerr << "getArrayPrimary: could not read from index" << std::endl;
+        return dense_array;  // invalid data sets
+    }
+
+    try {
+        std::vector<float> arr_data;
+        std::vector<std::int64_t> arr_indices;
+        readPrimarySparse(data, idx, arr_indices, arr_data);
+
+        const std::int64_t arr_nnz = static_cast<std::int64_t>(arr_indices.size());
 
         // Populate dense arr
 #pragma omp parallel for
-        for (std::int64_t i = 0; i < static_cast<std::int64_t>(arr_nnz); ++i) {
+        for (std::int64_t i = 0; i < arr_nnz; ++i) {
             assert(arr_indices[i] >= 0);
             assert(arr_indices[i] < size_second);
-            dense_array[arr_indices[i]] = arr_data[i];
+            dense_array[arr_indices[i]] = transform(arr_data[i], idx, arr_indices[i]);
         }
     }
-    catch (const H5::Exception& e) {
-        std::cerr << "Error reading primary array " << idx << ": " << e.getDetailMsg() << std::endl;
+    catch (...) {
+        reportException("Error reading primary array " + std::to_string(idx));
     }
 
     return dense_array;
 }
 
-static std::vector<float> getArraySecondary(const SparseMatrixData& data, const std::int64_t size_primary, const std::int64_t size_second, const std::int64_t idx) {
-    std::vector<float> dense_array(size_primary, 0.0f);
+// Reads many primary arrays, reading the next one overlaps with densifying the current one
+static std::vector<std::vector<float>> getArraysPrimary(const SparseMatrixData& data, const ValueTransformer& transform, const std::int64_t size_primary, const std::int64_t size_second, const std::vector<std::int64_t>& idxs) {
+    std::vector<std::vector<float>> dense_arrays(idxs.size(), std::vector<float>(size_second, 0.0f));
 
-    if (!data._data_ds || !data._indices_ds || idx < 0 || idx >= size_second) {
-        std::cerr << "getArraySecondary: could not read from index" << std::endl;
-        return dense_array;  // invalid datasets or index
+    if (!hasSparseArrays(data)) {
+        std::cerr << "getArraysPrimary: could not read from indices" << std::endl;
+        return dense_arrays;  // invalid data sets
+    }
+
+    auto readArray = [&](const std::int64_t item, SparseArray& arr) {
+        const std::int64_t idx = idxs[item];
+
+        if (idx < 0 || idx >= size_primary) {
+            std::cerr << "getArraysPrimary: could not read from index " << idx << std::endl;
+            arr._indices.clear();
+            arr._values.clear();
+            return;
+        }
+
+        readPrimarySparse(data, idx, arr._indices, arr._values);
+        };
+
+    auto densifyArray = [&](const std::int64_t item, SparseArray& arr) {
+        std::vector<float>& dense_array = dense_arrays[item];
+        const std::int64_t arr_nnz = static_cast<std::int64_t>(arr._indices.size());
+
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < arr_nnz; ++i) {
+            dense_array[arr._indices[i]] = transform(arr._values[i], idxs[item], arr._indices[i]);
+        }
+        };
+
+    try {
+        BlockPipeline<SparseArray> pipeline;
+        pipeline.run(static_cast<std::int64_t>(idxs.size()), readArray, densifyArray);
+    }
+    catch (...) {
+        reportException("Error reading primary arrays");
+    }
+
+    return dense_arrays;
+}
+
+static std::vector<SparseArray> getSparseArraysPrimary(const SparseMatrixData& data, const ValueTransformer& transform, const std::int64_t size_primary, const std::vector<std::int64_t>& idxs) {
+    std::vector<SparseArray> sparse_arrays(idxs.size());
+
+    if (!hasSparseArrays(data)) {
+        std::cerr << "getSparseArraysPrimary: could not read from indices" << std::endl;
+        return sparse_arrays;  // invalid data sets
     }
 
     try {
-        // We need to scan through all arrays to find entries in the requested column
-        for (std::int64_t arr = 0; arr < size_primary; ++arr) {
-            const std::int64_t start = data._indptr[arr];
-            const std::int64_t end = data._indptr[arr + 1];
-            const std::int64_t arr_nnz = end - start;
-
-            if (arr_nnz == 0) {
-                continue;  // Empty arr, skip
+        for (size_t item = 0; item < idxs.size(); ++item) {
+            if (idxs[item] < 0 || idxs[item] >= size_primary) {
+                std::cerr << "getSparseArraysPrimary: could not read from index " << idxs[item] << std::endl;
+                continue;
             }
 
-            // Define hyperslab parameters for this arr
-            hsize_t offset = start;
-            hsize_t count = arr_nnz;
+            SparseArray& arr = sparse_arrays[item];
+            readPrimarySparse(data, idxs[item], arr._indices, arr._values);
 
-            // Read indices slice for this arr
-            H5::DataSpace indices_space = data._indices_ds->getSpace();
-            indices_space.selectHyperslab(H5S_SELECT_SET, &count, &offset);
+            for (size_t i = 0; i < arr._indices.size(); ++i) {
+                arr._values[i] = transform(arr._values[i], idxs[item], arr._indices[i]);
+            }
+        }
+    }
+    catch (...) {
+        reportException("Error reading primary arrays");
+    }
 
-            H5::DataSpace mem_space(1, &count);
-            std::vector<std::int64_t> arr_indices(arr_nnz);
-            data._indices_ds->read(arr_indices.data(), H5::PredType::NATIVE_INT64, mem_space, indices_space);
+    return sparse_arrays;
+}
 
-            // Check if this arr has an entry at the requested column
-            for (std::int64_t i = 0; i < arr_nnz; ++i) {
-                if (arr_indices[i] == idx) {
-                    // Found the column! Now read the corresponding data value
-                    hsize_t data_offset = start + i;
-                    hsize_t data_count = 1;
+// Every stride-th range first, then the ranges in between, such that partial results cover the whole matrix early
+static std::vector<BlockRange> stridedOrder(const std::vector<BlockRange>& ranges, const size_t stride) {
+    std::vector<BlockRange> ordered;
+    ordered.reserve(ranges.size());
 
-                    H5::DataSpace data_space = data._data_ds->getSpace();
-                    data_space.selectHyperslab(H5S_SELECT_SET, &data_count, &data_offset);
+    for (size_t offset = 0; offset < stride; ++offset) {
+        for (size_t r = offset; r < ranges.size(); r += stride) {
+            ordered.push_back(ranges[r]);
+        }
+    }
+
+    return ordered;
+}
+
+// Scans the given blocks of primary arrays for entries in the requested secondary indices and hands
+// each hit to store(slot, primary index, value), in order of the primary index within each block
+// block_done(block) is called after the hits of a block are stored
+template<typename Store, typename BlockDone>
+static void scanArraysSecondary(const SparseMatrixData& data, const std::vector<BlockRange>& ranges, const std::int64_t size_second, const std::vector<std::int64_t>& idxs, Store store, BlockDone block_done) {
+    // Map each requested secondary index to its output array
+    std::vector<std::int32_t> slots(size_second, -1);
+    for (size_t slot = 0; slot < idxs.size(); ++slot) {
+        if (idxs[slot] < 0 || idxs[slot] >= size_second) {
+            std::cerr << "scanArraysSecondary: could not read from index " << idxs[slot] << std::endl;
+            continue;
+        }
+        slots[idxs[slot]] = static_cast<std::int32_t>(slot);
+    }
+
+    struct Hit {
+        std::int64_t _arr;
+        std::int64_t _pos;      // position in block
+        std::int32_t _slot;
+    };
+
+    try {
+        // We need to scan through all arrays to find entries in the requested indices, one block at a time
+        std::vector<Hit> hits;
+        std::vector<float> hit_values;
+
+        streamPrimaryBlocks(data, ranges, /* readValues = */ false, [&](const PrimaryBlock& block) {
+            hits.clear();
+
+            for (std::int64_t arr = block._begin; arr < block._end; ++arr) {
+                const std::int64_t start = block._indptr[arr - block._begin];
+                const std::int64_t end   = block._indptr[arr - block._begin + 1];
+
+                for (std::int64_t i = start; i < end; ++i) {
+                    const std::int32_t slot = slots[block._indices[i]];
+                    if (slot >= 0) {
+                        hits.push_back({ arr, i, slot });
+                    }
+                }
+            }
 
-                    H5::DataSpace scalar_space(1, &data_count);
-                    float value;
-                    data._data_ds->read(&value, H5::PredType::NATIVE_FLOAT, scalar_space, data_space);
+            if (!hits.empty()) {
+                // Only read the values that span the hits of this block
+                const std::int64_t first = hits.front()._pos;
+                const std::int64_t count = hits.back()._pos - first + 1;
+                readValuesSlice(data, block._offset + first, count, hit_values);
 
-                    dense_array[arr] = value;
-                    break;  // Found the entry for this arr, move to next arr
+                for (const Hit& hit : hits) {
+                    store(hit._slot, hit._arr, hit_values[hit._pos - first]);
                 }
             }
+
+            block_done(block);
+            });
+    }
+    catch (...) {
+        reportException("Error reading secondary arrays");
+    }
+}
+
+// Hands the arrays read so far to progressive->_onPartial at most every _intervalSeconds
+static std::vector<std::vector<float>> getArraysSecondary(const SparseMatrixData& data, const BlockIndex* index, const ValueTransformer& transform, const std::int64_t size_primary, const std::int64_t size_second, const std::vector<std::int64_t>& idxs, const ProgressiveRead* progressive = nullptr) {
+    std::vector<std::vector<float>> dense_arrays(idxs.size(), std::vector<float>(size_primary, 0.0f));
+
+    if (!hasSparseArrays(data) || idxs.empty()) {
+        std::cerr << "getArraysSecondary: could not read from indices" << std::endl;
+        return dense_arrays;  // invalid datasets
+    }
+
+    std::vector<BlockRange> ranges = secondaryScanRanges(data, index, size_primary, idxs);
+
+    auto store = [&dense_arrays, &transform, &idxs](const std::int32_t slot, const std::int64_t arr, const float value) {
+        dense_arrays[slot][arr] = transform(value, arr, idxs[slot]);
+        };
+
+    if (!progressive || !progressive->_onPartial || ranges.size() < 2) {
+        scanArraysSecondary(data, ranges, size_second, idxs, store, [](const PrimaryBlock&) {});
+        return dense_arrays;
+    }
+
+    if (progressive->_stridedOrder) {
+        ranges = stridedOrder(ranges, ProgressiveRead::stride);
+    }
+
+    using clock = std::chrono::steady_clock;
+
+    const double total_nnz  = static_cast<double>(std::accumulate(ranges.begin(), ranges.end(), std::int64_t{ 0 }, [&data](const std::int64_t sum, const BlockRange& range) {
+        return sum + data._indptr[range.second] - data._indptr[range.first];
+        }));
+    const auto interval     = std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(progressive->_intervalSeconds));
+    auto last_partial       = clock::now();
+    double processed_nnz    = 0.0;
+
+    scanArraysSecondary(data, ranges, size_second, idxs, store, [&](const PrimaryBlock& block) {
+        processed_nnz += static_cast<double>(block._indptr.back());
+
+        // The last block is not published, the complete arrays are returned instead
+        if (processed_nnz >= total_nnz || clock::now() - last_partial < interval) {
+            return;
         }
+
+        progressive->_onPartial(dense_arrays, static_cast<float>(processed_nnz / total_nnz));
+        last_partial = clock::now();
+        });
+
+    return dense_arrays;
+}
+
+static std::vector<SparseArray> getSparseArraysSecondary(const SparseMatrixData& data, const BlockIndex* index, const ValueTransformer& transform, const std::int64_t size_primary, const std::int64_t size_second, const std::vector<std::int64_t>& idxs) {
+    std::vector<SparseArray> sparse_arrays(idxs.size());
+
+    if (!hasSparseArrays(data) || idxs.empty()) {
+        std::cerr << "getSparseArraysSecondary: could not read from indices" << std::endl;
+        return sparse_arrays;  // invalid datasets
     }
-    catch (const H5::Exception& e) {
-        std::cerr << "Error reading secondary array " << idx << ": " << e.getDetailMsg() << std::endl;
+
+    scanArraysSecondary(data, secondaryScanRanges(data, index, size_primary, idxs), size_second, idxs, [&sparse_arrays, &transform, &idxs](const std::int32_t slot, const std::int64_t arr, const float value) {
+        sparse_arrays[slot]._indices.push_back(arr);
+        sparse_arrays[slot]._values.push_back(transform(value, arr, idxs[slot]));
+        }, [](const PrimaryBlock&) {});
+
+    return sparse_arrays;
+}
+
+static std::vector<float> getArraySecondary(const SparseMatrixData& data, const BlockIndex* index, const ValueTransformer& transform, const std::int64_t size_primary, const std::int64_t size_second, const std::int64_t idx) {
+    if (!hasSparseArrays(data) || idx < 0 || idx >= size_second) {
+        std::cerr << "getArraySecondary: could not read from index" << std::endl;
+        return std::vector<float>(size_primary, 0.0f);  // invalid datasets or index
     }
 
-    return dense_array;
+    return std::move(getArraysSecondary(data, index, transform, size_primary, size_second, { idx }).front());
+}
+
+// Sums the given primary arrays, result has size_second entries
+static std::vector<float> sumArraysPrimary(const SparseMatrixData& data, const std::int64_t size_second, const std::vector<std::int64_t>& idxs) {
+    std::vector<float> sums(size_second, 0.0f);
+
+    auto readArray = [&](const std::int64_t item, SparseArray& arr) {
+        readPrimarySparse(data, idxs[item], arr._indices, arr._values);
+        };
+
+    auto addArray = [&](const std::int64_t, SparseArray& arr) {
+        const std::int64_t arr_nnz = static_cast<std::int64_t>(arr._indices.size());
+
+        // Indices are unique within an array
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < arr_nnz; ++i) {
+            sums[arr._indices[i]] += arr._values[i];
+        }
+        };
+
+    try {
+        BlockPipeline<SparseArray> pipeline;
+        pipeline.run(static_cast<std::int64_t>(idxs.size()), readArray, addArray);
+    }
+    catch (...) {
+        reportException("Error summing primary arrays");
+    }
+
+    return sums;
+}
+
+// Sums the given secondary arrays in a single scan, result has size_primary entries
+static std::vector<float> sumArraysSecondary(const SparseMatrixData& data, const BlockIndex* index, const std::int64_t size_primary, const std::int64_t size_second, const std::vector<std::int64_t>& idxs) {
+    std::vector<float> sums(size_primary, 0.0f);
+
+    std::vector<std::uint8_t> selected(size_second, 0);
+    for (const std::int64_t idx : idxs) {
+        selected[idx] = 1;
+    }
+
+    try {
+        std::vector<std::int64_t> hits;
+        std::vector<float> hit_values;
+
+        streamPrimaryBlocks(data, secondaryScanRanges(data, index, size_primary, idxs), /* readValues = */ false, [&](const PrimaryBlock& block) {
+            const std::int64_t block_nnz = static_cast<std::int64_t>(block._indices.size());
+
+            hits.clear();
+            for (std::int64_t i = 0; i < block_nnz; ++i) {
+                if (selected[block._indices[i]]) {
+                    hits.push_back(i);
+                }
+            }
+
+            if (hits.empty()) {
+                return;
+            }
+
+            const std::int64_t first = hits.front();
+            readValuesSlice(data, block._offset + first, hits.back() - first + 1, hit_values);
+
+            // Accumulate per primary array, the hits are sorted by position
+            const std::int64_t num_arrs = block._end - block._begin;
+#pragma omp parallel for
+            for (std::int64_t a = 0; a < num_arrs; ++a) {
+                const std::int64_t arr   = block._begin + a;
+                const std::int64_t start = block._indptr[a];
+                const std::int64_t end   = block._indptr[a + 1];
+
+                auto it = std::lower_bound(hits.begin(), hits.end(), start);
+                for (; it != hits.end() && *it < end; ++it) {
+                    sums[arr] += hit_values[*it - first];
+                }
+            }
+            });
+    }
+    catch (...) {
+        reportException("Error summing secondary arrays");
+    }
+
+    return sums;
+}
+
+// Sum of every primary array
+static std::vector<float> totalsPrimary(const SparseMatrixData& data, const std::int64_t size_primary) {
+    std::vector<float> totals(size_primary, 0.0f);
+
+    try {
+        streamPrimaryBlocks(data, primaryBlockRanges(data, size_primary, SparseMatrixReader::defaultBlockNnz), /* readValues = */ true, [&](const PrimaryBlock& block) {
+            const std::int64_t num_arrs = block._end - block._begin;
+
+#pragma omp parallel for
+            for (std::int64_t a = 0; a < num_arrs; ++a) {
+                const std::int64_t arr   = block._begin + a;
+                const std::int64_t start = block._indptr[a];
+                const std::int64_t end   = block._indptr[a + 1];
+
+                float total = 0.0f;
+                for (std::int64_t i = start; i < end; ++i) {
+                    total += block._values[i];
+                }
+                totals[arr] = total;
+            }
+            });
+    }
+    catch (...) {
+        reportException("Error computing primary totals");
+    }
+
+    return totals;
+}
+
+// Sum of every secondary array
+static std::vector<float> totalsSecondary(const SparseMatrixData& data, const std::int64_t size_primary, const std::int64_t size_second) {
+    std::vector<float> totals(size_second, 0.0f);
+
+    try {
+        streamPrimaryBlocks(data, primaryBlockRanges(data, size_primary, SparseMatrixReader::defaultBlockNnz), /* readValues = */ true, [&](const PrimaryBlock& block) {
+            const std::int64_t block_nnz = static_cast<std::int64_t>(block._indices.size());
+
+            for (std::int64_t i = 0; i < block_nnz; ++i) {
+                totals[block._indices[i]] += block._values[i];
+            }
+            });
+    }
+    catch (...) {
+        reportException("Error computing secondary totals");
+    }
+
+    return totals;
 }
 
 // =============================================================================
@@ -480,12 +1835,42 @@ CSRReader::~CSRReader() = default;
 
 std::vector<float>CSRReader::getRowImpl(std::int64_t row_idx) const
 {
-    return getArrayPrimary(_data, _data._num_rows, _data._num_cols, row_idx);
+    return getArrayPrimary(_data, getValueTransformer(), _data._num_rows, _data._num_cols, row_idx);
 }
 
 std::vector<float> CSRReader::getColumnImpl(std::int64_t col_idx) const
 {
-    return getArraySecondary(_data, _data._num_rows, _data._num_cols, col_idx);
+    return getArraySecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_rows, _data._num_cols, col_idx);
+}
+
+std::vector<std::vector<float>> CSRReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    return getArraysPrimary(_data, getValueTransformer(), _data._num_rows, _data._num_cols, row_indices);
+}
+
+std::vector<std::vector<float>> CSRReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return getArraysSecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_rows, _data._num_cols, col_indices);
+}
+
+std::vector<std::vector<float>> CSRReader::getColumnsProgressiveImpl(const std::vector<std::int64_t>& col_indices, const ProgressiveRead& progressive) const
+{
+    return getArraysSecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_rows, _data._num_cols, col_indices, &progressive);
+}
+
+std::vector<float> CSRReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return sumArraysSecondary(_data, getBlockIndex().get(), _data._num_rows, _data._num_cols, col_indices);
+}
+
+std::vector<float> CSRReader::getRowTotalsImpl() const
+{
+    return totalsPrimary(_data, _data._num_rows);
+}
+
+std::vector<SparseArray> CSRReader::getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return getSparseArraysSecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_rows, _data._num_cols, col_indices);
 }
 
 // =============================================================================
@@ -507,10 +1892,82 @@ CSCReader::~CSCReader() = default;
 
 std::vector<float> CSCReader::getColumnImpl(std::int64_t col_idx) const
 {
-    return getArrayPrimary(_data, _data._num_cols, _data._num_rows, col_idx);
+    return getArrayPrimary(_data, getValueTransformer(), _data._num_cols, _data._num_rows, col_idx);
 }
 
 std::vector<float> CSCReader::getRowImpl(std::int64_t row_idx) const
 {
-    return getArraySecondary(_data, _data._num_cols, _data._num_rows, row_idx);
+    return getArraySecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_cols, _data._num_rows, row_idx);
+}
+
+std::vector<std::vector<float>> CSCReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return getArraysPrimary(_data, getValueTransformer(), _data._num_cols, _data._num_rows, col_indices);
+}
+
+std::vector<std::vector<float>> CSCReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    return getArraysSecondary(_data, getBlockIndex().get(), getValueTransformer(), _data._num_cols, _data._num_rows, row_indices);
+}
+
+std::vector<float> CSCReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return sumArraysPrimary(_data, _data._num_rows, col_indices);
+}
+
+std::vector<float> CSCReader::getRowTotalsImpl() const
+{
+    return totalsSecondary(_data, _data._num_cols, _data._num_rows);
+}
+
+std::vector<SparseArray> CSCReader::getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return getSparseArraysPrimary(_data, getValueTransformer(), _data._num_cols, col_indices);
+}
+
+// =============================================================================
+// Factory
+// =============================================================================
+
+std::unique_ptr<SparseMatrixReader> openSparseMatrixReader(const std::string& filename, const H5AccessSettings& access)
+{
+    if (!std::filesystem::exists(filename)) {
+        std::cerr << "openSparseMatrixReader: file does not exist " << filename << std::endl;
+        return nullptr;
+    }
+
+    SparseMatrixType type = SparseMatrixType::UNKNOWN;
+
+    try {
+        type = SparseMatrixReader::readMatrixType(filename);
+    }
+    catch (const H5::Exception& e) {
+        std::cerr << "openSparseMatrixReader: " << e.getDetailMsg() << std::endl;
+        return nullptr;
+    }
+
+    // Files with both orientations route rows and columns to the matching copy
+    if (type == SparseMatrixType::CSR || type == SparseMatrixType::CSC) {
+        auto dual = std::make_unique<DualLayoutReader>();
+        dual->setH5Access(access);
+        if (dual->readFile(filename)) {
+            return dual;
+        }
+    }
+
+    std::unique_ptr<SparseMatrixReader> reader;
+
+    if (type == SparseMatrixType::CSC)
+        reader = std::make_unique<CSCReader>();
+    else if (type == SparseMatrixType::DENSE)
+        reader = std::make_unique<DenseMatrixReader>();
+    else
+        reader = std::make_unique<CSRReader>();
+
+    reader->setH5Access(access);
+    if (!reader->readFile(filename)) {
+        return nullptr;
+    }
+
+    return reader;
 }
@@ -1,7 +1,18 @@
 #pragma once
 
+#include "H5FileAccess.h"
+#include "IndptrArray.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <limits>
 #include <memory>
+#include <mutex>
 #include <list>
 #include <string>
 #include <unordered_map>
@@ -19,11 +30,21 @@ namespace H5 {
     class H5Object;
 }
 
+class AccessTraceRecorder;
+class BlockIndex;
+class DiskCache;
+
+// The HDF5 library is not built thread-safe, all calls into it are serialized through this mutex
+std::recursive_mutex& h5Mutex();
+
 std::string readAttributeString(H5::H5Object& file, const std::string& attr_name);
 
 bool groupExists(const H5::H5File& file, const std::string& path);
 bool attributeExists(const H5::H5Object& loc, const std::string& attr_name);
 
+// Reads a 1D array of variable or fixed-length strings, dest stays empty if the dataset does not exist
+void readStringArray(const H5::H5File& file, const std::string& groupName, const std::string& datasetName, std::vector<std::string>& dest);
+
 // =============================================================================
 // Sparse matrix common utilities
 // =============================================================================
@@ -34,12 +55,106 @@ using DataSet_p = std::unique_ptr<H5::DataSet>;
 enum class SparseMatrixType : std::int32_t {
     CSR,
     CSC,
+    DENSE,      // Chunked dense array, see DenseMatrixReader
     UNKNOWN,
 };
 
 std::string sparseMatrixTypeToString(const SparseMatrixType& type);
 SparseMatrixType sparseMatrixStringToType(const std::string& type);
 
+enum class AggregateReduction : std::int32_t {
+    SUM,
+    MEAN,
+    NORMALIZED_MEAN,    // Mean of library-size normalized values, i.e. counts per 10k
+};
+
+std::string aggregateReductionToString(const AggregateReduction& reduction);
+AggregateReduction aggregateReductionStringToType(const std::string& reduction);
+
+// Applied to the stored non-zero values when rows and columns are read, zeros stay zero
+struct ValueTransform {
+    bool    _normalizeTotals    = false;    // Divide by the row total and multiply with _targetSum
+    float   _targetSum          = 1e4f;
+    bool    _log1p              = false;
+    float   _scale              = 1.0f;     // After log1p
+    float   _clipMax            = std::numeric_limits<float>::infinity();   // After scaling
+
+    bool isIdentity() const { return !_normalizeTotals && !_log1p && _scale == 1.0f && std::isinf(_clipMax); }
+    bool operator==(const ValueTransform& other) const = default;
+};
+
+// Short stable key of a transform, e.g. "_t1a2b3c4d", empty for the identity
+std::string valueTransformKey(const ValueTransform& transform);
+
+// A ValueTransform bound to the row totals of a matrix, called in the densify kernels with the
+// primary and secondary index of every non-zero entry
+class ValueTransformer {
+public:
+    ValueTransformer() = default;
+    ValueTransformer(const ValueTransform& transform, const std::vector<float>* rowTotals, const bool rowsArePrimary) :
+        _transform(transform), _rowTotals(transform._normalizeTotals ? rowTotals : nullptr), _rowsArePrimary(rowsArePrimary), _identity(transform.isIdentity()) {}
+
+    bool isIdentity() const { return _identity; }
+
+    float operator()(float value, const std::int64_t primary, const std::int64_t secondary) const {
+        if (_identity)
+            return value;
+
+        if (_rowTotals != nullptr) {
+            const float total = (*_rowTotals)[_rowsArePrimary ? primary : secondary];
+            value = total > 0.0f ? value / total * _transform._targetSum : 0.0f;
+        }
+
+        if (_transform._log1p)
+            value = std::log1p(value);
+
+        return std::min(value * _transform._scale, _transform._clipMax);
+    }
+
+private:
+    ValueTransform              _transform      = {};
+    const std::vector<float>*   _rowTotals      = nullptr;
+    bool                        _rowsArePrimary = true;
+    bool                        _identity       = true;
+};
+
+enum class PredicateOp : std::int32_t {
+    LESS,
+    LESS_EQUAL,
+    EQUAL,
+    NOT_EQUAL,
+    GREATER_EQUAL,
+    GREATER,
+};
+
+// Compares the value of one variable with a constant, e.g. GeneA > 1
+struct RowPredicate {
+    std::int64_t    _column = 0;
+    PredicateOp     _op     = PredicateOp::GREATER;
+    float           _value  = 0.0f;
+
+    bool matches(const float value) const;
+};
+
+// Parses conjunctions like "GeneA > 1 AND GeneB == 0", operators are <, <=, ==, =, !=, >= and >
+// Returns false and describes the first problem in error if the query is malformed or names an unknown variable
+bool parseRowQuery(const std::string& query, const std::vector<std::string>& var_names, std::vector<RowPredicate>& predicates, std::string& error);
+
+// Non-zero entries of a single row or column
+struct SparseArray {
+    std::vector<std::int64_t>   _indices    = {};
+    std::vector<float>          _values     = {};
+};
+
+// Storage of the indices and data arrays that is not an HDF5 dataset, e.g. a Zarr store
+class SparseArraySource {
+public:
+    virtual ~SparseArraySource() = default;
+
+    virtual void readIndices(const std::int64_t offset, const std::int64_t count, std::vector<std::int64_t>& dest) const = 0;
+    virtual void readValues(const std::int64_t offset, const std::int64_t count, std::vector<float>& dest) const = 0;
+};
+
 struct SparseMatrixData {
     SparseMatrixData();
     ~SparseMatrixData();
@@ -51,17 +166,51 @@ struct SparseMatrixData {
     DataSet_p _indptr_ds;
     DataSet_p _indices_ds;
     DataSet_p _data_ds;
+    std::unique_ptr<SparseArraySource> _source;     // Replaces the datasets if set
 
     std::int64_t _num_rows = 0;
     std::int64_t _num_cols = 0;
-    std::vector<std::int64_t> _indptr = {};              // Column pointers (size = num_cols + 1)
+    IndptrArray _indptr = {};                            // Column pointers (size = num_cols + 1), Elias-Fano encoded for tall matrices
 
     std::vector<std::string> _obs_names = {};
     std::vector<std::string> _var_names = {};
+
+    ValueTransform _stored_transform = {};              // Transform the stored values already have, see extractColumns
+
+    H5AccessSettings _access = {};                      // Settings the file is opened with, after tuning
+
+    mutable std::atomic<std::uint64_t> _bytesRead = 0;  // Decoded indices and values since opening
+};
+
+// A contiguous range of primary arrays, i.e. rows for CSR and columns for CSC
+struct PrimaryBlock {
+    std::int64_t                _begin      = 0;    // First primary index in block
+    std::int64_t                _end        = 0;    // One past the last primary index in block
+    std::int64_t                _offset     = 0;    // Position of the first entry in data/indices
+    std::vector<std::int64_t>   _indptr     = {};   // Array pointers relative to _offset (size = _end - _begin + 1)
+    std::vector<std::int64_t>   _indices    = {};
+    std::vector<float>          _values     = {};   // Only filled if requested
+};
+
+using BlockCallback = std::function<void(const PrimaryBlock&)>;
+
+// Values of a streamed block as rows and columns read them, the stored values if transform is the identity
+const std::vector<float>& transformBlockValues(const PrimaryBlock& block, const ValueTransformer& transform, std::vector<float>& buffer);
+
+// Partial results of slow reads, i.e. columns of CSR matrices that scan all rows
+struct ProgressiveRead {
+    static constexpr size_t stride = 16;        // Every 16th block is scanned first with _stridedOrder
+
+    double  _intervalSeconds    = 0.25;         // Minimum time between two partial results
+    bool    _stridedOrder       = true;         // Scan a strided sample of the blocks first, otherwise in file order
+
+    // Called on the reading thread with all requested arrays, the values of blocks that are not scanned yet are zero
+    std::function<void(const std::vector<std::vector<float>>& arrays, float fraction)> _onPartial = {};
 };
 
 class SparseMatrixReader {
     using Cache = std::unordered_map<std::int64_t, std::pair<std::vector<float>, std::list<std::int64_t>::iterator>>;
+    using InFlight = std::unordered_map<std::int64_t, std::shared_future<void>>;   // Arrays being fetched, ready once they are cached
 
 public:
     SparseMatrixReader(SparseMatrixType type) : _type(type) {}
@@ -74,17 +223,65 @@ public: // Setup
 
     void setUseCache(const bool useCache) { _useCache = useCache; }
     void setMaxCacheSize(const size_t newSize);
-    bool readFile(const std::string& filename);
+    void setDiskCache(std::shared_ptr<DiskCache> diskCache);     // Second-level cache behind the in-memory cache, nullptr disables it
+    void releaseDiskCache(const std::shared_ptr<DiskCache>& diskCache);  // Disables the disk cache only if it is still the given one, for shared readers
+    void setUseBlockIndex(const bool useBlockIndex) { _useBlockIndex = useBlockIndex; }   // Skip blocks in secondary scans, see BlockIndex
+    void setCompactIndptr(const bool compactIndptr);   // Encode the indptr of tall matrices, see IndptrArray, kept across files and not thread-safe
+    void setH5Access(const H5AccessSettings& access) { _h5Access = access; }  // Used for the files read next, kept across files
+    virtual void setValueTransform(const ValueTransform& transform);    // Clears the cached arrays if the transform changes
+    void setAccessTrace(std::shared_ptr<AccessTraceRecorder> trace);   // Records getRow/getColumn calls, nullptr disables it
+    void releaseAccessTrace(const std::shared_ptr<AccessTraceRecorder>& trace);   // Disables the trace only if it is still the given one, for shared readers
+    virtual bool readFile(const std::string& filename);
+    bool readFileGroup(const std::string& filename, const std::string& groupName);    // e.g. a copy of X in layers/
     void reset(const bool keepType = true);
 
 public: // Getter
 
+    // The cached getters may be called from several threads, e.g. on readers shared through the ReaderRegistry
     std::vector<float> getRow(std::int64_t row_idx);
     std::vector<float> getColumn(std::int64_t col_idx);
 
+    // Batched access, reads all arrays that are not cached in a single pass
+    std::vector<std::vector<float>> getRows(const std::vector<std::int64_t>& row_indices);
+    std::vector<std::vector<float>> getColumns(const std::vector<std::int64_t>& col_indices);
+
+    // Same result as getColumns, publishes partial results while a slow scan is running
+    std::vector<std::vector<float>> getColumnsProgressive(const std::vector<std::int64_t>& col_indices, const ProgressiveRead& progressive);
+
+    // Reduces a set of columns to a single one without materializing the individual columns
+    std::vector<float> getColumnAggregate(const std::vector<std::int64_t>& col_indices, const AggregateReduction reduction);
+
+    // Sum of each row of the stored values, computed on first use
+    const std::vector<float>& getRowTotals() const;
+
+    // Sorted indices of the rows that satisfy all predicates, empty without predicates
+    // Only the non-zero entries of the queried columns are read, predicates that do not hold for zero restrict the candidates to them
+    std::vector<std::int64_t> queryRows(const std::vector<RowPredicate>& predicates) const;
+
+    // Streams the stored matrix in indptr-aligned blocks of roughly blockNnz non-zero entries
+    // Primary indices may be repeated across blocks (e.g. by sharded readers), consumers should accumulate
+    virtual bool streamBlocks(const BlockCallback& process, const bool readValues = true, const std::int64_t blockNnz = defaultBlockNnz) const;
+
+    static constexpr std::int64_t defaultBlockNnz = std::int64_t{ 1 } << 20;
+
+    // Loaded from next to the file or built in a single scan on first use, nullptr if disabled
+    std::shared_ptr<const BlockIndex> getBlockIndex() const;
+
     virtual std::vector<float> getRowImpl(std::int64_t row_idx) const = 0;
     virtual std::vector<float> getColumnImpl(std::int64_t col_idx) const = 0;
 
+    virtual std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const;
+    virtual std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const;
+
+    // Defaults to getColumnsImpl without partial results
+    virtual std::vector<std::vector<float>> getColumnsProgressiveImpl(const std::vector<std::int64_t>& col_indices, const ProgressiveRead& progressive) const;
+
+    virtual std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const = 0;
+    virtual std::vector<float> getRowTotalsImpl() const = 0;
+
+    // Defaults to sparsifying getColumnsImpl, sparse formats read the non-zero entries directly
+    virtual std::vector<SparseArray> getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const;
+
     bool hasObsNames() const { return !_data._obs_names.empty(); }
     bool hasVarNames() const { return !_data._var_names.empty(); }
 
@@ -99,12 +296,44 @@ public: // Getter
 
     const SparseMatrixData& getRawData() const { return _data; }
 
+    // Number of primary arrays (rows for CSR, columns for CSC) and their length
+    std::int64_t getPrimarySize() const { return _type == SparseMatrixType::CSC ? _data._num_cols : _data._num_rows; }
+    std::int64_t getSecondarySize() const { return _type == SparseMatrixType::CSC ? _data._num_rows : _data._num_cols; }
+
     bool getUseCache() const { return _useCache; }
+    bool getUseBlockIndex() const { return _useBlockIndex; }
+    bool getCompactIndptr() const { return _compactIndptr; }
+    const H5AccessSettings& getH5Access() const { return _h5Access; }
     size_t getMaxCacheSize() const { return _maxCacheSize; }
 
+    // Rows, columns and queried values are transformed, streamed blocks and aggregates stay raw
+    const ValueTransform& getValueTransform() const { return _valueTransform; }
+
+    // Binds the value transform to the row totals, computes them on first use if needed
+    // Streamed blocks are transformed with it by consumers that need the values as read, see transformBlockValues
+    ValueTransformer getValueTransformer() const;
+
+    // Values of extracted column subsets are stored transformed, requesting the same transform reads them as they are
+    const ValueTransform& getStoredValueTransform() const { return _data._stored_transform; }
+
+    // Columns in the in-memory cache, most recently used first
+    std::vector<std::int64_t> getCachedColumns() const;
+
+    // Bytes of indices and values read from the file, a measure of the I/O independent of the caches of HDF5 and the OS
+    virtual std::uint64_t getBytesRead() const { return _data._bytesRead; }
+
 private:
+    // Threads that miss on an array another thread is fetching wait for that fetch instead of reading it again
+    std::vector<std::vector<float>> getArrays(Cache& cache, std::list<std::int64_t>& order, InFlight& inFlight, const std::vector<std::int64_t>& indices, const bool rows, const ProgressiveRead* progressive = nullptr);
+
+    // Reads arrays from the disk cache if possible, otherwise from the file and stores them in the disk cache
+    std::vector<std::vector<float>> fetchArrays(const std::vector<std::int64_t>& indices, const bool rows, const ProgressiveRead* progressive = nullptr) const;
+
+    void recordAccess(const bool row, const std::int64_t index, const bool hit, const std::chrono::steady_clock::time_point start) const;
+
     std::optional<std::vector<float>*> lookupCache(Cache& cache, std::list<std::int64_t>& order, std::int64_t id) const;
-    void saveToCache(Cache& cache, std::list<std::int64_t>& order, std::int64_t id, const std::vector<float>& data) const;
+    // Drops the data if the cache was cleared since the fetch started, i.e. generation is outdated
+    void saveToCache(Cache& cache, std::list<std::int64_t>& order, std::int64_t id, const std::vector<float>& data, const std::uint64_t generation) const;
     void removeLeastRecentlyUsed(Cache& cache, std::list<std::int64_t>& order) const;
 
 protected:
@@ -114,13 +343,37 @@ protected:
     size_t                  _maxCacheSize                = 10;
 
     bool                    _useCache                    = true;
+    mutable std::mutex      _cacheMutex                  = {}; // Guards the caches below
+    std::shared_ptr<DiskCache> _diskCache                = {};
+    std::string             _diskCacheKey                = ""; // Version of the file in the disk cache
     std::list<std::int64_t> _lookupOrderRows             = {}; // Most recently used at front
     Cache                   _cacheRows                   = {};
     std::list<std::int64_t> _lookupOrderColumns          = {}; // Most recently used at front
     Cache                   _cacheColumns                = {};
+    InFlight                _inFlightRows                = {};
+    InFlight                _inFlightColumns             = {};
+    std::uint64_t           _cacheGeneration             = 0;  // Incremented whenever the cached arrays become invalid
+
+    mutable std::vector<float> _rowTotals                = {};
+    mutable std::mutex      _rowTotalsMutex              = {};
+
+    ValueTransform          _valueTransform              = {}; // Guarded by _cacheMutex
+    std::string             _valueTransformKey           = ""; // Appended to the disk cache key, empty without transform
+
+    std::shared_ptr<AccessTraceRecorder> _accessTrace    = {}; // Guarded by _cacheMutex
+
+    bool                    _useBlockIndex               = true;
+    bool                    _compactIndptr               = true;
+    H5AccessSettings        _h5Access                    = {};
+    mutable std::mutex      _blockIndexMutex             = {};
+    mutable std::shared_ptr<const BlockIndex> _blockIndex = {};
 };
 
-bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data);
+bool readMatrixFromFile(const std::string& filename, SparseMatrixData& data, const std::string& groupName = "X", const H5AccessSettings& access = {});
+
+// Cell Ranger filtered_feature_bc_matrix.h5 files, with barcodes as rows and feature names as columns
+bool isCellRangerFile(const std::string& filename);
+bool readMatrixFromCellRanger(const std::string& filename, SparseMatrixData& data, const H5AccessSettings& access = {});
 
 // =============================================================================
 // CSRReader
@@ -157,6 +410,17 @@ public: // Getter
 
     std::vector<float> getRowImpl(std::int64_t row_idx) const override;
     std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    // Columns scan all rows, optionally a strided sample of the row blocks first
+    std::vector<std::vector<float>> getColumnsProgressiveImpl(const std::vector<std::int64_t>& col_indices, const ProgressiveRead& progressive) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    std::vector<SparseArray> getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
 };
 
 // =============================================================================
@@ -197,4 +461,19 @@ public: // Getter
 
     std::vector<float> getRowImpl(std::int64_t row_idx) const override;
     std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    std::vector<SparseArray> getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
 };
+
+// =============================================================================
+// Factory
+// =============================================================================
+
+// Opens a CSR, CSC, dual-layout or dense reader depending on the storage in the file, returns nullptr on failure
+std::unique_ptr<SparseMatrixReader> openSparseMatrixReader(const std::string& filename, const H5AccessSettings& access = {});
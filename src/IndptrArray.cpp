@@ -0,0 +1,146 @@
+#include "IndptrArray.h"
+
+#include <algorithm>
+#include <bit>
+
+// =============================================================================
+// IndptrArray
+// =============================================================================
+
+bool IndptrArray::compact() {
+    if (_isCompact || _size == 0)
+        return _isCompact;
+
+    if (_plain.front() < 0)
+        return false;
+
+    for (size_t i = 1; i < _size; ++i) {
+        if (_plain[i] < _plain[i - 1])
+            return false;
+    }
+
+    const std::uint64_t universe = static_cast<std::uint64_t>(_plain.back());
+
+    _lowWidth = universe / _size > 0 ? static_cast<std::uint32_t>(std::bit_width(universe / _size) - 1) : 0;
+
+    const std::uint64_t lowMask = _lowWidth == 0 ? 0 : (std::uint64_t{ 1 } << _lowWidth) - 1;
+    const std::uint64_t numHighBits = _size + (universe >> _lowWidth) + 1;
+
+    _low.assign((_size * _lowWidth + 63) / 64 + 1, 0);
+    _high.assign((numHighBits + 63) / 64 + 1, 0);
+    _samples.assign(((_size - 1) >> sampleShift) + 1, 0);
+
+    for (size_t i = 0; i < _size; ++i) {
+        const std::uint64_t value = static_cast<std::uint64_t>(_plain[i]);
+
+        if (_lowWidth > 0) {
+            const std::uint64_t bit = i * _lowWidth;
+            const std::uint32_t shift = static_cast<std::uint32_t>(bit & 63);
+
+            _low[bit >> 6] |= (value & lowMask) << shift;
+            if (shift + _lowWidth > 64)
+                _low[(bit >> 6) + 1] |= (value & lowMask) >> (64 - shift);
+        }
+
+        const std::uint64_t pos = (value >> _lowWidth) + i;
+        _high[pos >> 6] |= std::uint64_t{ 1 } << (pos & 63);
+
+        if ((i & ((size_t{ 1 } << sampleShift) - 1)) == 0)
+            _samples[i >> sampleShift] = pos;
+    }
+
+    _plain = {};
+    _isCompact = true;
+
+    return true;
+}
+
+void IndptrArray::expand() {
+    if (!_isCompact)
+        return;
+
+    std::vector<std::int64_t> values = toVector();
+
+    *this = IndptrArray(std::move(values));
+}
+
+std::uint64_t IndptrArray::lowBits(const size_t i) const {
+    if (_lowWidth == 0)
+        return 0;
+
+    const std::uint64_t bit = i * _lowWidth;
+    const std::uint32_t shift = static_cast<std::uint32_t>(bit & 63);
+    const std::uint64_t mask = (std::uint64_t{ 1 } << _lowWidth) - 1;
+
+    std::uint64_t low = _low[bit >> 6] >> shift;
+    if (shift + _lowWidth > 64)
+        low |= _low[(bit >> 6) + 1] << (64 - shift);
+
+    return low & mask;
+}
+
+std::uint64_t IndptrArray::selectHigh(const size_t i) const {
+    const std::uint64_t sample = _samples[i >> sampleShift];
+    std::uint64_t rank = i & ((size_t{ 1 } << sampleShift) - 1);
+
+    size_t w = sample >> 6;
+    std::uint64_t word = _high[w] & (~std::uint64_t{ 0 } << (sample & 63));
+
+    // Visits the words up to the next sample: at most 255 set bits, about 8 words on average at 2 bits per entry,
+    // plus one zero bit per skipped high value, i.e. any zero words of large gaps such as a very long array
+    for (std::uint64_t count = std::popcount(word); rank >= count; count = std::popcount(word)) {
+        rank -= count;
+        word = _high[++w];
+    }
+
+    for (; rank > 0; --rank) {
+        word &= word - 1;
+    }
+
+    return (w << 6) + std::countr_zero(word);
+}
+
+std::int64_t IndptrArray::access(const size_t i) const {
+    const std::uint64_t high = selectHigh(i) - i;
+    return static_cast<std::int64_t>((high << _lowWidth) | lowBits(i));
+}
+
+void IndptrArray::decode(const size_t first, const size_t last, std::int64_t* dest) const {
+    if (first >= last)
+        return;
+
+    if (!_isCompact) {
+        std::copy(_plain.begin() + first, _plain.begin() + last, dest);
+        return;
+    }
+
+    // Walks the set bits of the high bits from the first value on
+    const std::uint64_t start = selectHigh(first);
+    size_t w = start >> 6;
+    std::uint64_t word = _high[w] & (~std::uint64_t{ 0 } << (start & 63));
+
+    for (size_t i = first; i < last; ++i) {
+        while (word == 0) {
+            word = _high[++w];
+        }
+
+        const std::uint64_t pos = (w << 6) + std::countr_zero(word);
+        word &= word - 1;
+
+        *dest++ = static_cast<std::int64_t>(((pos - i) << _lowWidth) | lowBits(i));
+    }
+}
+
+std::vector<std::int64_t> IndptrArray::toVector() const {
+    if (!_isCompact)
+        return _plain;
+
+    std::vector<std::int64_t> values(_size);
+    decode(0, _size, values.data());
+
+    return values;
+}
+
+std::uint64_t IndptrArray::getBytes() const {
+    return (_plain.size() + _low.size() + _high.size() + _samples.size()) * sizeof(std::uint64_t);
+}
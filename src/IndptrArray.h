@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+// =============================================================================
+// IndptrArray
+// =============================================================================
+
+/*
+The index pointers of a sparse matrix, either as plain 64-bit integers or Elias-Fano encoded.
+The encoding splits every value into L low bits, stored bit-packed, and the remaining high bits,
+stored in unary as a bit vector of about 2 bits per entry. With L = log2(nnz / size), an entry
+takes about L + 2 bits instead of 64, e.g. ~12 bits for 1000 entries per row.
+
+The position of every 256th set bit of the high bits is sampled, such that a random access is
+a lookup, a scan of the words up to the next sample and a select within a word. Ranges are decoded in a single
+sequential pass over the bits, which is used for the index pointers of streamed blocks.
+*/
+class IndptrArray
+{
+public:
+    // Readers encode index pointers with at least this many entries, shorter ones stay plain
+    static constexpr size_t compactMinSize = size_t{ 1 } << 20;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type        = std::int64_t;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = void;
+        using reference         = std::int64_t;
+
+        const_iterator() = default;
+        const_iterator(const IndptrArray* array, const difference_type pos) : _array(array), _pos(pos) {}
+
+        std::int64_t operator*() const { return (*_array)[static_cast<size_t>(_pos)]; }
+        std::int64_t operator[](const difference_type offset) const { return (*_array)[static_cast<size_t>(_pos + offset)]; }
+
+        const_iterator& operator++() { ++_pos; return *this; }
+        const_iterator& operator--() { --_pos; return *this; }
+        const_iterator operator++(int) { const_iterator it = *this; ++_pos; return it; }
+        const_iterator operator--(int) { const_iterator it = *this; --_pos; return it; }
+        const_iterator& operator+=(const difference_type offset) { _pos += offset; return *this; }
+        const_iterator& operator-=(const difference_type offset) { _pos -= offset; return *this; }
+
+        friend const_iterator operator+(const_iterator it, const difference_type offset) { return it += offset; }
+        friend const_iterator operator+(const difference_type offset, const_iterator it) { return it += offset; }
+        friend const_iterator operator-(const_iterator it, const difference_type offset) { return it -= offset; }
+        friend difference_type operator-(const const_iterator& a, const const_iterator& b) { return a._pos - b._pos; }
+
+        friend bool operator==(const const_iterator& a, const const_iterator& b) { return a._pos == b._pos; }
+        friend auto operator<=>(const const_iterator& a, const const_iterator& b) { return a._pos <=> b._pos; }
+
+    private:
+        const IndptrArray*  _array  = nullptr;
+        difference_type     _pos    = 0;
+    };
+
+public:
+    IndptrArray() = default;
+    IndptrArray(std::vector<std::int64_t> values) : _plain(std::move(values)), _size(_plain.size()) {}
+
+    // Elias-Fano encodes the values, false and unchanged if they are negative or decreasing
+    bool compact();
+
+    // Back to plain values
+    void expand();
+
+    bool isCompact() const { return _isCompact; }
+
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+
+    std::int64_t operator[](const size_t i) const { return _isCompact ? access(i) : _plain[i]; }
+    std::int64_t back() const { return (*this)[_size - 1]; }
+
+    const_iterator begin() const { return { this, 0 }; }
+    const_iterator end() const { return { this, static_cast<std::ptrdiff_t>(_size) }; }
+
+    // Writes the values [first, last) to dest
+    void decode(const size_t first, const size_t last, std::int64_t* dest) const;
+
+    std::vector<std::int64_t> toVector() const;
+
+    std::uint64_t getBytes() const;
+
+private:
+    std::int64_t access(const size_t i) const;
+
+    // Position of the i-th set bit of the high bits
+    std::uint64_t selectHigh(const size_t i) const;
+
+    std::uint64_t lowBits(const size_t i) const;
+
+private:
+    static constexpr std::uint32_t sampleShift = 8;     // Every 256th set bit is sampled
+
+    std::vector<std::int64_t>   _plain      = {};   // Empty if compact
+    size_t                      _size       = 0;
+    bool                        _isCompact  = false;
+    std::uint32_t               _lowWidth   = 0;    // L
+    std::vector<std::uint64_t>  _low        = {};   // L bits per value, one padding word
+    std::vector<std::uint64_t>  _high       = {};   // Value >> L in unary, the i-th set bit is at (value >> L) + i
+    std::vector<std::uint64_t>  _samples    = {};   // Position of every 256th set bit
+};
@@ -0,0 +1,116 @@
+#include "PointMapping.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+
+// =============================================================================
+// PointMapping
+// =============================================================================
+
+PointMapping PointMapping::join(const std::vector<std::string>& pointIds, const std::vector<std::string>& obsNames)
+{
+    PointMapping mapping;
+
+    if (obsNames.size() > static_cast<size_t>(std::numeric_limits<std::int32_t>::max())) {
+        std::cerr << "PointMapping::join: too many rows to map, using the row order" << std::endl;
+        return mapping;
+    }
+
+    if (pointIds == obsNames) {
+        mapping._numMatched = static_cast<std::int64_t>(pointIds.size());
+        return mapping;
+    }
+
+    const std::int64_t numPoints = static_cast<std::int64_t>(pointIds.size());
+    const std::int64_t numRows   = static_cast<std::int64_t>(obsNames.size());
+
+    mapping._rows.assign(pointIds.size(), -1);
+
+    if (numPoints <= numRows) {
+        // Hash the points, probe with the rows
+        std::unordered_map<std::string_view, std::int64_t> pointOfId;
+        pointOfId.reserve(pointIds.size());
+        for (std::int64_t point = 0; point < numPoints; ++point) {
+            pointOfId.emplace(pointIds[point], point);
+        }
+
+        std::vector<std::int64_t> pointOfRow(obsNames.size(), -1);
+
+#pragma omp parallel for
+        for (std::int64_t row = 0; row < numRows; ++row) {
+            const auto it = pointOfId.find(obsNames[row]);
+            if (it != pointOfId.end())
+                pointOfRow[row] = it->second;
+        }
+
+        // In row order such that the first of duplicate rows is kept
+        for (std::int64_t row = numRows - 1; row >= 0; --row) {
+            if (pointOfRow[row] >= 0)
+                mapping._rows[pointOfRow[row]] = static_cast<std::int32_t>(row);
+        }
+
+        // Duplicate point IDs all map to the same row
+        for (std::int64_t point = 0; point < numPoints; ++point) {
+            if (mapping._rows[point] < 0)
+                mapping._rows[point] = mapping._rows[pointOfId[pointIds[point]]];
+        }
+    }
+    else {
+        // Hash the rows, probe with the points
+        std::unordered_map<std::string_view, std::int32_t> rowOfName;
+        rowOfName.reserve(obsNames.size());
+        for (std::int64_t row = 0; row < numRows; ++row) {
+            rowOfName.emplace(obsNames[row], static_cast<std::int32_t>(row));
+        }
+
+#pragma omp parallel for
+        for (std::int64_t point = 0; point < numPoints; ++point) {
+            const auto it = rowOfName.find(pointIds[point]);
+            if (it != rowOfName.end())
+                mapping._rows[point] = it->second;
+        }
+    }
+
+    mapping._numMatched = std::count_if(mapping._rows.begin(), mapping._rows.end(), [](const std::int32_t row) { return row >= 0; });
+
+    return mapping;
+}
+
+std::vector<std::int64_t> PointMapping::rowsToPoints(const std::vector<std::int64_t>& rows, const std::int64_t numRows) const
+{
+    if (isIdentity())
+        return rows;
+
+    std::vector<char> isSelected(numRows, 0);
+    for (const std::int64_t row : rows) {
+        if (row >= 0 && row < numRows)
+            isSelected[row] = 1;
+    }
+
+    std::vector<std::int64_t> points;
+    for (size_t point = 0; point < _rows.size(); ++point) {
+        if (_rows[point] >= 0 && _rows[point] < numRows && isSelected[_rows[point]])
+            points.push_back(static_cast<std::int64_t>(point));
+    }
+
+    return points;
+}
+
+std::vector<std::int64_t> PointMapping::pointsToRows(const std::vector<std::int64_t>& points) const
+{
+    if (isIdentity())
+        return points;
+
+    std::vector<std::int64_t> rows;
+    rows.reserve(points.size());
+
+    for (const std::int64_t point : points) {
+        if (point >= 0 && point < static_cast<std::int64_t>(_rows.size()) && _rows[point] >= 0)
+            rows.push_back(_rows[point]);
+    }
+
+    return rows;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// PointMapping
+// =============================================================================
+
+/*
+Maps the points of an input data set to the rows of a matrix, for data sets that hold a
+filtered or reordered subset of the observations in the file. The point IDs are joined with
+the obs names of the file by a hash join: the shorter list is hashed and the longer one
+probes it in parallel. Only the row of each point is kept, as 32-bit integers, and no
+mapping at all if row i is point i.
+*/
+class PointMapping
+{
+public:
+    PointMapping() = default;       // Identity, row i is point i
+
+    // Points without a row of that name read as zeros, for duplicate obs names the first row is used
+    static PointMapping join(const std::vector<std::string>& pointIds, const std::vector<std::string>& obsNames);
+
+    bool isIdentity() const { return _rows.empty(); }
+    std::int64_t getNumMatched() const { return _numMatched; }
+
+    // Row of each point, -1 for points without a row, empty for the identity
+    const std::vector<std::int32_t>& getRows() const { return _rows; }
+
+    // Sorted points of the given rows, rows of no point are dropped
+    std::vector<std::int64_t> rowsToPoints(const std::vector<std::int64_t>& rows, const std::int64_t numRows) const;
+
+    // Rows of the given points in the same order, points without a row are dropped
+    std::vector<std::int64_t> pointsToRows(const std::vector<std::int64_t>& points) const;
+
+private:
+    std::vector<std::int32_t>   _rows       = {};
+    std::int64_t                _numMatched = 0;
+};
@@ -0,0 +1,123 @@
+#include "Quantization.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// =============================================================================
+// Output element types
+// =============================================================================
+
+std::string outputElementTypeToString(const OutputElementType& type)
+{
+    std::string typeStr = "";
+
+    switch (type)
+    {
+    case OutputElementType::FLOAT32:
+        typeStr = "float32";
+        break;
+    case OutputElementType::BFLOAT16:
+        typeStr = "bfloat16";
+        break;
+    case OutputElementType::UINT16:
+        typeStr = "uint16";
+        break;
+    case OutputElementType::UINT8:
+        typeStr = "uint8";
+        break;
+    }
+
+    return typeStr;
+}
+
+OutputElementType outputElementStringToType(const std::string& typeStr)
+{
+    OutputElementType type = OutputElementType::FLOAT32;
+
+    auto str_tolower = [](std::string str) -> std::string {
+        std::transform(str.begin(), str.end(), str.begin(), [](unsigned char c) { return std::tolower(c); });
+        return str;
+        };
+
+    const std::string typeStrLowerCase = str_tolower(typeStr);
+
+    if (typeStrLowerCase == "bfloat16")
+        type = OutputElementType::BFLOAT16;
+
+    if (typeStrLowerCase == "uint16")
+        type = OutputElementType::UINT16;
+
+    if (typeStrLowerCase == "uint8")
+        type = OutputElementType::UINT8;
+
+    return type;
+}
+
+// =============================================================================
+// Quantization
+// =============================================================================
+
+QuantizationParams computeQuantization(const std::vector<float>& values, const std::uint32_t maxLevel)
+{
+    QuantizationParams params = {};
+
+    if (values.empty() || maxLevel == 0)
+        return params;
+
+    const std::int64_t n = static_cast<std::int64_t>(values.size());
+
+    float minVal        = std::numeric_limits<float>::max();
+    float maxVal        = std::numeric_limits<float>::lowest();
+    std::int64_t nonInt = 0;
+
+#pragma omp parallel for reduction(min:minVal) reduction(max:maxVal) reduction(+:nonInt)
+    for (std::int64_t i = 0; i < n; ++i) {
+        const float v = values[i];
+
+        if (!std::isfinite(v))
+            continue;
+
+        minVal = std::min(minVal, v);
+        maxVal = std::max(maxVal, v);
+
+        if (v != std::nearbyint(v))
+            nonInt++;
+    }
+
+    if (minVal > maxVal)    // no finite values at all
+        return params;
+
+    // Counts fit without loss
+    if (nonInt == 0 && minVal >= 0.f && maxVal <= static_cast<float>(maxLevel))
+        return params;
+
+    params._offset = minVal;
+    params._scale  = (maxVal > minVal) ? (maxVal - minVal) / static_cast<float>(maxLevel) : 1.f;
+
+    return params;
+}
+
+std::uint16_t floatToBfloat16Bits(const float value)
+{
+    std::uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    // Keep NaNs quiet instead of rounding them to infinity
+    if (std::isnan(value))
+        return static_cast<std::uint16_t>((bits >> 16) | 0x0040u);
+
+    // Round to nearest even
+    const std::uint32_t roundingBias = 0x7FFFu + ((bits >> 16) & 1u);
+    return static_cast<std::uint16_t>((bits + roundingBias) >> 16);
+}
+
+float bfloat16BitsToFloat(const std::uint16_t bits)
+{
+    const std::uint32_t widened = static_cast<std::uint32_t>(bits) << 16;
+    float value = 0.f;
+    std::memcpy(&value, &widened, sizeof(value));
+    return value;
+}
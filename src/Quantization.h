@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// Output element types
+// =============================================================================
+
+enum class OutputElementType : std::int32_t {
+    FLOAT32,
+    BFLOAT16,
+    UINT16,
+    UINT8,
+};
+
+std::string outputElementTypeToString(const OutputElementType& type);
+OutputElementType outputElementStringToType(const std::string& type);
+
+// =============================================================================
+// Quantization
+// =============================================================================
+
+// Maps quantized values back to floats with: value = quantized * _scale + _offset
+struct QuantizationParams {
+    float _scale  = 1.f;
+    float _offset = 0.f;
+};
+
+// Integer-valued data within [0, maxLevel] is kept lossless with scale 1 and offset 0,
+// otherwise the value range [min, max] is spread linearly over [0, maxLevel]
+QuantizationParams computeQuantization(const std::vector<float>& values, const std::uint32_t maxLevel);
+
+std::uint16_t floatToBfloat16Bits(const float value);
+float bfloat16BitsToFloat(const std::uint16_t bits);
+
+template<typename T>
+inline T quantize(const float value, const QuantizationParams& params, const std::uint32_t maxLevel) {
+    const float level = (value - params._offset) / params._scale + 0.5f;
+
+    if (!(level > 0.f))     // also catches NaN
+        return T{ 0 };
+
+    if (level >= static_cast<float>(maxLevel))
+        return static_cast<T>(maxLevel);
+
+    return static_cast<T>(level);
+}
+
+template<typename T>
+inline float dequantize(const T value, const QuantizationParams& params) {
+    return static_cast<float>(value) * params._scale + params._offset;
+}
+
+// =============================================================================
+// Interleaving
+// =============================================================================
+
+// Interleaves per-dimension columns into a point-major buffer of the output type,
+// converting each value on the fly so that no intermediate float buffer is needed
+// pointRows maps each point to its row in the columns, -1 reads as zero, empty if row i is point i
+// Rows past the end of a column read as zero, e.g. with the identity for more points than rows
+template<typename T, typename Converter>
+std::vector<T> interleaveColumns(const std::vector<std::vector<float>>& columns, const size_t numPoints, Converter convert, const std::vector<std::int32_t>& pointRows = {}) {
+    const size_t numDims = columns.size();
+    std::vector<T> interleaved(numPoints * numDims);
+
+#pragma omp parallel for
+    for (std::int64_t point = 0; point < static_cast<std::int64_t>(numPoints); ++point) {
+        const std::int64_t row = pointRows.empty() ? point : pointRows[point];
+
+        for (size_t dim = 0; dim < numDims; ++dim) {
+            const bool inColumn = row >= 0 && static_cast<size_t>(row) < columns[dim].size();
+            interleaved[numDims * point + dim] = convert(inColumn ? columns[dim][row] : 0.f, dim);
+        }
+    }
+
+    return interleaved;
+}
+
+// Quantizes all columns to T with per-dimension scale and offset, which are written to params
+// The value range only covers the mapped rows
+template<typename T>
+std::vector<T> interleaveQuantized(const std::vector<std::vector<float>>& columns, const size_t numPoints, const std::uint32_t maxLevel, std::vector<QuantizationParams>& params, const std::vector<std::int32_t>& pointRows = {}) {
+    params.resize(columns.size());
+
+    std::vector<float> mapped;
+    for (size_t dim = 0; dim < columns.size(); ++dim) {
+        if (pointRows.empty() && columns[dim].size() == numPoints) {
+            params[dim] = computeQuantization(columns[dim], maxLevel);
+            continue;
+        }
+
+        mapped.resize(numPoints);
+        for (size_t point = 0; point < numPoints; ++point) {
+            const std::int64_t row = pointRows.empty() ? static_cast<std::int64_t>(point) : pointRows[point];
+            mapped[point] = row >= 0 && static_cast<size_t>(row) < columns[dim].size() ? columns[dim][row] : 0.f;
+        }
+        params[dim] = computeQuantization(mapped, maxLevel);
+    }
+
+    return interleaveColumns<T>(columns, numPoints, [&params, maxLevel](const float value, const size_t dim) -> T {
+        return quantize<T>(value, params[dim], maxLevel);
+        }, pointRows);
+}
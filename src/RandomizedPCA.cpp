@@ -0,0 +1,390 @@
+#include "RandomizedPCA.h"
+
+#include "H5Utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <vector>
+
+// =============================================================================
+// Dense helpers, all matrices are row-major
+// =============================================================================
+
+// Computes the l x l Gram matrix M^T M of a rows x l matrix
+static std::vector<double> gramMatrix(const std::vector<float>& M, const std::int64_t rows, const std::int64_t l) {
+    std::vector<double> G(l * l, 0.0);
+
+#pragma omp parallel
+    {
+        std::vector<double> G_local(l * l, 0.0);
+
+#pragma omp for
+        for (std::int64_t r = 0; r < rows; ++r) {
+            const float* m = &M[r * l];
+            for (std::int64_t i = 0; i < l; ++i) {
+                const double m_i = m[i];
+                for (std::int64_t j = i; j < l; ++j) {
+                    G_local[i * l + j] += m_i * m[j];
+                }
+            }
+        }
+
+#pragma omp critical
+        for (std::int64_t i = 0; i < l * l; ++i) {
+            G[i] += G_local[i];
+        }
+    }
+
+    for (std::int64_t i = 0; i < l; ++i) {
+        for (std::int64_t j = 0; j < i; ++j) {
+            G[i * l + j] = G[j * l + i];
+        }
+    }
+
+    return G;
+}
+
+// Cholesky-QR: M = Q R with G = M^T M = R^T R, Q overwrites M.
+// Numerically rank-deficient columns are set to zero.
+static void choleskyQR(std::vector<float>& M, const std::int64_t rows, const std::int64_t l) {
+    std::vector<double> R = gramMatrix(M, rows, l);
+
+    const double max_diag = *std::max_element(R.begin(), R.end());
+    const double eps      = std::max(max_diag, 1e-300) * 1e-12;
+
+    // Upper triangular Cholesky factor in place
+    std::vector<bool> degenerate(l, false);
+    for (std::int64_t j = 0; j < l; ++j) {
+        double diag = R[j * l + j];
+        for (std::int64_t k = 0; k < j; ++k) {
+            diag -= R[k * l + j] * R[k * l + j];
+        }
+
+        if (diag <= eps) {
+            degenerate[j] = true;
+            for (std::int64_t i = j; i < l; ++i) {
+                R[j * l + i] = 0.0;
+            }
+            R[j * l + j] = 1.0;
+            continue;
+        }
+
+        R[j * l + j] = std::sqrt(diag);
+
+        for (std::int64_t i = j + 1; i < l; ++i) {
+            double val = R[j * l + i];
+            for (std::int64_t k = 0; k < j; ++k) {
+                val -= R[k * l + j] * R[k * l + i];
+            }
+            R[j * l + i] = val / R[j * l + j];
+        }
+    }
+
+    // Q = M R^-1, i.e. solve x R = m for every row
+#pragma omp parallel for
+    for (std::int64_t r = 0; r < rows; ++r) {
+        float* m = &M[r * l];
+        for (std::int64_t j = 0; j < l; ++j) {
+            if (degenerate[j]) {
+                m[j] = 0.0f;
+                continue;
+            }
+
+            double val = m[j];
+            for (std::int64_t k = 0; k < j; ++k) {
+                val -= m[k] * R[k * l + j];
+            }
+            m[j] = static_cast<float>(val / R[j * l + j]);
+        }
+    }
+}
+
+// Two passes of Cholesky-QR give orthogonality close to machine precision
+static void orthonormalize(std::vector<float>& M, const std::int64_t rows, const std::int64_t l) {
+    choleskyQR(M, rows, l);
+    choleskyQR(M, rows, l);
+}
+
+// Eigen decomposition of a symmetric l x l matrix with cyclic Jacobi rotations,
+// eigenvalues are sorted in descending order, eigenvectors are the columns of V
+static void symmetricEigen(std::vector<double> A, const std::int64_t l, std::vector<double>& eigenvalues, std::vector<double>& V) {
+    V.assign(l * l, 0.0);
+    for (std::int64_t i = 0; i < l; ++i) {
+        V[i * l + i] = 1.0;
+    }
+
+    for (int sweep = 0; sweep < 100; ++sweep) {
+        double off = 0.0;
+        for (std::int64_t p = 0; p < l; ++p) {
+            for (std::int64_t q = p + 1; q < l; ++q) {
+                off += A[p * l + q] * A[p * l + q];
+            }
+        }
+
+        if (off < 1e-22) {
+            break;
+        }
+
+        for (std::int64_t p = 0; p < l; ++p) {
+            for (std::int64_t q = p + 1; q < l; ++q) {
+                const double a_pq = A[p * l + q];
+                if (std::abs(a_pq) < 1e-300) {
+                    continue;
+                }
+
+                const double theta = (A[q * l + q] - A[p * l + p]) / (2.0 * a_pq);
+                const double t     = (theta >= 0.0 ? 1.0 : -1.0) / (std::abs(theta) + std::sqrt(theta * theta + 1.0));
+                const double c     = 1.0 / std::sqrt(t * t + 1.0);
+                const double s     = t * c;
+
+                for (std::int64_t k = 0; k < l; ++k) {
+                    const double a_kp = A[k * l + p];
+                    const double a_kq = A[k * l + q];
+                    A[k * l + p] = c * a_kp - s * a_kq;
+                    A[k * l + q] = s * a_kp + c * a_kq;
+                }
+
+                for (std::int64_t k = 0; k < l; ++k) {
+                    const double a_pk = A[p * l + k];
+                    const double a_qk = A[q * l + k];
+                    A[p * l + k] = c * a_pk - s * a_qk;
+                    A[q * l + k] = s * a_pk + c * a_qk;
+                }
+
+                for (std::int64_t k = 0; k < l; ++k) {
+                    const double v_kp = V[k * l + p];
+                    const double v_kq = V[k * l + q];
+                    V[k * l + p] = c * v_kp - s * v_kq;
+                    V[k * l + q] = s * v_kp + c * v_kq;
+                }
+            }
+        }
+    }
+
+    // Sort descending
+    std::vector<std::int64_t> order(l);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&A, l](std::int64_t a, std::int64_t b) { return A[a * l + a] > A[b * l + b]; });
+
+    std::vector<double> V_sorted(l * l);
+    eigenvalues.resize(l);
+    for (std::int64_t j = 0; j < l; ++j) {
+        eigenvalues[j] = A[order[j] * l + order[j]];
+        for (std::int64_t k = 0; k < l; ++k) {
+            V_sorted[k * l + j] = V[k * l + order[j]];
+        }
+    }
+    V = std::move(V_sorted);
+}
+
+// =============================================================================
+// Streamed sparse-times-dense products
+// =============================================================================
+
+// out = A * D (transpose = false, D is num_cols x l, out is num_rows x l) or
+// out = A^T * D (transpose = true, D is num_rows x l, out is num_cols x l)
+// Values are transformed like rows and columns of the reader
+// Optionally accumulates the column sums of A in the same pass
+static bool streamedProduct(const SparseMatrixReader& reader, const std::vector<float>& D, std::vector<float>& out, const std::int64_t l, const bool transpose, const std::int64_t blockNnz, std::vector<double>* columnSums = nullptr) {
+    const bool rowsArePrimary = reader.getType() != SparseMatrixType::CSC;
+
+    // With D indexed by the secondary axis the output is indexed by the primary axis and rows do not conflict
+    const bool gather = (rowsArePrimary != transpose);
+
+    const ValueTransformer transform = reader.getValueTransformer();
+    std::vector<float> transformed;
+
+    std::fill(out.begin(), out.end(), 0.0f);
+
+    return reader.streamBlocks([&](const PrimaryBlock& block) {
+        const std::int64_t num_arrs = block._end - block._begin;
+        const std::vector<float>& values = transformBlockValues(block, transform, transformed);
+
+        if (gather) {
+#pragma omp parallel for schedule(dynamic, 64)
+            for (std::int64_t a = 0; a < num_arrs; ++a) {
+                float* o = &out[(block._begin + a) * l];
+                for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                    const float v  = values[i];
+                    const float* d = &D[block._indices[i] * l];
+                    for (std::int64_t c = 0; c < l; ++c) {
+                        o[c] += v * d[c];
+                    }
+                }
+            }
+        }
+        else {
+            // Scattered writes, every thread owns one output column
+#pragma omp parallel for
+            for (std::int64_t c = 0; c < l; ++c) {
+                for (std::int64_t a = 0; a < num_arrs; ++a) {
+                    const float d = D[(block._begin + a) * l + c];
+                    if (d == 0.0f) {
+                        continue;
+                    }
+                    for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                        out[block._indices[i] * l + c] += values[i] * d;
+                    }
+                }
+            }
+        }
+
+        if (columnSums != nullptr) {
+            std::vector<double>& sums = *columnSums;
+            if (rowsArePrimary) {
+                for (size_t i = 0; i < block._indices.size(); ++i) {
+                    sums[block._indices[i]] += values[i];
+                }
+            }
+            else {
+                for (std::int64_t a = 0; a < num_arrs; ++a) {
+                    for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                        sums[block._begin + a] += values[i];
+                    }
+                }
+            }
+        }
+
+        }, /* readValues = */ true, blockNnz);
+}
+
+// Applies the implicit centering of A * D: out -= 1 * (mean^T D)
+static void centerRows(std::vector<float>& out, const std::vector<float>& D, const std::vector<double>& mean, const std::int64_t num_rows, const std::int64_t num_cols, const std::int64_t l) {
+    std::vector<double> correction(l, 0.0);
+    for (std::int64_t j = 0; j < num_cols; ++j) {
+        for (std::int64_t c = 0; c < l; ++c) {
+            correction[c] += mean[j] * D[j * l + c];
+        }
+    }
+
+#pragma omp parallel for
+    for (std::int64_t r = 0; r < num_rows; ++r) {
+        for (std::int64_t c = 0; c < l; ++c) {
+            out[r * l + c] -= static_cast<float>(correction[c]);
+        }
+    }
+}
+
+// Applies the implicit centering of A^T * D: out -= mean * (1^T D)
+static void centerColumns(std::vector<float>& out, const std::vector<float>& D, const std::vector<double>& mean, const std::int64_t num_rows, const std::int64_t num_cols, const std::int64_t l) {
+    std::vector<double> column_sums(l, 0.0);
+    for (std::int64_t r = 0; r < num_rows; ++r) {
+        for (std::int64_t c = 0; c < l; ++c) {
+            column_sums[c] += D[r * l + c];
+        }
+    }
+
+#pragma omp parallel for
+    for (std::int64_t j = 0; j < num_cols; ++j) {
+        for (std::int64_t c = 0; c < l; ++c) {
+            out[j * l + c] -= static_cast<float>(mean[j] * column_sums[c]);
+        }
+    }
+}
+
+// =============================================================================
+// Randomized PCA
+// =============================================================================
+
+bool computeRandomizedPCA(const SparseMatrixReader& reader, const RandomizedPCASettings& settings, RandomizedPCAResult& result, const std::function<void(float)>& progress)
+{
+    const std::int64_t num_rows = reader.getNumRows();
+    const std::int64_t num_cols = reader.getNumCols();
+
+    if (num_rows < 2 || num_cols < 1 || settings._numComponents < 1) {
+        std::cerr << "computeRandomizedPCA: matrix too small or no components requested" << std::endl;
+        return false;
+    }
+
+    const std::int64_t l = std::min({ settings._numComponents + std::max<std::int64_t>(settings._oversampling, 0), num_rows, num_cols });
+    const std::int64_t k = std::min(settings._numComponents, l);
+
+    const std::int64_t num_passes = 2 + 2 * std::max<std::int64_t>(settings._powerIterations, 0);
+    std::int64_t pass = 0;
+    auto reportProgress = [&]() {
+        if (progress) {
+            progress(static_cast<float>(++pass) / static_cast<float>(num_passes));
+        }
+        };
+
+    // Random gaussian test matrix
+    std::vector<float> Z(num_cols * l);
+    {
+        std::mt19937_64 rng(settings._seed);
+        std::normal_distribution<float> normal(0.0f, 1.0f);
+        std::generate(Z.begin(), Z.end(), [&]() { return normal(rng); });
+    }
+
+    // Y = (A - 1 mean^T) Omega, column means are gathered in the same pass
+    std::vector<float> Y(num_rows * l);
+    std::vector<double> mean(num_cols, 0.0);
+
+    if (!streamedProduct(reader, Z, Y, l, /* transpose = */ false, settings._blockNnz, &mean)) {
+        return false;
+    }
+
+    for (double& m : mean) {
+        m /= static_cast<double>(num_rows);
+    }
+
+    centerRows(Y, Z, mean, num_rows, num_cols, l);
+    orthonormalize(Y, num_rows, l);
+    reportProgress();
+
+    // Power iterations sharpen the spectrum
+    for (std::int64_t it = 0; it < settings._powerIterations; ++it) {
+        if (!streamedProduct(reader, Y, Z, l, /* transpose = */ true, settings._blockNnz)) {
+            return false;
+        }
+        centerColumns(Z, Y, mean, num_rows, num_cols, l);
+        orthonormalize(Z, num_cols, l);
+        reportProgress();
+
+        if (!streamedProduct(reader, Z, Y, l, /* transpose = */ false, settings._blockNnz)) {
+            return false;
+        }
+        centerRows(Y, Z, mean, num_rows, num_cols, l);
+        orthonormalize(Y, num_rows, l);
+        reportProgress();
+    }
+
+    // B^T = (A - 1 mean^T)^T Q, the eigen decomposition of B B^T gives the left singular vectors of B
+    if (!streamedProduct(reader, Y, Z, l, /* transpose = */ true, settings._blockNnz)) {
+        return false;
+    }
+    centerColumns(Z, Y, mean, num_rows, num_cols, l);
+
+    std::vector<double> eigenvalues, V;
+    symmetricEigen(gramMatrix(Z, num_cols, l), l, eigenvalues, V);
+
+    // Scores are Q * V * Sigma
+    result._numComponents = k;
+    result._scores.assign(num_rows * k, 0.0f);
+    result._explainedVariance.resize(k);
+
+    std::vector<double> sigma(k);
+    for (std::int64_t i = 0; i < k; ++i) {
+        const double lambda = std::max(eigenvalues[i], 0.0);
+        sigma[i] = std::sqrt(lambda);
+        result._explainedVariance[i] = static_cast<float>(lambda / static_cast<double>(num_rows - 1));
+    }
+
+#pragma omp parallel for
+    for (std::int64_t r = 0; r < num_rows; ++r) {
+        const float* q = &Y[r * l];
+        for (std::int64_t i = 0; i < k; ++i) {
+            double score = 0.0;
+            for (std::int64_t c = 0; c < l; ++c) {
+                score += q[c] * V[c * l + i];
+            }
+            result._scores[r * k + i] = static_cast<float>(score * sigma[i]);
+        }
+    }
+
+    reportProgress();
+
+    return true;
+}
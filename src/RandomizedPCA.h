@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+class SparseMatrixReader;
+
+// =============================================================================
+// Out-of-core randomized PCA
+// =============================================================================
+
+/*
+Randomized SVD (Halko, Martinsson & Tropp, 2011) of the column-centered matrix A - 1 * mean^T.
+The sparse matrix is streamed from disk in indptr-aligned blocks for every product with A,
+the centering is applied implicitly as a rank-one correction, so A is never densified.
+A holds the values as rows and columns are read, i.e. with the value transform of the reader.
+Apart from the n x l result, memory is bounded by the block size and the m x l projection,
+where n is the number of rows, m the number of columns and l = components + oversampling.
+*/
+
+struct RandomizedPCASettings {
+    std::int64_t    _numComponents      = 10;
+    std::int64_t    _oversampling       = 10;
+    std::int64_t    _powerIterations    = 2;
+    std::uint64_t   _seed               = 42;
+    std::int64_t    _blockNnz           = std::int64_t{ 1 } << 20;
+};
+
+struct RandomizedPCAResult {
+    std::vector<float>  _scores             = {};   // Row-major num_rows x numComponents
+    std::vector<float>  _explainedVariance  = {};   // Per component
+    std::int64_t        _numComponents      = 0;
+};
+
+// progress is called with values in [0, 1]
+bool computeRandomizedPCA(const SparseMatrixReader& reader, const RandomizedPCASettings& settings, RandomizedPCAResult& result, const std::function<void(float)>& progress = {});
@@ -0,0 +1,120 @@
+#include "ReaderRegistry.h"
+
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <system_error>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// File identity
+// =============================================================================
+
+bool readFileIdentity(const std::string& filename, FileIdentity& identity) {
+    std::error_code error;
+
+    const fs::path canonicalPath = fs::canonical(filename, error);
+    if (error) {
+        return false;
+    }
+
+    identity._canonicalPath = canonicalPath.string();
+    identity._size          = fs::is_regular_file(canonicalPath, error) ? fs::file_size(canonicalPath, error) : 0;
+    identity._modified      = fs::last_write_time(canonicalPath, error).time_since_epoch().count();
+
+    return !error;
+}
+
+// =============================================================================
+// ReaderRegistry
+// =============================================================================
+
+ReaderRegistry& ReaderRegistry::instance() {
+    static ReaderRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<SparseMatrixReader> ReaderRegistry::acquire(const std::string& filename, const ValueTransform& transform, const H5AccessSettings& access) {
+    FileIdentity identity;
+    if (!readFileIdentity(filename, identity)) {
+        std::cerr << "ReaderRegistry::acquire: file does not exist " << filename << std::endl;
+        return nullptr;
+    }
+
+    const std::string key = identity._canonicalPath + valueTransformKey(transform) + h5AccessKey(access);
+
+    std::promise<SharedReader> opened;
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        removeExpired();
+
+        auto it = _entries.find(key);
+
+        if (it != _entries.end() && it->second._identity == identity) {
+            if (SharedReader reader = it->second._reader.lock()) {
+                return reader;
+            }
+
+            // Another thread opens this file, wait for its result
+            if (it->second._opening.valid()) {
+                std::shared_future<SharedReader> opening = it->second._opening;
+                lock.unlock();
+                return opening.get();
+            }
+        }
+
+        // Readers of an outdated version stay valid for their current owners
+        Entry& entry    = _entries[key];
+        entry._identity = identity;
+        entry._reader.reset();
+        entry._opening  = opened.get_future().share();
+    }
+
+    SharedReader reader;
+
+    try {
+        reader = openSparseMatrixReader(filename, access);
+
+        if (reader) {
+            reader->setValueTransform(transform);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "ReaderRegistry::acquire: " << e.what() << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _entries.find(key);
+
+        // The entry may have been replaced by an open of a newer version meanwhile
+        if (it != _entries.end() && it->second._identity == identity) {
+            if (reader) {
+                it->second._reader = reader;
+                it->second._opening = {};
+            }
+            else {
+                _entries.erase(it);
+            }
+        }
+    }
+
+    opened.set_value(reader);
+
+    return reader;
+}
+
+size_t ReaderRegistry::getNumOpen() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    removeExpired();
+    return _entries.size();
+}
+
+void ReaderRegistry::removeExpired() {
+    std::erase_if(_entries, [](const auto& item) {
+        return item.second._reader.expired() && !item.second._opening.valid();
+        });
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "H5Utils.h"
+
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// =============================================================================
+// ReaderRegistry
+// =============================================================================
+
+// Identifies a file on disk independent of the path it was opened with
+struct FileIdentity {
+    std::string     _canonicalPath  = "";
+    std::uintmax_t  _size           = 0;    // 0 for directories, e.g. Zarr stores
+    std::int64_t    _modified       = 0;    // Last write time in file clock ticks
+
+    bool operator==(const FileIdentity& other) const = default;
+};
+
+// Returns false if the file does not exist
+bool readFileIdentity(const std::string& filename, FileIdentity& identity);
+
+/*
+Process-wide registry of open readers, such that several plugin instances on the
+same file share one reader: the file handles, indptr, obs and var names and the
+array cache are read and stored once.
+
+Readers are reference counted, the registry only keeps weak references and a file
+is closed once the last instance releases it. Readers are keyed by canonical path, value
+transform and file access settings, instances that transform the values differently or open
+the file with other HDF5 settings use separate readers.
+A file that is rewritten on disk (different size or modification time) is opened anew.
+Concurrent acquires of the same file wait for a single open.
+*/
+class ReaderRegistry
+{
+public:
+    static ReaderRegistry& instance();
+
+    // Opens the file with openSparseMatrixReader or returns the reader that is already open, nullptr on failure
+    std::shared_ptr<SparseMatrixReader> acquire(const std::string& filename, const ValueTransform& transform = {}, const H5AccessSettings& access = {});
+
+    // Number of files that are currently open
+    size_t getNumOpen();
+
+private:
+    ReaderRegistry() = default;
+
+    using SharedReader = std::shared_ptr<SparseMatrixReader>;
+
+    struct Entry {
+        FileIdentity                        _identity   = {};
+        std::weak_ptr<SparseMatrixReader>   _reader     = {};
+        std::shared_future<SharedReader>    _opening    = {};   // Valid while the file is being opened
+    };
+
+    void removeExpired();
+
+private:
+    std::mutex                      _mutex      = {};
+    std::map<std::string, Entry>    _entries    = {};   // Keyed by canonical path, value transform and file access key
+};
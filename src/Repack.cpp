@@ -0,0 +1,876 @@
+#include "Repack.h"
+
+#include "H5Utils.h"
+
+#include <H5Cpp.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <sys/clonefile.h>
+#endif
+
+// =============================================================================
+// Chunk writer
+// =============================================================================
+
+// Byte order of the HDF5 shuffle filter: first bytes of all elements, then all second bytes, ...
+static void shuffleBytes(const unsigned char* src, const size_t elementSize, const size_t numElements, unsigned char* dest) {
+    for (size_t i = 0; i < numElements; ++i) {
+        for (size_t b = 0; b < elementSize; ++b) {
+            dest[b * numElements + i] = src[i * elementSize + b];
+        }
+    }
+}
+
+// Appends to a chunked 1D dataset, full chunks are encoded in parallel and written with direct chunk writes
+template<typename T>
+class ChunkWriter {
+public:
+    // Extendible datasets grow with the appended values, otherwise their size must be known upfront
+    ChunkWriter(const H5::DataSet& dataset, const std::int64_t chunkSize, const int compressionLevel, const bool extendible = false) :
+        _dataset(dataset),
+        _chunkSize(std::max<std::int64_t>(chunkSize, 1)),
+        _compressionLevel(compressionLevel),
+        _extendible(extendible)
+    {
+        // Encode enough chunks at once to keep all threads busy, about 32 MiB of raw data
+        const std::int64_t chunkBytes = _chunkSize * static_cast<std::int64_t>(sizeof(T));
+        _chunksPerFlush = std::clamp<std::int64_t>((std::int64_t{ 32 } << 20) / chunkBytes, 4, 256);
+        _buffer.reserve(_chunkSize * _chunksPerFlush);
+    }
+
+    template<typename S>
+    void append(const S* values, const std::int64_t count) {
+        const std::int64_t capacity = _chunkSize * _chunksPerFlush;
+
+        std::int64_t pos = 0;
+        while (pos < count) {
+            const std::int64_t num = std::min(count - pos, capacity - static_cast<std::int64_t>(_buffer.size()));
+            std::transform(values + pos, values + pos + num, std::back_inserter(_buffer), [](const S value) { return static_cast<T>(value); });
+            pos += num;
+            _numAppended += num;
+
+            if (static_cast<std::int64_t>(_buffer.size()) == capacity) {
+                flush(false);
+            }
+        }
+    }
+
+    // Writes the remaining values, the last chunk is padded with zeros
+    void finish() {
+        flush(true);
+
+        if (_extendible) {
+            std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+            const hsize_t size = static_cast<hsize_t>(_numAppended);
+            _dataset.extend(&size);
+        }
+    }
+
+private:
+    void flush(const bool all) {
+        const std::int64_t numValues = static_cast<std::int64_t>(_buffer.size());
+        const std::int64_t numChunks = all ? (numValues + _chunkSize - 1) / _chunkSize : numValues / _chunkSize;
+
+        if (numChunks == 0) {
+            return;
+        }
+
+        const size_t chunkBytes = static_cast<size_t>(_chunkSize) * sizeof(T);
+        std::vector<std::vector<unsigned char>> encoded(numChunks);
+        std::vector<int> status(numChunks, Z_OK);
+
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t k = 0; k < numChunks; ++k) {
+            std::vector<T> chunk(_chunkSize, T{ 0 });
+            const std::int64_t first = k * _chunkSize;
+            std::copy(_buffer.begin() + first, _buffer.begin() + std::min(first + _chunkSize, numValues), chunk.begin());
+
+            const unsigned char* raw = reinterpret_cast<const unsigned char*>(chunk.data());
+
+            if (_compressionLevel <= 0) {
+                encoded[k].assign(raw, raw + chunkBytes);
+                continue;
+            }
+
+            std::vector<unsigned char> shuffled(chunkBytes);
+            shuffleBytes(raw, sizeof(T), static_cast<size_t>(_chunkSize), shuffled.data());
+
+            uLongf size = compressBound(static_cast<uLong>(chunkBytes));
+            encoded[k].resize(size);
+            status[k] = compress2(encoded[k].data(), &size, shuffled.data(), static_cast<uLong>(chunkBytes), _compressionLevel);
+            encoded[k].resize(size);
+        }
+
+        if (std::any_of(status.begin(), status.end(), [](const int s) { return s != Z_OK; })) {
+            throw std::runtime_error("compressing a chunk failed");
+        }
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+            if (_extendible) {
+                const hsize_t size = static_cast<hsize_t>((_chunksWritten + numChunks) * _chunkSize);
+                _dataset.extend(&size);
+            }
+
+            for (std::int64_t k = 0; k < numChunks; ++k) {
+                const hsize_t offset = static_cast<hsize_t>((_chunksWritten + k) * _chunkSize);
+
+                if (H5Dwrite_chunk(_dataset.getId(), H5P_DEFAULT, 0, &offset, encoded[k].size(), encoded[k].data()) < 0) {
+                    throw std::runtime_error("writing a chunk failed");
+                }
+            }
+        }
+
+        _chunksWritten += numChunks;
+        _buffer.erase(_buffer.begin(), _buffer.begin() + std::min(numChunks * _chunkSize, numValues));
+    }
+
+private:
+    H5::DataSet     _dataset;
+    std::int64_t    _chunkSize          = 1;
+    std::int64_t    _chunksPerFlush     = 4;
+    std::int64_t    _chunksWritten      = 0;
+    std::int64_t    _numAppended        = 0;
+    int             _compressionLevel   = 1;
+    bool            _extendible         = false;
+    std::vector<T>  _buffer             = {};
+};
+
+// =============================================================================
+// anndata output helpers
+// =============================================================================
+
+static void writeStringAttribute(H5::H5Object& object, const std::string& name, const std::string& value) {
+    H5::StrType type(H5::PredType::C_S1, H5T_VARIABLE);
+    type.setCset(H5T_CSET_UTF8);
+
+    H5::Attribute attr = object.createAttribute(name, type, H5::DataSpace(H5S_SCALAR));
+    attr.write(type, value);
+}
+
+static void writeEncoding(H5::H5Object& object, const std::string& type, const std::string& version) {
+    writeStringAttribute(object, "encoding-type", type);
+    writeStringAttribute(object, "encoding-version", version);
+}
+
+static void writeShapeAttribute(H5::Group& group, const std::int64_t numRows, const std::int64_t numCols) {
+    const std::array<std::int64_t, 2> shape = { numRows, numCols };
+    const hsize_t size = 2;
+
+    H5::Attribute attr = group.createAttribute("shape", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &size));
+    attr.write(H5::PredType::NATIVE_INT64, shape.data());
+}
+
+static void writeStringDataset(H5::Group& group, const std::string& name, const std::vector<std::string>& values) {
+    H5::StrType type(H5::PredType::C_S1, H5T_VARIABLE);
+    type.setCset(H5T_CSET_UTF8);
+
+    const hsize_t size = values.size();
+    H5::DataSet dataset = group.createDataSet(name, type, H5::DataSpace(1, &size));
+
+    std::vector<const char*> pointers(values.size());
+    std::transform(values.begin(), values.end(), pointers.begin(), [](const std::string& value) { return value.c_str(); });
+
+    if (!pointers.empty()) {
+        dataset.write(pointers.data(), type);
+    }
+
+    writeEncoding(dataset, "string-array", "0.2.0");
+}
+
+// Fields of a value transform as numeric scalars in a dict, read back with the file, see getStoredValueTransform
+static void writeValueTransform(H5::Group& parent, const ValueTransform& transform) {
+    H5::Group group = parent.createGroup("value_transform");
+    writeEncoding(group, "dict", "0.1.0");
+
+    auto writeScalar = [&group](const std::string& name, const double value) {
+        H5::DataSet dataset = group.createDataSet(name, H5::PredType::NATIVE_DOUBLE, H5::DataSpace(H5S_SCALAR));
+        dataset.write(&value, H5::PredType::NATIVE_DOUBLE);
+        writeEncoding(dataset, "numeric-scalar", "0.2.0");
+        };
+
+    writeScalar("normalize_totals", transform._normalizeTotals ? 1.0 : 0.0);
+    writeScalar("target_sum", transform._targetSum);
+    writeScalar("log1p", transform._log1p ? 1.0 : 0.0);
+    writeScalar("scale", transform._scale);
+    writeScalar("clip_max", transform._clipMax);
+}
+
+// Dataframe with only an index, names default to the array positions like in anndata
+static void writeIndexDataframe(H5::H5File& file, const std::string& name, std::vector<std::string> names, const std::int64_t size) {
+    if (static_cast<std::int64_t>(names.size()) != size) {
+        names.resize(size);
+        for (std::int64_t i = 0; i < size; ++i) {
+            names[i] = std::to_string(i);
+        }
+    }
+
+    H5::Group group = file.createGroup(name);
+    writeEncoding(group, "dataframe", "0.2.0");
+    writeStringAttribute(group, "_index", "_index");
+
+    const hsize_t noColumns = 0;
+    group.createAttribute("column-order", H5::PredType::NATIVE_DOUBLE, H5::DataSpace(1, &noColumns));
+
+    writeStringDataset(group, "_index", names);
+}
+
+// Extendible datasets start empty and have no size limit
+static H5::DataSet createArrayDataset(H5::Group& group, const std::string& name, const H5::PredType& type, const std::int64_t size, const std::int64_t chunkSize, const int compressionLevel, const bool extendible = false) {
+    const hsize_t dims = extendible ? 0 : static_cast<hsize_t>(size);
+    const hsize_t maxDims = extendible ? H5S_UNLIMITED : dims;
+    H5::DSetCreatPropList plist;
+
+    if (size > 0 || extendible) {
+        const hsize_t chunk = static_cast<hsize_t>(chunkSize);
+        plist.setChunk(1, &chunk);
+
+        if (compressionLevel > 0) {
+            plist.setShuffle();
+            plist.setDeflate(compressionLevel);
+        }
+    }
+
+    return group.createDataSet(name, type, H5::DataSpace(1, &dims, &maxDims), plist);
+}
+
+// =============================================================================
+// Repacking
+// =============================================================================
+
+std::int64_t repackChunkSize(const std::int64_t nnz, const std::int64_t numPrimary) {
+    if (nnz <= 0) {
+        return 1;
+    }
+
+    const std::int64_t arrays  = std::max<std::int64_t>(numPrimary, 1);
+    const std::int64_t average = (nnz + arrays - 1) / arrays;
+    const std::int64_t chunk   = static_cast<std::int64_t>(std::bit_ceil(static_cast<std::uint64_t>(4 * average)));
+
+    return std::min(std::clamp<std::int64_t>(chunk, 4096, std::int64_t{ 1 } << 20), nnz);
+}
+
+using BlockRange = std::pair<std::int64_t, std::int64_t>;   // [first, last) target array
+
+// One output copy: which axis is primary and how many entries each primary array gets
+struct CopyPlan {
+    bool                        _rowsArePrimary = true;
+    std::int64_t                _numPrimary     = 0;
+    std::int64_t                _numSecondary   = 0;
+    std::vector<std::int64_t>   _indptr         = {};
+    std::vector<BlockRange>     _passes         = {};   // Target arrays gathered per pass, empty for a direct copy
+};
+
+// Calls visit(row, col, i) for every entry i of the block
+template<typename Visit>
+static void forEachEntry(const PrimaryBlock& block, const bool rowsArePrimary, Visit&& visit) {
+    for (std::int64_t a = 0; a < block._end - block._begin; ++a) {
+        const std::int64_t primary = block._begin + a;
+
+        for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+            if (rowsArePrimary)
+                visit(primary, block._indices[i], i);
+            else
+                visit(block._indices[i], primary, i);
+        }
+    }
+}
+
+// Ranges of target arrays whose entries fit into maxEntries, a single array may exceed it
+static std::vector<BlockRange> planPasses(const std::vector<std::int64_t>& indptr, const std::int64_t maxEntries) {
+    std::vector<BlockRange> passes;
+    const std::int64_t numArrays = static_cast<std::int64_t>(indptr.size()) - 1;
+
+    std::int64_t begin = 0;
+    while (begin < numArrays) {
+        std::int64_t end = begin + 1;
+        while (end < numArrays && indptr[end + 1] - indptr[begin] <= maxEntries) {
+            ++end;
+        }
+
+        passes.emplace_back(begin, end);
+        begin = end;
+    }
+
+    return passes;
+}
+
+// Sorts the entries of every array by secondary index, input files are not required to be canonical
+static void sortArrays(const std::int64_t* indptr, const std::int64_t numArrays, const std::int64_t offset, std::vector<std::int64_t>& indices, std::vector<float>& values) {
+#pragma omp parallel for schedule(dynamic, 64)
+    for (std::int64_t a = 0; a < numArrays; ++a) {
+        const std::int64_t from = indptr[a] - offset;
+        const std::int64_t to   = indptr[a + 1] - offset;
+
+        if (std::is_sorted(indices.begin() + from, indices.begin() + to)) {
+            continue;
+        }
+
+        std::vector<std::pair<std::int64_t, float>> entries(to - from);
+        for (std::int64_t i = from; i < to; ++i) {
+            entries[i - from] = { indices[i], values[i] };
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+
+        for (std::int64_t i = from; i < to; ++i) {
+            indices[i] = entries[i - from].first;
+            values[i]  = entries[i - from].second;
+        }
+    }
+}
+
+template<typename Index>
+static void writeCopy(const SparseMatrixReader& reader, H5::Group& group, const H5::PredType& indexType, const CopyPlan& plan, const std::vector<std::int64_t>& rowRank, const RepackSettings& settings, const std::int64_t chunkSize, const std::function<void()>& passDone) {
+    const bool inputRowsArePrimary = reader.getType() != SparseMatrixType::CSC;
+    const std::int64_t nnz         = plan._indptr.back();
+
+    H5::DataSet indicesDataset, valuesDataset;
+
+    {
+        std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+        indicesDataset = createArrayDataset(group, "indices", indexType, nnz, chunkSize, settings._compressionLevel);
+        valuesDataset  = createArrayDataset(group, "data", H5::PredType::NATIVE_FLOAT, nnz, chunkSize, settings._compressionLevel);
+
+        const hsize_t indptrSize = plan._indptr.size();
+        H5::DataSet indptrDataset = group.createDataSet("indptr", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &indptrSize));
+        indptrDataset.write(plan._indptr.data(), H5::PredType::NATIVE_INT64);
+    }
+
+    ChunkWriter<Index> indicesWriter(indicesDataset, chunkSize, settings._compressionLevel);
+    ChunkWriter<float> valuesWriter(valuesDataset, chunkSize, settings._compressionLevel);
+
+    auto newRow = [&rowRank](const std::int64_t row) { return rowRank.empty() ? row : rowRank[row]; };
+
+    auto writeEntries = [&](const std::int64_t* indptr, const std::int64_t numArrays, const std::int64_t offset, std::vector<std::int64_t>& indices, std::vector<float>& values) {
+        sortArrays(indptr, numArrays, offset, indices, values);
+        indicesWriter.append(indices.data(), static_cast<std::int64_t>(indices.size()));
+        valuesWriter.append(values.data(), static_cast<std::int64_t>(values.size()));
+        };
+
+    bool streamed = true;
+
+    if (nnz > 0 && plan._passes.empty()) {
+        // Target arrays are the input arrays in the same order, only secondary indices may be renamed
+        std::vector<std::int64_t> indices;
+        std::vector<float> values;
+
+        streamed = reader.streamBlocks([&](const PrimaryBlock& block) {
+            const std::int64_t numEntries = block._indptr.back();
+
+            indices.resize(numEntries);
+            values.assign(block._values.begin(), block._values.begin() + numEntries);
+
+            for (std::int64_t i = 0; i < numEntries; ++i) {
+                indices[i] = plan._rowsArePrimary ? block._indices[i] : newRow(block._indices[i]);
+            }
+
+            writeEntries(block._indptr.data(), block._end - block._begin, 0, indices, values);
+            }, true, settings._blockNnz);
+
+        passDone();
+    }
+
+    for (const auto& [begin, end] : plan._passes) {
+        if (!streamed) {
+            break;
+        }
+
+        const std::int64_t offset = plan._indptr[begin];
+        std::vector<std::int64_t> indices(plan._indptr[end] - offset);
+        std::vector<float> values(indices.size());
+
+        std::vector<std::int64_t> cursor(plan._indptr.begin() + begin, plan._indptr.begin() + end);
+        for (std::int64_t& pos : cursor) {
+            pos -= offset;
+        }
+
+        streamed = reader.streamBlocks([&](const PrimaryBlock& block) {
+            forEachEntry(block, inputRowsArePrimary, [&](const std::int64_t row, const std::int64_t col, const std::int64_t i) {
+                const std::int64_t target    = plan._rowsArePrimary ? newRow(row) : col;
+                const std::int64_t secondary = plan._rowsArePrimary ? col : newRow(row);
+
+                if (target < begin || target >= end) {
+                    return;
+                }
+
+                const std::int64_t pos = cursor[target - begin]++;
+                indices[pos] = secondary;
+                values[pos]  = block._values[i];
+                });
+            }, true, settings._blockNnz);
+
+        if (streamed) {
+            writeEntries(plan._indptr.data() + begin, end - begin, offset, indices, values);
+        }
+
+        passDone();
+    }
+
+    if (!streamed) {
+        throw std::runtime_error("reading the input failed");
+    }
+
+    indicesWriter.finish();
+    valuesWriter.finish();
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+    indicesDataset.close();
+    valuesDataset.close();
+}
+
+// Chooses the narrowest index type for the plan and writes the copy, returns the bytes per index
+static size_t writeCopyNarrowest(const SparseMatrixReader& reader, H5::Group& group, const CopyPlan& plan, const std::vector<std::int64_t>& rowRank, const RepackSettings& settings, const std::int64_t chunkSize, const std::function<void()>& passDone) {
+    const std::int64_t maxIndex = std::max<std::int64_t>(plan._numSecondary - 1, 0);
+
+    if (maxIndex <= std::numeric_limits<std::uint16_t>::max()) {
+        writeCopy<std::uint16_t>(reader, group, H5::PredType::NATIVE_UINT16, plan, rowRank, settings, chunkSize, passDone);
+        return sizeof(std::uint16_t);
+    }
+
+    if (maxIndex <= std::numeric_limits<std::int32_t>::max()) {
+        writeCopy<std::int32_t>(reader, group, H5::PredType::NATIVE_INT32, plan, rowRank, settings, chunkSize, passDone);
+        return sizeof(std::int32_t);
+    }
+
+    writeCopy<std::int64_t>(reader, group, H5::PredType::NATIVE_INT64, plan, rowRank, settings, chunkSize, passDone);
+    return sizeof(std::int64_t);
+}
+
+bool repackMatrix(const std::string& inputPath, const std::string& outputPath, const RepackSettings& settings, RepackResult& result, const std::function<void(float)>& progress) {
+    result = {};
+
+    if (std::filesystem::exists(outputPath) && std::filesystem::exists(inputPath) && std::filesystem::equivalent(inputPath, outputPath)) {
+        std::cerr << "repackMatrix: output must not overwrite the input " << inputPath << std::endl;
+        return false;
+    }
+
+    std::unique_ptr<SparseMatrixReader> reader = openSparseMatrixReader(inputPath);
+
+    if (!reader) {
+        return false;
+    }
+
+    const std::int64_t numRows         = reader->getNumRows();
+    const std::int64_t numCols         = reader->getNumCols();
+    const bool inputRowsArePrimary     = reader->getType() != SparseMatrixType::CSC;
+
+    RepackSettings config = settings;
+    config._compressionLevel = std::clamp(config._compressionLevel, 0, 9);
+    config._blockNnz         = std::max<std::int64_t>(config._blockNnz, 1);
+
+    // Pass 1: entries per row and column, and the largest variable of every row for reordering
+    std::vector<std::int64_t> rowCounts(numRows, 0);
+    std::vector<std::int64_t> colCounts(numCols, 0);
+    std::vector<std::int64_t> rowKeys(config._reorderRows ? numRows : 0, numCols);
+    std::vector<float> rowMax(config._reorderRows ? numRows : 0, 0.f);
+    bool validIndices = true;
+
+    const bool counted = reader->streamBlocks([&](const PrimaryBlock& block) {
+        forEachEntry(block, inputRowsArePrimary, [&](const std::int64_t row, const std::int64_t col, const std::int64_t i) {
+            if (row < 0 || row >= numRows || col < 0 || col >= numCols) {
+                validIndices = false;
+                return;
+            }
+
+            ++rowCounts[row];
+            ++colCounts[col];
+
+            if (config._reorderRows && std::abs(block._values[i]) > rowMax[row]) {
+                rowMax[row]  = std::abs(block._values[i]);
+                rowKeys[row] = col;
+            }
+            });
+        }, config._reorderRows, config._blockNnz);
+
+    if (!counted || !validIndices) {
+        std::cerr << "repackMatrix: cannot read " << inputPath << (validIndices ? "" : ", indices are out of range") << std::endl;
+        return false;
+    }
+
+    // Rows with the same largest variable are stored next to each other, empty rows go last
+    std::vector<std::int64_t> rowOrder;     // Output row -> input row
+    std::vector<std::int64_t> rowRank;      // Input row -> output row
+
+    if (config._reorderRows) {
+        std::vector<std::int64_t> bucketStart(numCols + 2, 0);
+        for (const std::int64_t key : rowKeys) {
+            ++bucketStart[key + 1];
+        }
+        std::partial_sum(bucketStart.begin(), bucketStart.end(), bucketStart.begin());
+
+        rowOrder.resize(numRows);
+        for (std::int64_t row = 0; row < numRows; ++row) {
+            rowOrder[bucketStart[rowKeys[row]]++] = row;
+        }
+
+        rowRank.resize(numRows);
+        for (std::int64_t n = 0; n < numRows; ++n) {
+            rowRank[rowOrder[n]] = n;
+        }
+    }
+
+    const std::int64_t maxEntries = std::max<std::int64_t>(config._memoryLimit / static_cast<std::int64_t>(sizeof(std::int64_t) + sizeof(float)), 1);
+
+    auto makePlan = [&](const bool rowsArePrimary) {
+        CopyPlan plan;
+        plan._rowsArePrimary = rowsArePrimary;
+        plan._numPrimary     = rowsArePrimary ? numRows : numCols;
+        plan._numSecondary   = rowsArePrimary ? numCols : numRows;
+
+        plan._indptr.assign(plan._numPrimary + 1, 0);
+        for (std::int64_t t = 0; t < plan._numPrimary; ++t) {
+            const std::int64_t count = rowsArePrimary ? rowCounts[rowOrder.empty() ? t : rowOrder[t]] : colCounts[t];
+            plan._indptr[t + 1] = plan._indptr[t] + count;
+        }
+
+        // Same primary axis in the same order: copy block by block, otherwise gather in passes
+        const bool direct = rowsArePrimary == inputRowsArePrimary && (!rowsArePrimary || rowOrder.empty());
+        if (!direct && plan._indptr.back() > 0) {
+            plan._passes = planPasses(plan._indptr, maxEntries);
+        }
+
+        return plan;
+        };
+
+    const CopyPlan csrPlan = makePlan(true);
+    const CopyPlan cscPlan = config._writeCsc ? makePlan(false) : CopyPlan{};
+
+    auto numPasses = [](const CopyPlan& plan) -> std::int64_t {
+        if (plan._indptr.empty() || plan._indptr.back() == 0)
+            return 0;
+        return plan._passes.empty() ? 1 : static_cast<std::int64_t>(plan._passes.size());
+        };
+
+    const std::int64_t totalPasses = 1 + numPasses(csrPlan) + (config._writeCsc ? numPasses(cscPlan) : 0);
+    result._numPasses = 1;
+
+    auto passDone = [&]() {
+        ++result._numPasses;
+        if (progress)
+            progress(static_cast<float>(result._numPasses) / static_cast<float>(totalPasses));
+        };
+
+    if (progress)
+        progress(1.f / static_cast<float>(totalPasses));
+
+    try {
+        std::unique_ptr<H5::H5File> file;
+        std::unique_ptr<H5::Group> csrGroup, cscGroup;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+            file = std::make_unique<H5::H5File>(outputPath, H5F_ACC_TRUNC);
+            writeEncoding(*file, "anndata", "0.1.0");
+
+            csrGroup = std::make_unique<H5::Group>(file->createGroup("X"));
+            writeEncoding(*csrGroup, "csr_matrix", "0.1.0");
+            writeShapeAttribute(*csrGroup, numRows, numCols);
+
+            if (config._writeCsc) {
+                H5::Group layers = file->createGroup("layers");
+                writeEncoding(layers, "dict", "0.1.0");
+
+                cscGroup = std::make_unique<H5::Group>(layers.createGroup("X_csc"));
+                writeEncoding(*cscGroup, "csc_matrix", "0.1.0");
+                writeShapeAttribute(*cscGroup, numRows, numCols);
+                writeStringAttribute(*cscGroup, "copy-of", "/X");
+            }
+
+            std::vector<std::string> obsNames = reader->getObsNames();
+            if (!rowOrder.empty() && static_cast<std::int64_t>(obsNames.size()) == numRows) {
+                std::vector<std::string> ordered(numRows);
+                for (std::int64_t n = 0; n < numRows; ++n) {
+                    ordered[n] = std::move(obsNames[rowOrder[n]]);
+                }
+                obsNames = std::move(ordered);
+            }
+
+            writeIndexDataframe(*file, "obs", std::move(obsNames), numRows);
+            writeIndexDataframe(*file, "var", reader->getVarNames(), numCols);
+
+            H5::Group uns = file->createGroup("uns");
+            writeEncoding(uns, "dict", "0.1.0");
+
+            if (!rowOrder.empty()) {
+                const hsize_t size = rowOrder.size();
+                H5::DataSet sourceRows = uns.createDataSet("repack_source_row", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &size));
+                sourceRows.write(rowOrder.data(), H5::PredType::NATIVE_INT64);
+                writeEncoding(sourceRows, "array", "0.2.0");
+            }
+        }
+
+        result._csrChunkSize  = repackChunkSize(csrPlan._indptr.back(), numRows);
+        result._csrIndexBytes = writeCopyNarrowest(*reader, *csrGroup, csrPlan, rowRank, config, result._csrChunkSize, passDone);
+
+        if (config._writeCsc) {
+            result._cscChunkSize  = repackChunkSize(cscPlan._indptr.back(), numCols);
+            result._cscIndexBytes = writeCopyNarrowest(*reader, *cscGroup, cscPlan, rowRank, config, result._cscChunkSize, passDone);
+        }
+
+        std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+        csrGroup = {};
+        cscGroup = {};
+        file     = {};
+    }
+    catch (...) {
+        try {
+            throw;
+        }
+        catch (const H5::Exception& e) {
+            std::cerr << "repackMatrix: " << e.getDetailMsg() << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "repackMatrix: " << e.what() << std::endl;
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+// =============================================================================
+// Column subsets
+// =============================================================================
+
+template<typename Index>
+static bool writeColumnSubset(const SparseMatrixReader& reader, H5::Group& group, const H5::PredType& indexType, const std::vector<std::int64_t>& columns, const RepackSettings& settings, const std::function<bool(float)>& progress) {
+    const std::int64_t numRows    = reader.getNumRows();
+    const std::int64_t numColumns = static_cast<std::int64_t>(columns.size());
+    const std::int64_t batchSize  = std::clamp<std::int64_t>(settings._memoryLimit / std::max<std::int64_t>(numRows * static_cast<std::int64_t>(sizeof(float)), 1), 1, std::max<std::int64_t>(numColumns, 1));
+
+    std::vector<std::int64_t> indptr(numColumns + 1, 0);
+
+    H5::DataSet indicesDataset, valuesDataset;
+    std::unique_ptr<ChunkWriter<Index>> indicesWriter;
+    std::unique_ptr<ChunkWriter<float>> valuesWriter;
+
+    for (std::int64_t begin = 0; begin < numColumns; begin += batchSize) {
+        const std::int64_t end = std::min(begin + batchSize, numColumns);
+        const std::vector<std::vector<float>> dense = reader.getColumnsImpl({ columns.begin() + begin, columns.begin() + end });
+
+        // Non-zero entries of every column, collected in parallel
+        std::vector<std::vector<std::int64_t>> indices(end - begin);
+        std::vector<std::vector<float>> values(end - begin);
+
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t c = 0; c < end - begin; ++c) {
+            for (std::int64_t row = 0; row < static_cast<std::int64_t>(dense[c].size()); ++row) {
+                if (dense[c][row] != 0.f) {
+                    indices[c].push_back(row);
+                    values[c].push_back(dense[c][row]);
+                }
+            }
+        }
+
+        // Chunks are sized once the density of the first batch is known
+        if (!indicesWriter) {
+            std::int64_t batchNnz = 0;
+            for (const auto& columnIndices : indices) {
+                batchNnz += static_cast<std::int64_t>(columnIndices.size());
+            }
+
+            const std::int64_t estimatedNnz = batchNnz * numColumns / (end - begin);
+            const std::int64_t chunkSize    = repackChunkSize(std::max<std::int64_t>(estimatedNnz, 4096), numColumns);
+
+            {
+                std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+                indicesDataset = createArrayDataset(group, "indices", indexType, 0, chunkSize, settings._compressionLevel, true);
+                valuesDataset  = createArrayDataset(group, "data", H5::PredType::NATIVE_FLOAT, 0, chunkSize, settings._compressionLevel, true);
+            }
+
+            indicesWriter = std::make_unique<ChunkWriter<Index>>(indicesDataset, chunkSize, settings._compressionLevel, true);
+            valuesWriter  = std::make_unique<ChunkWriter<float>>(valuesDataset, chunkSize, settings._compressionLevel, true);
+        }
+
+        for (std::int64_t c = 0; c < end - begin; ++c) {
+            indicesWriter->append(indices[c].data(), static_cast<std::int64_t>(indices[c].size()));
+            valuesWriter->append(values[c].data(), static_cast<std::int64_t>(values[c].size()));
+            indptr[begin + c + 1] = indptr[begin + c] + static_cast<std::int64_t>(indices[c].size());
+        }
+
+        if (progress && !progress(static_cast<float>(end) / static_cast<float>(numColumns))) {
+            return false;
+        }
+    }
+
+    if (indicesWriter) {
+        indicesWriter->finish();
+        valuesWriter->finish();
+    }
+
+    std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+    if (indicesWriter) {
+        indicesDataset.close();
+        valuesDataset.close();
+    }
+    else {
+        createArrayDataset(group, "indices", indexType, 0, 1, 0);
+        createArrayDataset(group, "data", H5::PredType::NATIVE_FLOAT, 0, 1, 0);
+    }
+
+    const hsize_t indptrSize = indptr.size();
+    H5::DataSet indptrDataset = group.createDataSet("indptr", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &indptrSize));
+    indptrDataset.write(indptr.data(), H5::PredType::NATIVE_INT64);
+
+    return true;
+}
+
+bool extractColumns(const SparseMatrixReader& reader, const std::vector<std::int64_t>& columns, const std::string& outputPath, const RepackSettings& settings, const std::function<bool(float)>& progress) {
+    const std::int64_t numRows = reader.getNumRows();
+    const std::int64_t numCols = reader.getNumCols();
+
+    if (std::any_of(columns.begin(), columns.end(), [numCols](const std::int64_t col) { return col < 0 || col >= numCols; })) {
+        std::cerr << "extractColumns: column index out of range" << std::endl;
+        return false;
+    }
+
+    RepackSettings config = settings;
+    config._compressionLevel = std::clamp(config._compressionLevel, 0, 9);
+
+    bool completed = false;
+
+    try {
+        std::unique_ptr<H5::H5File> file;
+        std::unique_ptr<H5::Group> group;
+
+        {
+            std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+
+            file = std::make_unique<H5::H5File>(outputPath, H5F_ACC_TRUNC);
+            writeEncoding(*file, "anndata", "0.1.0");
+
+            group = std::make_unique<H5::Group>(file->createGroup("X"));
+            writeEncoding(*group, "csc_matrix", "0.1.0");
+            writeShapeAttribute(*group, numRows, static_cast<std::int64_t>(columns.size()));
+
+            const std::vector<std::string>& varNames = reader.getVarNames();
+            std::vector<std::string> selectedNames;
+            if (static_cast<std::int64_t>(varNames.size()) == numCols) {
+                for (const std::int64_t col : columns) {
+                    selectedNames.push_back(varNames[col]);
+                }
+            }
+
+            writeIndexDataframe(*file, "obs", reader.getObsNames(), numRows);
+            writeIndexDataframe(*file, "var", std::move(selectedNames), static_cast<std::int64_t>(columns.size()));
+
+            H5::Group uns = file->createGroup("uns");
+            writeEncoding(uns, "dict", "0.1.0");
+
+            const hsize_t size = columns.size();
+            H5::DataSet sourceColumns = uns.createDataSet("extract_source_column", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &size));
+            if (!columns.empty()) {
+                sourceColumns.write(columns.data(), H5::PredType::NATIVE_INT64);
+            }
+            writeEncoding(sourceColumns, "array", "0.2.0");
+
+            // Values are written transformed, normalized with the row totals of the whole matrix
+            if (!reader.getValueTransform().isIdentity()) {
+                writeValueTransform(uns, reader.getValueTransform());
+            }
+        }
+
+        if (std::max<std::int64_t>(numRows - 1, 0) <= std::numeric_limits<std::uint16_t>::max())
+            completed = writeColumnSubset<std::uint16_t>(reader, *group, H5::PredType::NATIVE_UINT16, columns, config, progress);
+        else if (numRows - 1 <= std::numeric_limits<std::int32_t>::max())
+            completed = writeColumnSubset<std::int32_t>(reader, *group, H5::PredType::NATIVE_INT32, columns, config, progress);
+        else
+            completed = writeColumnSubset<std::int64_t>(reader, *group, H5::PredType::NATIVE_INT64, columns, config, progress);
+
+        std::lock_guard<std::recursive_mutex> lock(h5Mutex());
+        group = {};
+        file  = {};
+    }
+    catch (...) {
+        try {
+            throw;
+        }
+        catch (const H5::Exception& e) {
+            std::cerr << "extractColumns: " << e.getDetailMsg() << std::endl;
+        }
+        catch (const std::exception& e) {
+            std::cerr << "extractColumns: " << e.what() << std::endl;
+        }
+
+        completed = false;
+    }
+
+    if (!completed) {
+        std::error_code error;
+        std::filesystem::remove(outputPath, error);
+    }
+
+    return completed;
+}
+
+// =============================================================================
+// File cloning
+// =============================================================================
+
+bool cloneFile(const std::string& sourcePath, const std::string& targetPath) {
+    namespace fs = std::filesystem;
+    std::error_code error;
+
+    fs::remove(targetPath, error);
+
+#if defined(__linux__)
+    // Copy-on-write clone on btrfs, XFS and other filesystems that support reflinks
+    {
+        const int source = ::open(sourcePath.c_str(), O_RDONLY);
+        if (source >= 0) {
+            const int target = ::open(targetPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            const bool cloned = target >= 0 && ::ioctl(target, FICLONE, source) == 0;
+
+            if (target >= 0)
+                ::close(target);
+            ::close(source);
+
+            if (cloned)
+                return true;
+
+            fs::remove(targetPath, error);
+        }
+    }
+#elif defined(__APPLE__)
+    // Copy-on-write clone on APFS
+    if (::clonefile(sourcePath.c_str(), targetPath.c_str(), 0) == 0) {
+        return true;
+    }
+#endif
+
+    // Shares the data of the source, which is not modified while the project is saved
+    fs::create_hard_link(sourcePath, targetPath, error);
+    if (!error) {
+        return true;
+    }
+
+    return fs::copy_file(sourcePath, targetPath, fs::copy_options::overwrite_existing, error) && !error;
+}
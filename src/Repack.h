@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+class SparseMatrixReader;
+
+// =============================================================================
+// Repacking into an access-optimized layout
+// =============================================================================
+
+/*
+Rewrites any matrix that openSparseMatrixReader can open into an anndata .h5 file:
+```
+out.h5
+├── X                   # CSR copy, rows are the primary axis
+├── layers/X_csc        # CSC copy of the same matrix, attribute copy-of = "/X"
+├── obs/_index
+├── var/_index
+└── uns/repack_source_row   # only if rows are reordered: input row of every output row
+```
+Chunks of data and indices hold a few average primary arrays, such that a single row or
+column read touches one or two chunks. Chunks are shuffled and deflated with a low level
+on all threads and handed to HDF5 with direct chunk writes. Indices are stored in the
+narrowest integer type that holds the secondary size.
+
+Every copy is gathered in passes over the input, each pass collects the entries of a range
+of target arrays whose buffers fit into the memory limit. Apart from the per-row and
+per-column counts, memory is bounded by the limit and does not depend on the matrix size.
+*/
+
+struct RepackSettings {
+    std::int64_t    _memoryLimit        = std::int64_t{ 1 } << 30;  // Bytes for the gather buffers of one pass
+    int             _compressionLevel   = 1;                        // deflate level, 0 stores chunks uncompressed
+    bool            _reorderRows        = false;                    // Group rows by their largest variable
+    bool            _writeCsc           = true;
+    std::int64_t    _blockNnz           = std::int64_t{ 1 } << 20;  // Entries per streamed input block
+};
+
+struct RepackResult {
+    std::int64_t    _numPasses          = 0;    // Passes over the input, including the counting pass
+    std::int64_t    _csrChunkSize       = 0;    // Elements per chunk of data and indices
+    std::int64_t    _cscChunkSize       = 0;
+    size_t          _csrIndexBytes      = 0;    // Bytes per stored index
+    size_t          _cscIndexBytes      = 0;
+};
+
+// progress is called with values in [0, 1]
+bool repackMatrix(const std::string& inputPath, const std::string& outputPath, const RepackSettings& settings, RepackResult& result, const std::function<void(float)>& progress = {});
+
+// Elements per chunk: about four average primary arrays, between 4 Ki and 1 Mi elements
+std::int64_t repackChunkSize(const std::int64_t nnz, const std::int64_t numPrimary);
+
+// =============================================================================
+// Column subsets
+// =============================================================================
+
+/*
+Writes a subset of the columns (variables) with all rows as a compact CSC anndata file,
+e.g. to save only the variables a project uses. The columns are read in batches that fit
+into settings._memoryLimit, the input column of every output column is stored in
+uns/extract_source_column. Values are written with the value transform of the reader, which
+is stored in uns/value_transform such that it is not applied twice when the file is read with
+the same transform. progress is called with values in [0, 1] and cancels the
+export if it returns false, the output file is removed on failure and cancellation.
+*/
+bool extractColumns(const SparseMatrixReader& reader, const std::vector<std::int64_t>& columns, const std::string& outputPath, const RepackSettings& settings, const std::function<bool(float)>& progress = {});
+
+// Copy-on-write clone of the file where the filesystem supports it, otherwise a hard link or a copy
+bool cloneFile(const std::string& sourcePath, const std::string& targetPath);
@@ -0,0 +1,558 @@
+#include "ResidentReader.h"
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+
+std::string residentValueEncodingToString(const ResidentValueEncoding& encoding) {
+    switch (encoding)
+    {
+    case ResidentValueEncoding::FLOAT32:  return "float32";
+    case ResidentValueEncoding::UINT16:   return "uint16";
+    case ResidentValueEncoding::BFLOAT16: return "bfloat16";
+    }
+
+    return "float32";
+}
+
+// Entries of the other orientation in plain arrays and their cursors, before they are packed
+static std::uint64_t transposeScratchBytes(const std::int64_t nnz, const std::int64_t numSecondary) {
+    return static_cast<std::uint64_t>(nnz) * (sizeof(std::int64_t) + sizeof(float)) + static_cast<std::uint64_t>(numSecondary + 1) * 2 * sizeof(std::int64_t);
+}
+
+// The transformer takes the primary index first
+static float transformValue(const ValueTransformer& transform, const bool rowsArePrimary, const float value, const std::int64_t row, const std::int64_t col) {
+    return rowsArePrimary ? transform(value, row, col) : transform(value, col, row);
+}
+
+// Upper bound of one packed orientation, values are floats until they are encoded
+static std::uint64_t packedBytes(const std::int64_t nnz, const std::int64_t numArrays, const std::int64_t sizeSecondary) {
+    const std::uint64_t bitsPerIndex = std::bit_width(static_cast<std::uint64_t>(std::max<std::int64_t>(sizeSecondary, 1)));
+    const std::uint64_t perArray     = 2 * sizeof(std::int64_t) + sizeof(std::uint8_t) + sizeof(std::uint64_t);   // indptr, word offset, width and alignment
+
+    return static_cast<std::uint64_t>(nnz) * bitsPerIndex / 8 + static_cast<std::uint64_t>(nnz) * sizeof(float) + static_cast<std::uint64_t>(numArrays + 1) * perArray;
+}
+
+// =============================================================================
+// PackedArrays
+// =============================================================================
+
+std::uint64_t PackedArrays::getBytes() const {
+    return _indptr.size() * sizeof(std::int64_t) + _wordOffsets.size() * sizeof(std::int64_t) + _bitWidths.size() * sizeof(std::uint8_t)
+        + _words.size() * sizeof(std::uint64_t) + _values.size() * sizeof(float) + _packedValues.size() * sizeof(std::uint16_t);
+}
+
+void PackedArrays::appendArrays(const std::int64_t count, const std::int64_t* indptr, const std::int64_t* indices, const float* values) {
+    if (_indptr.empty()) {
+        _indptr.push_back(0);
+        _wordOffsets.push_back(0);
+    }
+
+    const std::int64_t first      = _numArrays;
+    const std::int64_t entryBase  = _indptr.back();
+
+    _numArrays += count;
+    _indptr.resize(_numArrays + 1);
+    _wordOffsets.resize(_numArrays + 1);
+    _bitWidths.resize(_numArrays);
+
+    // Width of the largest delta of each array
+#pragma omp parallel for
+    for (std::int64_t a = 0; a < count; ++a) {
+        std::uint64_t maxDelta = 0;
+        std::int64_t previous  = 0;
+
+        for (std::int64_t i = indptr[a]; i < indptr[a + 1]; ++i) {
+            maxDelta = std::max(maxDelta, static_cast<std::uint64_t>(indices[i] - previous));
+            previous = indices[i];
+        }
+
+        _bitWidths[first + a]       = static_cast<std::uint8_t>(std::bit_width(maxDelta));
+        _indptr[first + a + 1]      = entryBase + indptr[a + 1];
+    }
+
+    for (std::int64_t a = 0; a < count; ++a) {
+        const std::int64_t numBits = (indptr[a + 1] - indptr[a]) * _bitWidths[first + a];
+        _wordOffsets[first + a + 1] = _wordOffsets[first + a] + (numBits + 63) / 64;
+    }
+
+    _words.resize(_wordOffsets.back(), 0);
+
+#pragma omp parallel for
+    for (std::int64_t a = 0; a < count; ++a) {
+        const std::uint32_t width = _bitWidths[first + a];
+        std::uint64_t* words      = _words.data() + _wordOffsets[first + a];
+        std::uint64_t bit         = 0;
+        std::int64_t previous     = 0;
+
+        if (width == 0)
+            continue;
+
+        for (std::int64_t i = indptr[a]; i < indptr[a + 1]; ++i, bit += width) {
+            const std::uint64_t delta  = static_cast<std::uint64_t>(indices[i] - previous);
+            const std::uint64_t word   = bit >> 6;
+            const std::uint32_t shift  = static_cast<std::uint32_t>(bit & 63);
+
+            words[word] |= delta << shift;
+            if (shift + width > 64)
+                words[word + 1] |= delta >> (64 - shift);
+
+            previous = indices[i];
+        }
+    }
+
+    if (values != nullptr)
+        _values.insert(_values.end(), values, values + indptr[count]);
+    else
+        _values.resize(_indptr.back(), 0.0f);
+}
+
+void PackedArrays::encodeValues(const bool allowLossy) {
+    const std::int64_t nnz = static_cast<std::int64_t>(_values.size());
+    int isInteger = 1;
+
+#pragma omp parallel for reduction(&&:isInteger)
+    for (std::int64_t i = 0; i < nnz; ++i) {
+        const float value = _values[i];
+        isInteger = isInteger && value >= 0.0f && value <= 65535.0f && std::floor(value) == value;
+    }
+
+    if (isInteger)
+        _encoding = ResidentValueEncoding::UINT16;
+    else if (allowLossy)
+        _encoding = ResidentValueEncoding::BFLOAT16;
+    else {
+        _encoding = ResidentValueEncoding::FLOAT32;
+        return;
+    }
+
+    _packedValues.resize(_values.size());
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < nnz; ++i) {
+        _packedValues[i] = _encoding == ResidentValueEncoding::UINT16 ? static_cast<std::uint16_t>(_values[i]) : floatToBfloat16Bits(_values[i]);
+    }
+
+    std::vector<float>().swap(_values);
+}
+
+// =============================================================================
+// ResidentReader
+// =============================================================================
+
+ResidentReader::ResidentReader() :
+    SparseMatrixReader(SparseMatrixType::CSR)
+{
+    // The packed arrays are faster to scan than any index
+    setUseBlockIndex(false);
+}
+
+ResidentReader::~ResidentReader() = default;
+
+std::uint64_t ResidentReader::estimateBytes(const SparseMatrixReader& source, const bool bothOrientations)
+{
+    const SparseMatrixData& data = source.getRawData();
+
+    // Unknown before streaming, e.g. for dense or sharded matrices
+    if (data._indptr.empty())
+        return 0;
+
+    const std::int64_t nnz = data._indptr.back();
+    std::uint64_t bytes = packedBytes(nnz, source.getPrimarySize(), source.getSecondarySize());
+
+    if (bothOrientations)
+        bytes += packedBytes(nnz, source.getSecondarySize(), source.getPrimarySize()) + transposeScratchBytes(nnz, source.getSecondarySize());
+
+    return bytes;
+}
+
+std::unique_ptr<ResidentReader> ResidentReader::load(const SparseMatrixReader& source, const ResidentSettings& settings, const std::function<void(float)>& progress)
+{
+    if (source.getNumRows() == 0 || source.getNumCols() == 0) {
+        std::cerr << "ResidentReader::load: no matrix to load" << std::endl;
+        return nullptr;
+    }
+
+    const std::uint64_t estimate = estimateBytes(source, false);
+    if (estimate > settings._budgetBytes) {
+        std::cerr << "ResidentReader::load: about " << (estimate >> 20) << " MiB do not fit the budget of " << (settings._budgetBytes >> 20) << " MiB" << std::endl;
+        return nullptr;
+    }
+
+    // Rows are the primary arrays of all but CSC matrices
+    const bool rowsArePrimary = source.getType() != SparseMatrixType::CSC;
+
+    auto reader = std::make_unique<ResidentReader>();
+    reader->_type               = rowsArePrimary ? SparseMatrixType::CSR : SparseMatrixType::CSC;
+    reader->_data._filename     = source.getRawData()._filename;
+    reader->_data._num_rows     = source.getNumRows();
+    reader->_data._num_cols     = source.getNumCols();
+    reader->_data._obs_names    = source.getObsNames();
+    reader->_data._var_names    = source.getVarNames();
+    reader->_data._stored_transform = source.getStoredValueTransform();
+
+    PackedArrays& packed = rowsArePrimary ? reader->_rows : reader->_columns;
+    const std::int64_t numPrimary = reader->getPrimarySize();
+
+    std::int64_t nextPrimary = 0;
+    std::vector<std::int64_t> emptyIndptr;
+    std::vector<std::int64_t> sortedIndices;
+    std::vector<float> sortedValues;
+
+    auto appendBlock = [&](const PrimaryBlock& block) {
+        if (block._begin < nextPrimary)
+            throw std::runtime_error("primary arrays are not streamed in order");
+
+        // Arrays without entries may be skipped by the stream
+        if (block._begin > nextPrimary) {
+            emptyIndptr.assign(block._begin - nextPrimary + 1, 0);
+            packed.appendArrays(block._begin - nextPrimary, emptyIndptr.data(), nullptr, nullptr);
+        }
+
+        const std::int64_t count = block._end - block._begin;
+        const std::int64_t* indices = block._indices.data();
+        const float* values = block._values.data();
+
+        bool isSorted = true;
+        for (std::int64_t a = 0; a < count && isSorted; ++a) {
+            isSorted = std::is_sorted(indices + block._indptr[a], indices + block._indptr[a + 1]);
+        }
+
+        // Deltas need sorted indices, e.g. files written without sorting them
+        if (!isSorted) {
+            sortedIndices.resize(block._indices.size());
+            sortedValues.resize(block._values.size());
+            std::vector<std::int64_t> order;
+
+            for (std::int64_t a = 0; a < count; ++a) {
+                order.resize(block._indptr[a + 1] - block._indptr[a]);
+                std::iota(order.begin(), order.end(), block._indptr[a]);
+                std::sort(order.begin(), order.end(), [indices](const std::int64_t x, const std::int64_t y) { return indices[x] < indices[y]; });
+
+                for (size_t i = 0; i < order.size(); ++i) {
+                    sortedIndices[block._indptr[a] + i] = indices[order[i]];
+                    sortedValues[block._indptr[a] + i]  = values[order[i]];
+                }
+            }
+
+            indices = sortedIndices.data();
+            values  = sortedValues.data();
+        }
+
+        packed.appendArrays(count, block._indptr.data(), indices, values);
+        nextPrimary = block._end;
+
+        if (packed.getBytes() > settings._budgetBytes)
+            throw std::runtime_error("the matrix does not fit the budget");
+
+        if (progress)
+            progress(static_cast<float>(nextPrimary) / numPrimary);
+        };
+
+    try {
+        if (!source.streamBlocks(appendBlock, /* readValues = */ true))
+            return nullptr;
+    }
+    catch (const std::exception& e) {
+        std::cerr << "ResidentReader::load: " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    if (nextPrimary < numPrimary) {
+        emptyIndptr.assign(numPrimary - nextPrimary + 1, 0);
+        packed.appendArrays(numPrimary - nextPrimary, emptyIndptr.data(), nullptr, nullptr);
+    }
+
+    packed.encodeValues(settings._lossyValues);
+    reader->_data._indptr = packed._indptr;
+
+    if (settings._bothOrientations)
+        reader->buildTranspose(settings._budgetBytes, settings._lossyValues);
+
+    return reader;
+}
+
+bool ResidentReader::buildTranspose(const std::uint64_t budgetBytes, const bool allowLossy)
+{
+    const PackedArrays& primary = primaryArrays();
+    PackedArrays& other = _type == SparseMatrixType::CSC ? _rows : _columns;
+
+    const std::int64_t numPrimary   = getPrimarySize();
+    const std::int64_t numSecondary = getSecondarySize();
+    const std::int64_t nnz          = primary.getNnz();
+
+    const std::uint64_t estimate = packedBytes(nnz, numSecondary, numPrimary) + transposeScratchBytes(nnz, numSecondary);
+    if (primary.getBytes() + estimate > budgetBytes)
+        return false;
+
+    // Counting pass
+    std::vector<std::int64_t> indptr(numSecondary + 1, 0);
+
+#pragma omp parallel for
+    for (std::int64_t p = 0; p < numPrimary; ++p) {
+        primary.forEach(p, [&indptr](const std::int64_t secondary, float) {
+#pragma omp atomic
+            indptr[secondary + 1]++;
+            });
+    }
+
+    std::partial_sum(indptr.begin(), indptr.end(), indptr.begin());
+
+    // Scatter pass in primary order, such that the indices of each secondary array are sorted
+    std::vector<std::int64_t> cursors(indptr.begin(), indptr.end() - 1);
+    std::vector<std::int64_t> indices(nnz);
+    std::vector<float> values(nnz);
+
+    for (std::int64_t p = 0; p < numPrimary; ++p) {
+        primary.forEach(p, [&](const std::int64_t secondary, const float value) {
+            const std::int64_t pos = cursors[secondary]++;
+            indices[pos] = p;
+            values[pos]  = value;
+            });
+    }
+
+    std::vector<std::int64_t>().swap(cursors);
+
+    other.appendArrays(numSecondary, indptr.data(), indices.data(), values.data());
+
+    if (primary.getBytes() + other.getBytes() > budgetBytes) {
+        other = {};
+        return false;
+    }
+
+    // Values of the primary arrays are already encoded, the same encoding is lossless here
+    other.encodeValues(allowLossy);
+
+    return true;
+}
+
+std::vector<std::vector<float>> ResidentReader::readArrays(const std::vector<std::int64_t>& indices, const bool rows, const ValueTransformer& transform) const
+{
+    const PackedArrays& direct  = rows ? _rows : _columns;
+    const PackedArrays& other   = rows ? _columns : _rows;
+    const bool rowsArePrimary   = _type != SparseMatrixType::CSC;
+    const std::int64_t length   = rows ? _data._num_cols : _data._num_rows;
+    const std::int64_t count    = rows ? _data._num_rows : _data._num_cols;
+    const std::int64_t numArrays = static_cast<std::int64_t>(indices.size());
+
+    std::vector<std::vector<float>> arrays(indices.size(), std::vector<float>(length, 0.0f));
+
+    // Arrays out of range stay zero
+    std::vector<bool> valid(indices.size(), true);
+    for (std::int64_t i = 0; i < numArrays; ++i) {
+        if (indices[i] < 0 || indices[i] >= count) {
+            std::cerr << "ResidentReader::readArrays: could not read from index " << indices[i] << std::endl;
+            valid[i] = false;
+        }
+    }
+
+    if (!direct._indptr.empty()) {
+#pragma omp parallel for
+        for (std::int64_t i = 0; i < numArrays; ++i) {
+            if (!valid[i])
+                continue;
+
+            const std::int64_t index = indices[i];
+            std::vector<float>& array = arrays[i];
+
+            direct.forEach(index, [&](const std::int64_t secondary, const float value) {
+                array[secondary] = rows ? transformValue(transform, rowsArePrimary, value, index, secondary) : transformValue(transform, rowsArePrimary, value, secondary, index);
+                });
+        }
+
+        return arrays;
+    }
+
+    // Scans all arrays of the other orientation, repeated indices are copied afterwards
+    std::vector<std::int64_t> slots(count, -1);
+    for (std::int64_t i = 0; i < numArrays; ++i) {
+        if (valid[i] && slots[indices[i]] < 0)
+            slots[indices[i]] = i;
+    }
+
+#pragma omp parallel for schedule(dynamic, 256)
+    for (std::int64_t a = 0; a < other._numArrays; ++a) {
+        other.forEach(a, [&](const std::int64_t secondary, const float value) {
+            const std::int64_t slot = slots[secondary];
+            if (slot < 0)
+                return;
+
+            arrays[slot][a] = rows ? transformValue(transform, rowsArePrimary, value, secondary, a) : transformValue(transform, rowsArePrimary, value, a, secondary);
+            });
+    }
+
+    for (std::int64_t i = 0; i < numArrays; ++i) {
+        if (valid[i] && slots[indices[i]] != i)
+            arrays[i] = arrays[slots[indices[i]]];
+    }
+
+    return arrays;
+}
+
+std::vector<float> ResidentReader::getRowImpl(std::int64_t row_idx) const
+{
+    return std::move(readArrays({ row_idx }, true, getValueTransformer()).front());
+}
+
+std::vector<float> ResidentReader::getColumnImpl(std::int64_t col_idx) const
+{
+    return std::move(readArrays({ col_idx }, false, getValueTransformer()).front());
+}
+
+std::vector<std::vector<float>> ResidentReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    return readArrays(row_indices, true, getValueTransformer());
+}
+
+std::vector<std::vector<float>> ResidentReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    return readArrays(col_indices, false, getValueTransformer());
+}
+
+std::vector<float> ResidentReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    std::vector<float> sums(_data._num_rows, 0.0f);
+
+    const auto inRange = [this](const std::int64_t col) {
+        if (col >= 0 && col < _data._num_cols)
+            return true;
+
+        std::cerr << "ResidentReader::getColumnSumImpl: could not read from index " << col << std::endl;
+        return false;
+        };
+
+    if (hasColumns()) {
+        for (const std::int64_t col : col_indices) {
+            if (!inRange(col))
+                continue;
+
+            _columns.forEach(col, [&sums](const std::int64_t row, const float value) {
+                sums[row] += value;
+                });
+        }
+
+        return sums;
+    }
+
+    // Weights count repeated columns
+    std::vector<float> weights(_data._num_cols, 0.0f);
+    for (const std::int64_t col : col_indices) {
+        if (inRange(col))
+            weights[col] += 1.0f;
+    }
+
+#pragma omp parallel for
+    for (std::int64_t row = 0; row < _rows._numArrays; ++row) {
+        float sum = 0.0f;
+        _rows.forEach(row, [&](const std::int64_t col, const float value) {
+            sum += weights[col] * value;
+            });
+        sums[row] = sum;
+    }
+
+    return sums;
+}
+
+std::vector<float> ResidentReader::getRowTotalsImpl() const
+{
+    std::vector<float> totals(_data._num_rows, 0.0f);
+
+    if (hasRows()) {
+#pragma omp parallel for
+        for (std::int64_t row = 0; row < _rows._numArrays; ++row) {
+            float total = 0.0f;
+            _rows.forEach(row, [&total](std::int64_t, const float value) {
+                total += value;
+                });
+            totals[row] = total;
+        }
+
+        return totals;
+    }
+
+    for (std::int64_t col = 0; col < _columns._numArrays; ++col) {
+        _columns.forEach(col, [&totals](const std::int64_t row, const float value) {
+            totals[row] += value;
+            });
+    }
+
+    return totals;
+}
+
+std::vector<SparseArray> ResidentReader::getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    if (!hasColumns())
+        return SparseMatrixReader::getSparseColumnsImpl(col_indices);
+
+    const ValueTransformer transform = getValueTransformer();
+    const bool rowsArePrimary = _type != SparseMatrixType::CSC;
+    const std::int64_t numColumns = static_cast<std::int64_t>(col_indices.size());
+
+    std::vector<SparseArray> columns(col_indices.size());
+
+#pragma omp parallel for
+    for (std::int64_t i = 0; i < numColumns; ++i) {
+        const std::int64_t col = col_indices[i];
+        SparseArray& column = columns[i];
+
+        // Columns out of range stay empty
+        if (col < 0 || col >= _columns._numArrays)
+            continue;
+
+        _columns.forEach(col, [&](const std::int64_t row, const float value) {
+            column._indices.push_back(row);
+            column._values.push_back(transformValue(transform, rowsArePrimary, value, row, col));
+            });
+    }
+
+    return columns;
+}
+
+bool ResidentReader::streamBlocks(const BlockCallback& process, const bool readValues, const std::int64_t blockNnz) const
+{
+    const PackedArrays& primary = primaryArrays();
+
+    if (primary._indptr.empty()) {
+        std::cerr << "ResidentReader::streamBlocks: no data to stream" << std::endl;
+        return false;
+    }
+
+    PrimaryBlock block;
+
+    for (std::int64_t begin = 0; begin < primary._numArrays;) {
+        std::int64_t end = begin + 1;
+        while (end < primary._numArrays && primary._indptr[end + 1] - primary._indptr[begin] <= std::max<std::int64_t>(blockNnz, 1)) {
+            ++end;
+        }
+
+        block._begin  = begin;
+        block._end    = end;
+        block._offset = primary._indptr[begin];
+        block._indptr.resize(end - begin + 1);
+        block._indices.clear();
+        block._values.clear();
+
+        for (std::int64_t a = begin; a <= end; ++a) {
+            block._indptr[a - begin] = primary._indptr[a] - block._offset;
+        }
+
+        for (std::int64_t a = begin; a < end; ++a) {
+            primary.forEach(a, [&](const std::int64_t secondary, const float value) {
+                block._indices.push_back(secondary);
+                if (readValues)
+                    block._values.push_back(value);
+                });
+        }
+
+        if (!block._indices.empty())
+            process(block);
+
+        begin = end;
+    }
+
+    return true;
+}
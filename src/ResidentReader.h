@@ -0,0 +1,159 @@
+#pragma once
+
+#include "H5Utils.h"
+#include "Quantization.h"
+
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// Packed arrays
+// =============================================================================
+
+enum class ResidentValueEncoding : std::int32_t {
+    FLOAT32,
+    UINT16,     // Lossless, all values are integers in [0, 65535], e.g. raw counts
+    BFLOAT16,   // Lossy, only if requested
+};
+
+std::string residentValueEncodingToString(const ResidentValueEncoding& encoding);
+
+/*
+The sparse arrays of one orientation in memory. The indices of each array are delta-encoded
+and bit-packed with the width of the largest delta of that array. Every array starts at a
+word boundary, such that arrays are packed and decoded independently.
+*/
+struct PackedArrays {
+    std::int64_t                _numArrays      = 0;
+    std::vector<std::int64_t>   _indptr         = {};   // Entries of each array (size = _numArrays + 1)
+    std::vector<std::int64_t>   _wordOffsets    = {};   // First word of each array in _words (size = _numArrays + 1)
+    std::vector<std::uint8_t>   _bitWidths      = {};   // Bits per delta of each array
+    std::vector<std::uint64_t>  _words          = {};
+    ResidentValueEncoding       _encoding       = ResidentValueEncoding::FLOAT32;
+    std::vector<float>          _values         = {};   // FLOAT32
+    std::vector<std::uint16_t>  _packedValues   = {};   // UINT16 and BFLOAT16
+
+    std::int64_t getNnz() const { return _indptr.empty() ? 0 : _indptr.back(); }
+    std::uint64_t getBytes() const;
+
+    // Calls process(secondary, value) for all entries of an array in increasing secondary order, array must be in range
+    template<typename Process>
+    void forEach(const std::int64_t array, Process process) const;
+
+    // Appends arrays with sorted indices, indptr starts at 0 (size = count + 1), values are kept as float until encodeValues
+    void appendArrays(const std::int64_t count, const std::int64_t* indptr, const std::int64_t* indices, const float* values);
+
+    // Picks the smallest encoding that is lossless, or BFLOAT16 for non-integer values if allowed
+    void encodeValues(const bool allowLossy);
+};
+
+// =============================================================================
+// ResidentReader
+// =============================================================================
+
+struct ResidentSettings {
+    std::uint64_t   _budgetBytes        = std::uint64_t{ 16 } << 30;
+    bool            _bothOrientations   = true;     // Also keep the other orientation if it fits the budget
+    bool            _lossyValues        = false;    // Store non-integer values as bfloat16
+};
+
+/*
+Holds a whole matrix in memory, loaded once from any other reader in a single pass over its blocks.
+Both orientations are kept if they fit the memory budget, such that rows and columns are both
+decoded from a single packed array. With a single orientation, arrays of the other one are read
+with a parallel scan of all packed arrays, which is still much faster than a scan of the file.
+*/
+class ResidentReader : public SparseMatrixReader
+{
+
+public:
+    ResidentReader();
+    ~ResidentReader();
+
+    // Returns nullptr if the matrix does not fit the budget or cannot be streamed in order, then keep using the source
+    // progress is called with the fraction of the primary arrays that are loaded, and may throw to stop loading
+    static std::unique_ptr<ResidentReader> load(const SparseMatrixReader& source, const ResidentSettings& settings, const std::function<void(float)>& progress = {});
+
+    // Upper bound of the memory needed to hold the source in one or both orientations, 0 if unknown before loading
+    static std::uint64_t estimateBytes(const SparseMatrixReader& source, const bool bothOrientations);
+
+public: // Getter
+
+    std::vector<float> getRowImpl(std::int64_t row_idx) const override;
+    std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    std::vector<SparseArray> getSparseColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    // Streams the primary orientation from memory
+    bool streamBlocks(const BlockCallback& process, const bool readValues = true, const std::int64_t blockNnz = defaultBlockNnz) const override;
+
+    std::uint64_t getBytesRead() const override { return 0; }
+
+    bool hasRows() const { return !_rows._indptr.empty(); }
+    bool hasColumns() const { return !_columns._indptr.empty(); }
+
+    std::uint64_t getMemoryBytes() const { return _rows.getBytes() + _columns.getBytes(); }
+    ResidentValueEncoding getValueEncoding() const { return hasRows() ? _rows._encoding : _columns._encoding; }
+
+private:
+    const PackedArrays& primaryArrays() const { return _type == SparseMatrixType::CSC ? _columns : _rows; }
+
+    // Reads arrays of one direction, from its own orientation if available, by scanning the other one otherwise
+    std::vector<std::vector<float>> readArrays(const std::vector<std::int64_t>& indices, const bool rows, const ValueTransformer& transform) const;
+
+    // Builds the other orientation from the primary one, false if it does not fit the budget
+    bool buildTranspose(const std::uint64_t budgetBytes, const bool allowLossy);
+
+private:
+    PackedArrays    _rows       = {};   // Empty if not resident
+    PackedArrays    _columns    = {};   // Empty if not resident
+};
+
+// =============================================================================
+// Implementation
+// =============================================================================
+
+template<typename Process>
+void PackedArrays::forEach(const std::int64_t array, Process process) const {
+    assert(array >= 0 && array < _numArrays);
+
+    const std::int64_t begin = _indptr[array];
+    const std::int64_t count = _indptr[array + 1] - begin;
+    const std::uint32_t width = _bitWidths[array];
+    const std::uint64_t mask = width >= 64 ? ~std::uint64_t{ 0 } : (std::uint64_t{ 1 } << width) - 1;
+    const std::uint64_t* words = _words.data() + _wordOffsets[array];
+
+    std::int64_t secondary = 0;
+    std::uint64_t bit = 0;
+
+    for (std::int64_t i = 0; i < count; ++i, bit += width) {
+        const std::uint64_t word = bit >> 6;
+        const std::uint32_t shift = static_cast<std::uint32_t>(bit & 63);
+
+        std::uint64_t delta = words[word] >> shift;
+        if (shift + width > 64)
+            delta |= words[word + 1] << (64 - shift);
+
+        secondary += static_cast<std::int64_t>(delta & mask);
+
+        float value = 0.0f;
+        switch (_encoding)
+        {
+        case ResidentValueEncoding::FLOAT32:  value = _values[begin + i]; break;
+        case ResidentValueEncoding::UINT16:   value = static_cast<float>(_packedValues[begin + i]); break;
+        case ResidentValueEncoding::BFLOAT16: value = bfloat16BitsToFloat(_packedValues[begin + i]); break;
+        }
+
+        process(secondary, value);
+    }
+}
@@ -7,26 +7,154 @@ using namespace mv;
 SettingsAction::SettingsAction(QObject* parent) :
     gui::GroupAction(parent, "SettingsAction", true),
     _fileOnDiskAction(this, "H5 file on disk"),
+    _shardDirectoryAction(this, "Sharded H5 folder"),
     _matrixTypeAction(this, "Matrix storage", "None loaded yet"),
     _numAvailableDimsAction(this, "Variables", "None loaded yet"),
     _statusTextAction(this, "Status", "None loaded yet"),
+    _pointIdsFileAction(this, "Point IDs"),
+    _pointMappingAction(this, "Mapping", "Row i is point i"),
+    _pointOrderAction(this, "Point order"),
     _addRemoveDimsAction(this),
     _dataDimActions(),
+    _dimensionModel(this),
     _dataDimsAction(this, "Data dimensions"),
-    _saveDataToProjectAction(this, "Save data to project", false)
+    _dimensionSearchAction(this, "Search"),
+    _dimensionMatchesModel(this),
+    _dimensionMatchesAction(this, "Matches"),
+    _dimensionSearchGroupAction(this, "Find variables"),
+    _outputTypeAction(this, "Output type", { "float32", "bfloat16", "uint16", "uint8" }, "float32"),
+    _virtualDimNameAction(this, "Name"),
+    _virtualDimVariablesAction(this, "Variables"),
+    _virtualDimReductionAction(this, "Reduction", { "Sum", "Mean", "Normalized mean" }, "Mean"),
+    _addRemoveVirtualDimsAction(this),
+    _virtualDimsListAction(this, "Defined", "None"),
+    _virtualDimsAction(this, "Virtual dimensions"),
+    _pcaComponentsAction(this, "Components", 1, 100, 10),
+    _computePcaAction(this, "Compute PCA"),
+    _pcaAction(this, "PCA"),
+    _queryAction(this, "Query"),
+    _selectQueryAction(this, "Select points"),
+    _queryResultAction(this, "Result", "None"),
+    _queryGroupAction(this, "Select by values"),
+    _markerCountAction(this, "Markers", 1, 100, 10),
+    _findMarkersAction(this, "Find markers"),
+    _markersListAction(this, "Top markers", "None"),
+    _markersAction(this, "Marker variables"),
+    _panelVariablesAction(this, "Variables"),
+    _panelFileAction(this, "Panel file"),
+    _showPanelAction(this, "Show panel"),
+    _panelRankingAction(this, "Top by", { "Variance", "Mean", "Points with a value" }, "Variance"),
+    _panelCountAction(this, "Count", 1, 500, 50),
+    _showTopPanelAction(this, "Show top"),
+    _panelResultAction(this, "Result", "None"),
+    _panelAction(this, "Dimension panel"),
+    _normalizeTotalsAction(this, "Normalize totals", false),
+    _targetSumAction(this, "Target sum", 1, 1000000, 10000),
+    _log1pAction(this, "log1p", false),
+    _scaleAction(this, "Scale", 0.001f, 1000.f, 1.f, 3),
+    _clipAction(this, "Clip at", 0.f, 1000000.f, 0.f, 2),
+    _valueTransformAction(this, "Value transform"),
+    _progressiveIntervalAction(this, "Update interval (ms)", 0, 5000, 250),
+    _progressiveOrderAction(this, "Scan order", { "Strided sample first", "File order" }, "Strided sample first"),
+    _progressiveAction(this, "Progressive reading"),
+    _diskCacheDirectoryAction(this, "Cache folder"),
+    _diskCacheSizeAction(this, "Size (GiB)", 1, 1024, 8),
+    _clearDiskCacheAction(this, "Clear cache"),
+    _diskCacheAction(this, "Disk cache"),
+    _accessTraceDirectoryAction(this, "Trace folder"),
+    _accessTraceAction(this, "Access trace"),
+    _residentModeAction(this, "Load into memory", false),
+    _residentBudgetAction(this, "Budget (GiB)", 1, 1024, 16),
+    _residentLossyAction(this, "Compress values (lossy)", false),
+    _residentStatusAction(this, "Resident", "Read from disk"),
+    _residentAction(this, "In-memory mode"),
+    _h5AutoTuneAction(this, "Auto-tune", true),
+    _h5DriverAction(this, "Driver", { "sec2", "core", "direct" }, "sec2"),
+    _h5PageBufferAction(this, "Page buffer (MiB)", 0, 4096, 0),
+    _h5MetadataCacheAction(this, "Metadata cache (MiB)", 0, 1024, 0),
+    _h5MetaBlockAction(this, "Metadata blocks (KiB)", 0, 65536, 0),
+    _h5AccessStatusAction(this, "Opened with", "-"),
+    _h5AccessAction(this, "File access"),
+    _saveDataToProjectAction(this, "Save data to project", false),
+    _saveModeAction(this, "Saved data", { "Used variables", "Variable subset", "Entire file" }, "Used variables"),
+    _saveVariablesAction(this, "Saved variables")
 {
     setText("Sparse Matrix Access");
     setSerializationName("Sparse Matrix Access");
 
     _fileOnDiskAction.setToolTip("H5 file on disk");
+    _pointIdsFileAction.setToolTip("Text file with the obs name of every input point, one per line,\nfor input data that is a subset or reordering of the file.\nWithout a file, the \"PointIds\" property of the input data is used if present");
+    _shardDirectoryAction.setToolTip("Folder with several H5 files that are read as one matrix,\nconcatenated along the points in file name order,\nor a Zarr store (.zarr folder) with a sparse X");
     _matrixTypeAction.setToolTip("Storage type of sparse matrix on disk");
     _numAvailableDimsAction.setToolTip("Current status, e.g., readin/idle");
     _statusTextAction.setToolTip("Number of variables/dimensions/channels in the data");
+    _outputTypeAction.setToolTip("Element type of the output data\nuint16 and uint8 are quantized with a scale and offset per dimension,\ninteger counts that fit the range are stored without loss");
     _saveDataToProjectAction.setToolTip("Saving the data from disk to a project\nmight yield very large project files and loading times!");
+    _saveModeAction.setToolTip("Used variables: the selected variables and those of virtual dimensions\nVariable subset: the variables listed below\nBoth are prepared in the background as a compact file,\nthe entire file is cloned or linked where the file system allows it");
+    _saveVariablesAction.setToolTip("Variables that are saved to the project,\nseparated by commas, semicolons or whitespace");
+
+    _dimensionSearchAction.setToolTip("Start or part of variable names, case-insensitive\nNames that start with the search are listed first");
+    _dimensionMatchesAction.setToolTip("Picking a match adds it as a data dimension");
+
+    _virtualDimNameAction.setToolTip("Name of the virtual dimension");
+    _virtualDimVariablesAction.setToolTip("Variables that are reduced into the virtual dimension,\nseparated by commas, semicolons or whitespace");
+    _virtualDimReductionAction.setToolTip("Reduction over the variables\nNormalized mean: mean of library-size normalized values (counts per 10k)");
+    _virtualDimsListAction.setToolTip("Virtual dimensions that are appended to the data dimensions");
+    _pcaComponentsAction.setToolTip("Number of principal components");
+    _computePcaAction.setToolTip("Computes a randomized PCA of the entire matrix,\nstreaming it from disk, and adds the components as a derived data set");
+    _queryAction.setToolTip("Comparisons of variables with numbers, combined with AND\nOperators: <, <=, ==, !=, >=, >");
+    _markerCountAction.setToolTip("Number of top marker variables that are shown as data dimensions");
+    _findMarkersAction.setToolTip("Ranks all variables by Welch's t-test of log1p values,\nselected points against all other points, in one pass over the file");
+    _selectQueryAction.setToolTip("Selects the points of the input data that satisfy the query,\nonly the non-zero values of the queried variables are read");
+    _panelVariablesAction.setToolTip("Variables that replace the data dimensions,\nseparated by commas, semicolons or whitespace");
+    _panelFileAction.setToolTip("Text or CSV file with the variables of a panel,\nseparated by commas, semicolons or whitespace");
+    _showPanelAction.setToolTip("Shows all panel variables as data dimensions,\nread from the file in a single batch");
+    _panelRankingAction.setToolTip("Statistic of all points by which the top variables are chosen,\ncomputed in one pass over the file from log1p values");
+    _panelCountAction.setToolTip("Number of top variables that are shown as data dimensions");
+    _showTopPanelAction.setToolTip("Shows the top variables as data dimensions");
+    _normalizeTotalsAction.setToolTip("Divides the values of every point by its total over all variables\nand multiplies them with the target sum, e.g. counts per 10k");
+    _targetSumAction.setToolTip("Total of every point after normalization");
+    _log1pAction.setToolTip("Applies log(1 + value) after normalization");
+    _scaleAction.setToolTip("Multiplies the values after log1p");
+    _clipAction.setToolTip("Upper limit of the values after scaling, 0 disables clipping\nOnly the non-zero values are transformed while reading, zeros stay zero");
+    _progressiveIntervalAction.setToolTip("Variables that scan the whole file, e.g. of CSR files,\nare shown while they are read, at most once per interval\n0 shows them once they are complete");
+    _progressiveOrderAction.setToolTip("Strided sample first: every 16th block of points is read first,\nsuch that the pattern of the whole data set is visible early\nFile order: points are filled in from the start of the file");
+    _diskCacheDirectoryAction.setToolTip("Folder that keeps read variables across sessions,\nleave empty to disable the persistent cache");
+    _diskCacheSizeAction.setToolTip("Size cap of the cache folder,\nthe least recently used variables are removed first");
+    _clearDiskCacheAction.setToolTip("Removes all variables from the cache folder");
+    _accessTraceDirectoryAction.setToolTip("Folder in which every read of a variable or point is recorded,\nto tune the cache with SparseH5Replay. Leave empty to disable recording");
+    _residentModeAction.setToolTip("Loads the whole matrix into memory once, in the background,\nand serves all reads from memory afterwards. Falls back to reading\nfrom disk if the matrix does not fit the budget");
+    _residentBudgetAction.setToolTip("Memory that the resident matrix may use, both rows and columns\nare kept in memory if they fit, otherwise only the stored orientation");
+    _h5AutoTuneAction.setToolTip("Picks the HDF5 settings from the size and layout of each file:\nsmall files are read into memory, large paged files get a page buffer\nand large files a bigger metadata cache. Uncheck to use the settings below");
+    _h5DriverAction.setToolTip("sec2: reads from the file on every request\ncore: reads the whole file into memory when it is opened\ndirect: bypasses the page cache of the OS, if HDF5 is built with it");
+    _h5PageBufferAction.setToolTip("Caches whole file pages, only for files written with paged aggregation,\ne.g. h5repack -S PAGE. Disabled if 0");
+    _h5MetadataCacheAction.setToolTip("Initial size of the metadata cache, which holds e.g. the chunk index\nof the datasets. Default of the library if 0");
+    _h5MetaBlockAction.setToolTip("Minimum size of metadata allocations, only affects writes. Default of the library if 0");
+    _residentLossyAction.setToolTip("Stores non-integer values as bfloat16 with about 3 significant digits,\ninteger counts are always stored losslessly");
+
+    _virtualDimNameAction.setPlaceHolderString("Module score");
+    _virtualDimVariablesAction.setPlaceHolderString("GeneA, GeneB, GeneC");
+    _saveVariablesAction.setPlaceHolderString("GeneA, GeneB, GeneC");
+    _panelVariablesAction.setPlaceHolderString("GeneA, GeneB, GeneC");
+    _queryAction.setPlaceHolderString("GeneA > 1 AND GeneB == 0");
+    _dimensionSearchAction.setPlaceHolderString("GeneA");
+
+    _dimensionMatchesAction.setCustomModel(&_dimensionMatchesModel);
+
+    _addRemoveVirtualDimsAction.setText("Change #virtual dims");
+    _addRemoveVirtualDimsAction.getAddOptionButton().setToolTip("Add a virtual dimension");
+    _addRemoveVirtualDimsAction.getRemoveOptionButton().setToolTip("Remove the last virtual dimension");
 
     _matrixTypeAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _virtualDimsListAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
     _numAvailableDimsAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
     _statusTextAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _queryResultAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _markersListAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _panelResultAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _pointMappingAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _residentStatusAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
+    _h5AccessStatusAction.setDefaultWidgetFlags(gui::StringAction::WidgetFlag::Label);
 
     appendSingleDataDimAction(1);
 
@@ -34,13 +162,100 @@ SettingsAction::SettingsAction(QObject* parent) :
     _fileOnDiskAction.setFileType("Sparse H5 data");
     _fileOnDiskAction.setNameFilters({ "Images (*.h5)" });
 
+    _pointIdsFileAction.setPlaceHolderString("Pick point ID file...");
+    _pointIdsFileAction.setFileType("Point IDs");
+    _pointIdsFileAction.setNameFilters({ "Text files (*.txt *.csv *.tsv)" });
+
+    _panelFileAction.setPlaceHolderString("Pick panel file...");
+    _panelFileAction.setFileType("Variable panel");
+    _panelFileAction.setNameFilters({ "Text files (*.txt *.csv *.tsv)" });
+
+    _shardDirectoryAction.setPlaceHolderString("Pick folder with sharded H5 files or Zarr store...");
+    _diskCacheDirectoryAction.setPlaceHolderString("Pick cache folder...");
+    _accessTraceDirectoryAction.setPlaceHolderString("Pick trace folder...");
+
     addAction(&_fileOnDiskAction);
+    addAction(&_shardDirectoryAction);
     addAction(&_matrixTypeAction);
     addAction(&_numAvailableDimsAction);
     addAction(&_statusTextAction);
     addAction(&_addRemoveDimsAction);
+    _pointOrderAction.addAction(&_pointIdsFileAction);
+    _pointOrderAction.addAction(&_pointMappingAction);
+
+    _dimensionSearchGroupAction.addAction(&_dimensionSearchAction);
+    _dimensionSearchGroupAction.addAction(&_dimensionMatchesAction);
+
+    _virtualDimsAction.addAction(&_virtualDimNameAction);
+    _virtualDimsAction.addAction(&_virtualDimVariablesAction);
+    _virtualDimsAction.addAction(&_virtualDimReductionAction);
+    _virtualDimsAction.addAction(&_addRemoveVirtualDimsAction);
+    _virtualDimsAction.addAction(&_virtualDimsListAction);
+
+    _pcaAction.addAction(&_pcaComponentsAction);
+    _pcaAction.addAction(&_computePcaAction);
+
+    _queryGroupAction.addAction(&_queryAction);
+    _queryGroupAction.addAction(&_selectQueryAction);
+    _queryGroupAction.addAction(&_queryResultAction);
+
+    _markersAction.addAction(&_markerCountAction);
+    _markersAction.addAction(&_findMarkersAction);
+    _markersAction.addAction(&_markersListAction);
+
+    _panelAction.addAction(&_panelVariablesAction);
+    _panelAction.addAction(&_panelFileAction);
+    _panelAction.addAction(&_showPanelAction);
+    _panelAction.addAction(&_panelRankingAction);
+    _panelAction.addAction(&_panelCountAction);
+    _panelAction.addAction(&_showTopPanelAction);
+    _panelAction.addAction(&_panelResultAction);
+
+    _valueTransformAction.addAction(&_normalizeTotalsAction);
+    _valueTransformAction.addAction(&_targetSumAction);
+    _valueTransformAction.addAction(&_log1pAction);
+    _valueTransformAction.addAction(&_scaleAction);
+    _valueTransformAction.addAction(&_clipAction);
+
+    _progressiveAction.addAction(&_progressiveIntervalAction);
+    _progressiveAction.addAction(&_progressiveOrderAction);
+
+    _diskCacheAction.addAction(&_diskCacheDirectoryAction);
+    _diskCacheAction.addAction(&_diskCacheSizeAction);
+    _diskCacheAction.addAction(&_clearDiskCacheAction);
+
+    _accessTraceAction.addAction(&_accessTraceDirectoryAction);
+
+    _residentAction.addAction(&_residentModeAction);
+    _residentAction.addAction(&_residentBudgetAction);
+    _residentAction.addAction(&_residentLossyAction);
+    _residentAction.addAction(&_residentStatusAction);
+
+    _h5AccessAction.addAction(&_h5AutoTuneAction);
+    _h5AccessAction.addAction(&_h5DriverAction);
+    _h5AccessAction.addAction(&_h5PageBufferAction);
+    _h5AccessAction.addAction(&_h5MetadataCacheAction);
+    _h5AccessAction.addAction(&_h5MetaBlockAction);
+    _h5AccessAction.addAction(&_h5AccessStatusAction);
+
+    addAction(&_pointOrderAction);
     addAction(&_dataDimsAction);
+    addAction(&_dimensionSearchGroupAction);
+    addAction(&_virtualDimsAction);
+    addAction(&_pcaAction);
+    addAction(&_queryGroupAction);
+    addAction(&_markersAction);
+    addAction(&_panelAction);
+    addAction(&_valueTransformAction);
+    addAction(&_progressiveAction);
+    addAction(&_diskCacheAction);
+    addAction(&_accessTraceAction);
+    addAction(&_residentAction);
+    addAction(&_h5AccessAction);
+    addAction(&_outputTypeAction);
     addAction(&_saveDataToProjectAction);
+    addAction(&_saveModeAction);
+    addAction(&_saveVariablesAction);
 }
 
 SettingsAction::~SettingsAction() {
@@ -49,13 +264,31 @@ SettingsAction::~SettingsAction() {
 void SettingsAction::setEnabled(bool enabled)
 {
     _fileOnDiskAction.setEnabled(enabled);
+    _shardDirectoryAction.setEnabled(enabled);
     _addRemoveDimsAction.getAddOptionButton().setEnabled(enabled);
     _addRemoveDimsAction.getRemoveOptionButton().setEnabled(enabled);
     _addRemoveDimsAction.setEnabled(enabled);
     _matrixTypeAction.setEnabled(enabled);
     _numAvailableDimsAction.setEnabled(enabled);
+    _pointOrderAction.setEnabled(enabled);
     _dataDimsAction.setEnabled(enabled);
+    _dimensionSearchGroupAction.setEnabled(enabled);
+    _outputTypeAction.setEnabled(enabled);
+    _addRemoveVirtualDimsAction.getAddOptionButton().setEnabled(enabled);
+    _addRemoveVirtualDimsAction.getRemoveOptionButton().setEnabled(enabled);
+    _virtualDimsAction.setEnabled(enabled);
+    _computePcaAction.setEnabled(enabled);
+    _pcaAction.setEnabled(enabled);
+    _queryGroupAction.setEnabled(enabled);
+    _markersAction.setEnabled(enabled);
+    _panelAction.setEnabled(enabled);
+    _valueTransformAction.setEnabled(enabled);
+    _progressiveAction.setEnabled(enabled);
+    _residentAction.setEnabled(enabled);
+    _h5AccessAction.setEnabled(enabled);
     _saveDataToProjectAction.setEnabled(enabled);
+    _saveModeAction.setEnabled(enabled);
+    _saveVariablesAction.setEnabled(enabled);
     _statusTextAction.setEnabled(enabled);
 
     if (enabled) {
@@ -75,6 +308,7 @@ void SettingsAction::appendSingleDataDimAction(const size_t id)
 {
     auto& action = _dataDimActions.emplace_back(std::make_unique<gui::OptionAction>(this, QString("Dim %1").arg(id), QStringList{}, QString{}));
     action->setToolTip(QString("Data dimension %1").arg(id));
+    action->setCustomModel(&_dimensionModel);
     action->setDefaultWidgetFlag(gui::OptionAction::WidgetFlag::LineEdit);
     _dataDimsAction.addAction(action.get());
 }
@@ -113,7 +347,8 @@ void SettingsAction::resetDataDimActions()
 
     assert(_dataDimActions.size() == 1);
 
-    _dataDimActions.back()->initialize(QStringList{}, QString{});
+    _dimensionModel.setNames({});
+    _dataDimActions.back()->setCurrentIndex(-1);
 }
 
 std::vector<std::int32_t> SettingsAction::getSelectedOptionIndices() const
@@ -129,16 +364,103 @@ std::vector<std::int32_t> SettingsAction::getSelectedOptionIndices() const
     return selectedOptionIndices;
 }
 
+OutputElementType SettingsAction::getOutputElementType() const
+{
+    return outputElementStringToType(_outputTypeAction.getCurrentText().toStdString());
+}
+
+AggregateReduction SettingsAction::getVirtualDimReduction() const
+{
+    return aggregateReductionStringToType(_virtualDimReductionAction.getCurrentText().toStdString());
+}
+
+ValueTransform SettingsAction::getValueTransform() const
+{
+    ValueTransform transform;
+    transform._normalizeTotals  = _normalizeTotalsAction.isChecked();
+    transform._targetSum        = static_cast<float>(_targetSumAction.getValue());
+    transform._log1p            = _log1pAction.isChecked();
+    transform._scale            = _scaleAction.getValue();
+
+    if (_clipAction.getValue() > 0.f)
+        transform._clipMax = _clipAction.getValue();
+
+    return transform;
+}
+
+ResidentSettings SettingsAction::getResidentSettings() const
+{
+    ResidentSettings settings;
+    settings._budgetBytes   = static_cast<std::uint64_t>(_residentBudgetAction.getValue()) << 30;
+    settings._lossyValues   = _residentLossyAction.isChecked();
+
+    return settings;
+}
+
+H5AccessSettings SettingsAction::getH5AccessSettings() const
+{
+    constexpr std::uint64_t KiB = 1024;
+
+    H5AccessSettings settings;
+    settings._autoTune              = _h5AutoTuneAction.isChecked();
+    settings._driver                = h5DriverStringToType(_h5DriverAction.getCurrentText().toStdString());
+    settings._pageBufferBytes       = static_cast<std::uint64_t>(_h5PageBufferAction.getValue()) * KiB * KiB;
+    settings._metadataCacheBytes    = static_cast<std::uint64_t>(_h5MetadataCacheAction.getValue()) * KiB * KiB;
+    settings._metaBlockBytes        = static_cast<std::uint64_t>(_h5MetaBlockAction.getValue()) * KiB;
+
+    return settings;
+}
+
+ProgressiveRead SettingsAction::getProgressiveRead() const
+{
+    ProgressiveRead progressive;
+    progressive._intervalSeconds    = _progressiveIntervalAction.getValue() / 1000.0;
+    progressive._stridedOrder       = _progressiveOrderAction.getCurrentIndex() == 0;
+
+    return progressive;
+}
+
 void SettingsAction::fromVariantMap(const QVariantMap& variantMap)
 {
     gui::GroupAction::fromVariantMap(variantMap);
 
+    // Before the file such that it is opened with them
+    _h5AutoTuneAction.fromParentVariantMap(variantMap);
+    _h5DriverAction.fromParentVariantMap(variantMap);
+    _h5PageBufferAction.fromParentVariantMap(variantMap);
+    _h5MetadataCacheAction.fromParentVariantMap(variantMap);
+    _h5MetaBlockAction.fromParentVariantMap(variantMap);
+    _normalizeTotalsAction.fromParentVariantMap(variantMap);
+    _targetSumAction.fromParentVariantMap(variantMap);
+    _log1pAction.fromParentVariantMap(variantMap);
+    _scaleAction.fromParentVariantMap(variantMap);
+    _clipAction.fromParentVariantMap(variantMap);
     _fileOnDiskAction.fromParentVariantMap(variantMap);
+    _shardDirectoryAction.fromParentVariantMap(variantMap);
     _matrixTypeAction.fromParentVariantMap(variantMap);
     _statusTextAction.fromParentVariantMap(variantMap);
     _numAvailableDimsAction.fromParentVariantMap(variantMap);
+    _pointIdsFileAction.fromParentVariantMap(variantMap);
     _dataDimsAction.fromParentVariantMap(variantMap);
+    _outputTypeAction.fromParentVariantMap(variantMap);
+    _virtualDimReductionAction.fromParentVariantMap(variantMap);
+    _pcaComponentsAction.fromParentVariantMap(variantMap);
+    _queryAction.fromParentVariantMap(variantMap);
+    _markerCountAction.fromParentVariantMap(variantMap);
+    _panelVariablesAction.fromParentVariantMap(variantMap);
+    _panelRankingAction.fromParentVariantMap(variantMap);
+    _panelCountAction.fromParentVariantMap(variantMap);
+    _progressiveIntervalAction.fromParentVariantMap(variantMap);
+    _progressiveOrderAction.fromParentVariantMap(variantMap);
+    _diskCacheSizeAction.fromParentVariantMap(variantMap);
+    _diskCacheDirectoryAction.fromParentVariantMap(variantMap);
+    _accessTraceDirectoryAction.fromParentVariantMap(variantMap);
+    _residentModeAction.fromParentVariantMap(variantMap);
+    _residentBudgetAction.fromParentVariantMap(variantMap);
+    _residentLossyAction.fromParentVariantMap(variantMap);
     _saveDataToProjectAction.fromParentVariantMap(variantMap);
+    _saveModeAction.fromParentVariantMap(variantMap);
+    _saveVariablesAction.fromParentVariantMap(variantMap);
 }
 
 
@@ -147,11 +469,41 @@ QVariantMap SettingsAction::toVariantMap() const
     QVariantMap variantMap = gui::GroupAction::toVariantMap();
 
     _fileOnDiskAction.insertIntoVariantMap(variantMap);
+    _shardDirectoryAction.insertIntoVariantMap(variantMap);
     _matrixTypeAction.insertIntoVariantMap(variantMap);
     _statusTextAction.insertIntoVariantMap(variantMap);
     _numAvailableDimsAction.insertIntoVariantMap(variantMap);
+    _pointIdsFileAction.insertIntoVariantMap(variantMap);
     _dataDimsAction.insertIntoVariantMap(variantMap);
+    _outputTypeAction.insertIntoVariantMap(variantMap);
+    _virtualDimReductionAction.insertIntoVariantMap(variantMap);
+    _pcaComponentsAction.insertIntoVariantMap(variantMap);
+    _queryAction.insertIntoVariantMap(variantMap);
+    _markerCountAction.insertIntoVariantMap(variantMap);
+    _panelVariablesAction.insertIntoVariantMap(variantMap);
+    _panelRankingAction.insertIntoVariantMap(variantMap);
+    _panelCountAction.insertIntoVariantMap(variantMap);
+    _normalizeTotalsAction.insertIntoVariantMap(variantMap);
+    _targetSumAction.insertIntoVariantMap(variantMap);
+    _log1pAction.insertIntoVariantMap(variantMap);
+    _scaleAction.insertIntoVariantMap(variantMap);
+    _clipAction.insertIntoVariantMap(variantMap);
+    _progressiveIntervalAction.insertIntoVariantMap(variantMap);
+    _progressiveOrderAction.insertIntoVariantMap(variantMap);
+    _diskCacheSizeAction.insertIntoVariantMap(variantMap);
+    _diskCacheDirectoryAction.insertIntoVariantMap(variantMap);
+    _accessTraceDirectoryAction.insertIntoVariantMap(variantMap);
+    _residentModeAction.insertIntoVariantMap(variantMap);
+    _residentBudgetAction.insertIntoVariantMap(variantMap);
+    _residentLossyAction.insertIntoVariantMap(variantMap);
+    _h5AutoTuneAction.insertIntoVariantMap(variantMap);
+    _h5DriverAction.insertIntoVariantMap(variantMap);
+    _h5PageBufferAction.insertIntoVariantMap(variantMap);
+    _h5MetadataCacheAction.insertIntoVariantMap(variantMap);
+    _h5MetaBlockAction.insertIntoVariantMap(variantMap);
     _saveDataToProjectAction.insertIntoVariantMap(variantMap);
+    _saveModeAction.insertIntoVariantMap(variantMap);
+    _saveVariablesAction.insertIntoVariantMap(variantMap);
 
     return variantMap;
 }
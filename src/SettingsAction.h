@@ -1,12 +1,20 @@
 #pragma once
 
 #include "AddRemoveButtonAction.h"
+#include "DimensionModel.h"
+#include "H5Utils.h"
+#include "Quantization.h"
+#include "ResidentReader.h"
 
+#include <actions/DecimalAction.h>
+#include <actions/DirectoryPickerAction.h>
 #include <actions/GroupAction.h>
+#include <actions/IntegralAction.h>
 #include <actions/OptionAction.h>
 #include <actions/FilePickerAction.h>
 #include <actions/StringAction.h>
 #include <actions/ToggleAction.h>
+#include <actions/TriggerAction.h>
 
 #include <cstdint>
 #include <memory>
@@ -14,6 +22,13 @@
 
 #include <QString>
 
+// What is saved to the project if "Save data to project" is checked
+enum class ProjectSaveMode : std::int32_t {
+    USED_VARIABLES,     // Selected and virtual dimension variables as a compact file
+    VARIABLE_SUBSET,    // User-chosen variables as a compact file
+    ENTIRE_FILE,
+};
+
 class SettingsAction : public mv::gui::GroupAction
 {
 public:
@@ -29,21 +44,87 @@ public:
     bool removeDataDimAction();     // returns whether removing was successful
     void resetDataDimActions();
 
+    // All data dimension pickers show the same names, set once per matrix
+    void setDimensionNames(const QStringList& names) { _dimensionModel.setNames(names); }
+
 public: // Getters
 
     bool getSaveDataToProjectChecked() const { return _saveDataToProjectAction.isChecked(); }
     QString getFileOnDiskPath() const { return _fileOnDiskAction.getFilePath(); }
+    QString getShardDirectory() const { return _shardDirectoryAction.getDirectory(); }
+    QString getPointIdsFilePath() const { return _pointIdsFileAction.getFilePath(); }
+    QString getDiskCacheDirectory() const { return _diskCacheDirectoryAction.getDirectory(); }
+    std::uint64_t getDiskCacheSize() const { return static_cast<std::uint64_t>(_diskCacheSizeAction.getValue()) << 30; }    // Bytes
+    QString getAccessTraceDirectory() const { return _accessTraceDirectoryAction.getDirectory(); }
+    bool getResidentModeChecked() const { return _residentModeAction.isChecked(); }
+    ResidentSettings getResidentSettings() const;
+    H5AccessSettings getH5AccessSettings() const;
     std::vector<std::int32_t> getSelectedOptionIndices() const;
+    OutputElementType getOutputElementType() const;
+    AggregateReduction getVirtualDimReduction() const;
+    ValueTransform getValueTransform() const;
+    ProgressiveRead getProgressiveRead() const;     // Without callback, an interval of 0 disables partial results
+    ProjectSaveMode getProjectSaveMode() const { return static_cast<ProjectSaveMode>(_saveModeAction.getCurrentIndex()); }
 
 public: // Action getters
 
     mv::gui::FilePickerAction& getFileOnDiskAction() { return _fileOnDiskAction; }
+    mv::gui::DirectoryPickerAction& getShardDirectoryAction() { return _shardDirectoryAction; }
     mv::gui::StringAction& getMatrixTypeAction() { return _matrixTypeAction; }
     mv::gui::StringAction& getNumAvailableDimsAction() { return _numAvailableDimsAction; }
     mv::gui::StringAction& getStatusTextAction() { return _statusTextAction; }
+    mv::gui::FilePickerAction& getPointIdsFileAction() { return _pointIdsFileAction; }
+    mv::gui::StringAction& getPointMappingAction() { return _pointMappingAction; }
     AddRemoveButtonAction& getAddRemoveButtonAction() { return _addRemoveDimsAction; }
     OptionActions& getDataDimActions() { return _dataDimActions; }
+    mv::gui::StringAction& getDimensionSearchAction() { return _dimensionSearchAction; }
+    mv::gui::OptionAction& getDimensionMatchesAction() { return _dimensionMatchesAction; }
+    DimensionModel& getDimensionMatchesModel() { return _dimensionMatchesModel; }
     mv::gui::ToggleAction& getSaveDataToProjectAction() { return _saveDataToProjectAction; }
+    mv::gui::OptionAction& getSaveModeAction() { return _saveModeAction; }
+    mv::gui::StringAction& getSaveVariablesAction() { return _saveVariablesAction; }
+    mv::gui::OptionAction& getOutputTypeAction() { return _outputTypeAction; }
+    mv::gui::StringAction& getVirtualDimNameAction() { return _virtualDimNameAction; }
+    mv::gui::StringAction& getVirtualDimVariablesAction() { return _virtualDimVariablesAction; }
+    mv::gui::OptionAction& getVirtualDimReductionAction() { return _virtualDimReductionAction; }
+    AddRemoveButtonAction& getAddRemoveVirtualDimsAction() { return _addRemoveVirtualDimsAction; }
+    mv::gui::StringAction& getVirtualDimsListAction() { return _virtualDimsListAction; }
+    mv::gui::IntegralAction& getPcaComponentsAction() { return _pcaComponentsAction; }
+    mv::gui::TriggerAction& getComputePcaAction() { return _computePcaAction; }
+    mv::gui::StringAction& getQueryAction() { return _queryAction; }
+    mv::gui::TriggerAction& getSelectQueryAction() { return _selectQueryAction; }
+    mv::gui::StringAction& getQueryResultAction() { return _queryResultAction; }
+    mv::gui::IntegralAction& getMarkerCountAction() { return _markerCountAction; }
+    mv::gui::TriggerAction& getFindMarkersAction() { return _findMarkersAction; }
+    mv::gui::StringAction& getMarkersListAction() { return _markersListAction; }
+    mv::gui::StringAction& getPanelVariablesAction() { return _panelVariablesAction; }
+    mv::gui::FilePickerAction& getPanelFileAction() { return _panelFileAction; }
+    mv::gui::TriggerAction& getShowPanelAction() { return _showPanelAction; }
+    mv::gui::OptionAction& getPanelRankingAction() { return _panelRankingAction; }
+    mv::gui::IntegralAction& getPanelCountAction() { return _panelCountAction; }
+    mv::gui::TriggerAction& getShowTopPanelAction() { return _showTopPanelAction; }
+    mv::gui::StringAction& getPanelResultAction() { return _panelResultAction; }
+    mv::gui::ToggleAction& getNormalizeTotalsAction() { return _normalizeTotalsAction; }
+    mv::gui::IntegralAction& getTargetSumAction() { return _targetSumAction; }
+    mv::gui::ToggleAction& getLog1pAction() { return _log1pAction; }
+    mv::gui::DecimalAction& getScaleAction() { return _scaleAction; }
+    mv::gui::DecimalAction& getClipAction() { return _clipAction; }
+    mv::gui::IntegralAction& getProgressiveIntervalAction() { return _progressiveIntervalAction; }
+    mv::gui::OptionAction& getProgressiveOrderAction() { return _progressiveOrderAction; }
+    mv::gui::DirectoryPickerAction& getDiskCacheDirectoryAction() { return _diskCacheDirectoryAction; }
+    mv::gui::IntegralAction& getDiskCacheSizeAction() { return _diskCacheSizeAction; }
+    mv::gui::TriggerAction& getClearDiskCacheAction() { return _clearDiskCacheAction; }
+    mv::gui::DirectoryPickerAction& getAccessTraceDirectoryAction() { return _accessTraceDirectoryAction; }
+    mv::gui::ToggleAction& getResidentModeAction() { return _residentModeAction; }
+    mv::gui::IntegralAction& getResidentBudgetAction() { return _residentBudgetAction; }
+    mv::gui::ToggleAction& getResidentLossyAction() { return _residentLossyAction; }
+    mv::gui::StringAction& getResidentStatusAction() { return _residentStatusAction; }
+    mv::gui::ToggleAction& getH5AutoTuneAction() { return _h5AutoTuneAction; }
+    mv::gui::OptionAction& getH5DriverAction() { return _h5DriverAction; }
+    mv::gui::IntegralAction& getH5PageBufferAction() { return _h5PageBufferAction; }
+    mv::gui::IntegralAction& getH5MetadataCacheAction() { return _h5MetadataCacheAction; }
+    mv::gui::IntegralAction& getH5MetaBlockAction() { return _h5MetaBlockAction; }
+    mv::gui::StringAction& getH5AccessStatusAction() { return _h5AccessStatusAction; }
 
 public: // Serialization
 
@@ -55,12 +136,76 @@ private:
 
 protected:
 
-    mv::gui::FilePickerAction   _fileOnDiskAction;           /** File on disk */
-    mv::gui::StringAction       _matrixTypeAction;           /** Type of sparse matrix */
-    mv::gui::StringAction       _numAvailableDimsAction;     /** Shows number of available dimension */
-    mv::gui::StringAction       _statusTextAction;           /** Shows number of available dimension */
-    AddRemoveButtonAction       _addRemoveDimsAction;        /** Buttons to add/remove dimension option */
-    OptionActions               _dataDimActions;             /** Data dimension actions */
-    mv::gui::GroupAction        _dataDimsAction;             /** Group of data dimension actions */
-    mv::gui::ToggleAction       _saveDataToProjectAction;    /** Whether to save the data form disk to the project */
+    mv::gui::FilePickerAction       _fileOnDiskAction;           /** File on disk */
+    mv::gui::DirectoryPickerAction  _shardDirectoryAction;       /** Folder with sharded files on disk */
+    mv::gui::StringAction           _matrixTypeAction;           /** Type of sparse matrix */
+    mv::gui::StringAction           _numAvailableDimsAction;     /** Shows number of available dimension */
+    mv::gui::StringAction           _statusTextAction;           /** Shows number of available dimension */
+    mv::gui::FilePickerAction       _pointIdsFileAction;         /** Text file with the obs name of every input point, one per line */
+    mv::gui::StringAction           _pointMappingAction;         /** How the input points map to the rows of the file */
+    mv::gui::GroupAction            _pointOrderAction;           /** Group of point order actions */
+    AddRemoveButtonAction           _addRemoveDimsAction;        /** Buttons to add/remove dimension option */
+    OptionActions                   _dataDimActions;             /** Data dimension actions */
+    DimensionModel                  _dimensionModel;             /** Variable names shared by all data dimension actions */
+    mv::gui::GroupAction            _dataDimsAction;             /** Group of data dimension actions */
+    mv::gui::StringAction           _dimensionSearchAction;      /** Prefix or part of variable names, case-insensitive */
+    DimensionModel                  _dimensionMatchesModel;      /** Variables that match the search */
+    mv::gui::OptionAction           _dimensionMatchesAction;     /** Adds the picked match as a data dimension */
+    mv::gui::GroupAction            _dimensionSearchGroupAction; /** Group of variable search actions */
+    mv::gui::OptionAction           _outputTypeAction;           /** Element type of the output data */
+    mv::gui::StringAction           _virtualDimNameAction;       /** Name of a new virtual dimension */
+    mv::gui::StringAction           _virtualDimVariablesAction;  /** Variables that are reduced into a new virtual dimension */
+    mv::gui::OptionAction           _virtualDimReductionAction;  /** Reduction of a new virtual dimension */
+    AddRemoveButtonAction           _addRemoveVirtualDimsAction; /** Buttons to add/remove virtual dimensions */
+    mv::gui::StringAction           _virtualDimsListAction;      /** Lists the virtual dimensions */
+    mv::gui::GroupAction            _virtualDimsAction;          /** Group of virtual dimension actions */
+    mv::gui::IntegralAction         _pcaComponentsAction;        /** Number of principal components */
+    mv::gui::TriggerAction          _computePcaAction;           /** Computes a PCA of the entire matrix on disk */
+    mv::gui::GroupAction            _pcaAction;                  /** Group of PCA actions */
+    mv::gui::StringAction           _queryAction;                /** Predicates on variables, e.g. GeneA > 1 AND GeneB == 0 */
+    mv::gui::TriggerAction          _selectQueryAction;          /** Selects the input points that satisfy the query */
+    mv::gui::StringAction           _queryResultAction;          /** Number of selected points or the query error */
+    mv::gui::GroupAction            _queryGroupAction;           /** Group of query actions */
+    mv::gui::IntegralAction         _markerCountAction;          /** Number of marker variables that are shown as dimensions */
+    mv::gui::TriggerAction          _findMarkersAction;          /** Ranks all variables for the selected points against the rest */
+    mv::gui::StringAction           _markersListAction;          /** Lists the top marker variables */
+    mv::gui::GroupAction            _markersAction;              /** Group of marker actions */
+    mv::gui::StringAction           _panelVariablesAction;       /** Variables of a panel, e.g. marker genes */
+    mv::gui::FilePickerAction       _panelFileAction;            /** Text file with the variables of a panel */
+    mv::gui::TriggerAction          _showPanelAction;            /** Shows the panel variables as the data dimensions */
+    mv::gui::OptionAction           _panelRankingAction;         /** Statistic by which the top variables are chosen */
+    mv::gui::IntegralAction         _panelCountAction;           /** Number of top variables */
+    mv::gui::TriggerAction          _showTopPanelAction;         /** Shows the top variables as the data dimensions */
+    mv::gui::StringAction           _panelResultAction;          /** Number of shown variables and those not found */
+    mv::gui::GroupAction            _panelAction;                /** Group of dimension panel actions */
+    mv::gui::ToggleAction           _normalizeTotalsAction;      /** Whether values are divided by the total of their point */
+    mv::gui::IntegralAction         _targetSumAction;            /** Total of every point after normalization */
+    mv::gui::ToggleAction           _log1pAction;                /** Whether log1p is applied after normalization */
+    mv::gui::DecimalAction          _scaleAction;                /** Factor applied after log1p */
+    mv::gui::DecimalAction          _clipAction;                 /** Upper limit of the values, disabled if 0 */
+    mv::gui::GroupAction            _valueTransformAction;       /** Group of value transform actions */
+    mv::gui::IntegralAction         _progressiveIntervalAction;  /** Milliseconds between partial results of slow reads, disabled if 0 */
+    mv::gui::OptionAction           _progressiveOrderAction;     /** Order in which slow reads scan the file */
+    mv::gui::GroupAction            _progressiveAction;          /** Group of progressive reading actions */
+    mv::gui::DirectoryPickerAction  _diskCacheDirectoryAction;   /** Folder of the persistent cache, disabled if empty */
+    mv::gui::IntegralAction         _diskCacheSizeAction;        /** Size cap of the persistent cache in GiB */
+    mv::gui::TriggerAction          _clearDiskCacheAction;       /** Removes all entries of the persistent cache */
+    mv::gui::GroupAction            _diskCacheAction;            /** Group of persistent cache actions */
+    mv::gui::DirectoryPickerAction  _accessTraceDirectoryAction; /** Folder of recorded access traces, disabled if empty */
+    mv::gui::GroupAction            _accessTraceAction;          /** Group of access trace actions */
+    mv::gui::ToggleAction           _residentModeAction;         /** Whether the whole matrix is loaded into memory */
+    mv::gui::IntegralAction         _residentBudgetAction;       /** Memory budget of the resident matrix in GiB */
+    mv::gui::ToggleAction           _residentLossyAction;        /** Whether non-integer values are stored as bfloat16 */
+    mv::gui::StringAction           _residentStatusAction;       /** Size of the resident matrix or why it is read from disk */
+    mv::gui::GroupAction            _residentAction;             /** Group of in-memory mode actions */
+    mv::gui::ToggleAction           _h5AutoTuneAction;           /** Whether the HDF5 settings are picked per file */
+    mv::gui::OptionAction           _h5DriverAction;             /** HDF5 virtual file driver without auto-tuning */
+    mv::gui::IntegralAction         _h5PageBufferAction;         /** HDF5 page buffer in MiB without auto-tuning, for paged files */
+    mv::gui::IntegralAction         _h5MetadataCacheAction;      /** HDF5 metadata cache in MiB without auto-tuning, default if 0 */
+    mv::gui::IntegralAction         _h5MetaBlockAction;          /** HDF5 metadata block size in KiB without auto-tuning, default if 0 */
+    mv::gui::StringAction           _h5AccessStatusAction;       /** Settings the current file is opened with */
+    mv::gui::GroupAction            _h5AccessAction;             /** Group of HDF5 file access actions */
+    mv::gui::ToggleAction           _saveDataToProjectAction;    /** Whether to save the data form disk to the project */
+    mv::gui::OptionAction           _saveModeAction;             /** Which part of the data is saved to the project */
+    mv::gui::StringAction           _saveVariablesAction;        /** Variables that are saved with the variable subset mode */
 };
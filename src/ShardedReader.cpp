@@ -0,0 +1,430 @@
+#include "ShardedReader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iostream>
+#include <unordered_map>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// ShardedReader
+// =============================================================================
+
+ShardedReader::ShardedReader() :
+    SparseMatrixReader(SparseMatrixType::UNKNOWN)
+{
+}
+
+ShardedReader::ShardedReader(const std::vector<std::string>& filenames) :
+    ShardedReader()
+{
+    readFiles(filenames);
+}
+
+ShardedReader::~ShardedReader() = default;
+
+std::vector<std::string> ShardedReader::listShardFiles(const std::string& directory)
+{
+    std::vector<std::string> filenames;
+
+    std::error_code ec;
+    for (const auto& entry : fs::directory_iterator(directory, ec)) {
+        if (!entry.is_regular_file())
+            continue;
+
+        std::string extension = entry.path().extension().string();
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        if (extension == ".h5" || extension == ".hdf5")
+            filenames.push_back(entry.path().string());
+    }
+
+    if (ec) {
+        std::cerr << "ShardedReader::listShardFiles: cannot list " << directory << ": " << ec.message() << std::endl;
+    }
+
+    std::sort(filenames.begin(), filenames.end());
+
+    return filenames;
+}
+
+bool ShardedReader::readDirectory(const std::string& directory)
+{
+    return readFiles(listShardFiles(directory));
+}
+
+bool ShardedReader::readFiles(const std::vector<std::string>& filenames)
+{
+    reset(/* keepType = */ false);
+    _shards.clear();
+    _rowOffsets = { 0 };
+    _globalToShardCols.clear();
+    _shardToGlobalCols.clear();
+
+    if (filenames.empty()) {
+        std::cerr << "ShardedReader::readFiles: no files given" << std::endl;
+        return false;
+    }
+
+    // All shards share the budget for reading files into memory
+    H5AccessSettings access = _h5Access;
+    access._coreBudgetBytes /= filenames.size();
+
+    for (const std::string& filename : filenames) {
+        std::unique_ptr<SparseMatrixReader> shard = openSparseMatrixReader(filename, access);
+
+        if (!shard) {
+            std::cerr << "ShardedReader::readFiles: skipping " << filename << std::endl;
+            continue;
+        }
+
+        // The shards are only accessed through this reader, which caches the combined arrays
+        shard->setUseCache(false);
+
+        _rowOffsets.push_back(_rowOffsets.back() + shard->getNumRows());
+        _shards.push_back(std::move(shard));
+    }
+
+    if (_shards.empty()) {
+        return false;
+    }
+
+    const SparseMatrixReader& first = *_shards.front();
+
+    _type               = first.getType();
+    _data._filename     = filenames.front();
+    _data._num_rows     = _rowOffsets.back();
+    _data._num_cols     = first.getNumCols();
+    _data._var_names    = first.getVarNames();
+
+    // Hash the global variable names once, then align each shard against them
+    std::unordered_map<std::string, std::int64_t> globalCols;
+    globalCols.reserve(_data._var_names.size());
+    for (std::int64_t col = 0; col < static_cast<std::int64_t>(_data._var_names.size()); ++col) {
+        globalCols.emplace(_data._var_names[col], col);
+    }
+
+    _globalToShardCols.resize(_shards.size());
+    _shardToGlobalCols.resize(_shards.size());
+
+    bool allObsNames = true;
+
+    for (size_t shard = 0; shard < _shards.size(); ++shard) {
+        const SparseMatrixReader& reader = *_shards[shard];
+
+        if (reader.getType() != _type) {
+            _type = SparseMatrixType::UNKNOWN;    // mixed storage
+        }
+
+        allObsNames = allObsNames && reader.hasObsNames();
+
+        const std::vector<std::string>& shardNames = reader.getVarNames();
+
+        if (shardNames == _data._var_names && reader.getNumCols() == _data._num_cols) {
+            continue;   // same order, no mapping needed
+        }
+
+        if (shardNames.empty() || _data._var_names.empty()) {
+            std::cerr << "ShardedReader::readFiles: shard " << shard << " has different columns and no variable names to align them" << std::endl;
+            _shards.clear();
+            _rowOffsets = { 0 };
+            reset(false);
+            return false;
+        }
+
+        auto& globalToShard = _globalToShardCols[shard];
+        auto& shardToGlobal = _shardToGlobalCols[shard];
+        globalToShard.assign(_data._num_cols, -1);
+        shardToGlobal.assign(shardNames.size(), -1);
+
+        std::int64_t numMatched = 0;
+        for (std::int64_t col = 0; col < static_cast<std::int64_t>(shardNames.size()); ++col) {
+            const auto it = globalCols.find(shardNames[col]);
+            if (it == globalCols.end())
+                continue;
+
+            globalToShard[it->second] = col;
+            shardToGlobal[col] = it->second;
+            numMatched++;
+        }
+
+        if (numMatched < _data._num_cols) {
+            std::cerr << "ShardedReader::readFiles: shard " << shard << " lacks " << (_data._num_cols - numMatched) << " variables, they read as zeros" << std::endl;
+        }
+    }
+
+    if (allObsNames) {
+        _data._obs_names.reserve(_data._num_rows);
+        for (const auto& shard : _shards) {
+            _data._obs_names.insert(_data._obs_names.end(), shard->getObsNames().begin(), shard->getObsNames().end());
+        }
+    }
+
+    return true;
+}
+
+void ShardedReader::setValueTransform(const ValueTransform& transform)
+{
+    for (const auto& shard : _shards) {
+        shard->setValueTransform(transform);
+    }
+
+    SparseMatrixReader::setValueTransform(transform);
+}
+
+std::uint64_t ShardedReader::getBytesRead() const
+{
+    std::uint64_t bytesRead = 0;
+    for (const auto& shard : _shards) {
+        bytesRead += shard->getBytesRead();
+    }
+
+    return bytesRead;
+}
+
+std::vector<std::int64_t> ShardedReader::toShardColumns(const size_t shard, const std::vector<std::int64_t>& col_indices) const
+{
+    const auto& globalToShard = _globalToShardCols[shard];
+
+    if (globalToShard.empty()) {
+        return col_indices;
+    }
+
+    std::vector<std::int64_t> shardCols(col_indices.size(), -1);
+    for (size_t i = 0; i < col_indices.size(); ++i) {
+        const std::int64_t col = col_indices[i];
+        if (col >= 0 && col < static_cast<std::int64_t>(globalToShard.size())) {
+            shardCols[i] = globalToShard[col];
+        }
+    }
+
+    return shardCols;
+}
+
+std::vector<float> ShardedReader::toGlobalRow(const size_t shard, const std::vector<float>& shardRow) const
+{
+    const auto& shardToGlobal = _shardToGlobalCols[shard];
+
+    if (shardToGlobal.empty()) {
+        return shardRow;
+    }
+
+    std::vector<float> row(_data._num_cols, 0.0f);
+    for (size_t col = 0; col < shardRow.size() && col < shardToGlobal.size(); ++col) {
+        if (shardToGlobal[col] >= 0) {
+            row[shardToGlobal[col]] = shardRow[col];
+        }
+    }
+
+    return row;
+}
+
+std::vector<float> ShardedReader::getRowImpl(std::int64_t row_idx) const
+{
+    if (row_idx < 0 || row_idx >= _data._num_rows) {
+        std::cerr << "ShardedReader::getRowImpl: could not read from index" << std::endl;
+        return std::vector<float>(_data._num_cols, 0.0f);
+    }
+
+    const size_t shard = static_cast<size_t>(std::upper_bound(_rowOffsets.begin(), _rowOffsets.end(), row_idx) - _rowOffsets.begin()) - 1;
+
+    return toGlobalRow(shard, _shards[shard]->getRowImpl(row_idx - _rowOffsets[shard]));
+}
+
+std::vector<std::vector<float>> ShardedReader::getRowsImpl(const std::vector<std::int64_t>& row_indices) const
+{
+    std::vector<std::vector<float>> rows(row_indices.size());
+
+    // Batch the rows per shard
+    std::vector<std::vector<std::int64_t>> shardRows(_shards.size());
+    std::vector<std::vector<size_t>> shardPositions(_shards.size());
+
+    for (size_t i = 0; i < row_indices.size(); ++i) {
+        const std::int64_t row_idx = row_indices[i];
+
+        if (row_idx < 0 || row_idx >= _data._num_rows) {
+            std::cerr << "ShardedReader::getRowsImpl: could not read from index " << row_idx << std::endl;
+            rows[i].assign(_data._num_cols, 0.0f);
+            continue;
+        }
+
+        const size_t shard = static_cast<size_t>(std::upper_bound(_rowOffsets.begin(), _rowOffsets.end(), row_idx) - _rowOffsets.begin()) - 1;
+        shardRows[shard].push_back(row_idx - _rowOffsets[shard]);
+        shardPositions[shard].push_back(i);
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::int64_t shard = 0; shard < static_cast<std::int64_t>(_shards.size()); ++shard) {
+        if (shardRows[shard].empty())
+            continue;
+
+        std::vector<std::vector<float>> shardResult = _shards[shard]->getRowsImpl(shardRows[shard]);
+
+        for (size_t j = 0; j < shardResult.size(); ++j) {
+            rows[shardPositions[shard][j]] = toGlobalRow(shard, shardResult[j]);
+        }
+    }
+
+    return rows;
+}
+
+std::vector<float> ShardedReader::getColumnImpl(std::int64_t col_idx) const
+{
+    return std::move(getColumnsImpl({ col_idx }).front());
+}
+
+std::vector<std::vector<float>> ShardedReader::getColumnsImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    std::vector<std::vector<float>> columns(col_indices.size(), std::vector<float>(_data._num_rows, 0.0f));
+
+    // Every shard writes into its own slice of the columns
+#pragma omp parallel for schedule(dynamic)
+    for (std::int64_t shard = 0; shard < static_cast<std::int64_t>(_shards.size()); ++shard) {
+        const std::vector<std::int64_t> shardCols = toShardColumns(shard, col_indices);
+
+        std::vector<std::int64_t> readCols;
+        std::vector<size_t> readPositions;
+        for (size_t i = 0; i < shardCols.size(); ++i) {
+            if (shardCols[i] >= 0) {
+                readCols.push_back(shardCols[i]);
+                readPositions.push_back(i);
+            }
+        }
+
+        if (readCols.empty())
+            continue;
+
+        const std::vector<std::vector<float>> shardResult = _shards[shard]->getColumnsImpl(readCols);
+
+        for (size_t j = 0; j < shardResult.size(); ++j) {
+            std::copy(shardResult[j].begin(), shardResult[j].end(), columns[readPositions[j]].begin() + _rowOffsets[shard]);
+        }
+    }
+
+    return columns;
+}
+
+std::vector<float> ShardedReader::getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const
+{
+    std::vector<float> sums(_data._num_rows, 0.0f);
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::int64_t shard = 0; shard < static_cast<std::int64_t>(_shards.size()); ++shard) {
+        std::vector<std::int64_t> shardCols = toShardColumns(shard, col_indices);
+        shardCols.erase(std::remove(shardCols.begin(), shardCols.end(), std::int64_t{ -1 }), shardCols.end());
+
+        if (shardCols.empty())
+            continue;
+
+        const std::vector<float> shardSums = _shards[shard]->getColumnSumImpl(shardCols);
+        std::copy(shardSums.begin(), shardSums.end(), sums.begin() + _rowOffsets[shard]);
+    }
+
+    return sums;
+}
+
+std::vector<float> ShardedReader::getRowTotalsImpl() const
+{
+    std::vector<float> totals(_data._num_rows, 0.0f);
+
+#pragma omp parallel for schedule(dynamic)
+    for (std::int64_t shard = 0; shard < static_cast<std::int64_t>(_shards.size()); ++shard) {
+        const std::vector<float> shardTotals = _shards[shard]->getRowTotalsImpl();
+        std::copy(shardTotals.begin(), shardTotals.end(), totals.begin() + _rowOffsets[shard]);
+    }
+
+    return totals;
+}
+
+bool ShardedReader::streamBlocks(const BlockCallback& process, const bool readValues, const std::int64_t blockNnz) const
+{
+    if (_type == SparseMatrixType::UNKNOWN) {
+        std::cerr << "ShardedReader::streamBlocks: cannot stream shards with mixed storage types" << std::endl;
+        return false;
+    }
+
+    const bool rowsArePrimary = _type != SparseMatrixType::CSC;
+
+    // Shard blocks are translated into global indices, for CSC the same columns appear once per shard
+    PrimaryBlock globalBlock;
+
+    for (size_t shard = 0; shard < _shards.size(); ++shard) {
+        const std::int64_t rowOffset    = _rowOffsets[shard];
+        const auto& shardToGlobal       = _shardToGlobalCols[shard];
+
+        const bool success = _shards[shard]->streamBlocks([&](const PrimaryBlock& block) {
+            if (rowsArePrimary && shardToGlobal.empty()) {
+                globalBlock = block;
+                globalBlock._begin += rowOffset;
+                globalBlock._end += rowOffset;
+                process(globalBlock);
+                return;
+            }
+
+            if (!rowsArePrimary) {
+                globalBlock = block;
+                for (std::int64_t& row : globalBlock._indices) {
+                    row += rowOffset;
+                }
+
+                if (shardToGlobal.empty()) {
+                    process(globalBlock);
+                    return;
+                }
+
+                // Columns are primary, hand them over one at a time in the global order
+                PrimaryBlock columnBlock;
+                for (std::int64_t a = 0; a < block._end - block._begin; ++a) {
+                    const std::int64_t globalCol = shardToGlobal[block._begin + a];
+                    if (globalCol < 0)
+                        continue;
+
+                    const std::int64_t start = block._indptr[a];
+                    const std::int64_t end   = block._indptr[a + 1];
+
+                    columnBlock._begin   = globalCol;
+                    columnBlock._end     = globalCol + 1;
+                    columnBlock._offset  = block._offset + start;
+                    columnBlock._indptr  = { 0, end - start };
+                    columnBlock._indices.assign(globalBlock._indices.begin() + start, globalBlock._indices.begin() + end);
+                    if (readValues)
+                        columnBlock._values.assign(block._values.begin() + start, block._values.begin() + end);
+
+                    process(columnBlock);
+                }
+                return;
+            }
+
+            // Rows are primary, drop columns that are not part of the global order
+            globalBlock._begin   = block._begin + rowOffset;
+            globalBlock._end     = block._end + rowOffset;
+            globalBlock._offset  = block._offset;
+            globalBlock._indptr.assign(1, 0);
+            globalBlock._indices.clear();
+            globalBlock._values.clear();
+
+            for (std::int64_t a = 0; a < block._end - block._begin; ++a) {
+                for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i) {
+                    const std::int64_t globalCol = shardToGlobal[block._indices[i]];
+                    if (globalCol < 0)
+                        continue;
+
+                    globalBlock._indices.push_back(globalCol);
+                    if (readValues)
+                        globalBlock._values.push_back(block._values[i]);
+                }
+                globalBlock._indptr.push_back(static_cast<std::int64_t>(globalBlock._indices.size()));
+            }
+
+            process(globalBlock);
+            }, readValues, blockNnz);
+
+        if (!success) {
+            return false;
+        }
+    }
+
+    return true;
+}
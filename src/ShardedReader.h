@@ -0,0 +1,70 @@
+#pragma once
+
+#include "H5Utils.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// ShardedReader
+// =============================================================================
+
+/*
+Reads several .h5 files as one logical matrix, concatenated along the rows (obs).
+The variables of the first shard define the columns, the variables of all other
+shards are matched by name, so their order may differ. Variables that are missing
+in a shard read as zeros for the rows of that shard.
+Columns are read from all shards in parallel, each shard fills its own slice of the result.
+*/
+class ShardedReader : public SparseMatrixReader
+{
+
+public:
+    ShardedReader();
+    ShardedReader(const std::vector<std::string>& filenames);
+
+    ~ShardedReader();
+
+public: // Setup
+
+    bool readFiles(const std::vector<std::string>& filenames);
+    bool readDirectory(const std::string& directory);      // all .h5 files, sorted by name
+
+    static std::vector<std::string> listShardFiles(const std::string& directory);
+
+    // Every shard normalizes with the totals of its own rows
+    void setValueTransform(const ValueTransform& transform) override;
+
+public: // Getter
+
+    std::vector<float> getRowImpl(std::int64_t row_idx) const override;
+    std::vector<float> getColumnImpl(std::int64_t col_idx) const override;
+
+    std::vector<std::vector<float>> getRowsImpl(const std::vector<std::int64_t>& row_indices) const override;
+    std::vector<std::vector<float>> getColumnsImpl(const std::vector<std::int64_t>& col_indices) const override;
+
+    std::vector<float> getColumnSumImpl(const std::vector<std::int64_t>& col_indices) const override;
+    std::vector<float> getRowTotalsImpl() const override;
+
+    bool streamBlocks(const BlockCallback& process, const bool readValues = true, const std::int64_t blockNnz = defaultBlockNnz) const override;
+
+    std::uint64_t getBytesRead() const override;
+
+    size_t getNumShards() const { return _shards.size(); }
+    const std::vector<std::int64_t>& getRowOffsets() const { return _rowOffsets; }
+
+private:
+    // Column indices local to a shard, -1 marks columns the shard does not have
+    std::vector<std::int64_t> toShardColumns(const size_t shard, const std::vector<std::int64_t>& col_indices) const;
+
+    // Copies a row of a shard into the global column order
+    std::vector<float> toGlobalRow(const size_t shard, const std::vector<float>& shardRow) const;
+
+private:
+    std::vector<std::unique_ptr<SparseMatrixReader>>    _shards             = {};
+    std::vector<std::int64_t>                           _rowOffsets         = {};   // First row of each shard, size = num shards + 1
+    std::vector<std::vector<std::int64_t>>              _globalToShardCols  = {};   // Empty if a shard has the global column order
+    std::vector<std::vector<std::int64_t>>              _shardToGlobalCols  = {};   // Empty if a shard has the global column order
+};
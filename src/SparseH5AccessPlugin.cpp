@@ -7,11 +7,24 @@
 #include <PointData/InfoAction.h>
 
 #include <QtConcurrent> 
+#include <QDateTime>
 #include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QList>
+#include <QRegularExpression>
+#include <QSignalBlocker>
+#include <QUuid>
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <filesystem>
+#include <limits>
+#include <stdexcept>
+#include <tuple>
+#include <variant>
 
 Q_PLUGIN_METADATA(IID "studio.manivault.SparseH5AccessPlugin")
 
@@ -51,6 +64,12 @@ static std::vector<std::string> toStdStringVec(const QStringList& qstr_lst) {
     return str_vec;
 }
 
+// Variable names separated by commas, semicolons or whitespace
+static QStringList splitVariables(const QString& variables) {
+    static const QRegularExpression separators("[,;\\s]+");
+    return variables.split(separators, Qt::SkipEmptyParts);
+}
+
 static std::vector<QString> toQStringVec(const QStringList& qstr_lst) {
 
     const std::int64_t n = static_cast<std::int64_t>(qstr_lst.size());
@@ -75,11 +94,30 @@ SparseH5AccessPlugin::SparseH5AccessPlugin(const mv::plugin::PluginFactory* fact
     _numPoints(),
     _numDims(1),
     _outputPoints(),
+    _pcaPoints(),
+    _pointMapping(),
     _selectedDimensionIndices(),
     _dimensionNames(),
-    _csrMatrix(),
-    _cscMatrix(),
-    _sparseMatrix(&_cscMatrix),
+    _dimensionIndices(),
+    _dimensionSearch(),
+    _dimensionMatches(),
+    _virtualDimensions(),
+    _emptyMatrix(),
+    _fileMatrix(),
+    _fileMatrixPath(),
+    _shardedMatrix(),
+    _diskCache(),
+    _accessTrace(),
+    _residentMatrix(),
+    _residentSource(),
+    _residentLoad(),
+    _residentLoadCancel(),
+    _projectExport(),
+    _projectExportCancel(),
+    _projectExportPath(),
+    _projectExportVariables(),
+    _backgroundTasks(),
+    _sparseMatrix(&_emptyMatrix),
     _blockReadingFromFile(false)
 {
     auto updateDataAfterOptionUIChanged = [this]() {
@@ -101,7 +139,7 @@ SparseH5AccessPlugin::SparseH5AccessPlugin(const mv::plugin::PluginFactory* fact
         const size_t newNumDims = _settingsAction.addDataDimAction();
         assert(newNumDims >= 1 && newNumDims < _dimensionNames.size());
 
-        updateOptionsForDim(static_cast<std::int32_t>(newNumDims - 1), _dimensionNames);
+        updateOptionsForDim(static_cast<std::int32_t>(newNumDims - 1));
 
         connect(_settingsAction.getDataDimActions().back().get(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::readDataFromDisk);
 
@@ -128,20 +166,82 @@ SparseH5AccessPlugin::SparseH5AccessPlugin(const mv::plugin::PluginFactory* fact
     connect(&_settingsAction.getAddRemoveButtonAction().getAddOptionButton(), &gui::TriggerAction::triggered, this, onAddOptionButton);
     connect(&_settingsAction.getAddRemoveButtonAction().getRemoveOptionButton(), &gui::TriggerAction::triggered, this, onRemoveOptionButton);
     connect(&_settingsAction.getFileOnDiskAction(), &gui::FilePickerAction::filePathChanged, this, &SparseH5AccessPlugin::updateFile);
+    connect(&_settingsAction.getShardDirectoryAction(), &gui::DirectoryPickerAction::directoryChanged, this, &SparseH5AccessPlugin::updateShardDirectory);
+    connect(&_settingsAction.getPointIdsFileAction(), &gui::FilePickerAction::filePathChanged, this, [this]() {
+        updatePointMapping();
+        rereadDataFromDisk();
+        });
     connect(_settingsAction.getDataDimActions().back().get(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::readDataFromDisk);
+
+    connect(&_settingsAction.getOutputTypeAction(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::rereadDataFromDisk);
+
+    connect(&_settingsAction.getDimensionSearchAction(), &gui::StringAction::stringChanged, this, &SparseH5AccessPlugin::updateDimensionMatches);
+    connect(&_settingsAction.getDimensionMatchesAction(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::addDimensionMatch);
+
+    connect(&_settingsAction.getAddRemoveVirtualDimsAction().getAddOptionButton(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::addVirtualDimension);
+    connect(&_settingsAction.getAddRemoveVirtualDimsAction().getRemoveOptionButton(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::removeVirtualDimension);
+    connect(&_settingsAction.getComputePcaAction(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::computePCA);
+    connect(&_settingsAction.getSelectQueryAction(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::selectByQuery);
+    connect(&_settingsAction.getFindMarkersAction(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::findMarkers);
+    connect(&_settingsAction.getShowPanelAction(), &gui::TriggerAction::triggered, this, [this]() {
+        showPanel(splitVariables(_settingsAction.getPanelVariablesAction().getString()));
+        });
+    connect(&_settingsAction.getPanelFileAction(), &gui::FilePickerAction::filePathChanged, this, &SparseH5AccessPlugin::loadPanelFile);
+    connect(&_settingsAction.getShowTopPanelAction(), &gui::TriggerAction::triggered, this, &SparseH5AccessPlugin::showTopPanel);
+
+    connect(&_settingsAction.getNormalizeTotalsAction(), &gui::ToggleAction::toggled, this, &SparseH5AccessPlugin::updateValueTransform);
+    connect(&_settingsAction.getTargetSumAction(), &gui::IntegralAction::valueChanged, this, &SparseH5AccessPlugin::updateValueTransform);
+    connect(&_settingsAction.getLog1pAction(), &gui::ToggleAction::toggled, this, &SparseH5AccessPlugin::updateValueTransform);
+    connect(&_settingsAction.getScaleAction(), &gui::DecimalAction::valueChanged, this, &SparseH5AccessPlugin::updateValueTransform);
+    connect(&_settingsAction.getClipAction(), &gui::DecimalAction::valueChanged, this, &SparseH5AccessPlugin::updateValueTransform);
+
+    connect(&_settingsAction.getDiskCacheDirectoryAction(), &gui::DirectoryPickerAction::directoryChanged, this, &SparseH5AccessPlugin::updateDiskCache);
+    connect(&_settingsAction.getDiskCacheSizeAction(), &gui::IntegralAction::valueChanged, this, &SparseH5AccessPlugin::updateDiskCache);
+    connect(&_settingsAction.getClearDiskCacheAction(), &gui::TriggerAction::triggered, this, [this]() {
+        if (_diskCache)
+            _diskCache->clear();
+        });
+
+    connect(&_settingsAction.getAccessTraceDirectoryAction(), &gui::DirectoryPickerAction::directoryChanged, this, &SparseH5AccessPlugin::updateAccessTrace);
+    connect(&_settingsAction.getH5AutoTuneAction(), &gui::ToggleAction::toggled, this, &SparseH5AccessPlugin::updateH5Access);
+    connect(&_settingsAction.getH5DriverAction(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::updateH5Access);
+    connect(&_settingsAction.getH5PageBufferAction(), &gui::IntegralAction::valueChanged, this, &SparseH5AccessPlugin::updateH5Access);
+    connect(&_settingsAction.getH5MetadataCacheAction(), &gui::IntegralAction::valueChanged, this, &SparseH5AccessPlugin::updateH5Access);
+    connect(&_settingsAction.getH5MetaBlockAction(), &gui::IntegralAction::valueChanged, this, &SparseH5AccessPlugin::updateH5Access);
+    connect(&_settingsAction.getResidentModeAction(), &gui::ToggleAction::toggled, this, &SparseH5AccessPlugin::updateResidentMatrix);
+
+    connect(&_settingsAction.getSaveDataToProjectAction(), &gui::ToggleAction::toggled, this, &SparseH5AccessPlugin::stageProjectExport);
+    connect(&_settingsAction.getSaveModeAction(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::stageProjectExport);
+    connect(&_settingsAction.getSaveVariablesAction(), &gui::StringAction::stringChanged, this, &SparseH5AccessPlugin::stageProjectExport);
 }
 
 SparseH5AccessPlugin::~SparseH5AccessPlugin()
 {
+    // The export reads through this instance
+    cancelProjectExport();
+
+    if (_residentLoadCancel)
+        *_residentLoadCancel = true;
+
+    _residentLoad.waitForFinished();
+
+    for (QFuture<void>& task : _backgroundTasks) {
+        task.waitForFinished();
+    }
+
+    // Shared readers outlive this instance, other instances may have installed their own trace or cache meanwhile
+    _sparseMatrix->releaseAccessTrace(_accessTrace);
+
+    if (_fileMatrix)
+        _fileMatrix->releaseDiskCache(_diskCache);
 }
 
-void SparseH5AccessPlugin::updateOptionsForDim(const std::int32_t numDim, const QStringList& dimNames)
+void SparseH5AccessPlugin::updateOptionsForDim(const std::int32_t numDim)
 {
     _blockReadingFromFile = true;
 
+    // The options are the shared variable names of the settings
     auto& action = _settingsAction.getDataDimActions()[numDim];
-    action->setCurrentIndex(0);
-    action->setOptions(dimNames);
     action->setCurrentIndex(numDim);
 
     _blockReadingFromFile = false;
@@ -171,6 +271,7 @@ void SparseH5AccessPlugin::init()
 
     _settingsAction.setEnabled(false);
     _settingsAction.getFileOnDiskAction().setEnabled(true);                 // the filepicker must be enabled at the start
+    _settingsAction.getShardDirectoryAction().setEnabled(true);
     _settingsAction.getStatusTextAction().setString("None loaded yet");     // the status must also not say that it's busy
 
     // Add settings to UI
@@ -184,44 +285,408 @@ void SparseH5AccessPlugin::init()
 void SparseH5AccessPlugin::updateFile(const QString& filePathQt)
 {
     _settingsAction.resetDataDimActions();
+    releaseResidentMatrix();
 
-    _csrMatrix.reset();
-    _cscMatrix.reset();
+    // Other instances on the same file and with the same value transform share the reader, including its cache
+    _sparseMatrix->releaseAccessTrace(_accessTrace);
+    _sparseMatrix = &_emptyMatrix;
 
-    const std::string filePath  = filePathQt.toStdString();
-    const SparseMatrixType type = SparseMatrixReader::readMatrixType(filePath);
-    const std::string typeStr   = sparseMatrixTypeToString(type);
-    
-    switch (type)
-    {
-    case SparseMatrixType::CSR:
-        _sparseMatrix = &_csrMatrix;
-        break;
-    case SparseMatrixType::CSC:
-        _sparseMatrix = &_cscMatrix;
-        break;
-    default:
-        _sparseMatrix = &_csrMatrix;
+    if (_fileMatrix)
+        _fileMatrix->releaseDiskCache(_diskCache);
+
+    _shardedMatrix.reset();
+    _fileMatrix = ReaderRegistry::instance().acquire(filePathQt.toStdString(), _settingsAction.getValueTransform(), _settingsAction.getH5AccessSettings());
+    _fileMatrixPath = filePathQt;
+
+    updateH5AccessStatus();
+
+    if (!_fileMatrix) {
+        qDebug() << "SparseH5AccessPlugin::updateFile: cannot read " << filePathQt;
+        updateDimensions("None");
+        return;
+    }
+
+    _sparseMatrix = _fileMatrix.get();
+
+    if (_diskCache) {
+        _fileMatrix->setDiskCache(_diskCache);
+    }
+
+    // Rows are read from the CSR copy and columns from the CSC copy if the file holds both
+    if (dynamic_cast<const DualLayoutReader*>(_sparseMatrix) != nullptr) {
+        updateDimensions("CSR + CSC");
+        return;
     }
 
-    _sparseMatrix->readFile(filePath);
+    updateDimensions(QString::fromStdString(_sparseMatrix->getTypeString()));
+}
+
+void SparseH5AccessPlugin::updateShardDirectory(const QString& directoryQt)
+{
+    if (directoryQt.isEmpty()) {
+        return;
+    }
+
+    if (isZarrStore(directoryQt.toStdString())) {
+        updateFile(directoryQt);
+        return;
+    }
+
+    _settingsAction.resetDataDimActions();
 
+    // The resident matrix may still be loading from the shards
+    releaseResidentMatrix();
+
+    // Running reads keep the previous shards open
+    auto shardedMatrix = std::make_shared<ShardedReader>();
+    shardedMatrix->setH5Access(_settingsAction.getH5AccessSettings());
+
+    if (!shardedMatrix->readDirectory(directoryQt.toStdString())) {
+        qDebug() << "SparseH5AccessPlugin::updateShardDirectory: no readable H5 files in " << directoryQt;
+        return;
+    }
+
+    _sparseMatrix->releaseAccessTrace(_accessTrace);
+    _shardedMatrix = std::move(shardedMatrix);
+    _sparseMatrix = _shardedMatrix.get();
+
+    if (_fileMatrix)
+        _fileMatrix->releaseDiskCache(_diskCache);
+
+    _fileMatrix.reset();
+    _shardedMatrix->setValueTransform(_settingsAction.getValueTransform());
+    updateH5AccessStatus();
+
+    updateDimensions(QString("%1 (%2 shards)").arg(QString::fromStdString(_shardedMatrix->getTypeString())).arg(_shardedMatrix->getNumShards()));
+}
+
+void SparseH5AccessPlugin::updateDimensions(const QString& matrixTypeStr)
+{
     _dimensionNames = toQStringList(_sparseMatrix->getVarNames());
     _selectedDimensionIndices = {};
 
-    _settingsAction.getMatrixTypeAction().setString(QString::fromStdString(typeStr));
+    // The compact project file of the previous matrix is outdated
+    cancelProjectExport();
+
+    _dimensionIndices.clear();
+    _dimensionIndices.reserve(_dimensionNames.size());
+    for (qsizetype index = 0; index < _dimensionNames.size(); ++index) {
+        _dimensionIndices.insert(_dimensionNames[index], index);
+    }
+
+    resolveVirtualDimensions();
+
+    _settingsAction.getMatrixTypeAction().setString(matrixTypeStr);
     _settingsAction.getNumAvailableDimsAction().setString(QString::number(_dimensionNames.size()));
+    _settingsAction.setDimensionNames(_dimensionNames);
+
+    _dimensionSearch = DimensionSearchIndex(_sparseMatrix->getVarNames());
+    updateDimensionMatches();
     _settingsAction.setEnabled(true);
 
     assert(_settingsAction.getDataDimActions().size() == _numDims);
 
     for (int numDim = 0; numDim < _numDims; numDim++) {
-        updateOptionsForDim(numDim, _dimensionNames);
+        updateOptionsForDim(numDim);
     }
 
+    updatePointMapping();
+    updateAccessTrace();
+    updateResidentMatrix();
     readDataFromDisk();
 }
 
+void SparseH5AccessPlugin::updateDiskCache()
+{
+    const QString directory = _settingsAction.getDiskCacheDirectory();
+
+    // The reader may be shared, the disk cache of another instance is kept unless this one replaces it
+    if (_fileMatrix) {
+        _fileMatrix->releaseDiskCache(_diskCache);
+    }
+
+    if (directory.isEmpty()) {
+        _diskCache.reset();
+    }
+    else {
+        _diskCache = DiskCache::open(directory.toStdString(), _settingsAction.getDiskCacheSize());
+    }
+
+    if (_fileMatrix && _diskCache) {
+        _fileMatrix->setDiskCache(_diskCache);
+    }
+}
+
+void SparseH5AccessPlugin::updateAccessTrace()
+{
+    // A new trace per matrix, the previous one is written when it is released
+    _sparseMatrix->releaseAccessTrace(_accessTrace);
+    _accessTrace.reset();
+
+    const QString directory = _settingsAction.getAccessTraceDirectory();
+
+    if (directory.isEmpty() || getDiskMatrix() == &_emptyMatrix) {
+        return;
+    }
+
+    const QString source    = _fileMatrix ? _fileMatrixPath : _settingsAction.getShardDirectory();
+    const QString tracePath = QDir(directory).filePath(QString("%1_%2.sh5t").arg(QFileInfo(source).completeBaseName(), QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss")));
+
+    _accessTrace = std::make_shared<AccessTraceRecorder>(tracePath.toStdString(), _sparseMatrix->getNumRows(), _sparseMatrix->getNumCols());
+
+    if (!_accessTrace->isGood()) {
+        qDebug() << "SparseH5AccessPlugin::updateAccessTrace: cannot write " << tracePath;
+        _accessTrace.reset();
+        return;
+    }
+
+    // Includes the reads of other instances that share the reader
+    _sparseMatrix->setAccessTrace(_accessTrace);
+}
+
+void SparseH5AccessPlugin::updateValueTransform()
+{
+    const ValueTransform transform = _settingsAction.getValueTransform();
+
+    // The resident matrix transforms its own values, the reader on disk follows for when it is released
+    if (_residentMatrix) {
+        _residentMatrix->setValueTransform(transform);
+    }
+
+    if (_fileMatrix) {
+        if (_fileMatrix->getValueTransform() == transform)
+            return;
+
+        if (!reacquireFileMatrix())
+            return;
+    }
+    else if (_shardedMatrix && getDiskMatrix() == _shardedMatrix.get()) {
+        _shardedMatrix->setValueTransform(transform);
+    }
+
+    rereadDataFromDisk();
+}
+
+void SparseH5AccessPlugin::updateH5Access()
+{
+    const H5AccessSettings access = _settingsAction.getH5AccessSettings();
+
+    // Shards are opened with them the next time the folder is read
+    if (_shardedMatrix && getDiskMatrix() == _shardedMatrix.get()) {
+        _shardedMatrix->setH5Access(access);
+        return;
+    }
+
+    if (!_fileMatrix || _fileMatrix->getH5Access() == access)
+        return;
+
+    // The values are the same, only how they are read from the file changes
+    reacquireFileMatrix();
+}
+
+void SparseH5AccessPlugin::updateH5AccessStatus()
+{
+    QString status = "-";
+
+    if (_fileMatrix && !isZarrStore(_fileMatrixPath.toStdString()))
+        status = QString::fromStdString(h5AccessToString(_fileMatrix->getRawData()._access));
+    else if (_shardedMatrix && getDiskMatrix() == _shardedMatrix.get())
+        status = "Per shard";
+
+    _settingsAction.getH5AccessStatusAction().setString(status);
+}
+
+bool SparseH5AccessPlugin::reacquireFileMatrix()
+{
+    // Readers are shared, instances with another transform or other access settings keep theirs
+    std::shared_ptr<SparseMatrixReader> fileMatrix = ReaderRegistry::instance().acquire(_fileMatrixPath.toStdString(), _settingsAction.getValueTransform(), _settingsAction.getH5AccessSettings());
+    if (!fileMatrix) {
+        qDebug() << "SparseH5AccessPlugin::reacquireFileMatrix: cannot reopen " << _fileMatrixPath;
+        return false;
+    }
+
+    _fileMatrix->releaseAccessTrace(_accessTrace);
+    _fileMatrix->releaseDiskCache(_diskCache);
+    _fileMatrix     = std::move(fileMatrix);
+
+    if (_residentMatrix) {
+        _residentSource = _fileMatrix;
+    }
+    else {
+        _sparseMatrix = _fileMatrix.get();
+        _fileMatrix->setAccessTrace(_accessTrace);
+    }
+
+    if (_diskCache) {
+        _fileMatrix->setDiskCache(_diskCache);
+    }
+
+    updateH5AccessStatus();
+
+    return true;
+}
+
+void SparseH5AccessPlugin::updatePointMapping()
+{
+    _pointMapping = {};
+
+    if (!_sparseMatrix)
+        return;
+
+    // One ID per line in the picked file, otherwise from the input data if it carries them
+    QStringList pointIds;
+    const QString pointIdsFilePath = _settingsAction.getPointIdsFilePath();
+
+    if (!pointIdsFilePath.isEmpty()) {
+        QFile file(pointIdsFilePath);
+        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            static const QRegularExpression lineBreaks("[\\r\\n]+");
+            pointIds = QString::fromUtf8(file.readAll()).split(lineBreaks, Qt::SkipEmptyParts);
+        }
+        else {
+            qDebug() << "SparseH5AccessPlugin::updatePointMapping: cannot read " << pointIdsFilePath;
+        }
+    }
+    else {
+        pointIds = getInputDataset<Points>()->getProperty("PointIds").toStringList();
+    }
+
+    const std::int64_t numRows = _sparseMatrix->getNumRows();
+
+    if (pointIds.isEmpty() || !_sparseMatrix->hasObsNames()) {
+        _settingsAction.getPointMappingAction().setString(static_cast<size_t>(numRows) == _numPoints ? QString("Row i is point i") : QString("%1 rows for %2 points, no point IDs").arg(numRows).arg(_numPoints));
+        return;
+    }
+
+    if (static_cast<size_t>(pointIds.size()) != _numPoints) {
+        _settingsAction.getPointMappingAction().setString(QString("%1 point IDs for %2 points, row i is point i").arg(pointIds.size()).arg(_numPoints));
+        return;
+    }
+
+    _pointMapping = PointMapping::join(toStdStringVec(pointIds), _sparseMatrix->getObsNames());
+
+    _settingsAction.getPointMappingAction().setString(_pointMapping.isIdentity() ? QString("Row i is point i") : QString("%1 of %2 points found in the file").arg(_pointMapping.getNumMatched()).arg(_numPoints));
+}
+
+void SparseH5AccessPlugin::updateResidentMatrix()
+{
+    releaseResidentMatrix();
+
+    if (!_settingsAction.getResidentModeChecked() || _sparseMatrix == &_emptyMatrix) {
+        return;
+    }
+
+    // Reads are served from disk until the whole matrix is loaded
+    _residentLoadCancel = std::make_shared<std::atomic<bool>>(false);
+
+    auto loadAsync = [this, source = shareSparseMatrix(), settings = _settingsAction.getResidentSettings(), cancel = _residentLoadCancel]() -> std::shared_ptr<ResidentReader> {
+        auto reportProgress = [this, cancel](const float progress) {
+            // Stops loading at the next block
+            if (*cancel)
+                throw std::runtime_error("loading was cancelled");
+
+            QMetaObject::invokeMethod(this, [this, cancel, progress]() {
+                if (!*cancel)
+                    _settingsAction.getResidentStatusAction().setString(QString("Loading... %1%").arg(static_cast<int>(progress * 100.f)));
+                });
+            };
+
+        return ResidentReader::load(*source, settings, reportProgress);
+        };
+
+    auto swapInResident = [this, cancel = _residentLoadCancel](std::shared_ptr<ResidentReader> residentMatrix) -> void {
+        if (*cancel)
+            return;
+
+        if (!residentMatrix) {
+            _settingsAction.getResidentStatusAction().setString("Read from disk, does not fit the budget");
+            return;
+        }
+
+        residentMatrix->setValueTransform(_settingsAction.getValueTransform());
+        residentMatrix->setMaxCacheSize(_sparseMatrix->getMaxCacheSize());
+
+        // The reader on disk may have been replaced with another value transform meanwhile
+        _sparseMatrix->releaseAccessTrace(_accessTrace);
+        _residentSource = shareSparseMatrix();
+        _residentMatrix = std::move(residentMatrix);
+        _sparseMatrix   = _residentMatrix.get();
+        _sparseMatrix->setAccessTrace(_accessTrace);
+
+        const QString orientations = _residentMatrix->hasRows() && _residentMatrix->hasColumns() ? "rows and columns" : (_residentMatrix->hasRows() ? "rows" : "columns");
+        _settingsAction.getResidentStatusAction().setString(QString("%1 MiB, %2, %3 values").arg(_residentMatrix->getMemoryBytes() >> 20).arg(orientations, QString::fromStdString(residentValueEncodingToString(_residentMatrix->getValueEncoding()))));
+        };
+
+    _settingsAction.getResidentStatusAction().setString("Loading...");
+
+    _residentLoad = QtConcurrent::run(loadAsync);
+    _residentLoad.then(this, swapInResident);
+}
+
+void SparseH5AccessPlugin::releaseResidentMatrix()
+{
+    // A load of the previous matrix stops at its next block
+    if (_residentLoadCancel) {
+        *_residentLoadCancel = true;
+    }
+
+    _residentLoad.waitForFinished();
+    _residentLoadCancel.reset();
+
+    if (_residentMatrix) {
+        _sparseMatrix->releaseAccessTrace(_accessTrace);
+        _sparseMatrix = _residentSource.get();
+        _sparseMatrix->setAccessTrace(_accessTrace);
+        _residentMatrix.reset();
+    }
+
+    _residentSource.reset();
+    _settingsAction.getResidentStatusAction().setString("Read from disk");
+}
+
+std::shared_ptr<SparseMatrixReader> SparseH5AccessPlugin::shareSparseMatrix() const
+{
+    if (_residentMatrix && _sparseMatrix == _residentMatrix.get())
+        return _residentMatrix;
+
+    if (_fileMatrix && _sparseMatrix == _fileMatrix.get())
+        return _fileMatrix;
+
+    if (_shardedMatrix && _sparseMatrix == _shardedMatrix.get())
+        return _shardedMatrix;
+
+    // The placeholder is a member, the destructor waits for the tasks that use it
+    return std::shared_ptr<SparseMatrixReader>(std::shared_ptr<SparseMatrixReader>(), _sparseMatrix);
+}
+
+void SparseH5AccessPlugin::trackBackgroundTask(const QFuture<void>& task)
+{
+    _backgroundTasks.removeIf([](const QFuture<void>& backgroundTask) { return backgroundTask.isFinished(); });
+    _backgroundTasks.push_back(task);
+}
+
+void SparseH5AccessPlugin::warmCache(const QStringList& dimensionNames)
+{
+    if (!_fileMatrix || dimensionNames.isEmpty())
+        return;
+
+    std::vector<std::int64_t> columnIndices;
+    for (const QString& dimensionName : dimensionNames) {
+        const auto it = _dimensionIndices.constFind(dimensionName);
+        if (it != _dimensionIndices.cend())
+            columnIndices.push_back(it.value());
+    }
+
+    if (columnIndices.size() > _fileMatrix->getMaxCacheSize()) {
+        _fileMatrix->setMaxCacheSize(columnIndices.size());
+    }
+
+    // Fills the in-memory cache from the disk cache, or from the file if not cached on disk yet
+    auto future = QtConcurrent::run([reader = _fileMatrix, columnIndices]() {
+        reader->getColumns(columnIndices);
+        });
+}
+
 void SparseH5AccessPlugin::readDataFromDisk() {
 
     if (_blockReadingFromFile) {
@@ -236,59 +701,679 @@ void SparseH5AccessPlugin::readDataFromDisk() {
 
     std::swap(_selectedDimensionIndices, selectedDimensionIndices);
 
-    using ResultType = std::pair<std::vector<float>, std::vector<QString>>;
+    using OutputBuffer = std::variant<std::vector<float>, std::vector<biovault::bfloat16_t>, std::vector<std::uint16_t>, std::vector<std::uint8_t>>;
+    using ResultType = std::tuple<OutputBuffer, std::vector<QString>, std::vector<QuantizationParams>>;
+
+    // Interleaves the dimensions in the requested element type, picking the row of each point
+    // Columns are still read over all rows, as cached columns are shared by all reads and instances of the file
+    // The worker uses copies, the members may change while it is reading
+    auto interleave = [numPoints = _numPoints, pointRows = _pointMapping.getRows(), outputType = _settingsAction.getOutputElementType()](const std::vector<std::vector<float>>& dimensionValues, std::vector<QuantizationParams>& quantization) -> OutputBuffer {
+        switch (outputType)
+        {
+        case OutputElementType::BFLOAT16:
+            return interleaveColumns<biovault::bfloat16_t>(dimensionValues, numPoints, [](const float value, size_t) { return biovault::bfloat16_t(value); }, pointRows);
+        case OutputElementType::UINT16:
+            return interleaveQuantized<std::uint16_t>(dimensionValues, numPoints, std::numeric_limits<std::uint16_t>::max(), quantization, pointRows);
+        case OutputElementType::UINT8:
+            return interleaveQuantized<std::uint8_t>(dimensionValues, numPoints, std::numeric_limits<std::uint8_t>::max(), quantization, pointRows);
+        case OutputElementType::FLOAT32:
+        default:
+            return interleaveColumns<float>(dimensionValues, numPoints, [](const float value, size_t) { return value; }, pointRows);
+        }
+        };
 
-    auto readDataAsync = [this]() -> ResultType {
+    // Sets the output data of a partial or the final result
+    auto publish = [this](ResultType& result) -> void {
+        auto& [values, dimensionNames, quantization] = result;
+        const size_t numOutputDims = dimensionNames.size();
 
-        assert(_numDims == _selectedDimensionIndices.size());
+        std::visit([this, numOutputDims](auto&& buffer) { _outputPoints->setData(std::move(buffer), numOutputDims); }, values);
+        _outputPoints->setDimensionNames(dimensionNames);
 
-        // Read dimensions from disk
-        std::vector<std::vector<float>> dimensionValues(_numDims);
-        std::vector<QString> dimensionNames(_numDims);
-        const std::vector<std::string>& allDimNames = _sparseMatrix->getVarNames();
-        for (size_t dim = 0; dim < _numDims; ++dim) {
-            const std::int32_t selectedDimIndex = _selectedDimensionIndices[dim];
-            dimensionValues[dim] = _sparseMatrix->getColumn(selectedDimIndex);
-            dimensionNames[dim] = QString::fromStdString(allDimNames[selectedDimIndex]);
+        // Quantized outputs are mapped back with: value = quantized * scale + offset
+        QVariantList scales, offsets;
+        for (const QuantizationParams& params : quantization) {
+            scales << params._scale;
+            offsets << params._offset;
         }
+        _outputPoints->setProperty("DimensionScales", scales);
+        _outputPoints->setProperty("DimensionOffsets", offsets);
 
-        // Interleave data and pass to core
-        const size_t total_size = _numPoints * _numDims;
-        std::vector<float> dimensionValuesInterleaved(total_size);
+        mv::events().notifyDatasetDataChanged(_outputPoints);
+        };
 
-#pragma omp parallel for
-        for (std::int64_t point = 0; point < static_cast<std::int64_t>(_numPoints); ++point) {
-            for (size_t dim = 0; dim < _numDims; ++dim) {
-                dimensionValuesInterleaved[_numDims * point + dim] = dimensionValues[dim][point];
-            }
+    auto readDataAsync = [this, interleave, publish, reader = shareSparseMatrix(), selectedDimensionIndices = _selectedDimensionIndices, progressiveSettings = _settingsAction.getProgressiveRead(), virtualDimensions = _virtualDimensions]() -> ResultType {
+
+        const size_t numDims = selectedDimensionIndices.size();
+
+        std::vector<QString> dimensionNames(numDims);
+        const std::vector<std::string>& allDimNames = reader->getVarNames();
+        for (size_t dim = 0; dim < numDims; ++dim) {
+            dimensionNames[dim] = QString::fromStdString(allDimNames[selectedDimensionIndices[dim]]);
+        }
+        for (const VirtualDimension& virtualDimension : virtualDimensions) {
+            if (!virtualDimension._indices.empty())
+                dimensionNames.emplace_back(virtualDimension._name);
         }
 
-        return std::make_pair(std::move(dimensionValuesInterleaved), std::move(dimensionNames));
+        // Partial results of slow column scans are shown while reading, virtual dimensions are zero until the end
+        // A partial result is skipped while the previous one is not applied yet, such that the main thread is not flooded
+        ProgressiveRead progressive = progressiveSettings;
+        auto partialPending = std::make_shared<std::atomic<bool>>(false);
+
+        if (progressive._intervalSeconds > 0.0) {
+            progressive._onPartial = [this, interleave, publish, numRows = reader->getNumRows(), dimensionNames, partialPending](const std::vector<std::vector<float>>& arrays, const float fraction) {
+                if (partialPending->exchange(true))
+                    return;
+
+                std::vector<std::vector<float>> partialValues = arrays;
+                partialValues.resize(dimensionNames.size(), std::vector<float>(numRows, 0.0f));
+
+                std::vector<QuantizationParams> quantization;
+                OutputBuffer buffer = interleave(partialValues, quantization);
+                auto partial = std::make_shared<ResultType>(std::move(buffer), dimensionNames, std::move(quantization));
+
+                QMetaObject::invokeMethod(this, [this, publish, partial, fraction, partialPending]() {
+                    publish(*partial);
+
+                    _settingsAction.getStatusTextAction().setString(QString("Reading... %1%").arg(static_cast<int>(fraction * 100.f)));
+                    *partialPending = false;
+                    });
+                };
+        }
+
+        // Read all dimensions from disk in one batch
+        const std::vector<std::int64_t> columnIndices(selectedDimensionIndices.begin(), selectedDimensionIndices.end());
+        std::vector<std::vector<float>> dimensionValues = reader->getColumnsProgressive(columnIndices, progressive);
+
+        // Virtual dimensions are accumulated in a single pass each
+        for (const VirtualDimension& virtualDimension : virtualDimensions) {
+            if (virtualDimension._indices.empty())
+                continue;
+
+            dimensionValues.emplace_back(reader->getColumnAggregate(virtualDimension._indices, virtualDimension._reduction));
+        }
+
+        // Interleave data in the requested element type and pass to core
+        std::vector<QuantizationParams> quantization;
+        OutputBuffer dimensionValuesInterleaved = interleave(dimensionValues, quantization);
+
+        return std::make_tuple(std::move(dimensionValuesInterleaved), std::move(dimensionNames), std::move(quantization));
         };
 
-    auto passDataToCore = [this](ResultType result) -> void {
-        _outputPoints->setData(std::move(result.first), _numDims);
-        _outputPoints->setDimensionNames(result.second);
-        mv::events().notifyDatasetDataChanged(_outputPoints);
+    auto passDataToCore = [this, publish](ResultType result) -> void {
+        publish(result);
         _settingsAction.setEnabled(true);
+
+        stageProjectExport();
         };
 
     _settingsAction.setEnabled(false);
 
     // Read data asynchronously, then update core data in main thread
-    auto future = QtConcurrent::run(readDataAsync).then(this, passDataToCore);
+    QFuture<ResultType> reading = QtConcurrent::run(readDataAsync);
+    trackBackgroundTask(QFuture<void>(reading));
+    reading.then(this, passDataToCore);
+}
+
+void SparseH5AccessPlugin::rereadDataFromDisk()
+{
+    if (_sparseMatrix->getNumCols() == 0)
+        return;
+
+    // Forget the current selection such that it is read again
+    _selectedDimensionIndices = {};
+    readDataFromDisk();
+}
+
+void SparseH5AccessPlugin::addVirtualDimension()
+{
+    VirtualDimension virtualDimension;
+    virtualDimension._variables = splitVariables(_settingsAction.getVirtualDimVariablesAction().getString());
+    virtualDimension._reduction = _settingsAction.getVirtualDimReduction();
+    virtualDimension._name      = _settingsAction.getVirtualDimNameAction().getString().trimmed();
+
+    if (virtualDimension._variables.isEmpty()) {
+        qDebug() << "SparseH5AccessPlugin: a virtual dimension needs at least one variable";
+        return;
+    }
+
+    if (virtualDimension._name.isEmpty()) {
+        virtualDimension._name = QString("%1 of %2 variables").arg(QString::fromStdString(aggregateReductionToString(virtualDimension._reduction))).arg(virtualDimension._variables.size());
+    }
+
+    _virtualDimensions.push_back(std::move(virtualDimension));
+
+    resolveVirtualDimensions();
+    updateVirtualDimensionsList();
+    rereadDataFromDisk();
+}
+
+void SparseH5AccessPlugin::removeVirtualDimension()
+{
+    if (_virtualDimensions.empty())
+        return;
+
+    _virtualDimensions.pop_back();
+
+    updateVirtualDimensionsList();
+    rereadDataFromDisk();
+}
+
+void SparseH5AccessPlugin::resolveVirtualDimensions()
+{
+    for (VirtualDimension& virtualDimension : _virtualDimensions) {
+        virtualDimension._indices.clear();
+        virtualDimension._indices.reserve(virtualDimension._variables.size());
+
+        for (const QString& variable : virtualDimension._variables) {
+            const auto it = _dimensionIndices.constFind(variable);
+
+            if (it == _dimensionIndices.cend()) {
+                qDebug() << "SparseH5AccessPlugin: virtual dimension" << virtualDimension._name << "- unknown variable" << variable;
+                continue;
+            }
+
+            virtualDimension._indices.push_back(it.value());
+        }
+    }
+}
+
+void SparseH5AccessPlugin::updateVirtualDimensionsList()
+{
+    QStringList virtualDimensionsList;
+
+    for (const VirtualDimension& virtualDimension : _virtualDimensions) {
+        virtualDimensionsList << QString("%1 (%2 of %3)").arg(virtualDimension._name).arg(virtualDimension._indices.size()).arg(virtualDimension._variables.size());
+    }
+
+    _settingsAction.getVirtualDimsListAction().setString(virtualDimensionsList.isEmpty() ? QString("None") : virtualDimensionsList.join(", "));
+}
+
+void SparseH5AccessPlugin::computePCA()
+{
+    if (_sparseMatrix->getNumCols() == 0)
+        return;
+
+    RandomizedPCASettings pcaSettings;
+    pcaSettings._numComponents = _settingsAction.getPcaComponentsAction().getValue();
+
+    auto computeAsync = [this, reader = shareSparseMatrix(), pcaSettings]() -> RandomizedPCAResult {
+        RandomizedPCAResult result;
+
+        auto reportProgress = [this](const float progress) {
+            QMetaObject::invokeMethod(this, [this, progress]() {
+                _settingsAction.getStatusTextAction().setString(QString("Computing PCA... %1%").arg(static_cast<int>(progress * 100.f)));
+                });
+            };
+
+        computeRandomizedPCA(*reader, pcaSettings, result, reportProgress);
+
+        return result;
+        };
+
+    auto passPcaToCore = [this](RandomizedPCAResult result) -> void {
+        _settingsAction.setEnabled(true);
+
+        const size_t numComponents = static_cast<size_t>(result._numComponents);
+
+        // Scores are computed per row of the file
+        if (numComponents > 0 && !_pointMapping.isIdentity()) {
+            const std::vector<std::int32_t>& pointRows = _pointMapping.getRows();
+            std::vector<float> pointScores(_numPoints * numComponents, 0.0f);
+
+            for (size_t point = 0; point < _numPoints; ++point) {
+                if (pointRows[point] >= 0)
+                    std::copy_n(result._scores.begin() + static_cast<size_t>(pointRows[point]) * numComponents, numComponents, pointScores.begin() + point * numComponents);
+            }
+
+            result._scores = std::move(pointScores);
+        }
+
+        if (numComponents == 0 || result._scores.size() < _numPoints * numComponents) {
+            qDebug() << "SparseH5AccessPlugin::computePCA: could not compute PCA for all points";
+            return;
+        }
+
+        result._scores.resize(_numPoints * numComponents);
+
+        if (!_pcaPoints.isValid()) {
+            const auto inputData = getInputDataset<Points>();
+            _pcaPoints = Dataset<Points>(mv::data().createDerivedDataset("Sparse PCA", inputData, inputData));
+        }
+
+        std::vector<QString> componentNames(numComponents);
+        QVariantList explainedVariance;
+        for (size_t component = 0; component < numComponents; ++component) {
+            componentNames[component] = QString("PC %1").arg(component + 1);
+            explainedVariance << result._explainedVariance[component];
+        }
+
+        _pcaPoints->setData(std::move(result._scores), numComponents);
+        _pcaPoints->setDimensionNames(componentNames);
+        _pcaPoints->setProperty("ExplainedVariance", explainedVariance);
+        mv::events().notifyDatasetDataChanged(_pcaPoints);
+        };
+
+    _settingsAction.setEnabled(false);
+    _settingsAction.getStatusTextAction().setString("Computing PCA...");
+
+    // Stream the matrix asynchronously, then update core data in main thread
+    QFuture<RandomizedPCAResult> computing = QtConcurrent::run(computeAsync);
+    trackBackgroundTask(QFuture<void>(computing));
+    computing.then(this, passPcaToCore);
+}
+
+void SparseH5AccessPlugin::selectByQuery()
+{
+    if (_sparseMatrix->getNumCols() == 0)
+        return;
+
+    std::vector<RowPredicate> predicates;
+    std::string error;
+    if (!parseRowQuery(_settingsAction.getQueryAction().getString().toStdString(), _sparseMatrix->getVarNames(), predicates, error)) {
+        _settingsAction.getQueryResultAction().setString(QString::fromStdString(error));
+        return;
+    }
+
+    if (_pointMapping.isIdentity() && static_cast<size_t>(_sparseMatrix->getNumRows()) != _numPoints) {
+        _settingsAction.getQueryResultAction().setString("The file rows do not match the points");
+        return;
+    }
+
+    auto queryAsync = [reader = shareSparseMatrix(), predicates]() -> std::vector<std::int64_t> {
+        return reader->queryRows(predicates);
+        };
+
+    // Rows of the file are mapped to the points of the input data
+    auto selectInCore = [this, numRows = _sparseMatrix->getNumRows()](std::vector<std::int64_t> rows) -> void {
+        _settingsAction.setEnabled(true);
+
+        const std::vector<std::int64_t> points = _pointMapping.rowsToPoints(rows, numRows);
+        const std::vector<std::uint32_t> selectionIndices(points.begin(), points.end());
+
+        auto inputData = getInputDataset<Points>();
+        inputData->setSelectionIndices(selectionIndices);
+        mv::events().notifyDatasetDataSelectionChanged(inputData);
+
+        _settingsAction.getQueryResultAction().setString(QString("%1 points selected").arg(selectionIndices.size()));
+        };
+
+    _settingsAction.setEnabled(false);
+    _settingsAction.getStatusTextAction().setString("Querying...");
+
+    QFuture<std::vector<std::int64_t>> querying = QtConcurrent::run(queryAsync);
+    trackBackgroundTask(QFuture<void>(querying));
+    querying.then(this, selectInCore);
+}
+
+void SparseH5AccessPlugin::findMarkers()
+{
+    if (_sparseMatrix->getNumCols() == 0)
+        return;
+
+    if (_pointMapping.isIdentity() && static_cast<size_t>(_sparseMatrix->getNumRows()) != _numPoints) {
+        _settingsAction.getMarkersListAction().setString("The file rows do not match the points");
+        return;
+    }
+
+    // Rows of the file that are not input points belong to the rest
+    const std::vector<std::uint32_t>& selectionIndices = getInputDataset<Points>()->getSelectionIndices();
+    const std::vector<std::int64_t> selectedRows = _pointMapping.pointsToRows(std::vector<std::int64_t>(selectionIndices.begin(), selectionIndices.end()));
+
+    if (selectedRows.empty() || selectedRows.size() >= static_cast<size_t>(_sparseMatrix->getNumRows())) {
+        _settingsAction.getMarkersListAction().setString("Select some of the points first");
+        return;
+    }
+
+    auto computeAsync = [this, reader = shareSparseMatrix(), selectedRows]() -> DifferentialExpressionResult {
+        DifferentialExpressionResult result;
+
+        auto reportProgress = [this](const float progress) {
+            QMetaObject::invokeMethod(this, [this, progress]() {
+                _settingsAction.getStatusTextAction().setString(QString("Ranking markers... %1%").arg(static_cast<int>(progress * 100.f)));
+                });
+            };
+
+        computeDifferentialExpression(*reader, selectedRows, DifferentialExpressionSettings{}, result, reportProgress);
+
+        return result;
+        };
+
+    // The top ranked variables replace the data dimensions
+    auto showMarkers = [this](DifferentialExpressionResult result) -> void {
+        _settingsAction.setEnabled(true);
+
+        if (result._ranking.empty()) {
+            _settingsAction.getMarkersListAction().setString("Could not rank the variables");
+            return;
+        }
+
+        const size_t numMarkers = std::min<size_t>(_settingsAction.getMarkerCountAction().getValue(), result._ranking.size());
+
+        std::vector<std::int64_t> columnIndices;
+        QStringList markerNames;
+        for (size_t rank = 0; rank < numMarkers; ++rank) {
+            const DifferentialExpressionStatistics& statistics = result._ranking[rank];
+            columnIndices.push_back(statistics._column);
+            markerNames << QString("%1 (t = %2)").arg(_dimensionNames[statistics._column]).arg(statistics._tStatistic, 0, 'f', 1);
+        }
+
+        _settingsAction.getMarkersListAction().setString(markerNames.join(", "));
+
+        showDimensions(columnIndices);
+        };
+
+    _settingsAction.setEnabled(false);
+    _settingsAction.getStatusTextAction().setString("Ranking markers...");
+
+    // Stream the matrix asynchronously, then update the dimension pickers in main thread
+    QFuture<DifferentialExpressionResult> ranking = QtConcurrent::run(computeAsync);
+    trackBackgroundTask(QFuture<void>(ranking));
+    ranking.then(this, showMarkers);
+}
+
+void SparseH5AccessPlugin::showPanel(const QStringList& variables)
+{
+    if (variables.isEmpty() || _dimensionNames.isEmpty())
+        return;
+
+    std::vector<std::int64_t> columnIndices;
+    QStringList notFound;
+
+    for (const QString& variable : variables) {
+        auto it = _dimensionIndices.constFind(variable);
+        std::int64_t columnIndex = it != _dimensionIndices.cend() ? it.value() : -1;
+
+        // Names that only differ in case, the first prefix match is the best candidate
+        if (columnIndex < 0) {
+            const std::vector<std::int64_t> matches = _dimensionSearch.search(variable.toStdString(), 1);
+            if (!matches.empty() && _dimensionNames[matches.front()].compare(variable, Qt::CaseInsensitive) == 0)
+                columnIndex = matches.front();
+        }
+
+        if (columnIndex < 0)
+            notFound << variable;
+        else if (std::find(columnIndices.begin(), columnIndices.end(), columnIndex) == columnIndices.end())
+            columnIndices.push_back(columnIndex);
+    }
+
+    QString result = QString("%1 of %2 shown").arg(columnIndices.size()).arg(variables.size());
+    if (!notFound.isEmpty())
+        result += QString(", not found: %1").arg(notFound.join(", "));
+    _settingsAction.getPanelResultAction().setString(result);
+
+    // All pickers are created first, then every column is read in a single batch
+    showDimensions(columnIndices);
+}
+
+void SparseH5AccessPlugin::loadPanelFile(const QString& filePath)
+{
+    QFile file(filePath);
+    if (filePath.isEmpty() || !file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        _settingsAction.getPanelResultAction().setString("Cannot read the panel file");
+        return;
+    }
+
+    QStringList variables = splitVariables(QString::fromUtf8(file.readAll()));
+    for (QString& variable : variables) {
+        variable.remove('"');
+    }
+    variables.removeAll(QString());
+
+    _settingsAction.getPanelVariablesAction().setString(variables.join(", "));
+    showPanel(variables);
+}
+
+void SparseH5AccessPlugin::showTopPanel()
+{
+    if (_sparseMatrix->getNumCols() == 0)
+        return;
+
+    const std::int32_t ranking  = _settingsAction.getPanelRankingAction().getCurrentIndex();
+    const size_t count          = static_cast<size_t>(_settingsAction.getPanelCountAction().getValue());
+
+    auto computeAsync = [this, reader = shareSparseMatrix(), ranking, count]() -> std::vector<std::int64_t> {
+        auto reportProgress = [this](const float progress) {
+            QMetaObject::invokeMethod(this, [this, progress]() {
+                _settingsAction.getStatusTextAction().setString(QString("Ranking variables... %1%").arg(static_cast<int>(progress * 100.f)));
+                });
+            };
+
+        std::vector<ColumnStatistics> statistics;
+        if (!computeColumnStatistics(*reader, DifferentialExpressionSettings{}, statistics, reportProgress))
+            return {};
+
+        auto statistic = [ranking](const ColumnStatistics& column) {
+            switch (ranking) {
+            case 1:  return column._mean;
+            case 2:  return column._fraction;
+            default: return column._variance;
+            }
+            };
+
+        const size_t numTop = std::min(count, statistics.size());
+        std::partial_sort(statistics.begin(), statistics.begin() + numTop, statistics.end(), [&statistic](const ColumnStatistics& a, const ColumnStatistics& b) {
+            return statistic(a) > statistic(b);
+            });
+
+        std::vector<std::int64_t> columnIndices(numTop);
+        for (size_t rank = 0; rank < numTop; ++rank) {
+            columnIndices[rank] = statistics[rank]._column;
+        }
+
+        return columnIndices;
+        };
+
+    auto showTop = [this](std::vector<std::int64_t> columnIndices) -> void {
+        _settingsAction.setEnabled(true);
+
+        if (columnIndices.empty()) {
+            _settingsAction.getPanelResultAction().setString("Could not rank the variables");
+            return;
+        }
+
+        QStringList variables;
+        for (const std::int64_t columnIndex : columnIndices) {
+            variables << _dimensionNames[columnIndex];
+        }
+
+        _settingsAction.getPanelVariablesAction().setString(variables.join(", "));
+        _settingsAction.getPanelResultAction().setString(QString("Top %1 by %2").arg(columnIndices.size()).arg(_settingsAction.getPanelRankingAction().getCurrentText().toLower()));
+
+        showDimensions(columnIndices);
+        };
+
+    _settingsAction.setEnabled(false);
+    _settingsAction.getStatusTextAction().setString("Ranking variables...");
+
+    // Stream the matrix asynchronously, then update the dimension pickers in main thread
+    QFuture<std::vector<std::int64_t>> computing = QtConcurrent::run(computeAsync);
+    trackBackgroundTask(QFuture<void>(computing));
+    computing.then(this, showTop);
+}
+
+void SparseH5AccessPlugin::updateDimensionMatches()
+{
+    constexpr size_t maxMatches = 100;
+
+    const QString query = _settingsAction.getDimensionSearchAction().getString().trimmed();
+    _dimensionMatches = query.isEmpty() ? std::vector<std::int64_t>{} : _dimensionSearch.search(query.toStdString(), maxMatches);
+
+    QStringList matchNames;
+    matchNames.reserve(static_cast<qsizetype>(_dimensionMatches.size()));
+    for (const std::int64_t columnIndex : _dimensionMatches) {
+        matchNames << _dimensionNames[columnIndex];
+    }
+
+    // Listing the matches does not add one
+    QSignalBlocker blocker(&_settingsAction.getDimensionMatchesAction());
+    _settingsAction.getDimensionMatchesModel().setNames(matchNames);
+    _settingsAction.getDimensionMatchesAction().setCurrentIndex(-1);
+}
+
+void SparseH5AccessPlugin::addDimensionMatch(const std::int32_t matchIndex)
+{
+    if (matchIndex < 0 || matchIndex >= static_cast<std::int32_t>(_dimensionMatches.size()))
+        return;
+
+    const std::int64_t columnIndex = _dimensionMatches[matchIndex];
+
+    std::vector<std::int64_t> columnIndices;
+    for (const std::int32_t selectedIndex : _settingsAction.getSelectedOptionIndices()) {
+        if (selectedIndex >= 0)
+            columnIndices.push_back(selectedIndex);
+    }
+
+    if (std::find(columnIndices.begin(), columnIndices.end(), columnIndex) == columnIndices.end())
+        columnIndices.push_back(columnIndex);
+
+    showDimensions(columnIndices);
+}
+
+void SparseH5AccessPlugin::showDimensions(const std::vector<std::int64_t>& columnIndices)
+{
+    if (columnIndices.empty())
+        return;
+
+    _blockReadingFromFile = true;
+
+    auto& dataDimActions = _settingsAction.getDataDimActions();
+
+    while (dataDimActions.size() < columnIndices.size()) {
+        _settingsAction.addDataDimAction();
+        connect(dataDimActions.back().get(), &gui::OptionAction::currentIndexChanged, this, &SparseH5AccessPlugin::readDataFromDisk);
+    }
+
+    while (dataDimActions.size() > columnIndices.size()) {
+        _settingsAction.removeDataDimAction();
+    }
+
+    for (size_t dim = 0; dim < columnIndices.size(); ++dim) {
+        dataDimActions[dim]->setCurrentIndex(static_cast<int>(columnIndices[dim]));
+    }
+
+    _blockReadingFromFile = false;
+
+    _numDims = dataDimActions.size();
+    if (_sparseMatrix->getMaxCacheSize() < _numDims) {
+        _sparseMatrix->setMaxCacheSize(_numDims);
+    }
+
+    readDataFromDisk();
+}
+
+QStringList SparseH5AccessPlugin::getProjectSaveVariables() const
+{
+    if (_settingsAction.getProjectSaveMode() == ProjectSaveMode::VARIABLE_SUBSET) {
+        return splitVariables(_settingsAction.getSaveVariablesAction().getString());
+    }
+
+    // Everything that is needed to show the current dimensions again
+    QStringList variables;
+    for (const std::int32_t dimensionIndex : _selectedDimensionIndices) {
+        if (dimensionIndex >= 0 && dimensionIndex < _dimensionNames.size())
+            variables << _dimensionNames[dimensionIndex];
+    }
+
+    for (const VirtualDimension& virtualDimension : _virtualDimensions) {
+        variables << virtualDimension._variables;
+    }
+
+    return variables;
+}
+
+void SparseH5AccessPlugin::stageProjectExport()
+{
+    if (!_settingsAction.getSaveDataToProjectChecked() || _settingsAction.getProjectSaveMode() == ProjectSaveMode::ENTIRE_FILE || _sparseMatrix->getNumCols() == 0)
+        return;
+
+    const QStringList variables = getProjectSaveVariables();
+
+    if (variables == _projectExportVariables && _projectExport.isValid())
+        return;
+
+    cancelProjectExport();
+
+    std::vector<std::int64_t> columnIndices;
+    for (const QString& variable : variables) {
+        const auto it = _dimensionIndices.constFind(variable);
+
+        if (it == _dimensionIndices.cend()) {
+            qDebug() << "SparseH5AccessPlugin::stageProjectExport: unknown variable" << variable;
+            continue;
+        }
+
+        if (std::find(columnIndices.begin(), columnIndices.end(), it.value()) == columnIndices.end())
+            columnIndices.push_back(it.value());
+    }
+
+    _projectExportVariables = variables;
+    _projectExportCancel    = std::make_shared<std::atomic<bool>>(false);
+    _projectExportPath      = QDir::temp().filePath(QString("SparseH5Access_%1.h5").arg(QUuid::createUuid().toString(QUuid::WithoutBraces)));
+
+    auto exportAsync = [this, reader = shareSparseMatrix(), columnIndices, cancel = _projectExportCancel, outputPath = _projectExportPath.toStdString()]() -> bool {
+        auto reportProgress = [this, cancel](const float progress) -> bool {
+            QMetaObject::invokeMethod(this, [this, progress]() {
+                _settingsAction.getStatusTextAction().setString(QString("Preparing project data... %1%").arg(static_cast<int>(progress * 100.f)));
+                });
+            return !cancel->load();
+            };
+
+        // A cancelled export leaves its output to cancelProjectExport
+        return extractColumns(*reader, columnIndices, outputPath, RepackSettings{}, reportProgress) && !cancel->load();
+        };
+
+    // Only the variables are streamed out, the project save itself just links the result
+    _projectExport = QtConcurrent::run(exportAsync);
+}
+
+void SparseH5AccessPlugin::cancelProjectExport()
+{
+    if (_projectExportCancel)
+        *_projectExportCancel = true;
+
+    // A running export stops after its current batch, its output is removed once it has stopped
+    _projectExport.waitForFinished();
+
+    if (!_projectExportPath.isEmpty()) {
+        std::error_code error;
+        fs::remove(_projectExportPath.toStdString(), error);
+    }
+
+    _projectExport          = {};
+    _projectExportCancel    = {};
+    _projectExportPath      = {};
+    _projectExportVariables = {};
 }
 
 void SparseH5AccessPlugin::fromVariantMap(const QVariantMap& variantMap)
 {
     AnalysisPlugin::fromVariantMap(variantMap);
 
+    // Virtual dimensions are resolved once the file is opened
+    _virtualDimensions.clear();
+    for (const QVariant& virtualDimensionVariant : variantMap.value("VirtualDimensions").toList()) {
+        const QVariantMap virtualDimensionMap = virtualDimensionVariant.toMap();
+
+        VirtualDimension virtualDimension;
+        virtualDimension._name      = virtualDimensionMap.value("Name").toString();
+        virtualDimension._variables = virtualDimensionMap.value("Variables").toStringList();
+        virtualDimension._reduction = aggregateReductionStringToType(virtualDimensionMap.value("Reduction").toString().toStdString());
+
+        _virtualDimensions.push_back(std::move(virtualDimension));
+    }
+    updateVirtualDimensionsList();
+
     _settingsAction.fromParentVariantMap(variantMap);
 
     if (_settingsAction.getSaveDataToProjectChecked()) {
         loadFileFromProject(variantMap);
     }
 
+    // Variables that were used in the last session are read ahead
+    warmCache(variantMap.value("CachedDimensions").toStringList());
+
 }
 
 QVariantMap SparseH5AccessPlugin::toVariantMap() const
@@ -297,6 +1382,25 @@ QVariantMap SparseH5AccessPlugin::toVariantMap() const
 
     _settingsAction.insertIntoVariantMap(variantMap);
 
+    QVariantList virtualDimensionsList;
+    for (const VirtualDimension& virtualDimension : _virtualDimensions) {
+        virtualDimensionsList << QVariantMap{
+            { "Name", virtualDimension._name },
+            { "Variables", virtualDimension._variables },
+            { "Reduction", QString::fromStdString(aggregateReductionToString(virtualDimension._reduction)) },
+        };
+    }
+    variantMap["VirtualDimensions"] = virtualDimensionsList;
+
+    QStringList cachedDimensions;
+    if (_fileMatrix) {
+        for (const std::int64_t columnIndex : _fileMatrix->getCachedColumns()) {
+            if (columnIndex >= 0 && columnIndex < _dimensionNames.size())
+                cachedDimensions << _dimensionNames[columnIndex];
+        }
+    }
+    variantMap["CachedDimensions"] = cachedDimensions;
+
     if (_settingsAction.getSaveDataToProjectChecked()) {
         saveFileToProject(variantMap);
     }
@@ -306,17 +1410,55 @@ QVariantMap SparseH5AccessPlugin::toVariantMap() const
 
 bool SparseH5AccessPlugin::saveFileToProject(QVariantMap& variantMap) const
 {
+    const fs::path mvSaveDir = mv::projects().getTemporaryDirPath(mv::AbstractProjectManager::TemporaryDirType::Save).toStdString();
+
+    if (_settingsAction.getProjectSaveMode() != ProjectSaveMode::ENTIRE_FILE) {
+        if (!_projectExport.isValid()) {
+            qDebug() << "SparseH5AccessPlugin::saveFileToProject: no variables to save";
+            return false;
+        }
+
+        // Usually done by now, otherwise only the remaining variables are waited for
+        _projectExport.waitForFinished();
+
+        if (!_projectExport.result()) {
+            qDebug() << "SparseH5AccessPlugin::saveFileToProject: could not write the saved variables";
+            return false;
+        }
+
+        const fs::path sourceName   = fs::path(_settingsAction.getFileOnDiskPath().toStdString()).stem();
+        const fs::path subsetName   = (sourceName.empty() ? std::string("data") : sourceName.string()) + "_subset.h5";
+        const bool success          = cloneFile(_projectExportPath.toStdString(), (mvSaveDir / subsetName).string());
+
+        if (success) {
+            variantMap["FileOnDiskName"] = QVariant::fromValue(QString::fromStdString(subsetName.string()));
+            qDebug() << "SparseH5AccessPlugin::saveFileToProject: saved" << _projectExportVariables.size() << "variables to project:" << subsetName;
+        }
+
+        return success;
+    }
+
+    if (_shardedMatrix && getDiskMatrix() == _shardedMatrix.get()) {
+        qDebug() << "SparseH5AccessPlugin::saveFileToProject: sharded data is not saved to the project, only the folder path";
+        return false;
+    }
+
+    if (getDiskMatrix() && getDiskMatrix()->getRawData()._source) {
+        qDebug() << "SparseH5AccessPlugin::saveFileToProject: Zarr stores are not saved to the project, only the folder path";
+        return false;
+    }
+
     const fs::path fileOnDiskPath = _settingsAction.getFileOnDiskPath().toStdString();
 
     if (fileOnDiskPath.empty()) {
         return false;
     }
 
-    const fs::path mvSaveDir            = mv::projects().getTemporaryDirPath(mv::AbstractProjectManager::TemporaryDirType::Save).toStdString();
     const fs::path fileOnDiskName       = fileOnDiskPath.filename();
     const fs::path savePath             = mvSaveDir / fileOnDiskName;
 
-    const bool success = fs::copy_file(fileOnDiskPath, savePath, fs::copy_options::overwrite_existing);
+    // Reflinks and hard links avoid copying the entire file where the file system allows them
+    const bool success = cloneFile(fileOnDiskPath.string(), savePath.string());
 
     if (success) {
         variantMap["FileOnDiskName"]    = QVariant::fromValue(QString::fromStdString(fileOnDiskName.string()));
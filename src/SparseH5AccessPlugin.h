@@ -10,16 +10,47 @@
 #include <Dataset.h>
 #include <PointData/PointData.h>
 
+#include "AccessTrace.h"
+#include "DenseMatrixReader.h"
+#include "DifferentialExpression.h"
+#include "DimensionSearch.h"
+#include "DiskCache.h"
+#include "DualLayoutReader.h"
 #include "H5Utils.h"
+#include "PointMapping.h"
+#include "Quantization.h"
+#include "RandomizedPCA.h"
+#include "ReaderRegistry.h"
+#include "Repack.h"
+#include "ResidentReader.h"
 #include "SettingsAction.h"
+#include "ShardedReader.h"
+#include "ZarrUtils.h"
 
+#include <QFuture>
+#include <QHash>
+#include <QList>
 #include <QString>
 #include <QStringList>
 #include <QVariantMap>
 
+#include <atomic>
 #include <cstdint>
+#include <memory>
 #include <vector>
 
+// =============================================================================
+// Virtual dimensions
+// =============================================================================
+
+// A dimension that reduces a set of variables into a single value per point
+struct VirtualDimension {
+    QString                     _name       = {};
+    QStringList                 _variables  = {};
+    AggregateReduction          _reduction  = AggregateReduction::MEAN;
+    std::vector<std::int64_t>   _indices    = {};   // Resolved variable indices in the current file
+};
+
 // =============================================================================
 // Analysis
 // =============================================================================
@@ -38,32 +69,93 @@ public:
 private:
     // Default: select the first two dimensions of the data
     void updateFile(const QString& filePathQt);
+    void updateShardDirectory(const QString& directoryQt);
+    void updateDimensions(const QString& matrixTypeStr);
+    void updateDiskCache();
+    void updateAccessTrace();
+    void updateValueTransform();
+    void updateH5Access();
+    void updateH5AccessStatus();
+    bool reacquireFileMatrix();         // Swaps in the shared reader of the file for the current transform and access settings
+    void updatePointMapping();
+    void updateResidentMatrix();
+    void releaseResidentMatrix();
+    void warmCache(const QStringList& dimensionNames);
 
     void readDataFromDisk();
-    void updateOptionsForDim(const std::int32_t numDim, const QStringList& dimNames);
+    void rereadDataFromDisk();
+    void updateOptionsForDim(const std::int32_t numDim);
+    void updateDimensionMatches();
+    void addDimensionMatch(const std::int32_t matchIndex);
+
+    void addVirtualDimension();
+    void removeVirtualDimension();
+    void resolveVirtualDimensions();
+    void updateVirtualDimensionsList();
+
+    void computePCA();
+    void selectByQuery();
+    void findMarkers();
+    void showPanel(const QStringList& variables);
+    void loadPanelFile(const QString& filePath);
+    void showTopPanel();
+    void showDimensions(const std::vector<std::int64_t>& columnIndices);
+
+    QStringList getProjectSaveVariables() const;
+    void stageProjectExport();
+    void cancelProjectExport();
 
     bool saveFileToProject(QVariantMap& variantMap) const;
     bool loadFileFromProject(const QVariantMap& variantMap);
 
+    // The reader of the file or shards, also while the resident matrix serves the reads
+    SparseMatrixReader* getDiskMatrix() const { return _residentMatrix ? _residentSource.get() : _sparseMatrix; }
+
+    // Owning reference to _sparseMatrix, background tasks hold it such that swapping the reader does not free it under them
+    std::shared_ptr<SparseMatrixReader> shareSparseMatrix() const;
+
+    // Waited for when this instance is destroyed, the tasks use its members
+    void trackBackgroundTask(const QFuture<void>& task);
+
 public: // Serialization
 
     Q_INVOKABLE void fromVariantMap(const QVariantMap& variantMap) override;
     Q_INVOKABLE QVariantMap toVariantMap() const override;
 
 private:
-    SettingsAction              _settingsAction;    /** General settings */
-
-    size_t                      _numPoints;         /** Numer of data points */
-    size_t                      _numDims;           /** The number of dimensions */
-    mv::Dataset<Points>         _outputPoints;
-    std::vector<std::int32_t>   _selectedDimensionIndices;
-    QStringList                 _dimensionNames;
-
-    CSRReader                   _csrMatrix;
-    CSCReader                   _cscMatrix;
-    SparseMatrixReader*         _sparseMatrix;
-
-    bool                        _blockReadingFromFile;
+    SettingsAction                 _settingsAction;    /** General settings */
+
+    size_t                         _numPoints;         /** Numer of data points */
+    size_t                         _numDims;           /** The number of dimensions */
+    mv::Dataset<Points>            _outputPoints;
+    mv::Dataset<Points>            _pcaPoints;         /** Principal components of the matrix on disk */
+    PointMapping                   _pointMapping;      /** Row of each input point, identity unless the points are a subset or reordering of the file */
+    std::vector<std::int32_t>      _selectedDimensionIndices;
+    QStringList                    _dimensionNames;
+    QHash<QString, std::int64_t>   _dimensionIndices;  /** Lookup from variable name to index */
+    DimensionSearchIndex           _dimensionSearch;   /** Search over the variable names for the "Find variables" group */
+    std::vector<std::int64_t>      _dimensionMatches;  /** Columns of the listed matches */
+    std::vector<VirtualDimension>  _virtualDimensions; /** Dimensions reduced from sets of variables */
+
+    CSCReader                      _emptyMatrix;       /** Placeholder until a file is opened */
+    std::shared_ptr<SparseMatrixReader> _fileMatrix;   /** Shared with other instances on the same file, see ReaderRegistry */
+    QString                        _fileMatrixPath;    /** File or Zarr store of _fileMatrix */
+    std::shared_ptr<ShardedReader> _shardedMatrix;     /** Several files read as one matrix, replaced for every folder */
+    std::shared_ptr<DiskCache>     _diskCache;         /** Persistent second-level cache of read variables */
+    std::shared_ptr<AccessTraceRecorder> _accessTrace; /** Records the reads of _sparseMatrix, see SparseH5Replay */
+    std::shared_ptr<ResidentReader> _residentMatrix;   /** Whole matrix in memory, serves all reads once loaded */
+    std::shared_ptr<SparseMatrixReader> _residentSource; /** Reader that _residentMatrix is loaded from */
+    QFuture<std::shared_ptr<ResidentReader>> _residentLoad;  /** Loads the resident matrix in the background */
+    std::shared_ptr<std::atomic<bool>> _residentLoadCancel;
+
+    mutable QFuture<bool>          _projectExport;          /** Compact file with the saved variables, written in the background */
+    std::shared_ptr<std::atomic<bool>> _projectExportCancel;
+    QString                        _projectExportPath;      /** Temporary location of the compact file */
+    QStringList                    _projectExportVariables; /** Variables in the compact file */
+    QList<QFuture<void>>           _backgroundTasks;        /** Reads and computations that are running or finished recently */
+    SparseMatrixReader*            _sparseMatrix;
+
+    bool                           _blockReadingFromFile;
 };
 
 // =============================================================================
@@ -0,0 +1,851 @@
+#include "ZarrUtils.h"
+
+#include <zlib.h>
+
+#ifdef SH5A_WITH_BLOSC
+#include <blosc.h>
+#endif
+
+#ifdef SH5A_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+// =============================================================================
+// JSON
+// =============================================================================
+
+// Just enough JSON for Zarr metadata
+struct JsonValue {
+    enum class Type { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT };
+
+    Type                        _type   = Type::NUL;
+    bool                        _bool   = false;
+    double                      _number = 0.0;
+    std::string                 _string = "";
+    std::vector<std::string>    _keys   = {};   // Object keys, parallel to _items
+    std::vector<JsonValue>      _items  = {};   // Array elements or object values
+
+    bool isNull() const { return _type == Type::NUL; }
+    bool isNumber() const { return _type == Type::NUMBER; }
+    bool isString() const { return _type == Type::STRING; }
+    bool isArray() const { return _type == Type::ARRAY; }
+    bool isObject() const { return _type == Type::OBJECT; }
+
+    const JsonValue* find(const std::string& key) const {
+        for (size_t i = 0; i < _keys.size(); ++i)
+            if (_keys[i] == key)
+                return &_items[i];
+        return nullptr;
+    }
+
+    std::string stringOr(const std::string& key, const std::string& fallback) const {
+        const JsonValue* value = find(key);
+        return value && value->isString() ? value->_string : fallback;
+    }
+};
+
+class JsonParser {
+public:
+    explicit JsonParser(const std::string& text) : _text(text) {}
+
+    JsonValue parse() {
+        JsonValue value = parseValue();
+        skipWhitespace();
+        if (_pos != _text.size())
+            fail("trailing characters");
+        return value;
+    }
+
+private:
+    [[noreturn]] void fail(const std::string& message) const {
+        throw std::runtime_error("JSON: " + message + " at position " + std::to_string(_pos));
+    }
+
+    void skipWhitespace() {
+        while (_pos < _text.size() && std::isspace(static_cast<unsigned char>(_text[_pos])))
+            ++_pos;
+    }
+
+    bool consume(const char c) {
+        skipWhitespace();
+        if (_pos < _text.size() && _text[_pos] == c) {
+            ++_pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(const char c) {
+        if (!consume(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    bool consumeLiteral(const std::string& literal) {
+        if (_text.compare(_pos, literal.size(), literal) != 0)
+            return false;
+        _pos += literal.size();
+        return true;
+    }
+
+    JsonValue parseValue() {
+        skipWhitespace();
+        if (_pos >= _text.size())
+            fail("unexpected end");
+
+        JsonValue value;
+        const char c = _text[_pos];
+
+        if (c == '{') {
+            value._type = JsonValue::Type::OBJECT;
+            ++_pos;
+            if (consume('}'))
+                return value;
+            do {
+                skipWhitespace();
+                value._keys.push_back(parseString());
+                expect(':');
+                value._items.push_back(parseValue());
+            } while (consume(','));
+            expect('}');
+        }
+        else if (c == '[') {
+            value._type = JsonValue::Type::ARRAY;
+            ++_pos;
+            if (consume(']'))
+                return value;
+            do {
+                value._items.push_back(parseValue());
+            } while (consume(','));
+            expect(']');
+        }
+        else if (c == '"') {
+            value._type = JsonValue::Type::STRING;
+            value._string = parseString();
+        }
+        else if (consumeLiteral("true") || consumeLiteral("false")) {
+            value._type = JsonValue::Type::BOOL;
+            value._bool = _text[_pos - 1] == 'e' && _text[_pos - 2] == 'u';
+        }
+        else if (consumeLiteral("null")) {
+            value._type = JsonValue::Type::NUL;
+        }
+        else if (consumeLiteral("NaN")) {    // written by Python's json module
+            value._type = JsonValue::Type::NUMBER;
+            value._number = std::nan("");
+        }
+        else {
+            const char* begin = _text.c_str() + _pos;
+            char* end = nullptr;
+            value._type = JsonValue::Type::NUMBER;
+            value._number = std::strtod(begin, &end);
+            if (end == begin)
+                fail("invalid value");
+            _pos += static_cast<size_t>(end - begin);
+        }
+
+        return value;
+    }
+
+    std::string parseString() {
+        if (_pos >= _text.size() || _text[_pos] != '"')
+            fail("expected string");
+        ++_pos;
+
+        std::string result;
+        while (_pos < _text.size() && _text[_pos] != '"') {
+            char c = _text[_pos++];
+
+            if (c != '\\') {
+                result.push_back(c);
+                continue;
+            }
+
+            if (_pos >= _text.size())
+                fail("unterminated escape");
+
+            c = _text[_pos++];
+            switch (c) {
+            case 'b': result.push_back('\b'); break;
+            case 'f': result.push_back('\f'); break;
+            case 'n': result.push_back('\n'); break;
+            case 'r': result.push_back('\r'); break;
+            case 't': result.push_back('\t'); break;
+            case 'u': {
+                if (_pos + 4 > _text.size())
+                    fail("invalid unicode escape");
+                const unsigned long code = std::strtoul(_text.substr(_pos, 4).c_str(), nullptr, 16);
+                _pos += 4;
+
+                // Encode as UTF-8, surrogate pairs are not combined
+                if (code < 0x80) {
+                    result.push_back(static_cast<char>(code));
+                }
+                else if (code < 0x800) {
+                    result.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    result.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                else {
+                    result.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    result.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    result.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default: result.push_back(c); break;
+            }
+        }
+
+        if (_pos >= _text.size())
+            fail("unterminated string");
+        ++_pos;
+
+        return result;
+    }
+
+private:
+    const std::string&  _text;
+    size_t              _pos = 0;
+};
+
+static std::string readFileBytes(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("cannot open " + path.string());
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+static JsonValue readJsonFile(const fs::path& path) {
+    return JsonParser(readFileBytes(path)).parse();
+}
+
+// Attributes of a group or array, empty if there are none
+static JsonValue readZarrAttributes(const fs::path& path) {
+    if (fs::exists(path / "zarr.json")) {
+        const JsonValue metadata = readJsonFile(path / "zarr.json");
+        if (const JsonValue* attributes = metadata.find("attributes"))
+            return *attributes;
+    }
+    else if (fs::exists(path / ".zattrs")) {
+        return readJsonFile(path / ".zattrs");
+    }
+
+    JsonValue empty;
+    empty._type = JsonValue::Type::OBJECT;
+    return empty;
+}
+
+// =============================================================================
+// Codecs
+// =============================================================================
+
+// Inflates zlib and gzip streams, the header type is detected automatically
+static std::vector<char> inflateBytes(const std::vector<char>& src, const size_t expectedSize) {
+    z_stream stream = {};
+    if (inflateInit2(&stream, 15 + 32) != Z_OK)
+        throw std::runtime_error("zlib: cannot initialize");
+
+    std::vector<char> dest(expectedSize > 0 ? expectedSize : src.size() * 4 + 64);
+
+    stream.next_in  = reinterpret_cast<Bytef*>(const_cast<char*>(src.data()));
+    stream.avail_in = static_cast<uInt>(src.size());
+
+    int status = Z_OK;
+    do {
+        if (stream.total_out == dest.size())
+            dest.resize(dest.size() * 2);
+
+        stream.next_out  = reinterpret_cast<Bytef*>(dest.data() + stream.total_out);
+        stream.avail_out = static_cast<uInt>(dest.size() - stream.total_out);
+        status = inflate(&stream, Z_NO_FLUSH);
+    } while (status == Z_OK || (status == Z_BUF_ERROR && stream.avail_out == 0));
+
+    const size_t size = stream.total_out;
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END)
+        throw std::runtime_error("zlib: corrupt chunk");
+
+    dest.resize(size);
+    return dest;
+}
+
+static std::vector<char> decodeBytes(const std::string& codec, std::vector<char>&& src, const size_t expectedSize) {
+    if (codec == "zlib" || codec == "gzip") {
+        return inflateBytes(src, expectedSize);
+    }
+
+    if (codec == "crc32c") {
+        // Checksum is appended, it is not verified
+        if (src.size() < 4)
+            throw std::runtime_error("crc32c: chunk too short");
+        src.resize(src.size() - 4);
+        return std::move(src);
+    }
+
+    if (codec == "zstd") {
+#ifdef SH5A_WITH_ZSTD
+        const unsigned long long contentSize = ZSTD_getFrameContentSize(src.data(), src.size());
+        if (contentSize == ZSTD_CONTENTSIZE_ERROR)
+            throw std::runtime_error("zstd: corrupt chunk");
+
+        const size_t capacity = contentSize != ZSTD_CONTENTSIZE_UNKNOWN ? static_cast<size_t>(contentSize) : expectedSize;
+        if (capacity == 0)
+            throw std::runtime_error("zstd: unknown chunk size");
+
+        std::vector<char> dest(capacity);
+        const size_t size = ZSTD_decompress(dest.data(), dest.size(), src.data(), src.size());
+        if (ZSTD_isError(size))
+            throw std::runtime_error(std::string("zstd: ") + ZSTD_getErrorName(size));
+
+        dest.resize(size);
+        return dest;
+#else
+        throw std::runtime_error("zstd codec is not available in this build");
+#endif
+    }
+
+    if (codec == "blosc") {
+#ifdef SH5A_WITH_BLOSC
+        size_t nbytes = 0, cbytes = 0, blocksize = 0;
+        blosc_cbuffer_sizes(src.data(), &nbytes, &cbytes, &blocksize);
+
+        std::vector<char> dest(nbytes);
+        const int size = blosc_decompress_ctx(src.data(), dest.data(), dest.size(), 1);
+        if (size < 0)
+            throw std::runtime_error("blosc: corrupt chunk");
+
+        dest.resize(static_cast<size_t>(size));
+        return dest;
+#else
+        throw std::runtime_error("blosc codec is not available in this build");
+#endif
+    }
+
+    throw std::runtime_error("unsupported codec " + codec);
+}
+
+// =============================================================================
+// Zarr arrays
+// =============================================================================
+
+struct ZarrDataType {
+    char    _kind       = 'f';      // f(loat), i(nt), u(nsigned), b(ool) or O (vlen-utf8 strings)
+    size_t  _size       = 4;
+    bool    _bigEndian  = false;
+};
+
+// Zarr v2 dtype, e.g. <f4, |u1 or |O
+static ZarrDataType parseDataTypeV2(const std::string& dtype) {
+    if (dtype.size() < 2)
+        throw std::runtime_error("unsupported dtype " + dtype);
+
+    ZarrDataType type;
+    type._bigEndian = dtype[0] == '>';
+    type._kind      = dtype[1];
+    type._size      = type._kind == 'O' ? 0 : static_cast<size_t>(std::atoi(dtype.c_str() + 2));
+
+    return type;
+}
+
+// Zarr v3 data_type, e.g. float32, uint8 or string
+static ZarrDataType parseDataTypeV3(const std::string& dataType) {
+    ZarrDataType type;
+
+    if (dataType == "string") {
+        type._kind = 'O';
+        type._size = 0;
+    }
+    else if (dataType == "bool") {
+        type._kind = 'b';
+        type._size = 1;
+    }
+    else if (dataType.rfind("float", 0) == 0) {
+        type._kind = 'f';
+        type._size = static_cast<size_t>(std::atoi(dataType.c_str() + 5)) / 8;
+    }
+    else if (dataType.rfind("uint", 0) == 0) {
+        type._kind = 'u';
+        type._size = static_cast<size_t>(std::atoi(dataType.c_str() + 4)) / 8;
+    }
+    else if (dataType.rfind("int", 0) == 0) {
+        type._kind = 'i';
+        type._size = static_cast<size_t>(std::atoi(dataType.c_str() + 3)) / 8;
+    }
+    else {
+        throw std::runtime_error("unsupported data_type " + dataType);
+    }
+
+    return type;
+}
+
+template<typename S>
+static S loadScalar(const char* src, const bool swap) {
+    std::array<char, sizeof(S)> bytes;
+    std::memcpy(bytes.data(), src, sizeof(S));
+    if (swap)
+        std::reverse(bytes.begin(), bytes.end());
+
+    S value;
+    std::memcpy(&value, bytes.data(), sizeof(S));
+    return value;
+}
+
+template<typename T>
+static T loadElement(const char* src, const ZarrDataType& type, const bool swap) {
+    switch (type._kind) {
+    case 'f':
+        return type._size == 8 ? static_cast<T>(loadScalar<double>(src, swap)) : static_cast<T>(loadScalar<float>(src, swap));
+    case 'i':
+        switch (type._size) {
+        case 1: return static_cast<T>(loadScalar<std::int8_t>(src, swap));
+        case 2: return static_cast<T>(loadScalar<std::int16_t>(src, swap));
+        case 4: return static_cast<T>(loadScalar<std::int32_t>(src, swap));
+        default: return static_cast<T>(loadScalar<std::int64_t>(src, swap));
+        }
+    default:
+        switch (type._size) {
+        case 1: return static_cast<T>(loadScalar<std::uint8_t>(src, swap));
+        case 2: return static_cast<T>(loadScalar<std::uint16_t>(src, swap));
+        case 4: return static_cast<T>(loadScalar<std::uint32_t>(src, swap));
+        default: return static_cast<T>(loadScalar<std::uint64_t>(src, swap));
+        }
+    }
+}
+
+template<typename T>
+constexpr char dataKind() {
+    return std::is_floating_point_v<T> ? 'f' : (std::is_signed_v<T> ? 'i' : 'u');
+}
+
+// A one-dimensional Zarr array in a directory store
+class ZarrArray {
+    using Chunk = std::shared_ptr<const std::vector<char>>;     // Decoded bytes, empty if the chunk is not stored
+
+public:
+    ZarrArray() = default;
+    ZarrArray(const ZarrArray&) = delete;
+    ZarrArray& operator=(const ZarrArray&) = delete;
+
+    // Reads the array metadata, throws std::runtime_error
+    void open(const fs::path& path) {
+        _path = path;
+
+        if (fs::exists(path / "zarr.json"))
+            openV3(readJsonFile(path / "zarr.json"));
+        else if (fs::exists(path / ".zarray"))
+            openV2(readJsonFile(path / ".zarray"));
+        else
+            throw std::runtime_error("no Zarr array at " + path.string());
+
+        if (_dataType._kind != 'O' && _dataType._kind != 'b' && _dataType._size != 1 && _dataType._size != 2 && _dataType._size != 4 && _dataType._size != 8)
+            throw std::runtime_error("unsupported element size in " + path.string());
+
+        if (_dataType._kind == 'f' && _dataType._size != 4 && _dataType._size != 8)
+            throw std::runtime_error("unsupported float size in " + path.string());
+
+        // Keep a few chunks decoded, recent reads in the secondary scan and neighbouring arrays often share them
+        constexpr size_t cacheBudget = size_t{ 64 } << 20;
+        const size_t chunkBytes = static_cast<size_t>(_chunkSize) * std::max<size_t>(_dataType._size, 8);
+        _cacheCapacity = std::clamp<size_t>(cacheBudget / std::max<size_t>(chunkBytes, 1), 2, 64);
+    }
+
+    std::int64_t getSize() const { return _size; }
+
+    // Reads and converts count elements starting at offset, chunks are decoded in parallel
+    template<typename T>
+    void read(const std::int64_t offset, const std::int64_t count, std::vector<T>& dest) const {
+        dest.resize(count > 0 ? count : 0);
+
+        if (count <= 0)
+            return;
+
+        if (_dataType._kind == 'O')
+            throw std::runtime_error("cannot read strings as numbers from " + _path.string());
+
+        if (offset < 0 || offset + count > _size)
+            throw std::runtime_error("read out of range in " + _path.string());
+
+        const std::int64_t firstChunk   = offset / _chunkSize;
+        const std::int64_t lastChunk    = (offset + count - 1) / _chunkSize;
+        const std::vector<Chunk> chunks = getChunks(firstChunk, lastChunk);
+
+        const bool swap     = _dataType._bigEndian != (std::endian::native == std::endian::big);
+        const bool sameType = !swap && _dataType._kind == dataKind<T>() && _dataType._size == sizeof(T);
+        const T fill        = static_cast<T>(std::isnan(_fillValue) ? 0.0 : _fillValue);
+
+#pragma omp parallel for
+        for (std::int64_t k = 0; k < static_cast<std::int64_t>(chunks.size()); ++k) {
+            const std::int64_t chunkBegin   = (firstChunk + k) * _chunkSize;
+            const std::int64_t from         = std::max(offset, chunkBegin);
+            const std::int64_t to           = std::min(offset + count, chunkBegin + _chunkSize);
+            const std::vector<char>& bytes  = *chunks[k];
+
+            if (bytes.empty()) {
+                std::fill(dest.begin() + (from - offset), dest.begin() + (to - offset), fill);
+                continue;
+            }
+
+            const char* src = bytes.data() + (from - chunkBegin) * _dataType._size;
+
+            if (sameType) {
+                std::memcpy(dest.data() + (from - offset), src, (to - from) * sizeof(T));
+                continue;
+            }
+
+            for (std::int64_t i = from; i < to; ++i, src += _dataType._size)
+                dest[i - offset] = loadElement<T>(src, _dataType, swap);
+        }
+    }
+
+    // Reads all elements of a vlen-utf8 string array
+    void readStrings(std::vector<std::string>& dest) const {
+        dest.clear();
+
+        if (_dataType._kind != 'O')
+            throw std::runtime_error("not a string array: " + _path.string());
+
+        if (_size == 0)
+            return;
+
+        const std::vector<Chunk> chunks = getChunks(0, (_size - 1) / _chunkSize);
+        dest.reserve(_size);
+
+        auto readUInt32 = [](const std::vector<char>& bytes, const size_t pos) -> std::uint32_t {
+            if (pos + 4 > bytes.size())
+                throw std::runtime_error("vlen-utf8: truncated chunk");
+            return loadScalar<std::uint32_t>(bytes.data() + pos, std::endian::native == std::endian::big);
+            };
+
+        for (const Chunk& chunk : chunks) {
+            const std::vector<char>& bytes = *chunk;
+
+            if (bytes.empty()) {
+                dest.resize(std::min<std::int64_t>(dest.size() + _chunkSize, _size));
+                continue;
+            }
+
+            const std::uint32_t numItems = readUInt32(bytes, 0);
+            size_t pos = 4;
+
+            for (std::uint32_t item = 0; item < numItems && static_cast<std::int64_t>(dest.size()) < _size; ++item) {
+                const std::uint32_t length = readUInt32(bytes, pos);
+                pos += 4;
+
+                if (pos + length > bytes.size())
+                    throw std::runtime_error("vlen-utf8: truncated chunk");
+
+                dest.emplace_back(bytes.data() + pos, length);
+                pos += length;
+            }
+        }
+    }
+
+private:
+    void openV2(const JsonValue& metadata) {
+        const JsonValue* shape  = metadata.find("shape");
+        const JsonValue* chunks = metadata.find("chunks");
+
+        if (!shape || !chunks || shape->_items.size() != 1 || chunks->_items.size() != 1)
+            throw std::runtime_error("only one-dimensional arrays are supported: " + _path.string());
+
+        _size       = static_cast<std::int64_t>(shape->_items[0]._number);
+        _chunkSize  = std::max<std::int64_t>(static_cast<std::int64_t>(chunks->_items[0]._number), 1);
+        _dataType   = parseDataTypeV2(metadata.stringOr("dtype", ""));
+
+        if (const JsonValue* fill = metadata.find("fill_value"); fill && fill->isNumber())
+            _fillValue = fill->_number;
+
+        if (const JsonValue* compressor = metadata.find("compressor"); compressor && compressor->isObject())
+            _codecs.push_back(compressor->stringOr("id", ""));
+
+        if (const JsonValue* filters = metadata.find("filters"); filters && filters->isArray()) {
+            for (const JsonValue& filter : filters->_items) {
+                if (filter.stringOr("id", "") != "vlen-utf8")
+                    throw std::runtime_error("unsupported filter " + filter.stringOr("id", "") + " in " + _path.string());
+            }
+        }
+
+        _chunkKeyPrefix = "";
+    }
+
+    void openV3(const JsonValue& metadata) {
+        if (metadata.stringOr("node_type", "") != "array")
+            throw std::runtime_error("not a Zarr array: " + _path.string());
+
+        const JsonValue* shape = metadata.find("shape");
+        const JsonValue* grid  = metadata.find("chunk_grid");
+        const JsonValue* gridConfig = grid ? grid->find("configuration") : nullptr;
+        const JsonValue* chunkShape = gridConfig ? gridConfig->find("chunk_shape") : nullptr;
+
+        if (!shape || !chunkShape || shape->_items.size() != 1 || chunkShape->_items.size() != 1)
+            throw std::runtime_error("only one-dimensional arrays are supported: " + _path.string());
+
+        _size       = static_cast<std::int64_t>(shape->_items[0]._number);
+        _chunkSize  = std::max<std::int64_t>(static_cast<std::int64_t>(chunkShape->_items[0]._number), 1);
+        _dataType   = parseDataTypeV3(metadata.stringOr("data_type", ""));
+
+        if (const JsonValue* fill = metadata.find("fill_value"); fill && fill->isNumber())
+            _fillValue = fill->_number;
+
+        _chunkKeyPrefix = "c/";
+        if (const JsonValue* keyEncoding = metadata.find("chunk_key_encoding")) {
+            const JsonValue* keyConfig  = keyEncoding->find("configuration");
+            const std::string separator = keyConfig ? keyConfig->stringOr("separator", "/") : "/";
+
+            _chunkKeyPrefix = keyEncoding->stringOr("name", "default") == "v2" ? "" : "c" + separator;
+        }
+
+        // Codecs are listed in encoding order, bytes-to-bytes codecs follow the array-to-bytes codec
+        if (const JsonValue* codecs = metadata.find("codecs")) {
+            for (const JsonValue& codec : codecs->_items) {
+                const std::string name = codec.stringOr("name", "");
+
+                if (name == "bytes") {
+                    const JsonValue* config = codec.find("configuration");
+                    _dataType._bigEndian = config && config->stringOr("endian", "little") == "big";
+                }
+                else if (name == "vlen-utf8" || name == "transpose") {
+                    continue;   // strings are handled by readStrings, transposing is a no-op in 1D
+                }
+                else if (name == "sharding_indexed") {
+                    throw std::runtime_error("sharded Zarr arrays are not supported: " + _path.string());
+                }
+                else {
+                    _codecs.push_back(name);
+                }
+            }
+        }
+
+        std::reverse(_codecs.begin(), _codecs.end());
+    }
+
+    Chunk decodeChunk(const std::int64_t chunk) const {
+        const fs::path chunkPath = _path / (_chunkKeyPrefix + std::to_string(chunk));
+
+        if (!fs::exists(chunkPath))
+            return std::make_shared<const std::vector<char>>();
+
+        const std::string raw = readFileBytes(chunkPath);
+        std::vector<char> bytes(raw.begin(), raw.end());
+
+        const size_t expectedSize = static_cast<size_t>(_chunkSize) * _dataType._size;
+        for (const std::string& codec : _codecs)
+            bytes = decodeBytes(codec, std::move(bytes), expectedSize);
+
+        if (_dataType._kind != 'O' && bytes.size() < expectedSize)
+            throw std::runtime_error("chunk " + chunkPath.string() + " is too short");
+
+        return std::make_shared<const std::vector<char>>(std::move(bytes));
+    }
+
+    // Returns decoded chunks [first, last], chunks that are not cached are decoded in parallel
+    std::vector<Chunk> getChunks(const std::int64_t first, const std::int64_t last) const {
+        const std::int64_t numChunks = last - first + 1;
+        std::vector<Chunk> chunks(numChunks);
+
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+            for (auto it = _cache.begin(); it != _cache.end(); ++it) {
+                if (it->first >= first && it->first <= last)
+                    chunks[it->first - first] = it->second;
+            }
+        }
+
+        std::vector<std::string> errors(numChunks);
+
+#pragma omp parallel for schedule(dynamic)
+        for (std::int64_t k = 0; k < numChunks; ++k) {
+            if (chunks[k])
+                continue;
+
+            try {
+                chunks[k] = decodeChunk(first + k);
+            }
+            catch (const std::exception& e) {
+                errors[k] = e.what();
+            }
+        }
+
+        for (const std::string& error : errors) {
+            if (!error.empty())
+                throw std::runtime_error(error);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_cacheMutex);
+
+            // Most recently used at front, only the last chunks of a long read are kept
+            for (std::int64_t k = std::max<std::int64_t>(0, numChunks - static_cast<std::int64_t>(_cacheCapacity)); k < numChunks; ++k) {
+                const std::int64_t id = first + k;
+                _cache.remove_if([id](const auto& entry) { return entry.first == id; });
+                _cache.emplace_front(id, chunks[k]);
+            }
+
+            while (_cache.size() > _cacheCapacity)
+                _cache.pop_back();
+        }
+
+        return chunks;
+    }
+
+private:
+    fs::path                                            _path           = {};
+    std::int64_t                                        _size           = 0;
+    std::int64_t                                        _chunkSize      = 1;
+    ZarrDataType                                        _dataType       = {};
+    double                                              _fillValue      = 0.0;
+    std::vector<std::string>                            _codecs         = {};   // Bytes-to-bytes codecs in decoding order
+    std::string                                         _chunkKeyPrefix = "";
+    size_t                                              _cacheCapacity  = 2;
+    mutable std::mutex                                  _cacheMutex     = {};
+    mutable std::list<std::pair<std::int64_t, Chunk>>   _cache          = {};   // Most recently used at front
+};
+
+// =============================================================================
+// Zarr sparse matrices
+// =============================================================================
+
+class ZarrArraySource : public SparseArraySource {
+public:
+    ZarrArraySource(const fs::path& matrixPath) {
+        _indices.open(matrixPath / "indices");
+        _data.open(matrixPath / "data");
+    }
+
+    void readIndices(const std::int64_t offset, const std::int64_t count, std::vector<std::int64_t>& dest) const override {
+        _indices.read(offset, count, dest);
+    }
+
+    void readValues(const std::int64_t offset, const std::int64_t count, std::vector<float>& dest) const override {
+        _data.read(offset, count, dest);
+    }
+
+    // Entries that both indices and data hold
+    std::int64_t getNnz() const { return std::min(_indices.getSize(), _data.getSize()); }
+
+private:
+    ZarrArray _indices;
+    ZarrArray _data;
+};
+
+bool isZarrStore(const std::string& path) {
+    std::error_code ec;
+    return fs::is_directory(path, ec) && (fs::exists(fs::path(path) / ".zgroup", ec) || fs::exists(fs::path(path) / "zarr.json", ec));
+}
+
+SparseMatrixType readZarrMatrixType(const std::string& path) {
+    SparseMatrixType type = SparseMatrixType::UNKNOWN;
+
+    try {
+        type = sparseMatrixStringToType(readZarrAttributes(fs::path(path) / "X").stringOr("encoding-type", ""));
+    }
+    catch (const std::exception& e) {
+        std::cerr << "readZarrMatrixType: " << e.what() << std::endl;
+    }
+
+    if (type == SparseMatrixType::DENSE) {
+        std::cerr << "readZarrMatrixType: dense X is not supported in Zarr stores" << std::endl;
+        type = SparseMatrixType::UNKNOWN;
+    }
+
+    return type;
+}
+
+// Index of an anndata dataframe, its column name is stored in the _index attribute
+static void readZarrIndex(const fs::path& groupPath, std::vector<std::string>& dest) {
+    dest.clear();
+
+    if (!fs::is_directory(groupPath))
+        return;
+
+    const std::string indexName = readZarrAttributes(groupPath).stringOr("_index", "_index");
+
+    if (!fs::is_directory(groupPath / indexName))
+        return;
+
+    ZarrArray index;
+    index.open(groupPath / indexName);
+    index.readStrings(dest);
+}
+
+bool readMatrixFromZarr(const std::string& path, SparseMatrixData& data)
+{
+    const fs::path storePath  = path;
+    const fs::path matrixPath = storePath / "X";
+
+    try {
+        const JsonValue attributes = readZarrAttributes(matrixPath);
+        const std::string encoding = attributes.stringOr("encoding-type", "");
+        const SparseMatrixType type = sparseMatrixStringToType(encoding);
+
+        if (type != SparseMatrixType::CSR && type != SparseMatrixType::CSC) {
+            std::cerr << "readMatrixFromZarr: X must be a csr_matrix or csc_matrix, found '" << encoding << "'" << std::endl;
+            return false;
+        }
+
+        const JsonValue* shape = attributes.find("shape");
+        if (!shape || shape->_items.size() != 2) {
+            std::cerr << "readMatrixFromZarr: X has no shape attribute" << std::endl;
+            return false;
+        }
+
+        auto source = std::make_unique<ZarrArraySource>(matrixPath);
+
+        ZarrArray indptrArray;
+        indptrArray.open(matrixPath / "indptr");
+
+        const std::int64_t num_rows = static_cast<std::int64_t>(shape->_items[0]._number);
+        const std::int64_t num_cols = static_cast<std::int64_t>(shape->_items[1]._number);
+        const std::int64_t num_primary = type == SparseMatrixType::CSR ? num_rows : num_cols;
+
+        if (num_rows < 0 || num_cols < 0 || indptrArray.getSize() != num_primary + 1) {
+            std::cerr << "readMatrixFromZarr: indptr does not match the " << num_primary << (type == SparseMatrixType::CSR ? " rows" : " columns") << " of X" << std::endl;
+            return false;
+        }
+
+        std::vector<std::int64_t> indptr;
+        indptrArray.read(0, indptrArray.getSize(), indptr);
+
+        // Truncated or inconsistent stores would be read out of bounds
+        if (indptr.front() != 0 || !std::is_sorted(indptr.begin(), indptr.end()) || indptr.back() > source->getNnz()) {
+            std::cerr << "readMatrixFromZarr: indptr is not increasing from 0 to at most the " << source->getNnz() << " stored entries" << std::endl;
+            return false;
+        }
+
+        data._indptr = std::move(indptr);
+
+        data._filename = path;
+        data._num_rows = num_rows;
+        data._num_cols = num_cols;
+        data._source   = std::move(source);
+
+        readZarrIndex(storePath / "obs", data._obs_names);
+        readZarrIndex(storePath / "var", data._var_names);
+    }
+    catch (const std::exception& e) {
+        std::cerr << "readMatrixFromZarr: " << e.what() << std::endl;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "H5Utils.h"
+
+#include <string>
+
+// =============================================================================
+// Zarr utilities
+// =============================================================================
+
+/*
+Reads sparse anndata matrices from local Zarr directory stores (format v2 and v3):
+```
+store.zarr
+├── X                   # group with attributes encoding-type (csr_matrix or csc_matrix) and shape
+│   ├── data            # 1D array of non-zero values
+│   ├── indices         # 1D array of column (CSR) or row (CSC) indices
+│   └── indptr          # 1D array of index pointers
+├── var/_index          # (optional) 1D vlen-utf8 string array of variable IDs
+└── obs/_index          # (optional) 1D vlen-utf8 string array of observation IDs
+```
+Supported codecs are zlib and gzip, blosc and zstd if the plugin is built with them.
+Chunks are decompressed in parallel and no global lock is held, recently used chunks are cached.
+Sharded arrays (Zarr v3 sharding codec) are not supported.
+*/
+
+// Whether path is a directory with Zarr group metadata
+bool isZarrStore(const std::string& path);
+
+SparseMatrixType readZarrMatrixType(const std::string& path);
+
+// Opens the arrays of X and reads indptr and names, data and indices are read on demand through data._source
+bool readMatrixFromZarr(const std::string& path, SparseMatrixData& data);
@@ -6,20 +6,22 @@ from pathlib import Path
 
 def save_h5(data: ad.AnnData, filename: str | Path, storage_type: str):
     """
-    Save AnnData sparse matrix in CSC (Compressed Sparse Column) or CSR (Compressed Sparse Row) format to HDF5.
+    Save AnnData sparse matrix in CSC (Compressed Sparse Column) or CSR (Compressed Sparse Row) format to HDF5,
+    in the layout of anndata's h5ad files.
 
-    CSC format stores:
+    The group X stores:
     - data: non-zero values
     - indices: row/column indices for each non-zero value
     - indptr: pointers to start of each column/row in data/indices arrays
-    - storage_type: sparse matrix storage type
+    - attributes encoding-type (csr_matrix or csc_matrix) and shape
+    Names are stored in obs/_index and var/_index
     """
     if storage_type.upper() == 'CSR' and not isinstance(data.X, sp.csr_matrix):
         raise TypeError('Data is not CSR.')
     if storage_type.upper() == 'CSC' and not isinstance(data.X, sp.csc_matrix):
         raise TypeError('Data is not CSC.')
 
-    data_string_dt = h5py.string_dtype() # encoding='utf-8'
+    data_string_dt = h5py.string_dtype(encoding='utf-8')
 
     if not isinstance(filename, Path):
         filename = Path(filename)
@@ -27,17 +29,19 @@ def save_h5(data: ad.AnnData, filename: str | Path, storage_type: str):
     filename.parent.mkdir(parents=True, exist_ok=True)
 
     with h5py.File(filename, 'w') as f:
-        f.attrs['format'] = storage_type
-        f.create_dataset('data', data=data.X.data)
-        f.create_dataset('indices', data=data.X.indices)  # row indices
-        f.create_dataset('indptr', data=data.X.indptr)  # column pointers
-        f.create_dataset('shape', data=data.X.shape)
-
-        # Optional metadata
-        if hasattr(data, 'obs_names') and len(data.obs_names) == data.n_obs:
-            f.create_dataset('obs_names', data=data.obs_names.to_numpy(), dtype=data_string_dt)
-        if hasattr(data, 'var_names') and len(data.var_names) == data.n_vars:
-            f.create_dataset('var_names', data=data.var_names.to_numpy(), dtype=data_string_dt)
+        f.attrs['encoding-type'] = 'anndata'
+        f.attrs['encoding-version'] = '0.1.0'
+
+        X = f.create_group('X')
+        X.attrs['encoding-type'] = f'{storage_type.lower()}_matrix'
+        X.attrs['encoding-version'] = '0.1.0'
+        X.attrs['shape'] = data.X.shape
+        X.create_dataset('data', data=data.X.data)
+        X.create_dataset('indices', data=data.X.indices)
+        X.create_dataset('indptr', data=data.X.indptr)
+
+        f.create_group('obs').create_dataset('_index', data=data.obs_names.to_numpy(), dtype=data_string_dt)
+        f.create_group('var').create_dataset('_index', data=data.var_names.to_numpy(), dtype=data_string_dt)
 
 # Generate random sparse matrix in COO format
 n_obs, n_vars = 5, 4                                        # observations × variables
@@ -57,8 +61,9 @@ csr_data = coo.tocsr()
 adata_csc = ad.AnnData(X=csc_data)
 adata_csr = ad.AnnData(X=csr_data)
 
-adata_csr.obs_names = [f"obs{i}" for i in range(n_obs)]
-adata_csr.var_names = [f"var{j}" for j in range(n_vars)]
+for adata in (adata_csc, adata_csr):
+    adata.obs_names = [f"obs{i}" for i in range(n_obs)]
+    adata.var_names = [f"var{j}" for j in range(n_vars)]
 
 # Print info to confirm
 print("CSC-format AnnData:")
@@ -70,3 +75,134 @@ print(adata_csr)
 save_h5(adata_csc, './data/csc.h5', 'csc')
 save_h5(adata_csr, './data/csr.h5', 'csr')
 
+
+def save_dense_h5(data: ad.AnnData, filename: str | Path, chunks: tuple[int, int]):
+    """
+    Save AnnData dense matrix as chunked dataset X, with names in obs/_index and var/_index
+    """
+    data_string_dt = h5py.string_dtype(encoding='utf-8')
+
+    with h5py.File(filename, 'w') as f:
+        f.attrs['encoding-type'] = 'anndata'
+        X = f.create_dataset('X', data=np.asarray(data.X, dtype=np.float32), chunks=chunks)
+        X.attrs['encoding-type'] = 'array'
+        f.create_group('obs').create_dataset('_index', data=data.obs_names.to_numpy(), dtype=data_string_dt)
+        f.create_group('var').create_dataset('_index', data=data.var_names.to_numpy(), dtype=data_string_dt)
+
+def save_loom(data: ad.AnnData, filename: str | Path, chunks: tuple[int, int]):
+    """
+    Save dense matrix in loom layout: matrix is variables x observations, names as fixed-length strings
+    """
+    with h5py.File(filename, 'w') as f:
+        f.create_dataset('matrix', data=np.asarray(data.X, dtype=np.float32).T, chunks=chunks)
+        f.create_group('row_attrs').create_dataset('Gene', data=data.var_names.to_numpy().astype('S'))
+        f.create_group('col_attrs').create_dataset('CellID', data=data.obs_names.to_numpy().astype('S'))
+
+adata_dense = ad.AnnData(X=coo.toarray())
+adata_dense.obs_names = [f"obs{i}" for i in range(n_obs)]
+adata_dense.var_names = [f"var{j}" for j in range(n_vars)]
+
+save_dense_h5(adata_dense, './data/dense.h5', chunks=(2, 3))
+save_loom(adata_dense, './data/dense.loom', chunks=(3, 2))
+
+
+def save_zarr(data: ad.AnnData, store: str | Path, storage_type: str, zarr_format: int, chunk_size: int):
+    """
+    Save AnnData sparse matrix as a Zarr directory store, metadata and chunks are written by hand
+    such that the fixture does not depend on a particular zarr-python version.
+    v2 stores use zlib and plain chunk keys, v3 stores use gzip, 'c/' chunk keys and big-endian indptr
+    """
+    import gzip
+    import json
+    import shutil
+    import struct
+    import zlib
+
+    store = Path(store)
+    shutil.rmtree(store, ignore_errors=True)
+
+    def write_group(path: Path, attributes: dict):
+        path.mkdir(parents=True, exist_ok=True)
+        if zarr_format == 2:
+            (path / '.zgroup').write_text(json.dumps({'zarr_format': 2}))
+            (path / '.zattrs').write_text(json.dumps(attributes))
+        else:
+            (path / 'zarr.json').write_text(json.dumps({'zarr_format': 3, 'node_type': 'group', 'attributes': attributes}))
+
+    def encode_strings(values) -> bytes:
+        encoded = struct.pack('<I', len(values))
+        for value in values:
+            encoded += struct.pack('<I', len(value.encode())) + value.encode()
+        return encoded
+
+    def write_array(path: Path, values, dtype: str = '<f4'):
+        path.mkdir(parents=True, exist_ok=True)
+        is_string = dtype == '|O'
+        values = list(values) if is_string else np.asarray(values, dtype=dtype)
+
+        if zarr_format == 2:
+            meta = {'zarr_format': 2, 'shape': [len(values)], 'chunks': [chunk_size], 'dtype': dtype, 'order': 'C',
+                    'fill_value': None if is_string else 0, 'compressor': {'id': 'zlib', 'level': 1},
+                    'filters': [{'id': 'vlen-utf8'}] if is_string else None}
+            (path / '.zarray').write_text(json.dumps(meta))
+        else:
+            data_types = {'<f4': 'float32', '<i4': 'int32', '>i8': 'int64', '|O': 'string'}
+            serializer = {'name': 'vlen-utf8'} if is_string else \
+                {'name': 'bytes', 'configuration': {'endian': 'big' if dtype.startswith('>') else 'little'}}
+            meta = {'zarr_format': 3, 'node_type': 'array', 'shape': [len(values)], 'data_type': data_types[dtype],
+                    'chunk_grid': {'name': 'regular', 'configuration': {'chunk_shape': [chunk_size]}},
+                    'chunk_key_encoding': {'name': 'default', 'configuration': {'separator': '/'}},
+                    'fill_value': '' if is_string else 0,
+                    'codecs': [serializer, {'name': 'gzip', 'configuration': {'level': 1}}]}
+            (path / 'zarr.json').write_text(json.dumps(meta))
+            (path / 'c').mkdir(exist_ok=True)
+
+        for chunk in range(0, (len(values) + chunk_size - 1) // chunk_size):
+            part = values[chunk * chunk_size:(chunk + 1) * chunk_size]
+            if is_string:
+                raw = encode_strings(part + [''] * (chunk_size - len(part)))
+            else:
+                raw = np.concatenate([part, np.zeros(chunk_size - len(part), dtype=dtype)]).astype(dtype).tobytes()
+
+            if zarr_format == 2:
+                (path / str(chunk)).write_bytes(zlib.compress(raw))
+            else:
+                (path / 'c' / str(chunk)).write_bytes(gzip.compress(raw))
+
+    matrix = data.X.tocsr() if storage_type == 'csr' else data.X.tocsc()
+
+    write_group(store, {'encoding-type': 'anndata', 'encoding-version': '0.1.0'})
+    write_group(store / 'X', {'encoding-type': f'{storage_type}_matrix', 'encoding-version': '0.1.0', 'shape': list(matrix.shape)})
+    write_array(store / 'X' / 'data', matrix.data, '<f4')
+    write_array(store / 'X' / 'indices', matrix.indices, '<i4')
+    write_array(store / 'X' / 'indptr', matrix.indptr, '<i4' if zarr_format == 2 else '>i8')
+    write_group(store / 'obs', {'_index': '_index', 'encoding-type': 'dataframe'})
+    write_array(store / 'obs' / '_index', data.obs_names, '|O')
+    write_group(store / 'var', {'_index': '_index', 'encoding-type': 'dataframe'})
+    write_array(store / 'var' / '_index', data.var_names, '|O')
+
+save_zarr(adata_csr, './data/csr.zarr', 'csr', zarr_format=2, chunk_size=3)
+save_zarr(adata_csc, './data/csc_v3.zarr', 'csc', zarr_format=3, chunk_size=2)
+
+
+def save_cell_ranger(data: ad.AnnData, filename: str | Path):
+    """
+    Save AnnData counts like Cell Ranger's filtered_feature_bc_matrix.h5: features x barcodes in CSC layout,
+    i.e. the CSR arrays of barcodes x features, uint32 counts, int32 indices and fixed-length names
+    """
+    counts = sp.csr_matrix(np.rint(data.X.toarray()).astype(np.uint32))
+
+    with h5py.File(filename, 'w') as f:
+        f.attrs['filetype'] = 'matrix'
+        matrix = f.create_group('matrix')
+        matrix.create_dataset('data', data=counts.data)
+        matrix.create_dataset('indices', data=counts.indices.astype(np.int32))
+        matrix.create_dataset('indptr', data=counts.indptr.astype(np.int64))
+        matrix.create_dataset('shape', data=np.array([data.n_vars, data.n_obs], dtype=np.int32))
+        matrix.create_dataset('barcodes', data=data.obs_names.to_numpy().astype('S'))
+        features = matrix.create_group('features')
+        features.create_dataset('id', data=np.array([f"ENSG{j:011d}" for j in range(data.n_vars)]).astype('S'))
+        features.create_dataset('name', data=data.var_names.to_numpy().astype('S'))
+        features.create_dataset('feature_type', data=np.array(['Gene Expression'] * data.n_vars).astype('S'))
+
+save_cell_ranger(adata_csr, './data/cellranger.h5')
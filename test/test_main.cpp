@@ -1,13 +1,42 @@
 #include <catch2/catch_test_macros.hpp>	// for info on testing see https://github.com/catchorg/Catch2/blob/devel/docs/tutorial.md#test-cases-and-sections
 
+#include <H5Cpp.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <iterator>
 #include <iostream>
+#include <numeric>
+#include <random>
 #include <source_location>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "AccessTrace.h"
+#include "BlockIndex.h"
+#include "BlockPipeline.h"
+#include "DenseMatrixReader.h"
+#include "DifferentialExpression.h"
+#include "DimensionSearch.h"
+#include "DiskCache.h"
+#include "DualLayoutReader.h"
+#include "H5FileAccess.h"
 #include "H5Utils.h"
+#include "IndptrArray.h"
+#include "PointMapping.h"
+#include "Quantization.h"
+#include "RandomizedPCA.h"
+#include "ReaderRegistry.h"
+#include "Repack.h"
+#include "ResidentReader.h"
+#include "ShardedReader.h"
+#include "ZarrUtils.h"
 #include "test_utils.h"
 
 namespace fs = std::filesystem;
@@ -79,3 +108,1827 @@ TEST_CASE("Read sparse matrices from H5", "[H5][CRS][CSC]") {
 	checkApprox(sparseMatrix->getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
 }
 
+
+TEST_CASE("Select rows with predicates", "[H5][CRS][CSC][Query]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path fileNameSparseMatrix;
+
+	SECTION("CRS") {
+		info("\nTEST: CRS query\n");
+		sparseMatrix = &csrMatrix;
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("CSC") {
+		info("\nTEST: CSC query\n");
+		sparseMatrix = &cscMatrix;
+		fileNameSparseMatrix = "csc.h5";
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!sparseMatrix->readFile((dataDir / fileNameSparseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	const std::vector<std::string>& varNames = sparseMatrix->getVarNames();
+
+	auto query = [&](const std::string& text) {
+		std::vector<RowPredicate> predicates;
+		std::string error;
+		REQUIRE(parseRowQuery(text, varNames, predicates, error));
+		REQUIRE(error.empty());
+		return sparseMatrix->queryRows(predicates);
+		};
+
+	using Rows = std::vector<std::int64_t>;
+
+	REQUIRE(query(varNames[3] + " > 50 AND " + varNames[0] + " == 0") == Rows{ 4 });
+	REQUIRE(query(varNames[2] + " == 0") == Rows{ 2, 3, 4 });
+	REQUIRE(query(varNames[3] + " > 0") == Rows{ 2, 3, 4 });
+	REQUIRE(query(varNames[2] + " > 0 && " + varNames[2] + " < 30") == Rows{ 1 });
+	REQUIRE(query(varNames[1] + " != 0") == Rows{ 0 });
+	REQUIRE(query(varNames[3] + ">=40.6 and " + varNames[3] + "<=60") == Rows{ 3, 4 });
+	REQUIRE(query(varNames[0] + " < 100 AND " + varNames[1] + " = 0") == Rows{ 1, 2, 3, 4 });
+	REQUIRE(query(varNames[0] + " > 0 AND " + varNames[1] + " > 0").empty());
+
+	REQUIRE(sparseMatrix->queryRows({}).empty());
+	REQUIRE(sparseMatrix->queryRows({ { sparseMatrix->getNumCols(), PredicateOp::GREATER, 0.f } }).empty());
+
+	std::vector<RowPredicate> predicates;
+	std::string error;
+	REQUIRE_FALSE(parseRowQuery("", varNames, predicates, error));
+	REQUIRE_FALSE(parseRowQuery("NoSuchGene > 1", varNames, predicates, error));
+	REQUIRE(error == "unknown variable 'NoSuchGene'");
+	REQUIRE_FALSE(parseRowQuery(varNames[0] + " > one", varNames, predicates, error));
+	REQUIRE_FALSE(parseRowQuery(varNames[0] + " => 1", varNames, predicates, error));
+	REQUIRE_FALSE(parseRowQuery(varNames[0] + " AND " + varNames[1] + " > 1", varNames, predicates, error));
+}
+
+TEST_CASE("Search variable names", "[Search]") {
+
+	info("\nTEST: Variable name search\n");
+
+	const std::vector<std::string> names = { "CD8A", "cd3e", "MCD3", "CD3D", "Actb", "CD4", "XCD3E" };
+	DimensionSearchIndex search(names);
+
+	REQUIRE(search.size() == names.size());
+
+	SECTION("Prefix matches first, then substrings") {
+		REQUIRE(search.search("cd3") == std::vector<std::int64_t>{ 3, 1, 2, 6 });
+		REQUIRE(search.search("CD3", 2) == std::vector<std::int64_t>{ 3, 1 });
+		REQUIRE(search.search("CD3", 3) == std::vector<std::int64_t>{ 3, 1, 2 });
+		REQUIRE(search.search("actb") == std::vector<std::int64_t>{ 4 });
+		REQUIRE(search.search("nope").empty());
+		REQUIRE(search.search("", 3) == std::vector<std::int64_t>{ 0, 1, 2 });
+	}
+
+	SECTION("Refined queries") {
+		// Every query extends the previous one, as while typing
+		REQUIRE(search.search("d") == std::vector<std::int64_t>{ 0, 1, 2, 3, 5, 6 });
+		REQUIRE(search.search("d3") == std::vector<std::int64_t>{ 1, 2, 3, 6 });
+		REQUIRE(search.search("d3e") == std::vector<std::int64_t>{ 1, 6 });
+		REQUIRE(search.search("cd3e") == std::vector<std::int64_t>{ 1, 6 });
+
+		// A query that does not extend the previous one scans all names again
+		REQUIRE(search.search("cd") == std::vector<std::int64_t>{ 3, 1, 5, 0, 2, 6 });
+		REQUIRE(search.search("a") == std::vector<std::int64_t>{ 4, 0 });
+	}
+}
+
+TEST_CASE("Quantize output values", "[Quantization]") {
+
+	SECTION("Counts") {
+		info("\nTEST: Quantize counts\n");
+		const std::vector<std::vector<float>> columns = { { 0.f, 3.f, 250.f, 7.f }, { 1.f, 0.f, 0.f, 60000.f } };
+
+		std::vector<QuantizationParams> params;
+		const std::vector<std::uint16_t> quantized = interleaveQuantized<std::uint16_t>(columns, 4, 65535, params);
+
+		REQUIRE(params.size() == 2);
+		REQUIRE(quantized == std::vector<std::uint16_t>{ 0, 1, 3, 0, 250, 0, 7, 60000 });
+
+		for (const auto& param : params) {
+			REQUIRE(param._scale == 1.f);
+			REQUIRE(param._offset == 0.f);
+		}
+	}
+
+	SECTION("Floats") {
+		info("\nTEST: Quantize floats\n");
+		const std::vector<float> column = { -1.5f, 0.f, 20.2f, 30.4f };
+
+		const QuantizationParams params = computeQuantization(column, 255);
+
+		REQUIRE(params._offset == Catch::Approx(-1.5f));
+		REQUIRE(params._scale == Catch::Approx((30.4f + 1.5f) / 255.f));
+
+		for (const float value : column) {
+			const std::uint8_t q = quantize<std::uint8_t>(value, params, 255);
+			REQUIRE(dequantize(q, params) == Catch::Approx(value).margin(params._scale / 2.f));
+		}
+	}
+
+	SECTION("Bfloat16") {
+		info("\nTEST: Bfloat16 conversion\n");
+		checkApprox({ bfloat16BitsToFloat(floatToBfloat16Bits(1.f)), bfloat16BitsToFloat(floatToBfloat16Bits(-2.5f)) }, { 1.f, -2.5f });
+		REQUIRE(bfloat16BitsToFloat(floatToBfloat16Bits(30.4f)) == Catch::Approx(30.4f).epsilon(1e-2));
+	}
+}
+
+TEST_CASE("Map points to rows by name", "[Mapping]") {
+
+	const std::vector<std::string> obsNames = { "cell0", "cell1", "cell2", "cell3", "cell4" };
+
+	SECTION("Join") {
+		info("\nTEST: Join point IDs\n");
+
+		const PointMapping identity = PointMapping::join(obsNames, obsNames);
+		REQUIRE(identity.isIdentity());
+		REQUIRE(identity.getNumMatched() == 5);
+
+		// Fewer points than rows hashes the points
+		const PointMapping subset = PointMapping::join({ "cell3", "cell0", "unknown", "cell3" }, obsNames);
+		REQUIRE(subset.getRows() == std::vector<std::int32_t>{ 3, 0, -1, 3 });
+		REQUIRE(subset.getNumMatched() == 3);
+
+		// More points than rows hashes the rows, the first of duplicate rows is used
+		const PointMapping superset = PointMapping::join({ "cell4", "cell1", "cell2", "cell0", "cell3", "cell5" }, { "cell0", "cell1", "cell2", "cell3", "cell4", "cell1" });
+		REQUIRE(superset.getRows() == std::vector<std::int32_t>{ 4, 1, 2, 0, 3, -1 });
+		REQUIRE(PointMapping::join({ "cell1", "cell0" }, { "cell0", "cell1", "cell1" }).getRows() == std::vector<std::int32_t>{ 1, 0 });
+
+		REQUIRE(subset.rowsToPoints({ 3, 4 }, 5) == std::vector<std::int64_t>{ 0, 3 });
+		REQUIRE(subset.pointsToRows({ 1, 2, 3 }) == std::vector<std::int64_t>{ 0, 3 });
+		REQUIRE(identity.rowsToPoints({ 3, 4 }, 5) == std::vector<std::int64_t>{ 3, 4 });
+	}
+
+	SECTION("Interleave") {
+		info("\nTEST: Interleave mapped rows\n");
+
+		const std::vector<std::vector<float>> columns = { { 0.f, 1.f, 2.f, 3.f, 4.f }, { 0.f, 10.f, 20.f, 30.f, 40.f } };
+		const PointMapping mapping = PointMapping::join({ "cell3", "unknown", "cell1" }, obsNames);
+
+		const std::vector<float> interleaved = interleaveColumns<float>(columns, 3, [](const float value, size_t) { return value; }, mapping.getRows());
+		REQUIRE(interleaved == std::vector<float>{ 3.f, 30.f, 0.f, 0.f, 1.f, 10.f });
+
+		// The value range only covers the mapped rows
+		const std::vector<std::vector<float>> floats = { { 0.5f, 1.5f, 2.5f, 3.5f, 400.5f } };
+		std::vector<QuantizationParams> params;
+		const std::vector<std::uint8_t> quantized = interleaveQuantized<std::uint8_t>(floats, 3, 255, params, mapping.getRows());
+		REQUIRE(params[0]._offset == 0.f);
+		REQUIRE(params[0]._scale == Catch::Approx(3.5f / 255.f));
+		REQUIRE(quantized == std::vector<std::uint8_t>{ 255, 0, 109 });
+
+		// Row i is point i, points past the rows of the file read as zero and rows past the points are ignored
+		REQUIRE(interleaveColumns<float>(columns, 7, [](const float value, size_t) { return value; }) == std::vector<float>{ 0.f, 0.f, 1.f, 10.f, 2.f, 20.f, 3.f, 30.f, 4.f, 40.f, 0.f, 0.f, 0.f, 0.f });
+		REQUIRE(interleaveQuantized<std::uint8_t>(floats, 6, 255, params) == std::vector<std::uint8_t>{ 0, 1, 2, 2, 255, 0 });
+		REQUIRE(params[0]._scale == Catch::Approx(400.5f / 255.f));
+		REQUIRE(interleaveQuantized<std::uint8_t>(floats, 2, 255, params) == std::vector<std::uint8_t>{ 0, 255 });
+		REQUIRE(params[0]._offset == 0.5f);
+		REQUIRE(params[0]._scale == Catch::Approx(1.f / 255.f));
+	}
+}
+
+TEST_CASE("Batched and aggregated reads from H5", "[H5][CRS][CSC][Batched]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path fileNameSparseMatrix;
+
+	SECTION("CRS") {
+		info("\nTEST: CRS batched\n");
+		sparseMatrix = &csrMatrix;
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("CSC") {
+		info("\nTEST: CSC batched\n");
+		sparseMatrix = &cscMatrix;
+		fileNameSparseMatrix = "csc.h5";
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!sparseMatrix->readFile((dataDir / fileNameSparseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	const std::vector<std::vector<float>> columns = sparseMatrix->getColumns({ 3, 0, 3 });
+	REQUIRE(columns.size() == 3);
+	checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+	checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,   0.f });
+	checkApprox(columns[2], columns[0]);
+
+	const std::vector<std::vector<float>> rows = sparseMatrix->getRows({ 2, 0 });
+	REQUIRE(rows.size() == 2);
+	checkApprox(rows[0], { 30.4f, 0.f,  0.f,  70.f, });
+	checkApprox(rows[1], { 0.f,  10.f, 50.f,   0.f });
+
+	checkApprox(sparseMatrix->getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+
+	checkApprox(sparseMatrix->getColumnAggregate({ 0, 2 }, AggregateReduction::SUM), { 50.f, 20.2f, 30.4f, 0.f, 0.f });
+	checkApprox(sparseMatrix->getColumnAggregate({ 0, 2, 2 }, AggregateReduction::MEAN), { 25.f, 10.1f, 15.2f, 0.f, 0.f });
+	checkApprox(sparseMatrix->getColumnAggregate({ 2, 3 }, AggregateReduction::NORMALIZED_MEAN), { 50.f / 60.f * 5e3f, 5e3f, 70.f / 100.4f * 5e3f, 5e3f, 5e3f }, 1e-2f);
+}
+
+TEST_CASE("Transform values while reading", "[H5][CRS][CSC][Transform]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path fileNameSparseMatrix;
+
+	SECTION("CRS") {
+		info("\nTEST: CRS transform\n");
+		sparseMatrix = &csrMatrix;
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("CSC") {
+		info("\nTEST: CSC transform\n");
+		sparseMatrix = &cscMatrix;
+		fileNameSparseMatrix = "csc.h5";
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!sparseMatrix->readFile((dataDir / fileNameSparseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	// Cached raw arrays are dropped when the transform changes
+	checkApprox(sparseMatrix->getColumn(3), { 0.f, 0.f, 70.f, 40.6f, 60.f });
+
+	ValueTransform transform;
+	transform._normalizeTotals  = true;
+	transform._targetSum        = 100.f;
+	transform._log1p            = true;
+	sparseMatrix->setValueTransform(transform);
+
+	checkApprox(sparseMatrix->getColumn(3), { 0.f, 0.f, std::log1p(70.f / 100.4f * 100.f), std::log1p(100.f), std::log1p(100.f) });
+	checkApprox(sparseMatrix->getRow(2), { std::log1p(30.4f / 100.4f * 100.f), 0.f, 0.f, std::log1p(70.f / 100.4f * 100.f) });
+	checkApprox(sparseMatrix->getRows({ 0 }).front(), { 0.f, std::log1p(10.f / 60.f * 100.f), std::log1p(50.f / 60.f * 100.f), 0.f });
+
+	const std::vector<SparseArray> sparseColumns = sparseMatrix->getSparseColumnsImpl({ 1 });
+	REQUIRE(sparseColumns.front()._indices == std::vector<std::int64_t>{ 0 });
+	checkApprox(sparseColumns.front()._values, { std::log1p(10.f / 60.f * 100.f) });
+
+	// Totals and aggregates stay on the stored values
+	checkApprox(sparseMatrix->getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+	checkApprox(sparseMatrix->getColumnAggregate({ 0, 2 }, AggregateReduction::SUM), { 50.f, 20.2f, 30.4f, 0.f, 0.f });
+
+	transform._scale            = 0.5f;
+	transform._clipMax          = 2.2f;
+	sparseMatrix->setValueTransform(transform);
+	checkApprox(sparseMatrix->getColumn(3), { 0.f, 0.f, 0.5f * std::log1p(70.f / 100.4f * 100.f), 2.2f, 2.2f });
+
+	sparseMatrix->setValueTransform({});
+	checkApprox(sparseMatrix->getColumn(3), { 0.f, 0.f, 70.f, 40.6f, 60.f });
+}
+
+TEST_CASE("Randomized PCA from H5", "[H5][CRS][CSC][PCA]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path fileNameSparseMatrix;
+
+	SECTION("CRS") {
+		info("\nTEST: CRS PCA\n");
+		sparseMatrix = &csrMatrix;
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("CSC") {
+		info("\nTEST: CSC PCA\n");
+		sparseMatrix = &cscMatrix;
+		fileNameSparseMatrix = "csc.h5";
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!sparseMatrix->readFile((dataDir / fileNameSparseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	RandomizedPCASettings settings;
+	settings._numComponents = 2;
+	settings._blockNnz      = 2;	// force several blocks
+
+	RandomizedPCAResult result;
+	REQUIRE(computeRandomizedPCA(*sparseMatrix, settings, result));
+	REQUIRE(result._numComponents == 2);
+
+	// Reference from numpy SVD of the centered dense matrix, scores up to sign
+	checkApprox(result._explainedVariance, { 1523.4139f, 173.66565f }, 1e-1f);
+
+	const std::vector<float> expectedScores = { 48.52787f, 12.53464f, 32.64118f, 8.65536f, 42.26049f, 15.97217f, 11.38063f, 12.21481f, 27.52793f, 7.63664f };
+	std::vector<float> absScores(result._scores.size());
+	std::transform(result._scores.begin(), result._scores.end(), absScores.begin(), [](float v) { return std::abs(v); });
+	checkApprox(absScores, expectedScores, 1e-2f);
+
+	// Streamed values are transformed like rows and columns, i.e. the same as a file written with the transformed values
+	ValueTransform transform;
+	transform._normalizeTotals = true;
+	transform._log1p = true;
+	sparseMatrix->setValueTransform(transform);
+
+	RandomizedPCAResult transformedResult;
+	REQUIRE(computeRandomizedPCA(*sparseMatrix, settings, transformedResult));
+	REQUIRE(transformedResult._explainedVariance[0] < 100.f);
+
+	const fs::path transformedPath = fs::temp_directory_path() / "sh5a_pca_transformed.h5";
+	REQUIRE(extractColumns(*sparseMatrix, { 0, 1, 2, 3 }, transformedPath.string(), RepackSettings{}));
+	{
+		CSCReader stored(transformedPath.string());
+
+		RandomizedPCAResult storedResult;
+		REQUIRE(computeRandomizedPCA(stored, settings, storedResult));
+		checkApprox(transformedResult._explainedVariance, storedResult._explainedVariance, 1e-3f);
+
+		for (size_t i = 0; i < storedResult._scores.size(); ++i) {
+			REQUIRE(std::abs(transformedResult._scores[i]) == Catch::Approx(std::abs(storedResult._scores[i])).margin(1e-3));
+		}
+	}
+
+	fs::remove(transformedPath);
+}
+
+TEST_CASE("Differential expression of a selection", "[H5][CRS][CSC][DE]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path fileNameSparseMatrix;
+
+	SECTION("CRS") {
+		info("\nTEST: CRS differential expression\n");
+		sparseMatrix = &csrMatrix;
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("CSC") {
+		info("\nTEST: CSC differential expression\n");
+		sparseMatrix = &cscMatrix;
+		fileNameSparseMatrix = "csc.h5";
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!sparseMatrix->readFile((dataDir / fileNameSparseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	const std::vector<std::int64_t> selectedRows = { 2, 3, 4 };
+
+	// Streamed values are transformed like columns, log1p of the reader is not applied twice
+	ValueTransform normalized;
+	normalized._normalizeTotals = true;
+	ValueTransform logNormalized = normalized;
+	logNormalized._log1p = true;
+
+	for (const ValueTransform& transform : { ValueTransform{}, normalized, logNormalized })
+	for (const bool logTransform : { false, true }) {
+		sparseMatrix->setValueTransform(transform);
+
+		DifferentialExpressionSettings settings;
+		settings._logTransform = logTransform;
+		settings._blockNnz = 2;		// several blocks
+
+		DifferentialExpressionResult result;
+		REQUIRE(computeDifferentialExpression(*sparseMatrix, selectedRows, settings, result));
+		REQUIRE(result._numSelected == 3);
+		REQUIRE(result._numRest == 2);
+		REQUIRE(result._ranking.size() == 4);
+		REQUIRE(result._logTransformed == (logTransform || transform._log1p));
+
+		// Column 3 is only expressed in the selection, columns 1 and 2 only outside of it
+		REQUIRE(result._ranking.front()._column == 3);
+		REQUIRE(result._ranking[0]._tStatistic >= result._ranking[1]._tStatistic);
+		REQUIRE(result._ranking[1]._tStatistic >= result._ranking[2]._tStatistic);
+		REQUIRE(result._ranking[2]._tStatistic >= result._ranking[3]._tStatistic);
+
+		// Compare with statistics of the dense columns
+		for (const DifferentialExpressionStatistics& statistics : result._ranking) {
+			const std::vector<float> column = sparseMatrix->getColumn(statistics._column);
+
+			std::vector<double> inside, outside;
+			for (std::int64_t row = 0; row < static_cast<std::int64_t>(column.size()); ++row) {
+				const double value = logTransform && !transform._log1p ? std::log1p(column[row]) : column[row];
+				(std::find(selectedRows.begin(), selectedRows.end(), row) != selectedRows.end() ? inside : outside).push_back(value);
+			}
+
+			auto mean = [](const std::vector<double>& values) {
+				return std::accumulate(values.begin(), values.end(), 0.0) / values.size();
+				};
+			auto variance = [](const std::vector<double>& values, const double m) {
+				double sum = 0.0;
+				for (const double value : values)
+					sum += (value - m) * (value - m);
+				return sum / (values.size() - 1);
+				};
+
+			const double meanInside  = mean(inside);
+			const double meanOutside = mean(outside);
+			const double error       = std::sqrt(variance(inside, meanInside) / inside.size() + variance(outside, meanOutside) / outside.size());
+
+			REQUIRE(statistics._meanSelected == Catch::Approx(meanInside).margin(1e-4));
+			REQUIRE(statistics._meanRest == Catch::Approx(meanOutside).margin(1e-4));
+			REQUIRE(statistics._tStatistic == Catch::Approx(error > 0.0 ? (meanInside - meanOutside) / error : 0.0).margin(1e-3));
+			REQUIRE(statistics._fractionSelected == Catch::Approx(std::count_if(inside.begin(), inside.end(), [](double v) { return v != 0.0; }) / 3.0));
+			REQUIRE(statistics._fractionRest == Catch::Approx(std::count_if(outside.begin(), outside.end(), [](double v) { return v != 0.0; }) / 2.0));
+		}
+	}
+
+	sparseMatrix->setValueTransform({});
+
+	DifferentialExpressionResult result;
+	REQUIRE_FALSE(computeDifferentialExpression(*sparseMatrix, {}, {}, result));
+	REQUIRE_FALSE(computeDifferentialExpression(*sparseMatrix, { 0, 1, 2, 3, 4 }, {}, result));
+
+	// Statistics over all rows, e.g. for the top variables by variance
+	DifferentialExpressionSettings settings;
+	settings._logTransform = false;
+	settings._blockNnz = 2;
+
+	std::vector<ColumnStatistics> statistics;
+	REQUIRE(computeColumnStatistics(*sparseMatrix, settings, statistics));
+	REQUIRE(statistics.size() == 4);
+
+	const std::vector<float> expectedMeans      = { 6.08f, 2.f, 14.04f, 34.12f };
+	const std::vector<float> expectedVariances  = { 184.832f, 20.f, 480.608f, 1081.872f };
+	const std::vector<float> expectedFractions  = { 0.2f, 0.2f, 0.4f, 0.6f };
+	for (size_t column = 0; column < statistics.size(); ++column) {
+		REQUIRE(statistics[column]._column == static_cast<std::int64_t>(column));
+		REQUIRE(statistics[column]._mean == Catch::Approx(expectedMeans[column]).margin(1e-4));
+		REQUIRE(statistics[column]._variance == Catch::Approx(expectedVariances[column]).epsilon(1e-4));
+		REQUIRE(statistics[column]._fraction == Catch::Approx(expectedFractions[column]));
+	}
+
+	// Scaled values with entries below -1 are not log1p transformed
+	const fs::path scaledPath = fs::temp_directory_path() / "sh5a_scaled.h5";
+	{
+		const std::vector<std::int64_t> indptr  = { 0, 2, 4, 6, 8 };
+		const std::vector<std::int64_t> indices = { 0, 1, 0, 1, 0, 1, 0, 1 };
+		const std::vector<float> values         = { -2.f, 3.f, -1.5f, 2.5f, 1.f, -1.f, 2.f, -3.f };
+
+		H5::H5File file(scaledPath.string(), H5F_ACC_TRUNC);
+		H5::Group group = file.createGroup("X");
+
+		const hsize_t shapeSize = 2;
+		const std::array<std::int64_t, 2> shape = { 4, 2 };
+		group.createAttribute("shape", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &shapeSize)).write(H5::PredType::NATIVE_INT64, shape.data());
+
+		auto writeAll = [&group](const std::string& name, const auto& source, const H5::PredType& type) {
+			const hsize_t size = source.size();
+			group.createDataSet(name, type, H5::DataSpace(1, &size)).write(source.data(), type);
+			};
+		writeAll("indptr", indptr, H5::PredType::NATIVE_INT64);
+		writeAll("indices", indices, H5::PredType::NATIVE_INT64);
+		writeAll("data", values, H5::PredType::NATIVE_FLOAT);
+	}
+
+	{
+		CSRReader scaled(scaledPath.string());
+
+		DifferentialExpressionResult scaledResult;
+		REQUIRE(computeDifferentialExpression(scaled, { 0, 1 }, {}, scaledResult));
+		REQUIRE_FALSE(scaledResult._logTransformed);
+		REQUIRE(scaledResult._ranking.size() == 2);
+		REQUIRE(scaledResult._ranking[0]._column == 1);
+		REQUIRE(scaledResult._ranking[0]._meanSelected == Catch::Approx(2.75f));
+		REQUIRE(scaledResult._ranking[1]._meanSelected == Catch::Approx(-1.75f));
+
+		for (const DifferentialExpressionStatistics& scaledStatistics : scaledResult._ranking) {
+			REQUIRE(std::isfinite(scaledStatistics._tStatistic));
+			REQUIRE(scaledStatistics._logFoldChange == 0.f);
+		}
+
+		std::vector<ColumnStatistics> scaledColumns;
+		REQUIRE(computeColumnStatistics(scaled, {}, scaledColumns));
+		REQUIRE(scaledColumns[0]._mean == Catch::Approx(-0.125f));
+		REQUIRE(std::isfinite(scaledColumns[1]._variance));
+	}
+
+	fs::remove(scaledPath);
+}
+
+TEST_CASE("Read dense matrices from H5", "[H5][Dense]") {
+
+	DenseMatrixReader denseMatrix;
+
+	fs::path fileNameDenseMatrix;
+	bool transposed = false;
+
+	SECTION("anndata") {
+		info("\nTEST: Dense anndata\n");
+		fileNameDenseMatrix = "dense.h5";
+		transposed = false;
+	}
+
+	SECTION("loom") {
+		info("\nTEST: Dense loom\n");
+		fileNameDenseMatrix = "dense.loom";
+		transposed = true;
+	}
+
+	if (!fs::exists(dataDir / fileNameDenseMatrix) || !denseMatrix.readFile((dataDir / fileNameDenseMatrix).string())) {
+		info("ERROR: test file not loaded, probably it does not exist");
+		return;
+	}
+
+	denseMatrix.setUseCache(false);
+
+	REQUIRE(SparseMatrixReader::readMatrixType((dataDir / fileNameDenseMatrix).string()) == SparseMatrixType::DENSE);
+	REQUIRE(denseMatrix.isTransposed() == transposed);
+	REQUIRE(denseMatrix.getNumRows() == 5);
+	REQUIRE(denseMatrix.getNumCols() == 4);
+	REQUIRE(denseMatrix.getObsNames() == std::vector<std::string>{ "obs0", "obs1", "obs2", "obs3", "obs4" });
+	REQUIRE(denseMatrix.getVarNames() == std::vector<std::string>{ "var0", "var1", "var2", "var3" });
+
+	checkApprox(denseMatrix.getRow(0), { 0.f,  10.f, 50.f,   0.f });
+	checkApprox(denseMatrix.getRow(4), { 0.f,   0.f,  0.f,  60.f, });
+	checkApprox(denseMatrix.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+
+	// Columns 0 and 2 share a chunk stripe in one of the layouts
+	const std::vector<std::vector<float>> columns = denseMatrix.getColumns({ 3, 0, 2 });
+	REQUIRE(columns.size() == 3);
+	checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+	checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,   0.f });
+	checkApprox(columns[2], { 50.f, 20.2f, 0.f,  0.f,   0.f });
+
+	const std::vector<std::vector<float>> rows = denseMatrix.getRows({ 2, 3 });
+	checkApprox(rows[0], { 30.4f, 0.f,  0.f,  70.f, });
+	checkApprox(rows[1], { 0.f,   0.f,  0.f,  40.6f, });
+
+	checkApprox(denseMatrix.getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+	checkApprox(denseMatrix.getColumnAggregate({ 0, 2 }, AggregateReduction::SUM), { 50.f, 20.2f, 30.4f, 0.f, 0.f });
+
+	std::vector<float> columnTotals(denseMatrix.getNumCols(), 0.f);
+	REQUIRE(denseMatrix.streamBlocks([&columnTotals](const PrimaryBlock& block) {
+		for (std::int64_t i = 0; i < block._indptr.back(); ++i)
+			columnTotals[block._indices[i]] += block._values[i];
+		}, true, 4));
+	checkApprox(columnTotals, { 30.4f, 10.f, 70.2f, 170.6f });
+}
+
+TEST_CASE("Read Cell Ranger matrices from H5", "[H5][CellRanger]") {
+
+	const fs::path filePath = dataDir / "cellranger.h5";
+
+	if (!fs::exists(filePath)) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Cell Ranger\n");
+
+	REQUIRE(isCellRangerFile(filePath.string()));
+	REQUIRE_FALSE(isCellRangerFile((dataDir / "csr.h5").string()));
+	REQUIRE(SparseMatrixReader::readMatrixType(filePath.string()) == SparseMatrixType::CSR);
+
+	// Barcodes are rows, uint32 counts and int32 indices are converted while reading
+	std::unique_ptr<SparseMatrixReader> reader = openSparseMatrixReader(filePath.string());
+	REQUIRE(reader != nullptr);
+	reader->setUseCache(false);
+
+	REQUIRE(reader->getType() == SparseMatrixType::CSR);
+	REQUIRE(reader->getNumRows() == 5);
+	REQUIRE(reader->getNumCols() == 4);
+	REQUIRE(reader->getObsNames() == std::vector<std::string>{ "obs0", "obs1", "obs2", "obs3", "obs4" });
+	REQUIRE(reader->getVarNames() == std::vector<std::string>{ "var0", "var1", "var2", "var3" });
+
+	checkApprox(reader->getRow(0), { 0.f, 10.f, 50.f,  0.f });
+	checkApprox(reader->getRow(2), { 30.f, 0.f,  0.f, 70.f });
+	checkApprox(reader->getColumn(3), { 0.f, 0.f, 70.f, 41.f, 60.f });
+	checkApprox(reader->getColumns({ 2, 0 })[0], { 50.f, 20.f, 0.f, 0.f, 0.f });
+	checkApprox(reader->getRowTotals(), { 60.f, 20.f, 100.f, 41.f, 60.f });
+}
+
+TEST_CASE("Sharded matrices from H5", "[H5][Sharded]") {
+
+	ShardedReader shardedMatrix;
+
+	if (!fs::exists(dataDir / "csr.h5") || !fs::exists(dataDir / "csc.h5")) {
+		info("ERROR: test files not found");
+		return;
+	}
+
+	SECTION("Mixed") {
+		info("\nTEST: Sharded CSR and CSC\n");
+
+		if (!shardedMatrix.readFiles({ (dataDir / "csr.h5").string(), (dataDir / "csc.h5").string() })) {
+			info("ERROR: test file not loaded, probably it does not exist");
+			return;
+		}
+
+		REQUIRE(shardedMatrix.getNumShards() == 2);
+		REQUIRE(shardedMatrix.getNumRows() == 10);
+		REQUIRE(shardedMatrix.getNumCols() == 4);
+		REQUIRE(shardedMatrix.getType() == SparseMatrixType::UNKNOWN);
+		REQUIRE(shardedMatrix.getObsNames().size() == 10);
+
+		checkApprox(shardedMatrix.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f, 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(shardedMatrix.getRow(7), { 30.4f, 0.f,  0.f,  70.f, });
+
+		const std::vector<std::vector<float>> rows = shardedMatrix.getRows({ 5, 2 });
+		checkApprox(rows[0], { 0.f,  10.f, 50.f,   0.f });
+		checkApprox(rows[1], { 30.4f, 0.f,  0.f,  70.f, });
+
+		checkApprox(shardedMatrix.getColumnAggregate({ 0, 2 }, AggregateReduction::SUM), { 50.f, 20.2f, 30.4f, 0.f, 0.f, 50.f, 20.2f, 30.4f, 0.f, 0.f });
+		checkApprox(shardedMatrix.getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f, 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+
+		REQUIRE_FALSE(shardedMatrix.streamBlocks([](const PrimaryBlock&) {}));
+	}
+
+	SECTION("Stream") {
+		info("\nTEST: Sharded CSR blocks\n");
+
+		if (!shardedMatrix.readFiles({ (dataDir / "csr.h5").string(), (dataDir / "csr.h5").string() })) {
+			info("ERROR: test file not loaded, probably it does not exist");
+			return;
+		}
+
+		std::vector<float> rowTotals(shardedMatrix.getNumRows(), 0.f);
+		REQUIRE(shardedMatrix.streamBlocks([&rowTotals](const PrimaryBlock& block) {
+			for (std::int64_t a = 0; a < block._end - block._begin; ++a)
+				for (std::int64_t i = block._indptr[a]; i < block._indptr[a + 1]; ++i)
+					rowTotals[block._begin + a] += block._values[i];
+			}, true, 2));
+
+		checkApprox(rowTotals, shardedMatrix.getRowTotals());
+	}
+}
+
+TEST_CASE("Read sparse matrices from Zarr", "[Zarr][CRS][CSC]") {
+
+	CSRReader             csrMatrix;
+	CSCReader             cscMatrix;
+	SparseMatrixReader*		sparseMatrix = nullptr;
+
+	fs::path storeName;
+	SparseMatrixType sparseMatrixType = SparseMatrixType::UNKNOWN;
+
+	SECTION("CRS v2") {
+		info("\nTEST: Zarr v2 CRS\n");
+		sparseMatrix = &csrMatrix;
+		storeName = "csr.zarr";
+		sparseMatrixType = SparseMatrixType::CSR;
+	}
+
+	SECTION("CSC v3") {
+		info("\nTEST: Zarr v3 CSC\n");
+		sparseMatrix = &cscMatrix;
+		storeName = "csc_v3.zarr";
+		sparseMatrixType = SparseMatrixType::CSC;
+	}
+
+	assert(sparseMatrix != nullptr);
+
+	if (!isZarrStore((dataDir / storeName).string()) || !sparseMatrix->readFile((dataDir / storeName).string())) {
+		info("ERROR: test store not loaded, probably it does not exist");
+		return;
+	}
+
+	sparseMatrix->setUseCache(false);
+
+	REQUIRE(SparseMatrixReader::readMatrixType((dataDir / storeName).string()) == sparseMatrixType);
+	REQUIRE(sparseMatrix->getNumRows() == 5);
+	REQUIRE(sparseMatrix->getNumCols() == 4);
+	REQUIRE(sparseMatrix->getObsNames() == std::vector<std::string>{ "obs0", "obs1", "obs2", "obs3", "obs4" });
+	REQUIRE(sparseMatrix->getVarNames() == std::vector<std::string>{ "var0", "var1", "var2", "var3" });
+
+	checkApprox(sparseMatrix->getRow(0), { 0.f,  10.f, 50.f,   0.f });
+	checkApprox(sparseMatrix->getRow(2), { 30.4f, 0.f,  0.f,  70.f, });
+	checkApprox(sparseMatrix->getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+
+	const std::vector<std::vector<float>> columns = sparseMatrix->getColumns({ 3, 0 });
+	checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+	checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,  0.f });
+
+	checkApprox(sparseMatrix->getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+
+	std::vector<float> columnTotals(sparseMatrix->getNumCols(), 0.f);
+	if (sparseMatrixType == SparseMatrixType::CSR) {
+		REQUIRE(sparseMatrix->streamBlocks([&columnTotals](const PrimaryBlock& block) {
+			for (std::int64_t i = 0; i < block._indptr.back(); ++i)
+				columnTotals[block._indices[i]] += block._values[i];
+			}, true, 2));
+
+		checkApprox(columnTotals, { 30.4f, 10.f, 70.2f, 170.6f });
+
+		// Inconsistent stores are not opened
+		const fs::path brokenPath = fs::temp_directory_path() / "sh5a_broken.zarr";
+		fs::remove_all(brokenPath);
+		fs::copy(dataDir / storeName, brokenPath, fs::copy_options::recursive);
+
+		auto replaceInFile = [](const fs::path& filePath, const std::string& from, const std::string& to) {
+			std::ifstream in(filePath);
+			std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+			in.close();
+
+			const size_t pos = content.find(from);
+			REQUIRE(pos != std::string::npos);
+			std::ofstream(filePath, std::ios::trunc) << content.replace(pos, from.size(), to);
+			};
+
+		CSRReader broken;
+		replaceInFile(brokenPath / "X" / ".zattrs", "[5, 4]", "[6, 4]");
+		REQUIRE_FALSE(broken.readFile(brokenPath.string()));
+
+		replaceInFile(brokenPath / "X" / ".zattrs", "[6, 4]", "[5, 4]");
+		replaceInFile(brokenPath / "X" / "data" / ".zarray", "\"shape\": [7]", "\"shape\": [3]");
+		REQUIRE_FALSE(broken.readFile(brokenPath.string()));
+
+		fs::remove_all(brokenPath);
+	}
+}
+
+TEST_CASE("Repack into CSR and CSC copies", "[H5][Repack]") {
+
+	fs::path fileNameSparseMatrix;
+	RepackSettings settings;
+	settings._memoryLimit = 3 * (sizeof(std::int64_t) + sizeof(float));	// at most three entries per gather pass
+
+	SECTION("From CSR") {
+		info("\nTEST: Repack CSR\n");
+		fileNameSparseMatrix = "csr.h5";
+	}
+
+	SECTION("From CSC with reordered rows") {
+		info("\nTEST: Repack CSC, reordered\n");
+		fileNameSparseMatrix = "csc.h5";
+		settings._reorderRows = true;
+	}
+
+	if (!fs::exists(dataDir / fileNameSparseMatrix) || SparseMatrixReader::readMatrixType((dataDir / fileNameSparseMatrix).string()) == SparseMatrixType::UNKNOWN) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	std::unique_ptr<SparseMatrixReader> input = openSparseMatrixReader((dataDir / fileNameSparseMatrix).string());
+	REQUIRE(input);
+
+	const fs::path outputPath = fs::temp_directory_path() / ("repacked_" + fileNameSparseMatrix.string());
+
+	RepackResult result;
+	REQUIRE(repackMatrix((dataDir / fileNameSparseMatrix).string(), outputPath.string(), settings, result));
+	REQUIRE(result._numPasses > 3);
+	REQUIRE(result._csrChunkSize == 7);
+	REQUIRE(result._csrIndexBytes == sizeof(std::uint16_t));
+	REQUIRE(result._cscIndexBytes == sizeof(std::uint16_t));
+
+	CSRReader repacked;
+	REQUIRE(SparseMatrixReader::readMatrixType(outputPath.string()) == SparseMatrixType::CSR);
+	REQUIRE(repacked.readFile(outputPath.string()));
+	REQUIRE(repacked.getNumRows() == 5);
+	REQUIRE(repacked.getNumCols() == 4);
+	REQUIRE(repacked.getVarNames() == input->getVarNames());
+
+	// Output row n holds input row sourceRows[n]
+	std::vector<std::int64_t> sourceRows = { 0, 1, 2, 3, 4 };
+	std::vector<std::int64_t> cscIndptr, cscIndices;
+	std::vector<float> cscData;
+
+	{
+		H5::H5File file(outputPath.string(), H5F_ACC_RDONLY);
+
+		auto readAll = [&file](const std::string& name, auto& dest, const H5::PredType& type) {
+			H5::DataSet dataset = file.openDataSet(name);
+			hsize_t size = 0;
+			dataset.getSpace().getSimpleExtentDims(&size);
+			dest.resize(size);
+			dataset.read(dest.data(), type);
+			};
+
+		REQUIRE(file.nameExists("uns/repack_source_row") == settings._reorderRows);
+		if (settings._reorderRows)
+			readAll("uns/repack_source_row", sourceRows, H5::PredType::NATIVE_INT64);
+
+		H5::Group cscGroup = file.openGroup("layers/X_csc");
+		REQUIRE(readAttributeString(cscGroup, "copy-of") == "/X");
+		readAll("layers/X_csc/indptr", cscIndptr, H5::PredType::NATIVE_INT64);
+		readAll("layers/X_csc/indices", cscIndices, H5::PredType::NATIVE_INT64);
+		readAll("layers/X_csc/data", cscData, H5::PredType::NATIVE_FLOAT);
+	}
+
+	for (std::int64_t row = 0; row < 5; ++row) {
+		checkApprox(repacked.getRow(row), input->getRow(sourceRows[row]));
+
+		if (input->hasObsNames())
+			REQUIRE(repacked.getObsNames()[row] == input->getObsNames()[sourceRows[row]]);
+	}
+
+	REQUIRE(cscIndptr == std::vector<std::int64_t>{ 0, 1, 2, 4, 7 });
+	for (std::int64_t col = 0; col < 4; ++col) {
+		std::vector<float> column(5, 0.f);
+		for (std::int64_t i = cscIndptr[col]; i < cscIndptr[col + 1]; ++i) {
+			if (i > cscIndptr[col])
+				REQUIRE(cscIndices[i - 1] < cscIndices[i]);
+			column[cscIndices[i]] = cscData[i];
+		}
+
+		checkApprox(column, repacked.getColumn(col));
+	}
+
+	fs::remove(outputPath);
+}
+
+TEST_CASE("Extract column subsets", "[H5][Repack][Extract]") {
+
+	if (!fs::exists(dataDir / "csr.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Extract columns\n");
+
+	CSRReader input((dataDir / "csr.h5").string());
+	const fs::path outputPath = fs::temp_directory_path() / "extracted_columns.h5";
+
+	RepackSettings settings;
+	settings._memoryLimit = 5 * sizeof(float);	// one column per batch
+
+	std::vector<float> progress;
+	REQUIRE(extractColumns(input, { 3, 0 }, outputPath.string(), settings, [&progress](const float fraction) { progress.push_back(fraction); return true; }));
+	REQUIRE(progress == std::vector<float>{ 0.5f, 1.f });
+
+	{
+		CSCReader extracted;
+		REQUIRE(SparseMatrixReader::readMatrixType(outputPath.string()) == SparseMatrixType::CSC);
+		REQUIRE(extracted.readFile(outputPath.string()));
+		REQUIRE(extracted.getNumRows() == 5);
+		REQUIRE(extracted.getNumCols() == 2);
+		REQUIRE(extracted.getObsNames() == input.getObsNames());
+
+		if (input.hasVarNames())
+			REQUIRE(extracted.getVarNames() == std::vector<std::string>{ input.getVarNames()[3], input.getVarNames()[0] });
+
+		checkApprox(extracted.getColumn(0), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(extracted.getColumn(1), { 0.f,  0.f, 30.4f, 0.f,  0.f });
+		checkApprox(extracted.getRow(2), { 70.f, 30.4f });
+	}
+
+	// Transformed values are not transformed again when read with the same transform, normalized with the totals of all columns
+	{
+		ValueTransform transform;
+		transform._normalizeTotals = true;
+		transform._log1p = true;
+		input.setValueTransform(transform);
+
+		REQUIRE(extractColumns(input, { 3, 0 }, outputPath.string(), settings));
+
+		{
+			CSCReader extracted(outputPath.string());
+			REQUIRE(extracted.getStoredValueTransform() == transform);
+			extracted.setValueTransform(transform);
+
+			checkApprox(extracted.getColumn(0), input.getColumn(3));
+			checkApprox(extracted.getColumn(1), input.getColumn(0));
+			checkApprox(extracted.getRow(2), { input.getRow(2)[3], input.getRow(2)[0] });
+
+			// Also when loaded into memory
+			std::unique_ptr<ResidentReader> resident = ResidentReader::load(extracted, {});
+			REQUIRE(resident != nullptr);
+			resident->setValueTransform(transform);
+			checkApprox(resident->getColumn(0), input.getColumn(3));
+		}
+
+		input.setValueTransform({});
+		REQUIRE(extractColumns(input, { 3, 0 }, outputPath.string(), settings));
+		REQUIRE(CSCReader(outputPath.string()).getStoredValueTransform().isIdentity());
+	}
+
+	// Cancelled exports leave no file behind
+	REQUIRE_FALSE(extractColumns(input, { 3, 0 }, outputPath.string(), settings, [](const float) { return false; }));
+	REQUIRE_FALSE(fs::exists(outputPath));
+	REQUIRE_FALSE(extractColumns(input, { 4 }, outputPath.string(), settings));
+
+	// Clones have the same content as the source
+	const fs::path clonePath = fs::temp_directory_path() / "cloned_columns.h5";
+	REQUIRE(extractColumns(input, { 1 }, outputPath.string(), settings));
+	REQUIRE(cloneFile(outputPath.string(), clonePath.string()));
+	REQUIRE(fs::file_size(clonePath) == fs::file_size(outputPath));
+	REQUIRE(CSCReader(clonePath.string()).getNumCols() == 1);
+
+	fs::remove(outputPath);
+	fs::remove(clonePath);
+}
+
+TEST_CASE("Route rows and columns to CSR and CSC copies", "[H5][Dual]") {
+
+	if (!fs::exists(dataDir / "csc.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Dual layout\n");
+
+	// A file with X as CSR and layers/X_csc as CSC
+	const fs::path dualPath = fs::temp_directory_path() / "dual_layout.h5";
+	RepackResult result;
+	REQUIRE(repackMatrix((dataDir / "csc.h5").string(), dualPath.string(), RepackSettings{}, result));
+
+	REQUIRE(findMatrixLayouts((dataDir / "csc.h5").string()).size() <= 1);
+	REQUIRE_FALSE(DualLayoutReader().readFile((dataDir / "csc.h5").string()));
+
+	const std::vector<MatrixLayout> layouts = findMatrixLayouts(dualPath.string());
+	REQUIRE(layouts.size() == 2);
+	REQUIRE(layouts[0]._group == "X");
+	REQUIRE(layouts[0]._type == SparseMatrixType::CSR);
+	REQUIRE(layouts[1]._group == "layers/X_csc");
+	REQUIRE(layouts[1]._type == SparseMatrixType::CSC);
+
+	{
+		DualLayoutReader dualMatrix;
+		REQUIRE(dualMatrix.readFile(dualPath.string()));
+		REQUIRE(dualMatrix.getCsrGroup() == "X");
+		REQUIRE(dualMatrix.getCscGroup() == "layers/X_csc");
+		REQUIRE(dualMatrix.getNumRows() == 5);
+		REQUIRE(dualMatrix.getNumCols() == 4);
+
+		checkApprox(dualMatrix.getRow(2), { 30.4f, 0.f,  0.f,  70.f, });
+		checkApprox(dualMatrix.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+
+		const std::vector<std::vector<float>> columns = dualMatrix.getColumns({ 3, 0 });
+		checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,  0.f });
+
+		checkApprox(dualMatrix.getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+		checkApprox(dualMatrix.getColumnAggregate({ 0, 2 }, AggregateReduction::SUM), { 50.f, 20.2f, 30.4f, 0.f, 0.f });
+
+		// A single CSC copy is read like any other CSC group
+		CSCReader cscCopy;
+		REQUIRE(cscCopy.readFileGroup(dualPath.string(), "layers/X_csc"));
+		checkApprox(cscCopy.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+
+		std::unique_ptr<SparseMatrixReader> opened = openSparseMatrixReader(dualPath.string());
+		REQUIRE(dynamic_cast<DualLayoutReader*>(opened.get()) != nullptr);
+	}
+
+	// A layer named like a copy but without copy-of might hold other values, e.g. normalized counts
+	{
+		const H5::H5File file(dualPath.string(), H5F_ACC_RDWR);
+		file.openGroup("layers/X_csc").removeAttr("copy-of");
+	}
+
+	REQUIRE(findMatrixLayouts(dualPath.string()).size() == 1);
+	REQUIRE_FALSE(DualLayoutReader().readFile(dualPath.string()));
+
+	fs::remove(dualPath);
+}
+
+TEST_CASE("HDF5 file access settings", "[H5][Access]") {
+
+	constexpr std::uint64_t MiB = std::uint64_t{ 1 } << 20;
+
+	SECTION("Auto-tuning") {
+		const H5AccessSettings automatic;
+
+		const H5AccessSettings small = tuneH5Access({ ._fileSize = 10 * MiB }, automatic);
+		REQUIRE(small._driver == H5Driver::CORE);
+		REQUIRE(small._pageBufferBytes == 0);
+
+		const H5AccessSettings large = tuneH5Access({ ._fileSize = 8192 * MiB }, automatic);
+		REQUIRE(large._driver == H5Driver::SEC2);
+		REQUIRE(large._pageBufferBytes == 0);
+		REQUIRE(large._metadataCacheBytes == 64 * MiB);
+
+		const H5AccessSettings paged = tuneH5Access({ ._fileSize = 1024 * MiB, ._paged = true, ._pageSize = 4096 }, automatic);
+		REQUIRE(paged._driver == H5Driver::SEC2);
+		REQUIRE(paged._pageBufferBytes == 32 * MiB);
+		REQUIRE(paged._metadataCacheBytes == 16 * MiB);
+
+		// Requested settings are kept, page buffers only for paged files and in whole pages
+		const H5AccessSettings manual = { ._autoTune = false, ._driver = H5Driver::SEC2, ._pageBufferBytes = 10000, ._metadataCacheBytes = 4 * MiB };
+		REQUIRE(tuneH5Access({ ._fileSize = 10 * MiB }, manual)._pageBufferBytes == 0);
+		REQUIRE(tuneH5Access({ ._fileSize = 10 * MiB, ._paged = true, ._pageSize = 4096 }, manual)._pageBufferBytes == 8192);
+		REQUIRE(tuneH5Access({ ._fileSize = 10 * MiB }, manual)._metadataCacheBytes == 4 * MiB);
+
+		REQUIRE(h5AccessKey(automatic).empty());
+		REQUIRE(h5AccessKey(manual) != h5AccessKey({ ._autoTune = false }));
+		REQUIRE(h5AccessToString(small) == "core");
+		REQUIRE(h5AccessToString(paged) == "sec2, 32 MiB page buffer, 16 MiB metadata cache");
+	}
+
+	SECTION("Open files") {
+		const fs::path filePath = dataDir / "csr.h5";
+		if (!fs::exists(filePath)) {
+			info("ERROR: test file not found");
+			return;
+		}
+
+		H5FileLayout layout;
+		REQUIRE(readH5FileLayout(filePath.string(), layout));
+		REQUIRE(layout._fileSize == fs::file_size(filePath));
+		REQUIRE_FALSE(layout._paged);
+
+		// Small files are read into memory, all drivers read the same values
+		std::unique_ptr<SparseMatrixReader> automatic = openSparseMatrixReader(filePath.string());
+		REQUIRE(automatic != nullptr);
+		REQUIRE(automatic->getRawData()._access._driver == H5Driver::CORE);
+
+		const H5AccessSettings manual = { ._autoTune = false, ._driver = H5Driver::SEC2, ._pageBufferBytes = MiB, ._metadataCacheBytes = 4 * MiB, ._metaBlockBytes = 64 * 1024 };
+		std::unique_ptr<SparseMatrixReader> tuned = openSparseMatrixReader(filePath.string(), manual);
+		REQUIRE(tuned != nullptr);
+		REQUIRE(tuned->getRawData()._access._driver == H5Driver::SEC2);
+		REQUIRE(tuned->getRawData()._access._pageBufferBytes == 0);
+		REQUIRE(tuned->getRawData()._access._metadataCacheBytes == 4 * MiB);
+
+		automatic->setUseCache(false);
+		tuned->setUseCache(false);
+		checkApprox(automatic->getColumn(3), tuned->getColumn(3));
+		checkApprox(automatic->getRow(2), tuned->getRow(2));
+	}
+
+	SECTION("Paged files") {
+		const fs::path pagedPath = fs::temp_directory_path() / "sh5a_paged.h5";
+
+		{
+			H5::FileCreatPropList fcpl;
+			H5Pset_file_space_strategy(fcpl.getId(), H5F_FSPACE_STRATEGY_PAGE, false, 1);
+			H5Pset_file_space_page_size(fcpl.getId(), 4096);
+
+			H5::H5File file(pagedPath.string(), H5F_ACC_TRUNC, fcpl);
+			const std::vector<float> values(10000, 1.f);
+			const hsize_t size = values.size();
+			H5::DataSet dataset = file.createDataSet("values", H5::PredType::NATIVE_FLOAT, H5::DataSpace(1, &size));
+			dataset.write(values.data(), H5::PredType::NATIVE_FLOAT);
+		}
+
+		H5FileLayout layout;
+		REQUIRE(readH5FileLayout(pagedPath.string(), layout));
+		REQUIRE(layout._paged);
+		REQUIRE(layout._pageSize == 4096);
+
+		// Too large to read into memory with this budget, so it is page buffered
+		H5AccessSettings applied;
+		std::unique_ptr<H5::H5File> file = openH5File(pagedPath.string(), { ._coreBudgetBytes = 0 }, applied);
+		REQUIRE(file != nullptr);
+		REQUIRE(applied._driver == H5Driver::SEC2);
+		REQUIRE(applied._pageBufferBytes == 16 * 4096);
+
+		std::vector<float> values(10000, 0.f);
+		file->openDataSet("values").read(values.data(), H5::PredType::NATIVE_FLOAT);
+		REQUIRE(values.back() == 1.f);
+
+		file.reset();
+		fs::remove(pagedPath);
+	}
+}
+
+TEST_CASE("Share readers across instances", "[H5][Registry]") {
+
+	if (!fs::exists(dataDir / "csr.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Reader registry\n");
+
+	ReaderRegistry& registry = ReaderRegistry::instance();
+	const size_t numOpenBefore = registry.getNumOpen();
+
+	{
+		// Different paths to the same file share one reader
+		std::shared_ptr<SparseMatrixReader> first  = registry.acquire((dataDir / "csr.h5").string());
+		std::shared_ptr<SparseMatrixReader> second = registry.acquire((dataDir / "." / "csr.h5").string());
+		REQUIRE(first != nullptr);
+		REQUIRE(first == second);
+		REQUIRE(registry.getNumOpen() == numOpenBefore + 1);
+
+		// The cache is shared as well
+		checkApprox(first->getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(second->getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+
+		std::shared_ptr<SparseMatrixReader> other = registry.acquire((dataDir / "csc.h5").string());
+		REQUIRE(other != nullptr);
+		REQUIRE(other != first);
+		REQUIRE(registry.getNumOpen() == numOpenBefore + 2);
+
+		// Another value transform needs its own reader
+		ValueTransform transform;
+		transform._log1p = true;
+		std::shared_ptr<SparseMatrixReader> transformed = registry.acquire((dataDir / "csr.h5").string(), transform);
+		REQUIRE(transformed != nullptr);
+		REQUIRE(transformed != first);
+		REQUIRE(transformed->getValueTransform() == transform);
+		checkApprox(transformed->getColumn(3), { 0.f,  0.f, std::log1p(70.f), std::log1p(40.6f), std::log1p(60.f) });
+		REQUIRE(registry.getNumOpen() == numOpenBefore + 3);
+
+		REQUIRE(registry.acquire((dataDir / "does_not_exist.h5").string()) == nullptr);
+	}
+
+	// Files are closed with their last reference
+	REQUIRE(registry.getNumOpen() == numOpenBefore);
+
+	// Simultaneous opens are de-duplicated
+	std::vector<std::future<std::shared_ptr<SparseMatrixReader>>> opens;
+	for (int i = 0; i < 8; ++i) {
+		opens.push_back(std::async(std::launch::async, [&registry]() { return registry.acquire((dataDir / "csr.h5").string()); }));
+	}
+
+	std::vector<std::shared_ptr<SparseMatrixReader>> readers;
+	for (auto& open : opens) {
+		readers.push_back(open.get());
+	}
+
+	REQUIRE(readers.front() != nullptr);
+	REQUIRE(std::all_of(readers.begin(), readers.end(), [&readers](const auto& reader) { return reader == readers.front(); }));
+
+	// Concurrent reads through the shared cache
+	std::vector<std::future<std::vector<std::vector<float>>>> reads;
+	for (const auto& reader : readers) {
+		reads.push_back(std::async(std::launch::async, [reader]() { return reader->getColumns({ 3, 0, 3 }); }));
+	}
+
+	for (auto& read : reads) {
+		const std::vector<std::vector<float>> columns = read.get();
+		checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,  0.f });
+		checkApprox(columns[2], columns[0]);
+	}
+
+	// Threads that miss on the same column wait for a single read of it
+	std::shared_ptr<SparseMatrixReader> shared = readers.front();
+	readers.clear();
+
+	CSRReader single;
+	REQUIRE(single.readFile((dataDir / "csr.h5").string()));
+	single.getColumn(0);
+	const std::uint64_t singleBefore = single.getBytesRead();
+	single.getColumn(1);
+	const std::uint64_t bytesPerColumn = single.getBytesRead() - singleBefore;
+
+	const std::uint64_t bytesBefore = shared->getBytesRead();
+	std::vector<std::future<std::vector<float>>> columnReads;
+	for (int i = 0; i < 8; ++i) {
+		columnReads.push_back(std::async(std::launch::async, [shared]() { return shared->getColumn(1); }));
+	}
+
+	for (auto& read : columnReads) {
+		checkApprox(read.get(), { 10.f,  0.f,  0.f,  0.f,   0.f });
+	}
+
+	REQUIRE(shared->getBytesRead() - bytesBefore == bytesPerColumn);
+
+	const std::vector<std::int64_t> cachedColumns = shared->getCachedColumns();
+	REQUIRE(std::count(cachedColumns.begin(), cachedColumns.end(), 1) == 1);
+
+	// Reads that started before a change of the value transform do not cache their results
+	CSRReader transformed;
+	REQUIRE(transformed.readFile((dataDir / "csr.h5").string()));
+
+	ValueTransform log1p;
+	log1p._log1p = true;
+
+	std::future<void> reading = std::async(std::launch::async, [&transformed]() {
+		for (int i = 0; i < 200; ++i) {
+			transformed.getColumn(3);
+		}
+		});
+
+	for (int i = 0; i < 200; ++i) {
+		transformed.setValueTransform(i % 2 == 0 ? log1p : ValueTransform{});
+	}
+	reading.get();
+
+	transformed.setValueTransform(log1p);
+	checkApprox(transformed.getColumn(3), { 0.f,  0.f, std::log1p(70.f), std::log1p(40.6f), std::log1p(60.f) });
+
+	// An instance only releases the disk cache that it installed itself
+	const fs::path mineDir   = fs::temp_directory_path() / "sh5a_shared_cache_mine";
+	const fs::path theirsDir = fs::temp_directory_path() / "sh5a_shared_cache_theirs";
+	fs::remove_all(mineDir);
+	fs::remove_all(theirsDir);
+
+	{
+		auto mine   = std::make_shared<DiskCache>(mineDir.string(), 1 << 20);
+		auto theirs = std::make_shared<DiskCache>(theirsDir.string(), 1 << 20);
+
+		shared->setDiskCache(mine);
+		shared->setDiskCache(theirs);
+		shared->releaseDiskCache(mine);
+		shared->getColumn(2);
+		REQUIRE(mine->getNumEntries() == 0);
+		REQUIRE(theirs->getNumEntries() == 1);
+
+		shared->releaseDiskCache(theirs);
+		shared->getRow(0);
+		REQUIRE(theirs->getNumEntries() == 1);
+	}
+
+	fs::remove_all(mineDir);
+	fs::remove_all(theirsDir);
+}
+
+TEST_CASE("Persistent column cache", "[H5][DiskCache]") {
+
+	if (!fs::exists(dataDir / "csr.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Disk cache\n");
+
+	const fs::path cacheDir = fs::temp_directory_path() / "sh5a_disk_cache";
+	fs::remove_all(cacheDir);
+
+	const std::string fileKey = DiskCache::fileKey((dataDir / "csr.h5").string());
+	REQUIRE(fileKey.size() == 16);
+	REQUIRE(fileKey == DiskCache::fileKey((dataDir / "." / "csr.h5").string()));
+	REQUIRE(fileKey != DiskCache::fileKey((dataDir / "csc.h5").string()));
+	REQUIRE(DiskCache::fileKey((dataDir / "does_not_exist.h5").string()).empty());
+
+	{
+		auto diskCache = std::make_shared<DiskCache>(cacheDir.string(), 1 << 20);
+
+		CSRReader csrMatrix((dataDir / "csr.h5").string());
+		csrMatrix.setDiskCache(diskCache);
+
+		checkApprox(csrMatrix.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		csrMatrix.getColumns({ 0, 1 });
+		REQUIRE(diskCache->getNumEntries() == 3);
+		REQUIRE(csrMatrix.getCachedColumns() == std::vector<std::int64_t>{ 1, 0, 3 });
+	}
+
+	SECTION("Entries persist across sessions") {
+		auto diskCache = std::make_shared<DiskCache>(cacheDir.string(), 1 << 20);
+		REQUIRE(diskCache->getNumEntries() == 3);
+
+		std::vector<float> column;
+		REQUIRE(diskCache->load(fileKey, false, 3, 5, column));
+		checkApprox(column, { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		REQUIRE_FALSE(diskCache->load(fileKey, true, 3, 4, column));
+		REQUIRE_FALSE(diskCache->load(fileKey, false, 3, 6, column));
+
+		// Cached columns are served without touching the file
+		diskCache->store(fileKey, false, 2, { 1.f, 0.f, 2.f, 0.f, 3.f });
+		REQUIRE(diskCache->getNumEntries() == 4);
+
+		CSRReader csrMatrix((dataDir / "csr.h5").string());
+		csrMatrix.setDiskCache(diskCache);
+		const std::vector<std::vector<float>> columns = csrMatrix.getColumns({ 3, 2 });
+		checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		checkApprox(columns[1], { 1.f, 0.f, 2.f, 0.f, 3.f });
+
+		diskCache->clear();
+	}
+
+	SECTION("Corrupt entries are removed") {
+		auto diskCache = std::make_shared<DiskCache>(cacheDir.string(), 1 << 20);
+
+		const fs::path entryPath = cacheDir / (fileKey + "_c3.sh5c");
+		REQUIRE(fs::exists(entryPath));
+
+		{
+			std::fstream entry(entryPath, std::ios::binary | std::ios::in | std::ios::out);
+			entry.seekp(-1, std::ios::end);
+			entry.put('\x7f');
+		}
+
+		std::vector<float> column;
+		REQUIRE_FALSE(diskCache->load(fileKey, false, 3, 5, column));
+		REQUIRE_FALSE(fs::exists(entryPath));
+		REQUIRE(diskCache->getNumEntries() == 2);
+	}
+
+	SECTION("Least recently used entries are evicted") {
+		auto diskCache = std::make_shared<DiskCache>(cacheDir.string(), 1 << 20);
+		const std::uint64_t entrySize = diskCache->getSize() / diskCache->getNumEntries();
+
+		std::vector<float> column;
+		REQUIRE(diskCache->load(fileKey, false, 0, 5, column));
+
+		// Column 0 was used last and survives
+		diskCache->setMaxSize(entrySize + entrySize / 2);
+		REQUIRE(diskCache->getNumEntries() == 1);
+		REQUIRE(diskCache->load(fileKey, false, 0, 5, column));
+		checkApprox(column, { 0.f,  0.f, 30.4f, 0.f,  0.f });
+
+		diskCache->clear();
+		REQUIRE(diskCache->getNumEntries() == 0);
+		REQUIRE(diskCache->getSize() == 0);
+	}
+
+	fs::remove_all(cacheDir);
+}
+
+TEST_CASE("Skip blocks with a block index", "[H5][BlockIndex]") {
+
+	SECTION("Candidate blocks") {
+		info("\nTEST: Block index candidates\n");
+
+		// Four blocks of two arrays each
+		const std::vector<std::int64_t> indptr = { 0, 2, 4, 6, 8, 10, 12, 14, 16 };
+		const std::vector<BlockRange> blocks   = { { 0, 2 }, { 2, 4 }, { 4, 6 }, { 6, 8 } };
+		const std::vector<std::vector<std::int64_t>> blockIndices = { { 0, 1, 0, 2 }, { 3, 4, 3, 4 }, { 0, 5, 1, 5 }, { 6, 7, 6, 7 } };
+
+		for (const std::int64_t sizeSecondary : { std::int64_t{ 8 }, std::int64_t{ 1 } << 30 }) {
+			BlockIndex index(blocks, sizeSecondary);
+			REQUIRE(index.getKind() == (sizeSecondary == 8 ? BlockIndex::Kind::BITMAP : BlockIndex::Kind::BLOOM));
+
+			for (size_t block = 0; block < blocks.size(); ++block) {
+				index.addBlock(block, blockIndices[block].data(), static_cast<std::int64_t>(blockIndices[block].size()));
+			}
+
+			// No false negatives, a Bloom filter may report more blocks
+			for (size_t block = 0; block < blocks.size(); ++block) {
+				for (const std::int64_t idx : blockIndices[block]) {
+					REQUIRE(index.mayContain(block, idx));
+				}
+			}
+			REQUIRE_FALSE(index.mayContain(0, -1));
+			REQUIRE_FALSE(index.mayContain(0, sizeSecondary));
+			REQUIRE(index.findBlock(5) == 2);
+
+			if (index.getKind() == BlockIndex::Kind::BITMAP) {
+				REQUIRE(index.candidateRanges({ 5 }, indptr, 16) == std::vector<BlockRange>{ { 4, 6 } });
+				REQUIRE(index.candidateRanges({ 1, 6 }, indptr, 16) == std::vector<BlockRange>{ { 0, 2 }, { 4, 8 } });
+				REQUIRE(index.candidateRanges({ 1, 6 }, indptr, 4) == std::vector<BlockRange>{ { 0, 2 }, { 4, 6 }, { 6, 8 } });
+				REQUIRE(index.mergedRanges(indptr, 8) == std::vector<BlockRange>{ { 0, 4 }, { 4, 8 } });
+			}
+		}
+	}
+
+	if (!fs::exists(dataDir / "csr.h5") || !fs::exists(dataDir / "csc.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	SECTION("Persisted next to the file") {
+		info("\nTEST: Block index file\n");
+
+		const fs::path indexDir = fs::temp_directory_path() / "sh5a_block_index";
+		fs::remove_all(indexDir);
+		fs::create_directories(indexDir);
+
+		for (const std::string fileName : { "csr.h5", "csc.h5" }) {
+			const fs::path filePath = indexDir / fileName;
+			fs::copy_file(dataDir / fileName, filePath);
+
+			std::unique_ptr<SparseMatrixReader> withIndex = openSparseMatrixReader(filePath.string());
+			std::unique_ptr<SparseMatrixReader> withoutIndex = openSparseMatrixReader(filePath.string());
+			withIndex->setUseCache(false);
+			withoutIndex->setUseCache(false);
+			withoutIndex->setUseBlockIndex(false);
+
+			REQUIRE(withoutIndex->getBlockIndex() == nullptr);
+			REQUIRE(withIndex->getBlockIndex() != nullptr);
+			REQUIRE(fs::exists(BlockIndex::indexPath(filePath.string())));
+
+			const std::vector<std::int64_t> rows    = { 0, 2, 4 };
+			const std::vector<std::int64_t> columns = { 0, 1, 3 };
+			for (size_t i = 0; i < rows.size(); ++i) {
+				checkApprox(withIndex->getRow(rows[i]), withoutIndex->getRow(rows[i]));
+			}
+			for (size_t i = 0; i < columns.size(); ++i) {
+				checkApprox(withIndex->getColumn(columns[i]), withoutIndex->getColumn(columns[i]));
+			}
+			checkApprox(withIndex->getColumnAggregate(columns, AggregateReduction::SUM), withoutIndex->getColumnAggregate(columns, AggregateReduction::SUM));
+
+			// Loaded by the next reader
+			REQUIRE(BlockIndex::load(filePath.string(), withIndex->getRawData()._indptr, withIndex->getSecondarySize()) != nullptr);
+			REQUIRE(BlockIndex::load(filePath.string(), withIndex->getRawData()._indptr, withIndex->getSecondarySize() + 1) == nullptr);
+
+			// Stale once the file changes
+			fs::last_write_time(filePath, fs::last_write_time(filePath) + std::chrono::seconds(10));
+			REQUIRE(BlockIndex::load(filePath.string(), withIndex->getRawData()._indptr, withIndex->getSecondarySize()) == nullptr);
+		}
+
+		fs::remove_all(indexDir);
+	}
+}
+
+TEST_CASE("Elias-Fano encoded index pointers", "[Indptr]") {
+
+	SECTION("Access and decode") {
+		std::mt19937_64 rng(7);
+
+		// Dense and sparse arrays, runs of empty arrays and huge values
+		for (const std::int64_t maxNnz : { std::int64_t{ 0 }, std::int64_t{ 1 }, std::int64_t{ 3 }, std::int64_t{ 1000 }, std::int64_t{ 1 } << 40 }) {
+			for (const size_t size : { size_t{ 1 }, size_t{ 2 }, size_t{ 255 }, size_t{ 257 }, size_t{ 5000 } }) {
+				std::vector<std::int64_t> values(size, 0);
+				for (size_t i = 1; i < size; ++i) {
+					values[i] = values[i - 1] + (maxNnz == 0 ? 0 : static_cast<std::int64_t>(rng() % static_cast<std::uint64_t>(maxNnz + 1)));
+				}
+
+				IndptrArray indptr(values);
+				REQUIRE(indptr.compact());
+				REQUIRE(indptr.isCompact());
+				REQUIRE(indptr.size() == size);
+				REQUIRE(indptr.back() == values.back());
+
+				for (size_t i = 0; i < size; ++i) {
+					REQUIRE(indptr[i] == values[i]);
+				}
+
+				REQUIRE(indptr.toVector() == values);
+
+				const size_t first = size / 3;
+				std::vector<std::int64_t> range(size - first);
+				indptr.decode(first, size, range.data());
+				REQUIRE(std::equal(range.begin(), range.end(), values.begin() + first));
+
+				const std::int64_t target = values[size / 2];
+				REQUIRE(std::upper_bound(indptr.begin(), indptr.end(), target) - indptr.begin() == std::upper_bound(values.begin(), values.end(), target) - values.begin());
+
+				indptr.expand();
+				REQUIRE_FALSE(indptr.isCompact());
+				REQUIRE(indptr.toVector() == values);
+			}
+		}
+	}
+
+	SECTION("Size") {
+		// A tall matrix with about 1000 entries per row
+		std::vector<std::int64_t> values(100001, 0);
+		for (size_t i = 1; i < values.size(); ++i) {
+			values[i] = values[i - 1] + 500 + static_cast<std::int64_t>(i * 7919 % 1000);
+		}
+
+		IndptrArray indptr(values);
+		const std::uint64_t plainBytes = indptr.getBytes();
+		REQUIRE(indptr.compact());
+		REQUIRE(indptr.getBytes() * 4 < plainBytes);
+	}
+
+	SECTION("Invalid values stay plain") {
+		IndptrArray decreasing(std::vector<std::int64_t>{ 0, 5, 3 });
+		REQUIRE_FALSE(decreasing.compact());
+		REQUIRE(decreasing[2] == 3);
+
+		IndptrArray negative(std::vector<std::int64_t>{ -1, 5 });
+		REQUIRE_FALSE(negative.compact());
+
+		IndptrArray empty;
+		REQUIRE_FALSE(empty.compact());
+		REQUIRE(empty.empty());
+	}
+}
+
+TEST_CASE("Progressive column reads", "[H5][CRS][Progressive]") {
+
+	info("\nTEST: Progressive column reads\n");
+
+	// Spans three blocks of SparseMatrixReader::defaultBlockNnz entries
+	const std::int64_t numRows     = 2200;
+	const std::int64_t numCols     = 4000;
+	const std::int64_t rowNnz      = 1000;
+	const fs::path filePath        = fs::temp_directory_path() / "sh5a_progressive.h5";
+	const fs::path cacheDir        = fs::temp_directory_path() / "sh5a_progressive_cache";
+
+	{
+		std::vector<std::int64_t> indptr(numRows + 1, 0);
+		std::vector<std::int64_t> indices;
+		std::vector<float> values;
+		indices.reserve(numRows * rowNnz);
+		values.reserve(numRows * rowNnz);
+
+		for (std::int64_t row = 0; row < numRows; ++row) {
+			for (std::int64_t k = 0; k < rowNnz; ++k) {
+				indices.push_back((row + 4 * k) % numCols);
+			}
+			std::sort(indices.end() - rowNnz, indices.end());
+			for (std::int64_t k = 0; k < rowNnz; ++k) {
+				values.push_back(static_cast<float>(row + 1));
+			}
+			indptr[row + 1] = static_cast<std::int64_t>(indices.size());
+		}
+
+		H5::H5File file(filePath.string(), H5F_ACC_TRUNC);
+		H5::Group group = file.createGroup("X");
+
+		const hsize_t shapeSize = 2;
+		const std::array<std::int64_t, 2> shape = { numRows, numCols };
+		group.createAttribute("shape", H5::PredType::NATIVE_INT64, H5::DataSpace(1, &shapeSize)).write(H5::PredType::NATIVE_INT64, shape.data());
+
+		auto writeAll = [&group](const std::string& name, const auto& source, const H5::PredType& type) {
+			const hsize_t size = source.size();
+			group.createDataSet(name, type, H5::DataSpace(1, &size)).write(source.data(), type);
+			};
+		writeAll("indptr", indptr, H5::PredType::NATIVE_INT64);
+		writeAll("indices", indices, H5::PredType::NATIVE_INT64);
+		writeAll("data", values, H5::PredType::NATIVE_FLOAT);
+	}
+
+	const std::vector<std::int64_t> columns = { 0, 3, 0 };
+
+	std::vector<std::vector<float>> expected;
+	{
+		CSRReader reference(filePath.string());
+		reference.setUseBlockIndex(false);
+		expected = reference.getColumns(columns);
+	}
+
+	for (const bool stridedOrder : { true, false }) {
+		CSRReader csrMatrix(filePath.string());
+		csrMatrix.setUseBlockIndex(false);
+
+		// Partial results pass through the disk cache as well
+		if (!stridedOrder) {
+			csrMatrix.setDiskCache(DiskCache::open(cacheDir.string(), std::uint64_t{ 1 } << 30));
+		}
+
+		// Column 3 is cached and part of every partial result
+		checkApprox(csrMatrix.getColumn(3), expected[1]);
+
+		std::vector<float> fractions;
+
+		ProgressiveRead progressive;
+		progressive._intervalSeconds    = 0.0;
+		progressive._stridedOrder       = stridedOrder;
+		progressive._onPartial          = [&](const std::vector<std::vector<float>>& arrays, const float fraction) {
+			REQUIRE(arrays.size() == columns.size());
+			checkApprox(arrays[1], expected[1]);
+			checkApprox(arrays[2], arrays[0]);
+
+			// Rows are either complete or not scanned yet
+			REQUIRE(std::equal(arrays[0].begin(), arrays[0].end(), expected[0].begin(), [](const float partial, const float complete) {
+				return partial == 0.0f || partial == complete;
+				}));
+
+			fractions.push_back(fraction);
+			};
+
+		const std::vector<std::vector<float>> result = csrMatrix.getColumnsProgressive(columns, progressive);
+
+		REQUIRE(fractions.size() == 2);
+		REQUIRE(std::is_sorted(fractions.begin(), fractions.end()));
+		REQUIRE(fractions.back() < 1.0f);
+
+		REQUIRE(result.size() == expected.size());
+		for (size_t i = 0; i < result.size(); ++i) {
+			checkApprox(result[i], expected[i]);
+		}
+	}
+
+	fs::remove(filePath);
+	fs::remove_all(cacheDir);
+}
+
+TEST_CASE("Record and replay access traces", "[H5][Trace]") {
+
+	if (!fs::exists(dataDir / "csr.h5") || !fs::exists(dataDir / "csc.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	info("\nTEST: Access traces\n");
+
+	const fs::path tracePath = fs::temp_directory_path() / "sh5a_access.sh5t";
+
+	{
+		CSRReader csrMatrix((dataDir / "csr.h5").string());
+
+		auto trace = std::make_shared<AccessTraceRecorder>(tracePath.string(), csrMatrix.getNumRows(), csrMatrix.getNumCols());
+		REQUIRE(trace->isGood());
+		csrMatrix.setAccessTrace(trace);
+
+		checkApprox(csrMatrix.getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f });
+		csrMatrix.getColumn(3);
+		csrMatrix.getColumns({ 0, 3, 0 });      // Cached arrays are recorded first
+		csrMatrix.getColumn(3);
+		csrMatrix.releaseAccessTrace(nullptr);   // Not the installed trace
+		checkApprox(csrMatrix.getRow(2), { 30.4f, 0.f, 0.f, 70.f });
+
+		csrMatrix.releaseAccessTrace(trace);
+		csrMatrix.getRow(4);
+
+		REQUIRE(trace->getNumRecords() == 7);
+	}
+
+	AccessTraceHeader header;
+	std::vector<AccessRecord> records;
+	REQUIRE(readAccessTrace(tracePath.string(), header, records));
+	REQUIRE_FALSE(readAccessTrace((dataDir / "csr.h5").string(), header, records));
+	REQUIRE(readAccessTrace(tracePath.string(), header, records));
+
+	REQUIRE(header._numRows == 5);
+	REQUIRE(header._numCols == 4);
+	REQUIRE(records.size() == 7);
+
+	const std::vector<std::int64_t> expectedIndices = { 3, 3, 3, 0, 0, 3, 2 };
+	const std::vector<std::uint8_t> expectedHits    = { 0, 1, 1, 0, 0, 1, 0 };
+	for (size_t i = 0; i < records.size(); ++i) {
+		REQUIRE(records[i]._index == expectedIndices[i]);
+		REQUIRE(records[i]._hit == expectedHits[i]);
+		REQUIRE(records[i]._row == (i == 6 ? 1 : 0));
+	}
+
+	// Records of a batch share its start
+	REQUIRE(records[2]._timeNs == records[4]._timeNs);
+	REQUIRE(records[4]._timeNs < records[5]._timeNs);
+
+	const ReplayResult recorded = summarizeAccessTrace(records);
+	REQUIRE(recorded._numAccesses == 7);
+	REQUIRE(recorded._numHits == 3);
+	REQUIRE(recorded._latencyP50Ms <= recorded._latencyP99Ms);
+	REQUIRE(recorded._latencyP99Ms <= recorded._latencyMaxMs);
+
+	// Indices outside of the replayed matrix are skipped
+	records.push_back({ ._index = 10 });
+
+	ReplaySettings settings;
+	ReplayResult result;
+	{
+		CSCReader cscMatrix((dataDir / "csc.h5").string());
+		REQUIRE(replayAccessTrace(cscMatrix, records, settings, result));
+	}
+
+	REQUIRE(result._numAccesses == 7);
+	REQUIRE(result._numSkipped == 1);
+	REQUIRE(result._numHits == 3);
+	REQUIRE(result._bytesRead > 0);
+
+	// Column 0 evicts column 3 from a cache of a single array
+	settings._cacheSize = 1;
+	ReplayResult smallCache;
+	{
+		CSCReader cscMatrix((dataDir / "csc.h5").string());
+		REQUIRE(replayAccessTrace(cscMatrix, records, settings, smallCache));
+	}
+
+	REQUIRE(smallCache._numHits == 2);
+	REQUIRE(smallCache.getHitRate() < result.getHitRate());
+	REQUIRE(smallCache._bytesRead > result._bytesRead);
+
+	fs::remove(tracePath);
+}
+
+TEST_CASE("Resident in-memory matrices", "[H5][Resident]") {
+
+	SECTION("Packed arrays") {
+		info("\nTEST: Packed arrays\n");
+
+		// Deltas of up to 41 bits cross word boundaries
+		const std::vector<std::int64_t> indptr  = { 0, 3, 3, 4, 9 };
+		const std::vector<std::int64_t> indices = { 0, 5, 7, 0, 2, 3, std::int64_t{ 1 } << 40, (std::int64_t{ 1 } << 40) + 1, std::int64_t{ 1 } << 41 };
+		const std::vector<float> values         = { 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f, 8.f, 9.f };
+
+		const std::vector<std::int64_t> secondBlock = { 0, 1, 6 };
+
+		PackedArrays packed;
+		packed.appendArrays(2, indptr.data(), indices.data(), values.data());
+		packed.appendArrays(2, secondBlock.data(), indices.data() + 3, values.data() + 3);
+		packed.encodeValues(false);
+
+		REQUIRE(packed._numArrays == 4);
+		REQUIRE(packed.getNnz() == 9);
+		REQUIRE(packed._encoding == ResidentValueEncoding::UINT16);
+
+		for (std::int64_t a = 0; a < packed._numArrays; ++a) {
+			std::vector<std::int64_t> decodedIndices;
+			std::vector<float> decodedValues;
+			packed.forEach(a, [&](const std::int64_t secondary, const float value) {
+				decodedIndices.push_back(secondary);
+				decodedValues.push_back(value);
+				});
+
+			REQUIRE(decodedIndices == std::vector<std::int64_t>(indices.begin() + indptr[a], indices.begin() + indptr[a + 1]));
+			REQUIRE(decodedValues == std::vector<float>(values.begin() + indptr[a], values.begin() + indptr[a + 1]));
+		}
+	}
+
+	if (!fs::exists(dataDir / "csr.h5") || !fs::exists(dataDir / "csc.h5")) {
+		info("ERROR: test file not found");
+		return;
+	}
+
+	for (const std::string fileName : { "csr.h5", "csc.h5" }) {
+		info("\nTEST: Resident " + fileName + "\n");
+
+		std::unique_ptr<SparseMatrixReader> fileMatrix = openSparseMatrixReader((dataDir / fileName).string());
+		REQUIRE(fileMatrix != nullptr);
+
+		for (const bool bothOrientations : { true, false }) {
+			ResidentSettings settings;
+			settings._bothOrientations = bothOrientations;
+
+			float loaded = 0.f;
+			std::unique_ptr<ResidentReader> resident = ResidentReader::load(*fileMatrix, settings, [&loaded](const float fraction) { loaded = fraction; });
+			REQUIRE(resident != nullptr);
+			REQUIRE(loaded == 1.f);
+			REQUIRE(resident->getType() == fileMatrix->getType());
+			REQUIRE(resident->hasRows() == (bothOrientations || fileName == "csr.h5"));
+			REQUIRE(resident->hasColumns() == (bothOrientations || fileName == "csc.h5"));
+			REQUIRE(resident->getValueEncoding() == ResidentValueEncoding::FLOAT32);
+			REQUIRE(resident->getVarNames() == fileMatrix->getVarNames());
+
+			for (std::int64_t row = 0; row < fileMatrix->getNumRows(); ++row) {
+				checkApprox(resident->getRow(row), fileMatrix->getRow(row));
+			}
+			for (std::int64_t col = 0; col < fileMatrix->getNumCols(); ++col) {
+				checkApprox(resident->getColumn(col), fileMatrix->getColumn(col));
+			}
+
+			const std::vector<std::vector<float>> columns = resident->getColumns({ 3, 0, 3 });
+			checkApprox(columns[0], { 0.f,  0.f, 70.f, 40.6f, 60.f });
+			checkApprox(columns[1], { 0.f,  0.f, 30.4f, 0.f,  0.f });
+			checkApprox(columns[2], columns[0]);
+			checkApprox(resident->getRows({ 2, 1 })[1], { 0.f, 0.f, 20.2f, 0.f });
+
+			// Out of range stays zero
+			const std::vector<std::vector<float>> outOfRange = resident->getColumns({ -1, 3, resident->getNumCols() });
+			checkApprox(outOfRange[0], std::vector<float>(5, 0.f));
+			checkApprox(outOfRange[1], columns[0]);
+			checkApprox(outOfRange[2], std::vector<float>(5, 0.f));
+			checkApprox(resident->getRows({ resident->getNumRows() })[0], std::vector<float>(4, 0.f));
+
+			checkApprox(resident->getRowTotals(), { 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+			checkApprox(resident->getColumnAggregate({ 2, 3 }, AggregateReduction::SUM), fileMatrix->getColumnAggregate({ 2, 3 }, AggregateReduction::SUM));
+			REQUIRE(resident->queryRows({ { 3, PredicateOp::GREATER, 50.f }, { 0, PredicateOp::EQUAL, 0.f } }) == std::vector<std::int64_t>{ 4 });
+
+			std::vector<float> totals(resident->getSecondarySize(), 0.f);
+			REQUIRE(resident->streamBlocks([&totals](const PrimaryBlock& block) {
+				for (std::int64_t i = 0; i < block._indptr.back(); ++i)
+					totals[block._indices[i]] += block._values[i];
+				}, true, 2));
+			checkApprox(totals, fileName == "csr.h5" ? std::vector<float>{ 30.4f, 10.f, 70.2f, 170.6f } : std::vector<float>{ 60.f, 20.2f, 100.4f, 40.6f, 60.f });
+
+			// Transformed like the file
+			ValueTransform transform;
+			transform._normalizeTotals = true;
+			transform._log1p = true;
+			resident->setValueTransform(transform);
+			fileMatrix->setValueTransform(transform);
+			checkApprox(resident->getColumn(3), fileMatrix->getColumn(3));
+			checkApprox(resident->getRow(2), fileMatrix->getRow(2));
+			fileMatrix->setValueTransform({});
+		}
+
+		SECTION("Budget") {
+			ResidentSettings settings;
+			settings._budgetBytes = 16;
+			REQUIRE(ResidentReader::load(*fileMatrix, settings) == nullptr);
+
+			// Room for a single orientation
+			settings._budgetBytes = ResidentReader::estimateBytes(*fileMatrix, false);
+			REQUIRE(settings._budgetBytes < ResidentReader::estimateBytes(*fileMatrix, true));
+
+			std::unique_ptr<ResidentReader> resident = ResidentReader::load(*fileMatrix, settings);
+			REQUIRE(resident != nullptr);
+			REQUIRE(resident->hasRows() != resident->hasColumns());
+			REQUIRE(resident->getMemoryBytes() <= settings._budgetBytes);
+			checkApprox(resident->getColumn(1), { 10.f, 0.f, 0.f, 0.f, 0.f });
+
+			settings._lossyValues = true;
+			resident = ResidentReader::load(*fileMatrix, settings);
+			REQUIRE(resident->getValueEncoding() == ResidentValueEncoding::BFLOAT16);
+			checkApprox(resident->getColumn(3), { 0.f,  0.f, 70.f, 40.6f, 60.f }, 0.5f);
+		}
+	}
+}
+
+TEST_CASE("Pipelined block processing", "[Pipeline]") {
+
+	BlockPipeline<std::vector<std::int64_t>> pipeline(2);
+
+	SECTION("Order") {
+		info("\nTEST: Pipeline order\n");
+		std::vector<std::int64_t> consumed;
+
+		pipeline.run(100, [](std::int64_t item, std::vector<std::int64_t>& buffer) {
+			buffer.assign(3, item);
+			}, [&consumed](std::int64_t item, std::vector<std::int64_t>& buffer) {
+				REQUIRE(buffer == std::vector<std::int64_t>(3, item));
+				consumed.push_back(item);
+			});
+
+		REQUIRE(consumed.size() == 100);
+		REQUIRE(std::is_sorted(consumed.begin(), consumed.end()));
+	}
+
+	SECTION("Errors") {
+		info("\nTEST: Pipeline errors\n");
+		auto produceFailing = [](std::int64_t item, std::vector<std::int64_t>&) {
+			if (item == 5)
+				throw std::runtime_error("read failed");
+			};
+		auto consumeNothing = [](std::int64_t, std::vector<std::int64_t>&) {};
+
+		REQUIRE_THROWS_AS(pipeline.run(10, produceFailing, consumeNothing), std::runtime_error);
+
+		auto produceNothing = [](std::int64_t, std::vector<std::int64_t>&) {};
+		auto consumeFailing = [](std::int64_t item, std::vector<std::int64_t>&) {
+			if (item == 3)
+				throw std::runtime_error("processing failed");
+			};
+
+		REQUIRE_THROWS_AS(pipeline.run(10, produceNothing, consumeFailing), std::runtime_error);
+	}
+}
@@ -0,0 +1,98 @@
+#include "Repack.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// SparseH5Repack: rewrites a matrix file into the layout the plugin reads fastest
+// =============================================================================
+
+static void printUsage() {
+    std::cout << "Usage: SparseH5Repack <input> <output.h5> [options]\n"
+              << "\n"
+              << "Writes a CSR copy (X) and a CSC copy (layers/X_csc) of the input matrix,\n"
+              << "with chunks sized to the typical row and column and the narrowest index type.\n"
+              << "The input may be a sparse or dense anndata file, a loom file or a Zarr store.\n"
+              << "\n"
+              << "Options:\n"
+              << "  --memory <MiB>      Memory for the gather buffers, default 1024\n"
+              << "  --level <0-9>       Deflate level, 0 disables compression, default 1\n"
+              << "  --reorder-rows      Group rows by their largest variable, the input row of\n"
+              << "                      every output row is stored in uns/repack_source_row\n"
+              << "  --no-csc            Only write the CSR copy\n"
+              << "  --block-nnz <n>     Entries per streamed input block, default 1048576\n"
+              << "\n"
+              << "The number of threads follows OMP_NUM_THREADS.\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    RepackSettings settings;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            auto nextValue = [&]() -> std::string {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument("missing value for " + arg);
+                return argv[++i];
+                };
+
+            if (arg == "-h" || arg == "--help") {
+                printUsage();
+                return EXIT_SUCCESS;
+            }
+            else if (arg == "--memory")
+                settings._memoryLimit = std::stoll(nextValue()) << 20;
+            else if (arg == "--level")
+                settings._compressionLevel = std::stoi(nextValue());
+            else if (arg == "--reorder-rows")
+                settings._reorderRows = true;
+            else if (arg == "--no-csc")
+                settings._writeCsc = false;
+            else if (arg == "--block-nnz")
+                settings._blockNnz = std::stoll(nextValue());
+            else if (!arg.empty() && arg[0] == '-')
+                throw std::invalid_argument("unknown option " + arg);
+            else
+                positional.push_back(arg);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "SparseH5Repack: " << e.what() << std::endl;
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (positional.size() != 2) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    int lastPercent = -1;
+    auto progress = [&lastPercent](const float fraction) {
+        const int percent = static_cast<int>(fraction * 100.f);
+        if (percent != lastPercent) {
+            std::cout << "\r" << percent << "%" << std::flush;
+            lastPercent = percent;
+        }
+        };
+
+    RepackResult result;
+    if (!repackMatrix(positional[0], positional[1], settings, result, progress)) {
+        std::cerr << "\nSparseH5Repack: repacking " << positional[0] << " failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "\nWrote " << positional[1] << " in " << result._numPasses << " passes over the input\n"
+              << "  CSR: " << result._csrChunkSize << " entries per chunk, " << result._csrIndexBytes << " bytes per index\n";
+
+    if (settings._writeCsc)
+        std::cout << "  CSC: " << result._cscChunkSize << " entries per chunk, " << result._cscIndexBytes << " bytes per index\n";
+
+    return EXIT_SUCCESS;
+}
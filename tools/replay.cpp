@@ -0,0 +1,117 @@
+#include "AccessTrace.h"
+#include "H5Utils.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// =============================================================================
+// SparseH5Replay: replays a recorded access trace against a matrix file
+// =============================================================================
+
+static void printUsage() {
+    std::cout << "Usage: SparseH5Replay <trace.sh5t> <matrix> [options]\n"
+              << "\n"
+              << "Replays the getRow/getColumn calls of an access trace, recorded by the plugin,\n"
+              << "against any matrix file and cache configuration, and reports the hit rate of the\n"
+              << "in-memory cache, the bytes read from the file and the latency percentiles.\n"
+              << "\n"
+              << "Options:\n"
+              << "  --cache-size <n>        Arrays per direction in the in-memory cache, default 10\n"
+              << "  --disk-cache <dir>      Use a disk cache in this folder\n"
+              << "  --disk-cache-size <GiB> Size cap of the disk cache, default 8\n"
+              << "  --no-block-index        Scan all blocks when reading secondary arrays\n"
+              << "  --summary               Only summarize the trace as it was recorded\n";
+}
+
+static void printResult(const std::string& title, const ReplayResult& result) {
+    std::cout << title << "\n"
+              << std::fixed << std::setprecision(3)
+              << "  Accesses:   " << result._numAccesses << " (" << result._numSkipped << " skipped)\n"
+              << "  Hit rate:   " << result.getHitRate() * 100.0 << " % (" << result._numHits << " hits)\n"
+              << "  Total time: " << result._totalSeconds << " s\n"
+              << "  Latency:    p50 " << result._latencyP50Ms << " ms, p90 " << result._latencyP90Ms << " ms, p99 "
+              << result._latencyP99Ms << " ms, max " << result._latencyMaxMs << " ms\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::vector<std::string> positional;
+    ReplaySettings settings;
+    bool summaryOnly = false;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            const std::string arg = argv[i];
+
+            auto nextValue = [&]() -> std::string {
+                if (i + 1 >= argc)
+                    throw std::invalid_argument("missing value for " + arg);
+                return argv[++i];
+                };
+
+            if (arg == "-h" || arg == "--help") {
+                printUsage();
+                return EXIT_SUCCESS;
+            }
+            else if (arg == "--cache-size")
+                settings._cacheSize = static_cast<size_t>(std::stoull(nextValue()));
+            else if (arg == "--disk-cache")
+                settings._diskCacheDirectory = nextValue();
+            else if (arg == "--disk-cache-size")
+                settings._diskCacheSize = std::stoull(nextValue()) << 30;
+            else if (arg == "--no-block-index")
+                settings._useBlockIndex = false;
+            else if (arg == "--summary")
+                summaryOnly = true;
+            else if (!arg.empty() && arg[0] == '-')
+                throw std::invalid_argument("unknown option " + arg);
+            else
+                positional.push_back(arg);
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << "SparseH5Replay: " << e.what() << std::endl;
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    if (positional.size() != (summaryOnly ? 1 : 2)) {
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    AccessTraceHeader header;
+    std::vector<AccessRecord> records;
+    if (!readAccessTrace(positional[0], header, records)) {
+        std::cerr << "SparseH5Replay: cannot read " << positional[0] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    printResult("Recorded on a " + std::to_string(header._numRows) + " x " + std::to_string(header._numCols) + " matrix", summarizeAccessTrace(records));
+
+    if (summaryOnly)
+        return EXIT_SUCCESS;
+
+    std::unique_ptr<SparseMatrixReader> reader = openSparseMatrixReader(positional[1]);
+    if (!reader) {
+        std::cerr << "SparseH5Replay: cannot open " << positional[1] << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (reader->getNumRows() != header._numRows || reader->getNumCols() != header._numCols)
+        std::cout << "The matrix is " << reader->getNumRows() << " x " << reader->getNumCols() << ", indices outside of it are skipped\n";
+
+    ReplayResult result;
+    if (!replayAccessTrace(*reader, records, settings, result)) {
+        std::cerr << "SparseH5Replay: replaying " << positional[0] << " failed" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    printResult("Replayed on " + positional[1], result);
+    std::cout << "  Read:       " << result._bytesRead << " bytes (" << static_cast<double>(result._bytesRead) / (1 << 20) << " MiB)\n";
+
+    return EXIT_SUCCESS;
+}